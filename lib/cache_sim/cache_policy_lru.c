@@ -31,6 +31,19 @@
 #include "cache_sim_util.h"
 #include "cache_policy_lru.h"
 
+/* lru_tags: tags of the ways of a set, the data area starts with them */
+static inline uint64_t* lru_tags(const cache_handle_t *cache,
+    const uint64_t set) {
+    return (uint64_t *)cache->data + (set * cache->associativity);
+}
+
+/* lru_ways: LRU data of the ways of a set, stored after all the tags */
+static inline policy_lru_t* lru_ways(const cache_handle_t *cache,
+    const uint64_t set) {
+    return (policy_lru_t *)((uint64_t *)cache->data + cache->total_lines) +
+        (set * cache->associativity);
+}
+
 /* policy_lru_init */
 int policy_lru_init(cache_handle_t *cache) {
     /* sanity check: does cache exist? */
@@ -40,28 +53,31 @@ int policy_lru_init(cache_handle_t *cache) {
     }
 
     /* variables declaration and initialization */
-    void *ptr = NULL;
-    uint64_t i = 0;
+    uint64_t *tags = NULL;
+    policy_lru_t *ways = NULL;
+    int i = 0;
 
     /* allocate data area */
-    ptr = malloc(sizeof(policy_lru_t) * cache->total_lines);
+    cache->data = malloc((sizeof(uint64_t) + sizeof(policy_lru_t)) *
+        cache->total_lines);
 
-    if (NULL == ptr) {
+    if (NULL == cache->data) {
         printf("Error: unable to allocate memory for cache data\n");
         return CACHE_SIM_ERROR;
     }
-    cache->data = ptr;
-
-    /* initialize data area */
-    for (i = (uint64_t)cache->data;
-        i < ((uint64_t)cache->data + (sizeof(policy_lru_t) * cache->total_lines));
-        i += sizeof(uint64_t)) {
-        /* write UINT64_MAX everywhere... */
-        *(uint64_t *)i = UINT64_MAX;
+
+    /* initialize data area: all the ways are free */
+    tags = lru_tags(cache, 0);
+    ways = lru_ways(cache, 0);
+    for (i = 0; i < cache->total_lines; i++) {
+        tags[i] = UINT64_MAX;
+        ways[i].age = 0;
+        ways[i].load = LOAD_ACCESS;
+        ways[i].dirty = 0;
     }
 
     printf("Memory required: %9d bytes\n", (sizeof(cache_handle_t) +
-        (sizeof(policy_lru_t) * cache->total_lines)));
+        ((sizeof(uint64_t) + sizeof(policy_lru_t)) * cache->total_lines)));
 
     return CACHE_SIM_SUCCESS;
 }
@@ -69,59 +85,56 @@ int policy_lru_init(cache_handle_t *cache) {
 /* policy_lru_read */
 int policy_lru_access(cache_handle_t *cache, const uint64_t line_id,
     const load_t load) {
-    static policy_lru_t *base_addr = NULL;
-    static policy_lru_t *lru = NULL;
-    static uint64_t set = UINT64_MAX;
-    static int way = 0;
+    uint64_t *tags = NULL;
+    policy_lru_t *ways = NULL;
+    policy_lru_t *lru = NULL;
+    uint64_t set = UINT64_MAX;
+    int way = 0;
     register int i = 0;
 
     /* calculate tag and set for this address */
     set = line_id;
     CACHE_SIM_LINE_ID_TO_SET(set);
 
-    /* calculate data area base address for this set */
-    base_addr = (policy_lru_t *)((uint64_t)cache->data +
-        (set * cache->associativity * sizeof(policy_lru_t)));
-    lru = base_addr;
+    /* calculate data area base addresses for this set */
+    tags = lru_tags(cache, set);
+    ways = lru_ways(cache, set);
 
-    /* iterate across all the ways of the set */
-    for (i = cache->associativity; i > 0; i--) {
-        /* check if data is present */
-        if (base_addr->line_id == line_id) {
-            /* update access age */
-            base_addr->age = cache->access;
+    /* check if data is present in any way of the set */
+    if (0 <= (way = cache_sim_tag_find(tags, cache->associativity,
+        line_id))) {
+        lru = &(ways[way]);
 
-            #ifdef DEBUG
-            printf("HIT    line id [%018p] set [%2d:%d]\n", line_id, set, i);
-            #endif
+        /* update access age */
+        lru->age = cache->access;
 
-            /* if the hit was on a prefetched line */
-            if (LOAD_PREFETCH == base_addr->load) {
-                /* update the load reason */
-                base_addr->load = LOAD_ACCESS;
+        #ifdef DEBUG
+        printf("HIT    line id [%018p] set [%2d:%d]\n", line_id, set, way);
+        #endif
 
-                return (CACHE_SIM_L1_HIT + CACHE_SIM_L1_HIT_PREFETCH);
-            }
+        /* if the hit was on a prefetched line (prefetches don't use it) */
+        if ((LOAD_PREFETCH == lru->load) && (LOAD_ACCESS == load)) {
+            /* update the load reason */
+            lru->load = LOAD_ACCESS;
 
-            return CACHE_SIM_L1_HIT;
+            return (CACHE_SIM_L1_HIT + CACHE_SIM_L1_HIT_PREFETCH);
         }
 
-        /* if it is a free way use it (bonus!) */
-        if (UINT64_MAX == base_addr->line_id) {
-            lru = base_addr;
-            way = i;
-            break;
-        }
+        return CACHE_SIM_L1_HIT;
+    }
 
-        /* find the last recently used way in the set */
-        if (base_addr->age <= lru->age) {
-            lru = base_addr;
-            way = i;
+    /* if there is a free way use it (bonus!), invalidations can leave free
+     * ways anywhere in the set, otherwise find the last recently used way
+     */
+    if (0 > (way = cache_sim_tag_find(tags, cache->associativity,
+        UINT64_MAX))) {
+        for (way = 0, i = 1; i < cache->associativity; i++) {
+            if (ways[i].age <= ways[way].age) {
+                way = i;
+            }
         }
-
-        /* increment way address */
-        base_addr++;
     }
+    lru = &(ways[way]);
 
     /* if data was not found, report that and load it */
     #ifdef DEBUG
@@ -130,22 +143,84 @@ int policy_lru_access(cache_handle_t *cache, const uint64_t line_id,
         set, way, load);
     #endif
 
+    /* report the evicted line */
+    cache->victim_line = tags[way];
+    cache->victim_dirty = (UINT64_MAX != tags[way]) && lru->dirty;
+
     /* if the evicted line was prefetched and never accessed */
     if (LOAD_PREFETCH == lru->load) {
         /* load the data */
         lru->age = cache->access;
-        lru->line_id = line_id;
+        tags[way] = line_id;
         lru->load = load;
+        lru->dirty = 0;
 
         return (CACHE_SIM_L1_MISS + CACHE_SIM_L1_PREFETCH_EVICT);
     }
 
     /* load the data */
     lru->age = cache->access;
-    lru->line_id = line_id;
+    tags[way] = line_id;
     lru->load = load;
+    lru->dirty = 0;
 
     return CACHE_SIM_L1_MISS;
 }
 
+/* policy_lru_find: the way holding a line, or -1 */
+static int policy_lru_find(cache_handle_t *cache, const uint64_t line_id,
+    uint64_t *set) {
+    /* calculate set for this address */
+    *set = line_id;
+    CACHE_SIM_LINE_ID_TO_SET(*set);
+
+    return cache_sim_tag_find(lru_tags(cache, *set), cache->associativity,
+        line_id);
+}
+
+/* policy_lru_invalidate */
+line_state_t policy_lru_invalidate(cache_handle_t *cache,
+    const uint64_t line_id) {
+    policy_lru_t *way = NULL;
+    line_state_t state = LINE_ABSENT;
+    uint64_t set = UINT64_MAX;
+    int i = 0;
+
+    if (0 > (i = policy_lru_find(cache, line_id, &set))) {
+        return LINE_ABSENT;
+    }
+    way = &(lru_ways(cache, set)[i]);
+    state = way->dirty ? LINE_DIRTY : LINE_CLEAN;
+
+    #ifdef DEBUG
+    printf("INVAL  line id [%018p]\n", line_id);
+    #endif
+
+    /* free the way, it will be the first one used in this set */
+    lru_tags(cache, set)[i] = UINT64_MAX;
+    way->age = 0;
+    way->load = LOAD_ACCESS;
+    way->dirty = 0;
+
+    return state;
+}
+
+/* policy_lru_dirty */
+line_state_t policy_lru_dirty(cache_handle_t *cache, const uint64_t line_id) {
+    policy_lru_t *way = NULL;
+    line_state_t state = LINE_ABSENT;
+    uint64_t set = UINT64_MAX;
+    int i = 0;
+
+    if (0 > (i = policy_lru_find(cache, line_id, &set))) {
+        return LINE_ABSENT;
+    }
+    way = &(lru_ways(cache, set)[i]);
+    state = way->dirty ? LINE_DIRTY : LINE_CLEAN;
+
+    way->dirty = 1;
+
+    return state;
+}
+
 // EOF
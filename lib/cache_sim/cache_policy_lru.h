@@ -30,6 +30,10 @@ extern "C" {
 #include "cache_sim.h"
 #endif
 
+#ifndef CACHE_SIM_TYPES_H_
+#include "cache_sim_types.h"
+#endif
+
 #ifndef _STDINT_H
 #include <stdint.h>
 #endif
@@ -37,12 +41,18 @@ extern "C" {
 int policy_lru_init(cache_handle_t *cache);
 int policy_lru_access(cache_handle_t *cache, const uint64_t line_id,
 	const load_t load);
+line_state_t policy_lru_invalidate(cache_handle_t *cache,
+    const uint64_t line_id);
+line_state_t policy_lru_dirty(cache_handle_t *cache, const uint64_t line_id);
 
+/* LRU data of a way, its tag (line ID) is kept apart in the tags array of
+ * the set (see cache_sim_tag_find())
+ */
 typedef struct {
-    uint64_t line_id;
     uint64_t age;
     uint8_t  load;
-    uint8_t  padding[15];
+    uint8_t  dirty;
+    uint8_t  padding[6];
 } policy_lru_t;
 
 #ifdef __cplusplus
@@ -24,7 +24,6 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
-#include <math.h>
 
 /* Cache simulator headers */
 #include "cache_sim.h"
@@ -32,6 +31,20 @@
 #include "cache_sim_util.h"
 #include "cache_policy_plru.h"
 
+/* plru_tags: tags of the ways of a set, stored after the PLRU masks */
+static inline uint64_t* plru_tags(const cache_handle_t *cache,
+    const uint64_t set) {
+    return (uint64_t *)cache->data + cache->total_sets +
+        (set * cache->associativity);
+}
+
+/* plru_ways: PLRU data of the ways of a set, stored after all the tags */
+static inline policy_plru_t* plru_ways(const cache_handle_t *cache,
+    const uint64_t set) {
+    return (policy_plru_t *)((uint64_t *)cache->data + cache->total_sets +
+        cache->total_lines) + (set * cache->associativity);
+}
+
 /* policy_plru_init */
 int policy_plru_init(cache_handle_t *cache) {
     /* sanity check: does cache exist? */
@@ -41,12 +54,13 @@ int policy_plru_init(cache_handle_t *cache) {
     }
 
     /* variables declaration and initialization */
-    uint64_t *plru_mask = NULL;
+    uint64_t *plru_mask = NULL, *tags = NULL;
     policy_plru_t *block = NULL;
+    int i = 0;
 
     /* allocate data area */
-    cache->data = malloc((sizeof(policy_plru_t) * cache->total_lines) +
-        ((cache->total_sets * sizeof(uint64_t))));
+    cache->data = malloc((cache->total_sets * sizeof(uint64_t)) +
+        ((sizeof(uint64_t) + sizeof(policy_plru_t)) * cache->total_lines));
 
     if (NULL == cache->data) {
         printf("Error: unable to allocate memory for cache data\n");
@@ -54,28 +68,23 @@ int policy_plru_init(cache_handle_t *cache) {
     }
 
     /* initialize data area: PLRU masks */
-    for (plru_mask = (uint64_t *)cache->data;
-        (uint64_t)plru_mask < ((uint64_t)cache->data +
-            (cache->total_sets * sizeof(uint64_t)));
-        plru_mask++) {
-        *plru_mask = 0;
+    plru_mask = (uint64_t *)cache->data;
+    for (i = 0; i < cache->total_sets; i++) {
+        plru_mask[i] = 0;
     }
 
-    /* initialize data area: blocks on sets */
-    for (block = (policy_plru_t *)((uint64_t)cache->data +
-            (cache->total_sets * sizeof(uint64_t)));
-        (uint64_t)block < ((uint64_t)cache->data +
-            (cache->total_sets * sizeof(uint64_t)) +
-            (sizeof(policy_plru_t) * cache->total_lines));
-        block++) {
-        /* write UINT64_MAX in all blocks... */
-        block->line_id = UINT64_MAX;
-        block->load = LOAD_ACCESS;
+    /* initialize data area: blocks on sets (all free) */
+    tags = plru_tags(cache, 0);
+    block = plru_ways(cache, 0);
+    for (i = 0; i < cache->total_lines; i++) {
+        tags[i] = UINT64_MAX;
+        block[i].load = LOAD_ACCESS;
+        block[i].dirty = 0;
     }
 
     /* print out how much memory it requires */
     printf("Memory required: %9d bytes\n",
-        ((sizeof(policy_plru_t) * cache->total_lines) +
+        (((sizeof(uint64_t) + sizeof(policy_plru_t)) * cache->total_lines) +
         (cache->total_sets * sizeof(uint64_t))));
 
     return CACHE_SIM_SUCCESS;
@@ -84,10 +93,10 @@ int policy_plru_init(cache_handle_t *cache) {
 /* policy_plru_access */
 int policy_plru_access(cache_handle_t *cache, const uint64_t line_id,
     const load_t load) {
-    static policy_plru_t *way_addr = NULL;
-    static uint64_t *plru_mask = NULL;
-    static uint64_t set = UINT64_MAX;
-    static int way = 0, i = 0;
+    policy_plru_t *way_addr = NULL;
+    uint64_t *plru_mask = NULL, *tags = NULL;
+    uint64_t set = UINT64_MAX;
+    int way = 0, i = 0;
     int bit = 0, bit_set = 0, bit_offset = 0;
 
     /* calculate set for this address */
@@ -97,49 +106,47 @@ int policy_plru_access(cache_handle_t *cache, const uint64_t line_id,
     /* calculate the base address for the PLRU mask of this set */
     plru_mask = (uint64_t *)((uint64_t)cache->data + (set * sizeof(uint64_t)));
 
-    /* calculate the base address of the first way on the set */
-    way_addr = (policy_plru_t *)((uint64_t)cache->data +
-        (cache->total_sets * sizeof(uint64_t)) +
-        (set * cache->associativity * sizeof(policy_plru_t)));
+    /* calculate the base address of the tags of the set */
+    tags = plru_tags(cache, set);
 
-    /* iterate across all the ways of the set */
-    for (way = 0; way < cache->associativity; way++, way_addr++) {
-        /* check if data is present */
-        if (line_id == way_addr->line_id) {
-            #ifdef DEBUG
-            printf("HIT    line id [%018p] set [%2d:%d]\n", line_id, set, way);
-            #endif
+    /* check if data is present in any way of the set */
+    if (0 <= (way = cache_sim_tag_find(tags, cache->associativity,
+        line_id))) {
+        way_addr = &(plru_ways(cache, set)[way]);
 
-            /* update PLRU mask by inverting the bits used by this way */
-            for (i = 0; i < (int)log2(cache->associativity); i++) {
-                /* find out which bit should be toggled */
-                bit = bit_set + bit_offset;
+        #ifdef DEBUG
+        printf("HIT    line id [%018p] set [%2d:%d]\n", line_id, set, way);
+        #endif
 
-                /* toggle it */
-                TOGGLE_BIT(*plru_mask, bit);
+        /* update PLRU mask by inverting the bits used by this way */
+        for (i = 0; i < cache->way_length; i++) {
+            /* find out which bit should be toggled */
+            bit = bit_set + bit_offset;
 
-                /* add the bit offset */
-                bit_offset = way >> ((int)log2(cache->associativity) - 1 - i);
+            /* toggle it */
+            TOGGLE_BIT(*plru_mask, bit);
 
-                /* move to the next set of bits */
-                bit_set <<= 1;
-                bit_set++;
-            }
+            /* add the bit offset */
+            bit_offset = way >> (cache->way_length - 1 - i);
 
-            /* if the hit was on a prefetched line */
-            if (LOAD_PREFETCH == way_addr->load) {
-                /* reset load reason */
-                way_addr->load = LOAD_ACCESS;
+            /* move to the next set of bits */
+            bit_set <<= 1;
+            bit_set++;
+        }
 
-                return (CACHE_SIM_L1_HIT + CACHE_SIM_L1_HIT_PREFETCH);
-            }
+        /* if the hit was on a prefetched line (prefetches don't use it) */
+        if ((LOAD_PREFETCH == way_addr->load) && (LOAD_ACCESS == load)) {
+            /* reset load reason */
+            way_addr->load = LOAD_ACCESS;
 
-            return CACHE_SIM_L1_HIT;
+            return (CACHE_SIM_L1_HIT + CACHE_SIM_L1_HIT_PREFETCH);
         }
+
+        return CACHE_SIM_L1_HIT;
     }
 
     /* find the PLRU way and update PRLU mask */
-    for (i = 0, way = 0; i < (int)log2(cache->associativity); i++) {
+    for (i = 0, way = 0; i < cache->way_length; i++) {
         /* find out which bit should be read */
         bit = bit_set + bit_offset;
 
@@ -165,10 +172,7 @@ int policy_plru_access(cache_handle_t *cache, const uint64_t line_id,
     way >>= 1;
 
     /* calculate data area base address for this way */
-    way_addr = (policy_plru_t *)((uint64_t)cache->data +
-        (cache->total_sets * sizeof(uint64_t)) +
-        (set * cache->associativity * sizeof(policy_plru_t)) +
-        (way * sizeof(policy_plru_t)));
+    way_addr = &(plru_ways(cache, set)[way]);
 
     /* report a miss and load the line */
     #ifdef DEBUG
@@ -177,20 +181,81 @@ int policy_plru_access(cache_handle_t *cache, const uint64_t line_id,
         set, way, load);
     #endif
 
+    /* report the evicted line */
+    cache->victim_line = tags[way];
+    cache->victim_dirty = (UINT64_MAX != tags[way]) && way_addr->dirty;
+
     /* if the evicted line was prefetched and never accessed */
     if (LOAD_PREFETCH == way_addr->load) {
         /* load the data */
-        way_addr->line_id = line_id;
+        tags[way] = line_id;
         way_addr->load = load;
+        way_addr->dirty = 0;
 
         return (CACHE_SIM_L1_MISS + CACHE_SIM_L1_PREFETCH_EVICT);
     }
 
     /* load the data */
-    way_addr->line_id = line_id;
+    tags[way] = line_id;
     way_addr->load = load;
+    way_addr->dirty = 0;
 
     return CACHE_SIM_L1_MISS;
 }
 
+/* policy_plru_find: the way holding a line, or -1 */
+static int policy_plru_find(cache_handle_t *cache, const uint64_t line_id,
+    uint64_t *set) {
+    /* calculate set for this address */
+    *set = line_id;
+    CACHE_SIM_LINE_ID_TO_SET(*set);
+
+    return cache_sim_tag_find(plru_tags(cache, *set), cache->associativity,
+        line_id);
+}
+
+/* policy_plru_invalidate */
+line_state_t policy_plru_invalidate(cache_handle_t *cache,
+    const uint64_t line_id) {
+    policy_plru_t *way_addr = NULL;
+    line_state_t state = LINE_ABSENT;
+    uint64_t set = UINT64_MAX;
+    int way = 0;
+
+    if (0 > (way = policy_plru_find(cache, line_id, &set))) {
+        return LINE_ABSENT;
+    }
+    way_addr = &(plru_ways(cache, set)[way]);
+    state = way_addr->dirty ? LINE_DIRTY : LINE_CLEAN;
+
+    #ifdef DEBUG
+    printf("INVAL  line id [%018p]\n", line_id);
+    #endif
+
+    /* free the way (the PLRU mask is left as it is) */
+    plru_tags(cache, set)[way] = UINT64_MAX;
+    way_addr->load = LOAD_ACCESS;
+    way_addr->dirty = 0;
+
+    return state;
+}
+
+/* policy_plru_dirty */
+line_state_t policy_plru_dirty(cache_handle_t *cache, const uint64_t line_id) {
+    policy_plru_t *way_addr = NULL;
+    line_state_t state = LINE_ABSENT;
+    uint64_t set = UINT64_MAX;
+    int way = 0;
+
+    if (0 > (way = policy_plru_find(cache, line_id, &set))) {
+        return LINE_ABSENT;
+    }
+    way_addr = &(plru_ways(cache, set)[way]);
+    state = way_addr->dirty ? LINE_DIRTY : LINE_CLEAN;
+
+    way_addr->dirty = 1;
+
+    return state;
+}
+
 // EOF
@@ -30,6 +30,10 @@ extern "C" {
 #include "cache_sim.h"
 #endif
 
+#ifndef CACHE_SIM_TYPES_H_
+#include "cache_sim_types.h"
+#endif
+
 #ifndef _STDINT_H
 #include <stdint.h>
 #endif
@@ -44,11 +48,16 @@ extern "C" {
 int policy_plru_init(cache_handle_t *cache);
 int policy_plru_access(cache_handle_t *cache, const uint64_t line_id,
     const load_t load);
+line_state_t policy_plru_invalidate(cache_handle_t *cache,
+    const uint64_t line_id);
+line_state_t policy_plru_dirty(cache_handle_t *cache, const uint64_t line_id);
 
+/* PLRU data of a way, its tag (line ID) is kept apart in the tags array of
+ * the set (see cache_sim_tag_find())
+ */
 typedef struct {
-    uint64_t line_id;
     uint8_t  load;
-    uint8_t  padding[7];
+    uint8_t  dirty;
 } policy_plru_t;
 
 #ifdef __cplusplus
@@ -30,16 +30,20 @@
 /* Cache simulator headers */
 #include "cache_sim.h"
 #include "cache_sim_types.h"
+#include "cache_sim_hierarchy.h"
 #include "cache_sim_reuse.h"
 #include "cache_sim_symbol.h"
 #include "cache_policy_lru.h"
 #include "cache_policy_plru.h"
 
-/* List of policies */
-static policy_t policies[] = {
-    { "lru",  &policy_lru_init,  &policy_lru_access  },
-    { "plru", &policy_plru_init, &policy_plru_access },
-    { NULL,   NULL,              NULL,               }
+/* List of policies (read-only, shared by all caches) */
+static const policy_t policies[] = {
+    { "lru",  &policy_lru_init,  &policy_lru_access,
+        &policy_lru_invalidate,  &policy_lru_dirty  },
+    { "plru", &policy_plru_init, &policy_plru_access,
+        &policy_plru_invalidate, &policy_plru_dirty },
+    { NULL,   NULL,              NULL,
+        NULL,                    NULL               }
 };
 
 /* cache_sim_init */
@@ -100,9 +104,29 @@ int cache_sim_fini(cache_handle_t *cache) {
     printf("Prefetcher:                     \n");
     printf(" -> next line   %16"PRIu64"\n", cache->prefetcher_next_line);
     printf(" -> pollution   %16"PRIu64"\n", cache->prefetcher_evict);
+    if (NULL != cache->prefetch_data) {
+        printf(" -> stride      %16"PRIu64"\n", cache->prefetcher_stride);
+        printf(" -> stream      %16"PRIu64"\n", cache->prefetcher_stream);
+        printf(" -> filled      %16"PRIu64"\n", cache->prefetcher_fill);
+        printf(" -> accuracy    %15.2f%%\n",
+            (((double)cache->prefetcher_hit /
+                (double)cache->prefetcher_fill) * 100));
+        printf(" -> coverage    %15.2f%%\n",
+            (((double)cache->prefetcher_hit /
+                (double)(cache->prefetcher_hit + cache->miss)) * 100));
+        printf(" -> late        %16"PRIu64"\n", cache->prefetcher_late);
+    }
+    if ((NULL != cache->lower) || (0 < cache->upper.len)) {
+        printf("Hierarchy level:%16d\n", cache->level);
+        printf("Writebacks:     %16"PRIu64"\n", cache->writeback);
+        printf("Invalidations:  %16"PRIu64"\n", cache->invalidation);
+    }
     printf("  Cache finalized successfully  \n");
     printf("--------------------------------\n");
 
+    /* take the cache out of the hierarchy */
+    cache_sim_hierarchy_unlink(cache);
+
     /* destroy the cache and free memory */
     cache_destroy(cache);
 
@@ -130,10 +154,15 @@ static cache_handle_t* cache_create(const unsigned int total_size,
     cache->total_sets    = cache->total_lines / associativity;
     cache->offset_length = (int)log2(line_size);
     cache->set_length    = (int)log2(cache->total_sets);
+    cache->way_length    = (int)log2(associativity);
 
     /* replacement policy */
-    cache->access_fn = NULL;
-    cache->data      = NULL;
+    cache->access_fn     = NULL;
+    cache->invalidate_fn = NULL;
+    cache->dirty_fn      = NULL;
+    cache->data          = NULL;
+    cache->victim_line   = UINT64_MAX;
+    cache->victim_dirty  = 0;
 
     /* reused distance */
     cache->reuse_data  = NULL;
@@ -145,6 +174,15 @@ static cache_handle_t* cache_create(const unsigned int total_size,
 
     /* prefetchers */
     cache->next_line = PREFETCHER_INVALID;
+    cache->prefetch_data = NULL;
+
+    /* cache hierarchy (a single level until it is linked to others) */
+    cache->level = 1;
+    cache->inclusion = INCLUSION_NON_INCLUSIVE;
+    cache->upper.head.next = &(cache->upper.head);
+    cache->upper.head.prev = &(cache->upper.head);
+    cache->upper.len = 0;
+    cache->lower = NULL;
 
     /* initialize performance counters */
     cache->hit                  = 0;
@@ -152,8 +190,14 @@ static cache_handle_t* cache_create(const unsigned int total_size,
     cache->access               = 0;
     cache->conflict             = 0;
     cache->prefetcher_next_line = 0;
+    cache->prefetcher_stride    = 0;
+    cache->prefetcher_stream    = 0;
+    cache->prefetcher_fill      = 0;
     cache->prefetcher_hit       = 0;
+    cache->prefetcher_late      = 0;
     cache->prefetcher_evict     = 0;
+    cache->writeback            = 0;
+    cache->invalidation         = 0;
 
     printf("   Cache created successfully   \n");
     printf("Cache size:      %9d bytes\n", cache->total_size);
@@ -173,6 +217,9 @@ static void cache_destroy(cache_handle_t *cache) {
         if (NULL != cache->data) {
             free(cache->data);
         }
+        if (NULL != cache->prefetch_data) {
+            free(cache->prefetch_data);
+        }
         free(cache);
     }
 }
@@ -185,8 +232,10 @@ static int set_policy(cache_handle_t *cache, const char *policy) {
     while (NULL != policies[i].name) {
         if (0 == strcmp(policy, policies[i].name)) {
 
-            /* set the policy function */
-            cache->access_fn = policies[i].access_fn;
+            /* set the policy functions */
+            cache->access_fn     = policies[i].access_fn;
+            cache->invalidate_fn = policies[i].invalidate_fn;
+            cache->dirty_fn      = policies[i].dirty_fn;
 
             printf("Replacem policy: %15s\n", policy);
 
@@ -44,10 +44,28 @@ extern "C" {
 #define CACHE_SIM_L1_MISS_CONFLICT  0x080
 #define CACHE_SIM_L1_PREFETCH_EVICT 0x100
 
+/* Access types */
+#define CACHE_SIM_READ  0
+#define CACHE_SIM_WRITE 1
+
 /* Some limitations */
 #define CACHE_SIM_SYMBOL_MAX_LENGTH 40
 
-/* Type declaration: the cache itself */
+/* Type declaration: the cache itself
+ *
+ * Thread safety: all the state of a simulated cache (contents, replacement
+ * data, reuse distances, symbols, prefetchers and counters) lives in its
+ * cache_handle_t, and the library keeps no other mutable state. Handles that
+ * are not linked to each other can therefore be driven concurrently from
+ * different threads, e.g. one handle per candidate configuration. Nothing is
+ * synchronized, though: an access to one level of a hierarchy (see
+ * cache_sim_hierarchy.h) also updates the levels below it, through fills,
+ * writebacks and invalidations, and the levels above it, so a whole
+ * hierarchy, and not just a single handle, must be driven from one thread at
+ * a time. Caches shared by simulated cores therefore need the callers to
+ * serialize their accesses. Progress and statistics are printed to stdout,
+ * so the output of concurrent handles may interleave.
+ */
 typedef struct cache_handle cache_handle_t;
 
 /* Functions declaration */
@@ -56,6 +74,12 @@ cache_handle_t* cache_sim_init(const unsigned int total_size,
     const char *policy);
 int cache_sim_fini(cache_handle_t *cache);
 int cache_sim_access(cache_handle_t *cache, const uint64_t address);
+int cache_sim_access_type(cache_handle_t *cache, const uint64_t address,
+    const int type);
+int cache_sim_access_pc(cache_handle_t *cache, const uint64_t address,
+    const int type, const uint64_t pc);
+int cache_sim_access_batch(cache_handle_t *cache, const uint64_t *addresses,
+    const int *types, const size_t count, int *results);
 
 static cache_handle_t* cache_create(const unsigned int total_size,
     const unsigned int line_size, const unsigned int associativity);
@@ -28,13 +28,19 @@
 #include "cache_sim.h"
 #include "cache_sim_types.h"
 #include "cache_sim_util.h"
+#include "cache_sim_hierarchy.h"
+#include "cache_sim_prefetcher.h"
 #include "cache_sim_reuse.h"
 
-/* cache_sim_access */
-int cache_sim_access(cache_handle_t *cache, const uint64_t address) {
+/* access_line: the access itself, inlined in the single and batch entry
+ * points
+ */
+static inline int access_line(cache_handle_t *cache, const uint64_t address,
+    const int type, const uint64_t pc) {
     /* variables declaration */
-    static int rc = CACHE_SIM_ERROR;
-    static uint64_t line_id = UINT64_MAX;
+    int rc = CACHE_SIM_ERROR;
+    uint64_t line_id = UINT64_MAX;
+    uint64_t distance = UINT64_MAX;
 
     /* increment access counter */
     cache->access++;
@@ -44,32 +50,38 @@ int cache_sim_access(cache_handle_t *cache, const uint64_t address) {
     CACHE_SIM_ADDRESS_TO_LINE_ID(line_id);
 
     #ifdef DEBUG
-    printf("ACCESS address [%018p]\n", address);
+    printf("ACCESS address [%018p] type [%d]\n", address, type);
     #endif
 
-    /* call the replacement algorithm access function and evaluate the result */
-    switch (rc = cache->access_fn(cache, line_id, LOAD_ACCESS)) {
+    /* call the replacement algorithm access function */
+    rc = cache->access_fn(cache, line_id, LOAD_ACCESS);
+
+    /* on a miss, go down the hierarchy */
+    if (CACHE_SIM_L1_MISS & rc) {
+        cache_sim_hierarchy_load(cache, line_id);
+    }
+
+    /* stores leave the line dirty (write-back, write-allocate) */
+    if (CACHE_SIM_WRITE == type) {
+        cache->dirty_fn(cache, line_id);
+    }
+
+    /* evaluate the result */
+    switch (rc) {
         /* hit on a prefetched line */
         case CACHE_SIM_L1_HIT + CACHE_SIM_L1_HIT_PREFETCH: // fallover!
             /* increment prefetcher hits counter */
             cache->prefetcher_hit++;
 
+            /* was the prefetch late? */
+            if (NULL != cache->prefetch_data) {
+                cache_sim_prefetcher_hit(cache, line_id);
+            }
+
             /* if the next line prefetcher is tagged, keep prefething */
             if (PREFETCHER_NEXT_LINE_TAGGED == cache->next_line) {
-                /* if the next line load evicts a prefetched line */
-                if ((CACHE_SIM_L1_MISS + CACHE_SIM_L1_PREFETCH_EVICT) ==
-                    cache->access_fn(cache, (line_id + cache->line_size),
-                        LOAD_PREFETCH)) {
-                    /* increment prefetched evicted lines counter */
-                    cache->prefetcher_evict++;
-                }
-
-                /* increment prefetcher next line counter */
+                cache_sim_prefetcher_issue(cache, (line_id + cache->line_size));
                 cache->prefetcher_next_line++;
-
-                #ifdef DEBUG
-                printf("PREFET line id [%018p]\n", line_id + cache->line_size);
-                #endif
             }
 
         /* hit on a pre-loaded cache line */
@@ -89,46 +101,89 @@ int cache_sim_access(cache_handle_t *cache, const uint64_t address) {
             /* if prefetcher next line is ON fetch next line */
             if ((PREFETCHER_NEXT_LINE_SINGLE == cache->next_line) ||
                (PREFETCHER_NEXT_LINE_TAGGED == cache->next_line)) {
-                /* if the next line load evicts a prefetched line */
-                if ((CACHE_SIM_L1_MISS + CACHE_SIM_L1_PREFETCH_EVICT) ==
-                    cache->access_fn(cache, (line_id + cache->line_size),
-                        LOAD_PREFETCH)) {
-                    /* increment prefetched evicted lines counter */
-                    cache->prefetcher_evict++;
-                }
-
-                /* increment prefetcher next line counter */
+                cache_sim_prefetcher_issue(cache, (line_id + cache->line_size));
                 cache->prefetcher_next_line++;
-
-                #ifdef DEBUG
-                printf("PREFET line id [%018p]\n", line_id + cache->line_size);
-                #endif
             }
             break;
     }
 
+    /* train the stride and stream prefetchers */
+    if (NULL != cache->prefetch_data) {
+        cache_sim_prefetcher_train(cache, address, pc, rc);
+    }
+
     /* calculate reuse distance and check for set associative conflicts */
     if (NULL != cache->reuse_data) {
+        /* calculate reuse distance */
+        distance = cache->reuse_fn(cache, line_id);
+
         /* check for set associativity conflicts */
-        if ((cache->total_lines > cache_sim_reuse_get_age(cache, line_id)) &&
-            (CACHE_SIM_L1_MISS == rc)) {
+        if ((cache->total_lines > distance) && (CACHE_SIM_L1_MISS == rc)) {
 
             /* increment conflicts counter */
             cache->conflict++;
 
             #ifdef DEBUG
             printf("CONFLI line id [%018p] distance [%"PRIu64"]\n", line_id,
-                cache_sim_reuse_get_age(cache, line_id));
+                distance);
             #endif
 
             rc += CACHE_SIM_L1_MISS_CONFLICT;
         }
-
-        /* calculate reuse distance */
-        cache->reuse_fn(cache, line_id);
     }
 
     return rc;
 }
 
+/* cache_sim_access */
+int cache_sim_access(cache_handle_t *cache, const uint64_t address) {
+    return cache_sim_access_type(cache, address, CACHE_SIM_READ);
+}
+
+/* cache_sim_access_type */
+int cache_sim_access_type(cache_handle_t *cache, const uint64_t address,
+    const int type) {
+    return cache_sim_access_pc(cache, address, type, 0);
+}
+
+/* cache_sim_access_pc */
+int cache_sim_access_pc(cache_handle_t *cache, const uint64_t address,
+    const int type, const uint64_t pc) {
+    return access_line(cache, address, type, pc);
+}
+
+/* cache_sim_access_batch: a sequence of accesses in a single call, 'types'
+ * may be NULL (all reads) and so may be 'results' (the return code of each
+ * access is not needed)
+ */
+int cache_sim_access_batch(cache_handle_t *cache, const uint64_t *addresses,
+    const int *types, const size_t count, int *results) {
+    /* variables declaration */
+    size_t i = 0;
+    int rc = CACHE_SIM_ERROR;
+
+    /* sanity check: does cache exist? */
+    if (NULL == cache) {
+        printf("Error: cache does not exists\n");
+        return CACHE_SIM_ERROR;
+    }
+
+    /* sanity check: are there addresses? */
+    if ((NULL == addresses) && (0 < count)) {
+        printf("Error: no addresses to access\n");
+        return CACHE_SIM_ERROR;
+    }
+
+    for (i = 0; i < count; i++) {
+        rc = access_line(cache, addresses[i],
+            (NULL == types) ? CACHE_SIM_READ : types[i], 0);
+
+        if (NULL != results) {
+            results[i] = rc;
+        }
+    }
+
+    return CACHE_SIM_SUCCESS;
+}
+
 // EOF
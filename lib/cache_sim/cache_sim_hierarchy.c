@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+/* System standard headers */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Cache simulator headers */
+#include "cache_sim.h"
+#include "cache_sim_types.h"
+#include "cache_sim_util.h"
+#include "cache_sim_hierarchy.h"
+
+/* List of inclusion policies */
+static const struct {
+    const char *name;
+    inclusion_t inclusion;
+} inclusions[] = {
+    { "non-inclusive", INCLUSION_NON_INCLUSIVE },
+    { "inclusive",     INCLUSION_INCLUSIVE     },
+    { "exclusive",     INCLUSION_EXCLUSIVE     },
+    { NULL,            INCLUSION_INVALID       }
+};
+
+/* line_of */
+static inline uint64_t line_of(const cache_handle_t *cache, uint64_t address) {
+    CACHE_SIM_ADDRESS_TO_LINE_ID(address);
+    return address;
+}
+
+/* inclusion_name */
+static const char* inclusion_name(const inclusion_t inclusion) {
+    int i = 0;
+
+    while (NULL != inclusions[i].name) {
+        if (inclusion == inclusions[i].inclusion) {
+            return inclusions[i].name;
+        }
+        i++;
+    }
+
+    return "unknown";
+}
+
+/* set_level */
+static void set_level(cache_handle_t *cache, int level) {
+    /* levels are counted from the top, the deepest path wins */
+    for (; NULL != cache; cache = cache->lower) {
+        if (cache->level >= level) {
+            return;
+        }
+        cache->level = level;
+        level++;
+    }
+}
+
+/* cache_sim_hierarchy_link */
+int cache_sim_hierarchy_link(cache_handle_t *upper, cache_handle_t *lower,
+    const char *inclusion) {
+    /* sanity check: do caches exist? */
+    if ((NULL == upper) || (NULL == lower)) {
+        printf("Error: cache does not exists\n");
+        return CACHE_SIM_ERROR;
+    }
+
+    /* sanity check: a cache has only one lower level */
+    if (NULL != upper->lower) {
+        printf("Error: cache is already linked to a lower level\n");
+        return CACHE_SIM_ERROR;
+    }
+
+    /* variables declaration and initialization */
+    inclusion_t type = INCLUSION_INVALID;
+    cache_handle_t *cache = NULL;
+    int i = 0;
+
+    /* find the requested inclusion policy */
+    if (NULL == inclusion) {
+        inclusion = inclusions[0].name;
+    }
+    while (NULL != inclusions[i].name) {
+        if (0 == strcmp(inclusion, inclusions[i].name)) {
+            type = inclusions[i].inclusion;
+            break;
+        }
+        i++;
+    }
+    if (INCLUSION_INVALID == type) {
+        printf("Error: inclusion policy not found\n");
+        return CACHE_SIM_ERROR;
+    }
+
+    /* sanity check: all the caches above a level share its inclusion */
+    if ((0 < lower->upper.len) && (type != lower->inclusion)) {
+        printf("Error: lower level is already %s\n",
+            inclusion_name(lower->inclusion));
+        return CACHE_SIM_ERROR;
+    }
+
+    /* sanity check: no loops */
+    for (cache = lower; NULL != cache; cache = cache->lower) {
+        if (upper == cache) {
+            printf("Error: linking these caches would create a loop\n");
+            return CACHE_SIM_ERROR;
+        }
+    }
+
+    /* link them */
+    lower->inclusion = type;
+    list_prepend_item(&(lower->upper), (list_item_t *)upper);
+    upper->lower = lower;
+    set_level(lower, upper->level + 1);
+
+    printf("--------------------------------\n");
+    printf("   Cache hierarchy is linked    \n");
+    printf("Upper level:     %15d\n", upper->level);
+    printf("Lower level:     %15d\n", lower->level);
+    printf("Inclusion:       %15s\n", inclusion_name(type));
+    printf("--------------------------------\n");
+
+    return CACHE_SIM_SUCCESS;
+}
+
+/* cache_sim_hierarchy_unlink */
+void cache_sim_hierarchy_unlink(cache_handle_t *cache) {
+    list_item_t *item = NULL;
+
+    /* leave the lower level */
+    if (NULL != cache->lower) {
+        list_remove_item(&(cache->lower->upper), (list_item_t *)cache);
+        cache->lower = NULL;
+    }
+
+    /* the caches above now access memory directly */
+    while (0 < cache->upper.len) {
+        item = (list_item_t *)cache->upper.head.next;
+        list_remove_item(&(cache->upper), item);
+        ((cache_handle_t *)item)->lower = NULL;
+    }
+}
+
+/* cache_sim_hierarchy_init */
+cache_handle_t* cache_sim_hierarchy_init(const cache_sim_level_t *levels,
+    const int count) {
+    /* safety checks */
+    if ((NULL == levels) || (0 >= count)) {
+        return NULL;
+    }
+
+    /* variables declaration and initialization */
+    cache_handle_t *top = NULL, *last = NULL, *cache = NULL;
+    int i = 0;
+
+    /* create the levels from the top and link each one to the previous */
+    for (i = 0; i < count; i++) {
+        cache = cache_sim_init(levels[i].total_size, levels[i].line_size,
+            levels[i].associativity, levels[i].policy);
+        if (NULL == cache) {
+            printf("Error: unable to create cache level %d\n", i + 1);
+            break;
+        }
+
+        if ((NULL != last) && (CACHE_SIM_SUCCESS !=
+            cache_sim_hierarchy_link(last, cache, levels[i].inclusion))) {
+            cache_sim_fini(cache);
+            break;
+        }
+
+        if (NULL == top) {
+            top = cache;
+        }
+        last = cache;
+    }
+
+    /* undo everything if some level failed */
+    if ((i < count) && (NULL != top)) {
+        cache_sim_hierarchy_fini(top);
+        return NULL;
+    }
+
+    return top;
+}
+
+/* cache_sim_hierarchy_fini */
+int cache_sim_hierarchy_fini(cache_handle_t *cache) {
+    /* sanity check: does cache exist? */
+    if (NULL == cache) {
+        printf("Error: cache does not exists\n");
+        return CACHE_SIM_ERROR;
+    }
+
+    /* variables declaration */
+    cache_handle_t *level = NULL, *lower = NULL;
+
+    /* summary of all the levels from this one down */
+    printf("--------------------------------\n");
+    printf("Lvl      Accesses   Hit%%     Writebacks\n");
+    for (level = cache; NULL != level; level = level->lower) {
+        printf("L%-2d %13"PRIu64" %6.2f %14"PRIu64"\n", level->level,
+            level->access, (0 == level->access) ? 0.0 :
+                (((double)level->hit / (double)level->access) * 100),
+            level->writeback);
+    }
+
+    /* finalize this cache and the levels below it that no other cache uses */
+    for (level = cache; NULL != level; level = lower) {
+        if ((level != cache) && (0 < level->upper.len)) {
+            break;
+        }
+
+        lower = level->lower;
+        if (CACHE_SIM_SUCCESS != cache_sim_fini(level)) {
+            return CACHE_SIM_ERROR;
+        }
+    }
+
+    return CACHE_SIM_SUCCESS;
+}
+
+/* invalidate_above: drop the lines in [start, end) from the caches above an
+ * inclusive cache, returns LINE_DIRTY if any of them was dirty
+ */
+static line_state_t invalidate_above(cache_handle_t *cache,
+    const uint64_t start, const uint64_t end) {
+    /* variables declaration and initialization */
+    line_state_t rc = LINE_CLEAN, state = LINE_ABSENT;
+    cache_handle_t *upper = NULL;
+    uint64_t line_id = 0;
+
+    for (upper = (cache_handle_t *)cache->upper.head.next;
+        (void *)upper != (void *)&(cache->upper.head);
+        upper = (cache_handle_t *)upper->next) {
+        /* the upper level may use shorter lines than this one */
+        for (line_id = line_of(upper, start); line_id < end;
+            line_id += upper->line_size) {
+            state = upper->invalidate_fn(upper, line_id);
+            if (LINE_ABSENT == state) {
+                continue;
+            }
+
+            cache->invalidation++;
+            if (LINE_DIRTY == state) {
+                rc = LINE_DIRTY;
+            }
+        }
+
+        /* if the upper level is inclusive too, keep going up */
+        if ((INCLUSION_INCLUSIVE == upper->inclusion) &&
+            (LINE_DIRTY == invalidate_above(upper, start, end))) {
+            rc = LINE_DIRTY;
+        }
+    }
+
+    return rc;
+}
+
+/* insert_line: store a line evicted from the level above */
+static void insert_line(cache_handle_t *cache, const uint64_t address,
+    const int dirty) {
+    /* variables declaration and initialization */
+    uint64_t line_id = line_of(cache, address);
+
+    /* a dirty line already present only has to be marked */
+    if ((INCLUSION_EXCLUSIVE != cache->inclusion) && dirty &&
+        (LINE_ABSENT != cache->dirty_fn(cache, line_id))) {
+        return;
+    }
+
+    /* load it without counting an access */
+    if (CACHE_SIM_L1_MISS & cache->access_fn(cache, line_id, LOAD_ACCESS)) {
+        cache_sim_hierarchy_evict(cache);
+    }
+
+    if (dirty) {
+        cache->dirty_fn(cache, line_id);
+    }
+}
+
+/* cache_sim_hierarchy_evict */
+void cache_sim_hierarchy_evict(cache_handle_t *cache) {
+    /* variables declaration and initialization */
+    uint64_t line_id = cache->victim_line;
+    int dirty = cache->victim_dirty;
+
+    /* was a free way used? */
+    if (UINT64_MAX == line_id) {
+        return;
+    }
+    cache->victim_line = UINT64_MAX;
+
+    #ifdef DEBUG
+    printf("EVICT  line id [%018p] dirty [%d]\n", line_id, dirty);
+    #endif
+
+    /* an inclusive cache can't keep lines above that it doesn't have */
+    if ((INCLUSION_INCLUSIVE == cache->inclusion) &&
+        (LINE_DIRTY == invalidate_above(cache, line_id,
+            line_id + cache->line_size))) {
+        dirty = 1;
+    }
+
+    /* dirty lines are written back to the lower level (or memory) */
+    if (dirty) {
+        cache->writeback++;
+    }
+
+    /* an exclusive lower level takes all the victims, the others only take
+     * dirty ones
+     */
+    if ((NULL != cache->lower) &&
+        (dirty || (INCLUSION_EXCLUSIVE == cache->lower->inclusion))) {
+        insert_line(cache->lower, line_id, dirty);
+    }
+}
+
+/* cache_sim_hierarchy_fetch */
+int cache_sim_hierarchy_fetch(cache_handle_t *cache, const uint64_t address) {
+    /* variables declaration and initialization */
+    cache_handle_t *lower = cache->lower;
+    line_state_t state = LINE_ABSENT;
+
+    /* lines come from memory */
+    if (NULL == lower) {
+        return LINE_CLEAN;
+    }
+
+    /* an exclusive level gives its copy of the line away */
+    if (INCLUSION_EXCLUSIVE == lower->inclusion) {
+        lower->access++;
+
+        state = lower->invalidate_fn(lower, line_of(lower, address));
+        if (LINE_ABSENT == state) {
+            lower->miss++;
+            return cache_sim_hierarchy_fetch(lower, address);
+        }
+
+        lower->hit++;
+        return state;
+    }
+
+    /* the other ones are accessed as usual, loading the line if needed */
+    cache_sim_access_type(lower, address, CACHE_SIM_READ);
+
+    return LINE_CLEAN;
+}
+
+/* cache_sim_hierarchy_load: handle a miss, writing the victim back and
+ * fetching the line from the lower level
+ */
+void cache_sim_hierarchy_load(cache_handle_t *cache, const uint64_t line_id) {
+    cache_sim_hierarchy_evict(cache);
+
+    /* lines that move up from an exclusive level may be dirty */
+    if (LINE_DIRTY == cache_sim_hierarchy_fetch(cache, line_id)) {
+        cache->dirty_fn(cache, line_id);
+    }
+}
+
+// EOF
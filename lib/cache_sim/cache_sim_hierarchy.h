@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifndef CACHE_SIM_HIERARCHY_H_
+#define CACHE_SIM_HIERARCHY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CACHE_SIM_H_
+#include "cache_sim.h"
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
+/* Type declaration: geometry of one cache level, as reported by memsniffer
+ * (size, linesize and associativity) plus the replacement policy and what
+ * this level keeps of the lines of the level above it ("inclusive",
+ * "exclusive" or "non-inclusive", ignored for the first level)
+ */
+typedef struct {
+    unsigned int total_size;
+    unsigned int line_size;
+    unsigned int associativity;
+    const char *policy;
+    const char *inclusion;
+} cache_sim_level_t;
+
+/* Functions declaration */
+cache_handle_t* cache_sim_hierarchy_init(const cache_sim_level_t *levels,
+    const int count);
+int cache_sim_hierarchy_fini(cache_handle_t *cache);
+int cache_sim_hierarchy_link(cache_handle_t *upper, cache_handle_t *lower,
+    const char *inclusion);
+void cache_sim_hierarchy_unlink(cache_handle_t *cache);
+void cache_sim_hierarchy_evict(cache_handle_t *cache);
+int cache_sim_hierarchy_fetch(cache_handle_t *cache, const uint64_t address);
+void cache_sim_hierarchy_load(cache_handle_t *cache, const uint64_t line_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CACHE_SIM_HIERARCHY_H_ */
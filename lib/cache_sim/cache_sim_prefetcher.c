@@ -22,20 +22,90 @@
 /* System standard headers */
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 /* Cache simulator headers */
 #include "cache_sim.h"
 #include "cache_sim_types.h"
+#include "cache_sim_hierarchy.h"
 #include "cache_sim_prefetcher.h"
 
+/* prefetch_data_get: the stride and stream prefetchers data, allocated the
+ * first time it is needed
+ */
+static prefetch_data_t* prefetch_data_get(cache_handle_t *cache) {
+    /* variables declaration */
+    prefetch_data_t *data = cache->prefetch_data;
+    int i = 0;
+
+    if (NULL != data) {
+        return data;
+    }
+
+    if (NULL == (data = (prefetch_data_t *)malloc(sizeof(prefetch_data_t)))) {
+        printf("Error: unable to allocate memory\n");
+        return NULL;
+    }
+
+    data->stride   = 0;
+    data->stream   = 0;
+    data->degree   = 1;
+    data->distance = 1;
+    data->latency  = 0;
+
+    for (i = 0; i < PREFETCHER_STRIDE_ENTRIES; i++) {
+        data->stride_table[i].pc = UINT64_MAX;
+    }
+    for (i = 0; i < PREFETCHER_STREAM_ENTRIES; i++) {
+        data->stream_table[i].last = UINT64_MAX;
+        data->stream_table[i].age = 0;
+    }
+    for (i = 0; i < PREFETCHER_INFLIGHT_ENTRIES; i++) {
+        data->inflight[i].line_id = UINT64_MAX;
+    }
+
+    cache->prefetch_data = data;
+
+    return data;
+}
+
+/* print_prefetchers */
+static void print_prefetchers(const cache_handle_t *cache) {
+    /* variables declaration */
+    const prefetch_data_t *data = cache->prefetch_data;
+
+    /* be nice and print something... */
+    printf("--------------------------------\n");
+    printf("Next line prefetcher: %10s\n",
+        (PREFETCHER_INVALID == cache->next_line) ? "OFF" :
+            ((PREFETCHER_NEXT_LINE_SINGLE == cache->next_line) ? "SINGLE" :
+                (PREFETCHER_NEXT_LINE_TAGGED == cache->next_line) ? "TAGGED" :
+                    "UNKNOWN"));
+    printf("Stride prefetcher:    %10s\n",
+        ((NULL != data) && data->stride) ? "ON" : "OFF");
+    printf("Stream prefetcher:    %10s\n",
+        ((NULL != data) && data->stream) ? "ON" : "OFF");
+    printf("      Hardware prefetcher       \n");
+    printf("--------------------------------\n");
+}
+
 /* cache_sim_prefetcher_enable */
 int cache_sim_prefetcher_enable(cache_handle_t *cache, prefetcher_t type) {
+    /* variables declaration */
+    prefetch_data_t *data = NULL;
+
     /* sanity check: does cache exist? */
     if (NULL == cache) {
         printf("Error: cache does not exists\n");
         return CACHE_SIM_ERROR;
     }
 
+    /* unknown prefetcher type */
+    if (PREFETCHER_INVALID <= type) {
+        printf("Error: unknown prefetcher type\n");
+        return CACHE_SIM_ERROR;
+    }
+
     /* enable prefetcher next line on a miss (single line prefetching) */
     if (PREFETCHER_NEXT_LINE_SINGLE == type) {
         cache->next_line = PREFETCHER_NEXT_LINE_SINGLE;
@@ -46,21 +116,19 @@ int cache_sim_prefetcher_enable(cache_handle_t *cache, prefetcher_t type) {
         cache->next_line = PREFETCHER_NEXT_LINE_TAGGED;
     }
 
-    /* unknown prefetcher type */
-    if (PREFETCHER_INVALID <= type) {
-        printf("Error: unknown prefetcher type\n");
-        return CACHE_SIM_ERROR;
+    /* enable the stride or the stream prefetcher */
+    if ((PREFETCHER_STRIDE == type) || (PREFETCHER_STREAM == type)) {
+        if (NULL == (data = prefetch_data_get(cache))) {
+            return CACHE_SIM_ERROR;
+        }
+        if (PREFETCHER_STRIDE == type) {
+            data->stride = 1;
+        } else {
+            data->stream = 1;
+        }
     }
 
-    /* be nice and print something... */
-    printf("--------------------------------\n");
-    printf("Next line prefetcher: %10s\n",
-        (PREFETCHER_INVALID == cache->next_line) ? "OFF" :
-            ((PREFETCHER_NEXT_LINE_SINGLE == cache->next_line) ? "SINGLE" :
-                (PREFETCHER_NEXT_LINE_TAGGED == cache->next_line) ? "TAGGED" :
-                    "UNKNOWN"));
-    printf("      Hardware prefetcher       \n");
-    printf("--------------------------------\n");
+    print_prefetchers(cache);
 
     return CACHE_SIM_SUCCESS;
 }
@@ -73,29 +141,264 @@ int cache_sim_prefetcher_disable(cache_handle_t *cache, prefetcher_t type) {
         return CACHE_SIM_ERROR;
     }
 
+    /* unknown prefetcher type */
+    if (PREFETCHER_INVALID <= type) {
+        printf("Error: unknown prefetcher type\n");
+        return CACHE_SIM_ERROR;
+    }
+
     /* disable prefetcher next line */
     if ((PREFETCHER_NEXT_LINE_SINGLE == type) ||
         (PREFETCHER_NEXT_LINE_TAGGED == type)) {
         cache->next_line = PREFETCHER_INVALID;
     }
 
-    /* unknown prefetcher type */
-    if (PREFETCHER_INVALID <= type) {
-        printf("Error: unknown prefetcher type\n");
+    /* disable the stride or the stream prefetcher (their data and counters
+     * are kept until the cache is finalized)
+     */
+    if (NULL != cache->prefetch_data) {
+        if (PREFETCHER_STRIDE == type) {
+            cache->prefetch_data->stride = 0;
+        }
+        if (PREFETCHER_STREAM == type) {
+            cache->prefetch_data->stream = 0;
+        }
+    }
+
+    print_prefetchers(cache);
+
+    return CACHE_SIM_SUCCESS;
+}
+
+/* cache_sim_prefetcher_configure */
+int cache_sim_prefetcher_configure(cache_handle_t *cache, const int degree,
+    const int distance, const uint64_t latency) {
+    /* variables declaration */
+    prefetch_data_t *data = NULL;
+
+    /* sanity check: does cache exist? */
+    if (NULL == cache) {
+        printf("Error: cache does not exists\n");
         return CACHE_SIM_ERROR;
     }
 
+    /* sanity check: degree and distance */
+    if ((1 > degree) || (1 > distance)) {
+        printf("Error: prefetch degree and distance should be at least 1\n");
+        return CACHE_SIM_ERROR;
+    }
+
+    if (NULL == (data = prefetch_data_get(cache))) {
+        return CACHE_SIM_ERROR;
+    }
+
+    data->degree   = degree;
+    data->distance = distance;
+    data->latency  = latency;
+
     /* be nice and print something... */
     printf("--------------------------------\n");
-    printf("Next line prefetcher: %10s\n",
-        (PREFETCHER_INVALID == cache->next_line) ? "OFF" :
-            ((PREFETCHER_NEXT_LINE_SINGLE == cache->next_line) ? "SINGLE" :
-                (PREFETCHER_NEXT_LINE_TAGGED == cache->next_line) ? "TAGGED" :
-                    "UNKNOWN"));
-    printf("      Hardware prefetcher       \n");
+    printf("Prefetch degree:   %13d\n", data->degree);
+    printf("Prefetch distance: %13d\n", data->distance);
+    printf("Prefetch latency:  %13"PRIu64"\n", data->latency);
+    printf("     Prefetcher configured      \n");
     printf("--------------------------------\n");
 
     return CACHE_SIM_SUCCESS;
 }
 
+/* cache_sim_prefetcher_issue: load a line into the cache on behalf of a
+ * prefetcher (the caller counts it for the prefetcher that issued it)
+ */
+void cache_sim_prefetcher_issue(cache_handle_t *cache, const uint64_t line_id) {
+    /* variables declaration */
+    int rc = cache->access_fn(cache, line_id, LOAD_PREFETCH);
+    inflight_entry_t *entry = NULL;
+
+    /* if the prefetch evicts a prefetched line */
+    if ((CACHE_SIM_L1_MISS + CACHE_SIM_L1_PREFETCH_EVICT) == rc) {
+        /* increment prefetched evicted lines counter */
+        cache->prefetcher_evict++;
+    }
+
+    if (CACHE_SIM_L1_MISS & rc) {
+        cache_sim_hierarchy_load(cache, line_id);
+
+        /* increment prefetched lines counter */
+        cache->prefetcher_fill++;
+
+        /* remember when it was issued to check if it arrives in time */
+        if ((NULL != cache->prefetch_data) &&
+            (0 < cache->prefetch_data->latency)) {
+            entry = &(cache->prefetch_data->inflight[(line_id >>
+                cache->offset_length) % PREFETCHER_INFLIGHT_ENTRIES]);
+            entry->line_id = line_id;
+            entry->time = cache->access;
+        }
+    }
+
+    #ifdef DEBUG
+    printf("PREFET line id [%018p]\n", line_id);
+    #endif
+}
+
+/* cache_sim_prefetcher_hit: first access to a prefetched line, check if the
+ * prefetch had time to complete
+ */
+void cache_sim_prefetcher_hit(cache_handle_t *cache, const uint64_t line_id) {
+    /* variables declaration */
+    inflight_entry_t *entry = &(cache->prefetch_data->inflight[(line_id >>
+        cache->offset_length) % PREFETCHER_INFLIGHT_ENTRIES]);
+
+    if (line_id == entry->line_id) {
+        if ((cache->access - entry->time) < cache->prefetch_data->latency) {
+            /* increment late prefetches counter */
+            cache->prefetcher_late++;
+        }
+        entry->line_id = UINT64_MAX;
+    }
+}
+
+/* stride_train: learn the stride of this PC and prefetch along it */
+static void stride_train(cache_handle_t *cache, prefetch_data_t *data,
+    const uint64_t address, const uint64_t pc) {
+    /* variables declaration */
+    stride_entry_t *entry = &(data->stride_table[((pc *
+        0x9e3779b97f4a7c15ULL) >> 32) % PREFETCHER_STRIDE_ENTRIES]);
+    uint64_t last = entry->last;
+    int64_t stride = 0, step = 0;
+    int i = 0;
+
+    /* a new PC (or one that replaces another one) */
+    if (pc != entry->pc) {
+        entry->pc = pc;
+        entry->last = address;
+        entry->stride = 0;
+        entry->confidence = 0;
+        return;
+    }
+
+    entry->last = address;
+    if (0 == (stride = (int64_t)(address - last))) {
+        return;
+    }
+
+    /* the same stride again is more confidence on it, otherwise forget it
+     * only once the confidence is gone
+     */
+    if (stride == entry->stride) {
+        if (3 > entry->confidence) {
+            entry->confidence++;
+        }
+    } else if (0 < entry->confidence) {
+        entry->confidence--;
+    } else {
+        entry->stride = stride;
+    }
+
+    /* prefetch only when confident and when the access moves to a new line */
+    if ((2 > entry->confidence) ||
+        ((address >> cache->offset_length) == (last >> cache->offset_length))) {
+        return;
+    }
+
+    /* strides shorter than a line prefetch the next lines */
+    step = entry->stride;
+    if ((step > 0) && (step < (int64_t) cache->line_size)) {
+        step = (int64_t) cache->line_size;
+    }
+    if ((step < 0) && (step > -(int64_t) cache->line_size)) {
+        step = -(int64_t) cache->line_size;
+    }
+
+    for (i = 0; i < data->degree; i++) {
+        cache_sim_prefetcher_issue(cache, ((address + (uint64_t)(step *
+            (data->distance + i))) >> cache->offset_length) <<
+                cache->offset_length);
+        cache->prefetcher_stride++;
+    }
+}
+
+/* stream_train: follow the sequential streams of misses and prefetch ahead
+ * of them
+ */
+static void stream_train(cache_handle_t *cache, prefetch_data_t *data,
+    const uint64_t address) {
+    /* variables declaration */
+    stream_entry_t *entry = NULL, *victim = &(data->stream_table[0]);
+    uint64_t line = address >> cache->offset_length, gap = 0, best = UINT64_MAX;
+    int i = 0, direction = 0;
+
+    /* find the closest stream to this line (and the LRU one, just in case) */
+    for (i = 0; i < PREFETCHER_STREAM_ENTRIES; i++) {
+        if (UINT64_MAX != data->stream_table[i].last) {
+            gap = (line > data->stream_table[i].last) ?
+                (line - data->stream_table[i].last) :
+                (data->stream_table[i].last - line);
+            if ((PREFETCHER_STREAM_WINDOW >= gap) && (best > gap)) {
+                entry = &(data->stream_table[i]);
+                best = gap;
+            }
+        }
+        if (data->stream_table[i].age < victim->age) {
+            victim = &(data->stream_table[i]);
+        }
+    }
+
+    /* start a new stream */
+    if (NULL == entry) {
+        victim->last = line;
+        victim->age = cache->access;
+        victim->direction = 0;
+        victim->confidence = 0;
+        return;
+    }
+
+    entry->age = cache->access;
+    if (0 == best) {
+        return;
+    }
+
+    /* the same direction again is more confidence on the stream */
+    direction = (line > entry->last) ? 1 : -1;
+    if (direction == entry->direction) {
+        if (3 > entry->confidence) {
+            entry->confidence++;
+        }
+    } else {
+        entry->direction = direction;
+        entry->confidence = 1;
+    }
+    entry->last = line;
+
+    if (2 > entry->confidence) {
+        return;
+    }
+
+    for (i = 0; i < data->degree; i++) {
+        cache_sim_prefetcher_issue(cache, (line + (uint64_t)(direction *
+            (data->distance + i))) << cache->offset_length);
+        cache->prefetcher_stream++;
+    }
+}
+
+/* cache_sim_prefetcher_train: let the stride prefetcher see every access and
+ * the stream prefetcher see the misses (and the first hits on prefetched
+ * lines, otherwise a stream would stop as soon as it is covered)
+ */
+void cache_sim_prefetcher_train(cache_handle_t *cache, const uint64_t address,
+    const uint64_t pc, const int rc) {
+    /* variables declaration */
+    prefetch_data_t *data = cache->prefetch_data;
+
+    if (data->stride) {
+        stride_train(cache, data, address, pc);
+    }
+
+    if (data->stream &&
+        ((CACHE_SIM_L1_MISS & rc) || (CACHE_SIM_L1_HIT_PREFETCH & rc))) {
+        stream_train(cache, data, address);
+    }
+}
+
 // EOF
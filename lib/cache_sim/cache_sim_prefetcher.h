@@ -30,9 +30,23 @@ extern "C" {
 #include "cache_sim.h"
 #endif
 
+#ifndef CACHE_SIM_TYPES_H_
+#include "cache_sim_types.h"
+#endif
+
+#ifndef _STDINT_H
+#include <stdint.h>
+#endif
+
 /* Functions declaration */
 int cache_sim_prefetcher_enable(cache_handle_t *cache, prefetcher_t type);
 int cache_sim_prefetcher_disable(cache_handle_t *cache, prefetcher_t type);
+int cache_sim_prefetcher_configure(cache_handle_t *cache, const int degree,
+    const int distance, const uint64_t latency);
+void cache_sim_prefetcher_issue(cache_handle_t *cache, const uint64_t line_id);
+void cache_sim_prefetcher_hit(cache_handle_t *cache, const uint64_t line_id);
+void cache_sim_prefetcher_train(cache_handle_t *cache, const uint64_t address,
+    const uint64_t pc, const int rc);
 
 #ifdef __cplusplus
 }
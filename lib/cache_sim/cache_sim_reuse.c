@@ -23,6 +23,7 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 /* Cache simulator headers */
 #include "cache_sim.h"
@@ -30,6 +31,190 @@
 #include "cache_sim_util.h"
 #include "cache_sim_reuse.h"
 
+/* Smallest number of timestamps and hash table entries */
+#define REUSE_MIN_SIZE 1024
+
+/* reuse_hash */
+static inline uint64_t reuse_hash(const reuse_data_t *reuse,
+    const uint64_t line_id) {
+    return (line_id * 0x9e3779b97f4a7c15ULL) >> reuse->hash_shift;
+}
+
+/* reuse_find: entry holding a line or the empty entry where it would go */
+static inline uint64_t reuse_find(const reuse_data_t *reuse,
+    const uint64_t line_id) {
+    uint64_t mask = reuse->table_size - 1;
+    uint64_t slot = reuse_hash(reuse, line_id);
+
+    while ((UINT64_MAX != reuse->table[slot].line_id) &&
+        (line_id != reuse->table[slot].line_id)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/* reuse_erase: empty an entry, moving back the entries that follow it in the
+ * same probe sequence so that lookups never need tombstones
+ */
+static void reuse_erase(reuse_data_t *reuse, uint64_t slot) {
+    uint64_t mask = reuse->table_size - 1;
+    uint64_t next = (slot + 1) & mask;
+    uint64_t home = 0;
+
+    while (UINT64_MAX != reuse->table[next].line_id) {
+        home = reuse_hash(reuse, reuse->table[next].line_id);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            reuse->table[slot] = reuse->table[next];
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+
+    reuse->table[slot].line_id = UINT64_MAX;
+}
+
+/* reuse_alloc_table: allocate an empty hash table with 'size' entries */
+static int reuse_alloc_table(reuse_data_t *reuse, const uint64_t size) {
+    uint64_t i = 0;
+
+    reuse->table = malloc(size * sizeof(reuse_entry_t));
+    if (NULL == reuse->table) {
+        return CACHE_SIM_ERROR;
+    }
+
+    for (i = 0; i < size; i++) {
+        reuse->table[i].line_id = UINT64_MAX;
+    }
+
+    reuse->table_size = size;
+    for (reuse->hash_shift = 64; 1 < i; i >>= 1) {
+        reuse->hash_shift--;
+    }
+
+    return CACHE_SIM_SUCCESS;
+}
+
+/* reuse_grow_table: double the hash table (unlimited reuse only) */
+static int reuse_grow_table(reuse_data_t *reuse) {
+    reuse_entry_t *old_table = reuse->table;
+    uint64_t old_size = reuse->table_size;
+    uint64_t i = 0;
+
+    if (CACHE_SIM_SUCCESS != reuse_alloc_table(reuse, 2 * old_size)) {
+        reuse->table = old_table;
+        reuse->table_size = old_size;
+        return CACHE_SIM_ERROR;
+    }
+
+    for (i = 0; i < old_size; i++) {
+        if (UINT64_MAX != old_table[i].line_id) {
+            reuse->table[reuse_find(reuse, old_table[i].line_id)] =
+                old_table[i];
+        }
+    }
+    free(old_table);
+
+    return CACHE_SIM_SUCCESS;
+}
+
+/* fenwick_update: add 'delta' to the count at 'timestamp' */
+static inline void fenwick_update(reuse_data_t *reuse, uint64_t timestamp,
+    const uint64_t delta) {
+    for (timestamp++; timestamp <= reuse->capacity;
+        timestamp += timestamp & -timestamp) {
+        reuse->fenwick[timestamp - 1] += delta;
+    }
+}
+
+/* fenwick_sum: number of lines last accessed in [0, timestamp] */
+static inline uint64_t fenwick_sum(const reuse_data_t *reuse,
+    uint64_t timestamp) {
+    uint64_t sum = 0;
+
+    for (timestamp++; 0 < timestamp; timestamp -= timestamp & -timestamp) {
+        sum += reuse->fenwick[timestamp - 1];
+    }
+
+    return sum;
+}
+
+/* fenwick_first: timestamp of the least recently used line */
+static inline uint64_t fenwick_first(const reuse_data_t *reuse) {
+    uint64_t pos = 0, step = reuse->capacity;
+
+    /* find the longest prefix that sums to zero */
+    for (; 0 < step; step >>= 1) {
+        if (0 == reuse->fenwick[pos + step - 1]) {
+            pos += step;
+        }
+    }
+
+    return pos;
+}
+
+/* reuse_compact: renumber the live timestamps from zero and rebuild the tree,
+ * growing it if more than half of it would be in use (unlimited reuse only)
+ */
+static int reuse_compact(reuse_data_t *reuse) {
+    uint64_t old = 0, now = 0, i = 0, parent = 0;
+    uint64_t *ptr = NULL;
+
+    /* timestamps keep their order, so no sorting is needed */
+    for (old = 0; old < reuse->clock; old++) {
+        if (UINT64_MAX == reuse->owner[old]) {
+            continue;
+        }
+        reuse->table[reuse_find(reuse, reuse->owner[old])].timestamp = now;
+        reuse->owner[now++] = reuse->owner[old];
+    }
+    reuse->clock = now;
+
+    if ((2 * reuse->live) > reuse->capacity) {
+        ptr = realloc(reuse->fenwick, 2 * reuse->capacity * sizeof(uint64_t));
+        if (NULL == ptr) {
+            return CACHE_SIM_ERROR;
+        }
+        reuse->fenwick = ptr;
+
+        ptr = realloc(reuse->owner, 2 * reuse->capacity * sizeof(uint64_t));
+        if (NULL == ptr) {
+            return CACHE_SIM_ERROR;
+        }
+        reuse->owner = ptr;
+
+        reuse->capacity *= 2;
+    }
+
+    for (i = now; i < reuse->capacity; i++) {
+        reuse->owner[i] = UINT64_MAX;
+    }
+
+    /* build the tree in linear time */
+    memset(reuse->fenwick, 0, reuse->capacity * sizeof(uint64_t));
+    for (i = 1; i <= reuse->capacity; i++) {
+        if (i <= now) {
+            reuse->fenwick[i - 1]++;
+        }
+        parent = i + (i & -i);
+        if (parent <= reuse->capacity) {
+            reuse->fenwick[parent - 1] += reuse->fenwick[i - 1];
+        }
+    }
+
+    return CACHE_SIM_SUCCESS;
+}
+
+/* reuse_evict: stop tracking the least recently used line */
+static void reuse_evict(reuse_data_t *reuse) {
+    uint64_t timestamp = fenwick_first(reuse);
+
+    reuse_erase(reuse, reuse_find(reuse, reuse->owner[timestamp]));
+    reuse->owner[timestamp] = UINT64_MAX;
+    fenwick_update(reuse, timestamp, (uint64_t)-1);
+    reuse->live--;
+}
+
 /* cache_sim_reuse_enable */
 int cache_sim_reuse_enable(cache_handle_t *cache, const uint64_t limit) {
     /* sanity check: does cache exist? */
@@ -54,78 +239,55 @@ int cache_sim_reuse_enable(cache_handle_t *cache, const uint64_t limit) {
         }
     }
 
-    /* sanity check: limit higher than zero */
-    if (0 >= limit) {
-        printf("Error: limit is smaller than 1\n");
+    /* variables declaration */
+    reuse_data_t *reuse = NULL;
+    uint64_t size = REUSE_MIN_SIZE;
+
+    /* allocate memory for reuse data area */
+    reuse = malloc(sizeof(reuse_data_t));
+    if (NULL == reuse) {
+        printf("Error: unable to allocate memory to reuse distance area\n");
         return CACHE_SIM_ERROR;
     }
+    bzero(reuse, sizeof(reuse_data_t));
+    reuse->limit = limit;
+
+    /* with a limit, the table stays at most half full and the clock runs for
+     * at least 'limit' accesses between compactions
+     */
+    while ((0 < limit) && (size < (2 * limit))) {
+        size *= 2;
+    }
 
-    /* variables declaration */
-    list_item_reuse_t *item = NULL;
-    list_t *list = NULL;
-    int i = 0;
+    reuse->capacity = size;
+    reuse->fenwick = malloc(size * sizeof(uint64_t));
+    reuse->owner = malloc(size * sizeof(uint64_t));
+    if ((NULL == reuse->fenwick) || (NULL == reuse->owner) ||
+        (CACHE_SIM_SUCCESS != reuse_alloc_table(reuse, size))) {
+        printf("Error: unable to allocate memory to reuse distance area\n");
+        free(reuse->fenwick);
+        free(reuse->owner);
+        free(reuse);
+        return CACHE_SIM_ERROR;
+    }
+    memset(reuse->fenwick, 0, size * sizeof(uint64_t));
+    memset(reuse->owner, 0xff, size * sizeof(uint64_t));
 
-    /* set reuse limit */
+    /* set reuse limit and function */
+    cache->reuse_data  = reuse;
     cache->reuse_limit = limit;
+    cache->reuse_fn    = &cache_sim_reuse_update;
 
-    /* allocate memory for reuse data area acording to reuse limit */
-    if (0 == cache->reuse_limit) {
-        /* for unlimited reuse distance */
-        cache->reuse_data = malloc(sizeof(list_t));
-        if (NULL == cache->reuse_data) {
-            printf("unable to allocate memory to calculate reuse distance\n");
-            return CACHE_SIM_ERROR;
-        }
-
-        /* initialize the list */
-        list = cache->reuse_data;
-        list->head.next = &(list->head);
-        list->head.prev = &(list->head);
-        list->len = 0;
-
-        /* set the reuse distance function */
-        cache->reuse_fn = &cache_sim_reuse_unlimited;
-
-        printf("--------------------------------\n");
-        printf("      Reuse distance is ON      \n");
+    printf("--------------------------------\n");
+    printf("      Reuse distance is ON      \n");
+    if (0 == limit) {
         printf("Reuse limit:           unlimited\n");
-        printf("Memory required: %d bytes +%d/l\n", sizeof(list_t),
-            sizeof(list_item_t));
-        printf("--------------------------------\n");
     } else {
-        /* for a particular reuse distance limit */
-        cache->reuse_data = malloc(sizeof(list_t) +
-            (cache->reuse_limit * sizeof(list_item_reuse_t)));
-        if (NULL == cache->reuse_data) {
-            printf("Error: unable to allocate memory to reuse distance area\n");
-            return CACHE_SIM_ERROR;
-        }
-
-        /* initialize the list */
-        list = cache->reuse_data;
-        list->head.next = &(list->head);
-        list->head.prev = &(list->head);
-        list->len = 0;
-
-        /* set the reuse distance function */
-        cache->reuse_fn = &cache_sim_reuse_limited;
-
-        /* initialize list elements */
-        item = (list_item_reuse_t *)((uint64_t)cache->reuse_data + sizeof(list_t));
-        for (i = 0; i < cache->reuse_limit; i++) {
-            list_prepend_item((list_t *)(cache->reuse_data), (list_item_t *)item);
-            item->line_id = UINT64_MAX;
-            item->age = UINT16_MAX;
-            item++;
-        }
-
-        printf("--------------------------------\n");
-        printf("      Reuse distance is ON      \n");
         printf("Reuse limit:     %15"PRIu64"\n", cache->reuse_limit);
-        printf("Memory required: %9d bytes\n", sizeof(list_t) +
-            (cache->reuse_limit * sizeof(list_item_reuse_t)));
-        printf("--------------------------------\n");
     }
+    printf("Memory required: %9d bytes\n", (int)(sizeof(reuse_data_t) +
+        (size * ((2 * sizeof(uint64_t)) + sizeof(reuse_entry_t)))));
+    printf("--------------------------------\n");
 
     return CACHE_SIM_SUCCESS;
 }
@@ -144,137 +306,99 @@ int cache_sim_reuse_disable(cache_handle_t *cache) {
         return CACHE_SIM_ERROR;
     }
 
-    /* variables declaration */
-    // list_item_t *item;
-
     printf("--------------------------------\n");
-    // for (item = (list_item_t *)((list_t *)cache->reuse_data)->head.next;
-    //     item != &(((list_t *)cache->reuse_data)->head);
-    //     item = (list_item_t *)item->next) {
-    //     printf("Line: %018p, Distance: %"PRIu64"\n", item->line_id, item->age);
-    // }
-    printf(" (print something nice here...) \n");
+    printf("Tracked lines:   %15"PRIu64"\n", cache->reuse_data->live);
     printf("      Reuse distance is OFF     \n");
     printf("--------------------------------\n");
 
-    // TODO: free the list elements when reuse distance is unlimited
+    /* free everything */
+    free(cache->reuse_data->fenwick);
+    free(cache->reuse_data->owner);
+    free(cache->reuse_data->table);
     free(cache->reuse_data);
 
+    cache->reuse_data  = NULL;
+    cache->reuse_limit = 0;
+    cache->reuse_fn    = NULL;
+
     return CACHE_SIM_SUCCESS;
 }
 
-/* cache_sim_reuse_limited */
-int cache_sim_reuse_limited(cache_handle_t *cache, const uint64_t line_id) {
-    /* variable declarations */
-    static list_item_reuse_t *item = NULL;
-
-    /* for all elements in the list of lines... */
-    for (item = (list_item_reuse_t *)((list_t *)cache->reuse_data)->head.next;
-        (void *)item != (void *)&(((list_t *)cache->reuse_data)->head);
-        item = (list_item_reuse_t *)item->next) {
-        /* ...if we find the line... */
-        if (line_id == item->line_id) {
-            /* ...report it... */
-            #ifdef DEBUG
-            printf("REUSE  line id [%018p] reuse distance [%"PRIu64"]\n",
-                item->line_id, item->age);
-            #endif
-
-            /* ...move the line to the top of the list... */
-            list_movetop_item((list_t *)cache->reuse_data, (list_item_t *)item);
-
-            /* ...set the line's age to zero */
-            item->age = 0;
-
-            return CACHE_SIM_SUCCESS;
+/* cache_sim_reuse_update */
+uint64_t cache_sim_reuse_update(cache_handle_t *cache, const uint64_t line_id) {
+    /* variables declaration and initialization */
+    reuse_data_t *reuse = cache->reuse_data;
+    uint64_t distance = UINT64_MAX;
+    uint64_t slot = 0;
+
+    /* out of timestamps? */
+    if (reuse->clock == reuse->capacity) {
+        if (CACHE_SIM_SUCCESS != reuse_compact(reuse)) {
+            return UINT64_MAX;
         }
-
-        /* increment age for every line above the line we are looking for */
-        item->age++;
     }
 
-    /* if the line was not found take the last one and move it up to the top */
-    item = (list_item_reuse_t *)((list_t *)cache->reuse_data)->head.prev;
-    list_movetop_item((list_t *)cache->reuse_data, (list_item_t *)item);
-    item->line_id = line_id;
-    item->age = 0;
+    slot = reuse_find(reuse, line_id);
+    if (line_id == reuse->table[slot].line_id) {
+        /* lines accessed after the last access to this one */
+        distance = reuse->live - fenwick_sum(reuse,
+            reuse->table[slot].timestamp);
 
-    #ifdef DEBUG
-    printf("USE    line id [%018p]\n", item->line_id);
-    #endif
+        #ifdef DEBUG
+        printf("REUSE  line id [%018p] reuse distance [%"PRIu64"]\n",
+            line_id, distance);
+        #endif
 
-    return CACHE_SIM_SUCCESS;
-}
-
-/* cache_sim_reuse_unlimited */
-int cache_sim_reuse_unlimited(cache_handle_t *cache, const uint64_t line_id) {
-    /* variables declaration */
-    static list_item_reuse_t *item = NULL;
-
-    /* for all elements in the list of lines... */
-    for (item = (list_item_reuse_t *)((list_t *)cache->reuse_data)->head.next;
-        (void *)item != (void *)&(((list_t *)cache->reuse_data)->head);
-        item = (list_item_reuse_t *)item->next) {
-        /* ...if we find the line... */
-        if (line_id == item->line_id) {
-            /* ...report it... */
-            #ifdef DEBUG
-            printf("REUSE  line id [%018p] reuse distance [%"PRIu64"]\n",
-                item->line_id, item->age);
-            #endif
-
-            /* ...move the line to the top of the list... */
-            list_movetop_item((list_t *)cache->reuse_data, (list_item_t *)item);
-
-            /* ...set the line's age to zero */
-            item->age = 0;
-
-            return CACHE_SIM_SUCCESS;
+        /* forget the previous access */
+        fenwick_update(reuse, reuse->table[slot].timestamp, (uint64_t)-1);
+        reuse->owner[reuse->table[slot].timestamp] = UINT64_MAX;
+    } else {
+        #ifdef DEBUG
+        printf("USE    line id [%018p]\n", line_id);
+        #endif
+
+        /* make room for the new line */
+        if ((0 < reuse->limit) && (reuse->live == reuse->limit)) {
+            reuse_evict(reuse);
+            slot = reuse_find(reuse, line_id);
+        } else if ((0 == reuse->limit) &&
+            ((2 * (reuse->live + 1)) > reuse->table_size)) {
+            if (CACHE_SIM_SUCCESS != reuse_grow_table(reuse)) {
+                return UINT64_MAX;
+            }
+            slot = reuse_find(reuse, line_id);
         }
 
-        /* increment age for every line above the line we are looking for */
-        item->age++;
+        reuse->table[slot].line_id = line_id;
+        reuse->live++;
     }
 
-    /* if the line was not found, add it to the list */
-    item = malloc(sizeof(list_item_reuse_t));
-    if (NULL == item) {
-        return CACHE_SIM_ERROR;
-    }
-    list_prepend_item((list_t *)cache->reuse_data, (list_item_t *)item);
-    item->line_id = line_id;
-    item->age = 0;
+    /* stamp this access */
+    reuse->table[slot].timestamp = reuse->clock;
+    reuse->owner[reuse->clock] = line_id;
+    fenwick_update(reuse, reuse->clock, 1);
+    reuse->clock++;
 
-    #ifdef DEBUG
-    printf("USE    line id [%018p]\n", item->line_id);
-    #endif
-
-    return CACHE_SIM_SUCCESS;
+    return distance;
 }
 
 /* cache_sim_reuse_get_age */
 uint64_t cache_sim_reuse_get_age(cache_handle_t *cache, const uint64_t line_id) {
     /* sanity check: does cache exist? */
-    if (NULL == cache) {
+    if ((NULL == cache) || (NULL == cache->reuse_data)) {
         printf("Error: cache does not exists\n");
-        return CACHE_SIM_ERROR;
+        return UINT64_MAX;
     }
 
-    /* variable declarations */
-    static list_item_reuse_t *item = NULL;
-
-    /* for all elements in the list of lines... */
-    for (item = (list_item_reuse_t *)((list_t *)cache->reuse_data)->head.next;
-        (void *)item != (void *)&(((list_t *)cache->reuse_data)->head);
-        item = (list_item_reuse_t *)item->next) {
-        /* ...if we find the line... */
-        if (line_id == item->line_id) {
-            /* ...report its age... */
-            return item->age;
-        }
+    /* variables declaration and initialization */
+    reuse_data_t *reuse = cache->reuse_data;
+    uint64_t slot = reuse_find(reuse, line_id);
+
+    if (line_id != reuse->table[slot].line_id) {
+        return UINT64_MAX;
     }
 
-    return UINT64_MAX;
+    return reuse->live - fenwick_sum(reuse, reuse->table[slot].timestamp);
 }
 
 // EOF
@@ -31,6 +31,181 @@
 #include "cache_sim_util.h"
 #include "cache_sim_symbol.h"
 
+/* Initial number of symbols and name hash table entries */
+#define SYMBOL_MIN_SIZE 64
+
+/* symbol_hash: FNV-1a */
+static inline uint64_t symbol_hash(const char *symbol) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    while ('\0' != *symbol) {
+        hash ^= (unsigned char)*symbol++;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/* symbol_find: entry holding a name or the empty entry where it would go */
+static int symbol_find(const symbol_data_t *data, const char *symbol) {
+    int mask = data->table_size - 1;
+    int slot = (int)(symbol_hash(symbol) & mask);
+
+    while ((-1 != data->table[slot]) &&
+        (0 != strcmp(symbol, data->names[data->table[slot]]))) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/* symbol_grow: double the arrays and the hash table */
+static int symbol_grow(symbol_data_t *data) {
+    /* variables declaration and initialization */
+    int size = 2 * data->table_size, i = 0;
+    symbol_stats_t *stats = NULL;
+    void *names = NULL;
+    int *table = NULL;
+
+    stats = realloc(data->stats, 2 * data->size * sizeof(symbol_stats_t));
+    if (NULL == stats) {
+        return CACHE_SIM_ERROR;
+    }
+    data->stats = stats;
+
+    names = realloc(data->names, 2 * data->size * CACHE_SIM_SYMBOL_MAX_LENGTH);
+    if (NULL == names) {
+        return CACHE_SIM_ERROR;
+    }
+    data->names = names;
+    data->size *= 2;
+
+    /* rehash the names */
+    if (NULL == (table = malloc(size * sizeof(int)))) {
+        return CACHE_SIM_ERROR;
+    }
+    free(data->table);
+    data->table = table;
+    data->table_size = size;
+
+    for (i = 0; i < size; i++) {
+        data->table[i] = -1;
+    }
+    for (i = 0; i < data->count; i++) {
+        data->table[symbol_find(data, data->names[i])] = i;
+    }
+
+    return CACHE_SIM_SUCCESS;
+}
+
+/* range_find: index of the last range that starts at or before 'address', or
+ * -1 if there is none
+ */
+static int range_find(const symbol_data_t *data, const uint64_t address) {
+    int low = 0, high = data->range_count - 1, middle = 0;
+
+    while (low <= high) {
+        middle = low + ((high - low) / 2);
+        if (data->ranges[middle].start <= address) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return high;
+}
+
+/* range_check: ranges must not overlap */
+static int range_check(const symbol_data_t *data, const uint64_t start,
+    const uint64_t end) {
+    int i = range_find(data, start);
+
+    if ((0 <= i) && (start < data->ranges[i].end)) {
+        printf("Error: address range overlaps with symbol [%s]\n",
+            data->names[data->ranges[i].symbol]);
+        return CACHE_SIM_ERROR;
+    }
+
+    if ((i + 1 < data->range_count) && (end > data->ranges[i + 1].start)) {
+        printf("Error: address range overlaps with symbol [%s]\n",
+            data->names[data->ranges[i + 1].symbol]);
+        return CACHE_SIM_ERROR;
+    }
+
+    return CACHE_SIM_SUCCESS;
+}
+
+/* range_add */
+static int range_add(symbol_data_t *data, const uint64_t start,
+    const uint64_t end, const int symbol) {
+    /* variables declaration and initialization */
+    symbol_range_t *ranges = NULL;
+    int i = range_find(data, start);
+
+    if (data->range_count == data->range_size) {
+        ranges = realloc(data->ranges, (0 == data->range_size ?
+            SYMBOL_MIN_SIZE : 2 * data->range_size) * sizeof(symbol_range_t));
+        if (NULL == ranges) {
+            printf("unable to allocate memory for symbol\n");
+            return CACHE_SIM_ERROR;
+        }
+        data->ranges = ranges;
+        data->range_size = (0 == data->range_size) ?
+            SYMBOL_MIN_SIZE : 2 * data->range_size;
+    }
+
+    /* keep the array sorted, registration is rare */
+    memmove(&(data->ranges[i + 2]), &(data->ranges[i + 1]),
+        (data->range_count - (i + 1)) * sizeof(symbol_range_t));
+    data->ranges[i + 1].start = start;
+    data->ranges[i + 1].end = end;
+    data->ranges[i + 1].symbol = symbol;
+    data->range_count++;
+    data->last_range = -1;
+
+    return CACHE_SIM_SUCCESS;
+}
+
+/* symbol_count */
+static inline void symbol_count(symbol_stats_t *stats, const int rc) {
+    switch (rc) {
+        /* hit on a prefetched line */
+        case CACHE_SIM_L1_HIT + CACHE_SIM_L1_HIT_PREFETCH: // fallover
+            /* increment prefetcher hits counter */
+            stats->prefetcher_hit++;
+        /* hit on a pre-loaded cache line */
+        case CACHE_SIM_L1_HIT:
+            /* increment hits counter */
+            stats->hit++;
+            break;
+
+        /* miss on a prefetched line that have never been accessed */
+        case CACHE_SIM_L1_MISS + CACHE_SIM_L1_PREFETCH_EVICT + CACHE_SIM_L1_MISS_CONFLICT: // fallover
+            /* increment conflicts counter */
+            stats->conflict++;
+        case CACHE_SIM_L1_MISS + CACHE_SIM_L1_PREFETCH_EVICT:
+            /* increment prefetched evicted lines counter */
+            stats->prefetcher_evict++;
+            /* increment misses counter */
+            stats->miss++;
+            break;
+
+        /* miss on a prefetched line that have never been accessed */
+        case CACHE_SIM_L1_MISS + CACHE_SIM_L1_MISS_CONFLICT: // fallover
+            /* increment conflicts counter */
+            stats->conflict++;
+        /* common miss */
+        case CACHE_SIM_L1_MISS:
+            /* increment misses counter */
+            stats->miss++;
+            break;
+    }
+
+    /* increment access counter */
+    stats->access++;
+}
+
 /* cache_sim_symbol_enable */
 int cache_sim_symbol_enable(cache_handle_t *cache) {
     /* sanity check: does cache exist? */
@@ -46,25 +221,42 @@ int cache_sim_symbol_enable(cache_handle_t *cache) {
     }
 
     /* variables declaration */
-    list_t *list = NULL;
+    symbol_data_t *data = NULL;
+    int i = 0;
 
     /* allocate memory for symbol tracking data area */
-    cache->symbol_data = malloc(sizeof(list_t));
-    if (NULL == cache->symbol_data) {
+    data = malloc(sizeof(symbol_data_t));
+    if (NULL == data) {
         printf("unable to allocate memory to track symbols\n");
         return CACHE_SIM_ERROR;
     }
+    bzero(data, sizeof(symbol_data_t));
 
-    /* initialize the list */
-    list = cache->symbol_data;
-    list->head.next = &(list->head);
-    list->head.prev = &(list->head);
-    list->len = 0;
+    data->size = SYMBOL_MIN_SIZE;
+    data->table_size = 2 * SYMBOL_MIN_SIZE;
+    data->last_range = -1;
+    data->stats = malloc(data->size * sizeof(symbol_stats_t));
+    data->names = malloc(data->size * CACHE_SIM_SYMBOL_MAX_LENGTH);
+    data->table = malloc(data->table_size * sizeof(int));
+    if ((NULL == data->stats) || (NULL == data->names) ||
+        (NULL == data->table)) {
+        printf("unable to allocate memory to track symbols\n");
+        free(data->stats);
+        free(data->names);
+        free(data->table);
+        free(data);
+        return CACHE_SIM_ERROR;
+    }
+
+    for (i = 0; i < data->table_size; i++) {
+        data->table[i] = -1;
+    }
+    cache->symbol_data = data;
 
     printf("--------------------------------\n");
     printf("     Symbols tracking is ON     \n");
-    printf("Memory required: %d bytes +%d/s\n", sizeof(list_t),
-        sizeof(list_item_symbol_t));
+    printf("Memory required: %d bytes +%d/s\n", (int)sizeof(symbol_data_t),
+        (int)(sizeof(symbol_stats_t) + CACHE_SIM_SYMBOL_MAX_LENGTH));
     printf("--------------------------------\n");
 
     return CACHE_SIM_SUCCESS;
@@ -85,13 +277,14 @@ int cache_sim_symbol_disable(cache_handle_t *cache) {
     }
 
     /* variables declaration */
-    list_item_symbol_t *item = NULL;
+    symbol_data_t *data = cache->symbol_data;
+    symbol_stats_t *item = NULL;
+    int i = 0;
 
     printf("--------------------------------\n");
-    for (item = (list_item_symbol_t *)((list_t *)cache->symbol_data)->head.next;
-        (void *)item != (void *)&(((list_t *)cache->symbol_data)->head);
-        item = (list_item_symbol_t *)item->next) {
-        printf("Symbol: %24s\n", item->symbol ? item->symbol : "(null)");
+    for (i = 0; i < data->count; i++) {
+        item = &(data->stats[i]);
+        printf("Symbol: %24s\n", data->names[i]);
         printf("Cache accesses: %16"PRIu64"\n", item->access);
         printf("Cache hits:     %16"PRIu64"\n", item->hit);
         printf(" -> symbol hit rate  %10.2f%%\n",
@@ -113,104 +306,137 @@ int cache_sim_symbol_disable(cache_handle_t *cache) {
     printf("     Symbols tracking is OFF    \n");
     printf("--------------------------------\n");
 
-    // TODO: free the list elements
-    free(cache->symbol_data);
+    /* free everything */
+    free(data->stats);
+    free(data->names);
+    free(data->table);
+    free(data->ranges);
+    free(data);
+    cache->symbol_data = NULL;
 
     return CACHE_SIM_SUCCESS;
 }
 
-/* cache_sim_symbol_access */
-int cache_sim_symbol_access(cache_handle_t *cache, const uint64_t address,
-    const char *symbol) {
+/* cache_sim_symbol_register */
+int cache_sim_symbol_register(cache_handle_t *cache, const char *symbol,
+    const uint64_t address, const uint64_t size) {
     /* sanity check: is symbols tracking enabled? */
     if (NULL == cache->symbol_data) {
         if (CACHE_SIM_SUCCESS != cache_sim_symbol_enable(cache)) {
             printf("Error: unable to enable symbols tracking\n");
-            return CACHE_SIM_ERROR;
+            return -1;
         }
     }
 
-    /* variable declarations */
-    static int rc = CACHE_SIM_ERROR;
-    list_item_symbol_t *item = NULL;
-
-    /* for all elements in the list of symbols... */
-    for (item = (list_item_symbol_t *)((list_t *)cache->symbol_data)->head.next;
-        (void *)item != (void *)&(((list_t *)cache->symbol_data)->head);
-        item = (list_item_symbol_t *)item->next) {
-        /* ...if we find the symbol, stop */
-        if (0 == strcmp(symbol, item->symbol)) {
-            break;
-        }
-    }
+    /* variables declaration */
+    symbol_data_t *data = cache->symbol_data;
+    char name[CACHE_SIM_SYMBOL_MAX_LENGTH];
+    int slot = 0;
+    int id = -1;
 
-    /* if symbol was not found allocate memory and add it to the list */
-    if (&(((list_t *)(cache->symbol_data))->head) == (list_item_t *)item) {
-        /* allocate memory for symbol item */
-        item = malloc(sizeof(list_item_symbol_t));
-        if (NULL == item) {
-            printf("unable to allocate memory for symbol\n");
-            return CACHE_SIM_ERROR;
-        }
+    /* check the address range before registering anything */
+    if ((0 < size) &&
+        (CACHE_SIM_SUCCESS != range_check(data, address, address + size))) {
+        return -1;
+    }
 
-        /* initialize item */
-        bzero(item->symbol, CACHE_SIM_SYMBOL_MAX_LENGTH);
-        item->access   = 0;
-        item->hit      = 0;
-        item->miss     = 0;
-        item->conflict = 0;
+    /* names are kept (and compared) truncated */
+    strncpy(name, symbol, (CACHE_SIM_SYMBOL_MAX_LENGTH - 1));
+    name[CACHE_SIM_SYMBOL_MAX_LENGTH - 1] = '\0';
 
-        /* copy the symbol name */
-        if (CACHE_SIM_SYMBOL_MAX_LENGTH > (strlen(symbol) + 1)) {
-            strcpy(item->symbol, symbol);
-        } else {
-            strncpy(item->symbol, symbol, (CACHE_SIM_SYMBOL_MAX_LENGTH - 1));
+    /* if symbol was not found add it */
+    slot = symbol_find(data, name);
+    if (-1 == (id = data->table[slot])) {
+        if (((2 * (data->count + 1)) > data->table_size) ||
+            (data->count == data->size)) {
+            if (CACHE_SIM_SUCCESS != symbol_grow(data)) {
+                printf("unable to allocate memory for symbol\n");
+                return -1;
+            }
+            slot = symbol_find(data, name);
         }
 
-        /* add the symbol to the list */
-        list_prepend_item((list_t *)cache->symbol_data, (list_item_t *)item);
+        id = data->count++;
+        data->table[slot] = id;
+        strcpy(data->names[id], name);
+        bzero(&(data->stats[id]), sizeof(symbol_stats_t));
 
         #ifdef DEBUG
-        printf("SYMBOL found [%s]\n", item->symbol);
+        printf("SYMBOL found [%s] id [%d]\n", name, id);
         #endif
     }
 
-    /* call the real access function and increment hit/miss counter */
-    switch (rc = cache_sim_access(cache, address)) {
-        /* hit on a prefetched line */
-        case CACHE_SIM_L1_HIT + CACHE_SIM_L1_HIT_PREFETCH: // fallover
-            /* increment prefetcher hits counter */
-            item->prefetcher_hit++;
-        /* hit on a pre-loaded cache line */
-        case CACHE_SIM_L1_HIT:
-            /* increment hits counter */
-            item->hit++;
-            break;
+    /* index its address range */
+    if ((0 < size) &&
+        (CACHE_SIM_SUCCESS != range_add(data, address, address + size, id))) {
+        return -1;
+    }
 
-        /* miss on a prefetched line that have never been accessed */
-        case CACHE_SIM_L1_MISS + CACHE_SIM_L1_PREFETCH_EVICT + CACHE_SIM_L1_MISS_CONFLICT: // fallover
-            /* increment conflicts counter */
-            item->conflict++;
-        case CACHE_SIM_L1_MISS + CACHE_SIM_L1_PREFETCH_EVICT:
-            /* increment prefetched evicted lines counter */
-            item->prefetcher_evict++;
-            /* increment misses counter */
-            item->miss++;
-            break;
+    return id;
+}
 
-        /* miss on a prefetched line that have never been accessed */
-        case CACHE_SIM_L1_MISS + CACHE_SIM_L1_MISS_CONFLICT: // fallover
-            /* increment conflicts counter */
-            item->conflict++;
-        /* common miss */
-        case CACHE_SIM_L1_MISS:
-            /* increment misses counter */
-            item->miss++;
-            break;
+/* cache_sim_symbol_access */
+int cache_sim_symbol_access(cache_handle_t *cache, const uint64_t address,
+    const char *symbol) {
+    /* variable declarations */
+    int id = cache_sim_symbol_register(cache, symbol, 0, 0);
+
+    if (0 > id) {
+        return CACHE_SIM_ERROR;
     }
 
-    /* increment access counter */
-    item->access++;
+    return cache_sim_symbol_access_id(cache, address, CACHE_SIM_READ, id);
+}
+
+/* cache_sim_symbol_access_id */
+int cache_sim_symbol_access_id(cache_handle_t *cache, const uint64_t address,
+    const int type, const int symbol) {
+    /* sanity check: is it a registered symbol? */
+    if ((NULL == cache->symbol_data) || (0 > symbol) ||
+        (cache->symbol_data->count <= symbol)) {
+        printf("Error: unknown symbol [%d]\n", symbol);
+        return CACHE_SIM_ERROR;
+    }
+
+    /* variable declarations (the stride prefetcher tracks each symbol as if
+     * it was a PC)
+     */
+    int rc = cache_sim_access_pc(cache, address, type, (uint64_t)symbol);
+
+    symbol_count(&(cache->symbol_data->stats[symbol]), rc);
+
+    return rc;
+}
+
+/* cache_sim_symbol_access_range */
+int cache_sim_symbol_access_range(cache_handle_t *cache,
+    const uint64_t address, const int type) {
+    /* variable declarations */
+    symbol_data_t *data = cache->symbol_data;
+    symbol_range_t *range = NULL;
+    int rc = CACHE_SIM_ERROR, i = -1;
+
+    /* find the symbol, trying the last range found first */
+    if (NULL != data) {
+        i = data->last_range;
+        if ((0 > i) || (address < data->ranges[i].start) ||
+            (address >= data->ranges[i].end)) {
+            i = range_find(data, address);
+        }
+        if ((0 <= i) && (address < data->ranges[i].end)) {
+            range = &(data->ranges[i]);
+            data->last_range = i;
+        }
+    }
+
+    /* addresses out of any symbol are not counted */
+    if (NULL == range) {
+        return cache_sim_access_type(cache, address, type);
+    }
+
+    /* call the real access function and count it for the symbol */
+    rc = cache_sim_access_pc(cache, address, type, (uint64_t)range->symbol);
+    symbol_count(&(data->stats[range->symbol]), rc);
 
     return rc;
 }
@@ -37,8 +37,14 @@ extern "C" {
 /* Functions declaration */
 int cache_sim_symbol_enable(cache_handle_t *cache);
 int cache_sim_symbol_disable(cache_handle_t *cache);
+int cache_sim_symbol_register(cache_handle_t *cache, const char *symbol,
+    const uint64_t address, const uint64_t size);
 int cache_sim_symbol_access(cache_handle_t *cache, const uint64_t address,
     const char *symbol);
+int cache_sim_symbol_access_id(cache_handle_t *cache, const uint64_t address,
+    const int type, const int symbol);
+int cache_sim_symbol_access_range(cache_handle_t *cache,
+    const uint64_t address, const int type);
 
 #ifdef __cplusplus
 }
@@ -51,31 +51,71 @@ typedef struct list {
     volatile uint32_t len;
 } list_t;
 
-/* Type declaration: reuse list item (64 bytes) */
+/* Type declaration: reuse hash table entry (16 bytes) */
 typedef struct {
-    volatile list_item_t *next;
-    volatile list_item_t *prev;
-    uint64_t line_id;
-    uint16_t age;
-    uint16_t padding[3]; // can be safely used for something else
-} list_item_reuse_t;
+    uint64_t line_id;    // UINT64_MAX for an empty entry
+    uint64_t timestamp;  // time of the last access to this line
+} reuse_entry_t;
+
+/* Type declaration: reuse distance tracker
+ *
+ * Every access is stamped with the value of a clock. A hash table maps each
+ * tracked line to the timestamp of its last access, and a Fenwick tree over
+ * timestamps has a 1 at the last access of every tracked line. The reuse
+ * distance of a line (the number of distinct lines accessed since its last
+ * access) is the number of 1s after its timestamp, so lookups and updates
+ * take O(log n) time. When the clock runs out of timestamps, the live ones
+ * are renumbered in order. With a limit, only that many lines (the most
+ * recently used ones) are tracked, and memory stays bounded.
+ */
+typedef struct {
+    uint64_t limit;        // max # of tracked lines, 0 for no limit
+    uint64_t live;         // # of tracked lines
+    uint64_t clock;        // next timestamp
+    uint64_t capacity;     // # of timestamps (a power of two)
+    uint64_t *fenwick;     // Fenwick tree over timestamps
+    uint64_t *owner;       // line stamped at each timestamp (or UINT64_MAX)
+    uint64_t table_size;   // # of hash table entries (a power of two)
+    int hash_shift;
+    reuse_entry_t *table;
+} reuse_data_t;
 
-/* Type declaration: symbol list item (128 bytes) */
+/* Type declaration: per-symbol performance counters (48 bytes) */
 typedef struct {
-    /* list basic type and list of caches this symbol spans to (40 bytes) */
-    volatile list_item_t *next;
-    volatile list_item_t *prev;
-    list_t lines;
-    /* performance counters (48 bytes) */
     uint64_t access;
     uint64_t hit;
     uint64_t miss;
     uint64_t conflict;
     uint64_t prefetcher_hit;
     uint64_t prefetcher_evict;
-    /* the symbols itself (40 bytes) */
-    char symbol[CACHE_SIM_SYMBOL_MAX_LENGTH];
-} list_item_symbol_t;
+} symbol_stats_t;
+
+/* Type declaration: address range of a symbol, [start, end) */
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    int symbol;
+} symbol_range_t;
+
+/* Type declaration: symbols tracking data
+ *
+ * Symbols are registered once and identified by their index in the dense
+ * 'stats' and 'names' arrays. A hash table maps names to indexes for the
+ * callers that only know the name, and a sorted array of non-overlapping
+ * address ranges maps addresses to indexes.
+ */
+typedef struct {
+    int count;                 // # of registered symbols
+    int size;                  // # of allocated symbols
+    symbol_stats_t *stats;
+    char (*names)[CACHE_SIM_SYMBOL_MAX_LENGTH];
+    int *table;                // name hash table (-1 for an empty entry)
+    int table_size;            // # of entries (a power of two)
+    symbol_range_t *ranges;    // sorted by start address
+    int range_count;
+    int range_size;
+    int last_range;            // range found by the last lookup
+} symbol_data_t;
 
 /* Type declaration: enum to hold different types of prefetcher */
 typedef enum {
@@ -83,23 +123,93 @@ typedef enum {
     PREFETCHER_NEXT_LINE_TAGGED, // prefetch the next line when a miss occurs
                                  // and keep prefechting if a hit happens on a
                                  // prefetched line
-    // PREFETCHER_STREAM,
+    PREFETCHER_STRIDE,           // prefetch along the stride of the accesses
+                                 // made by each PC (or symbol)
+    PREFETCHER_STREAM,           // prefetch ahead of sequential streams of
+                                 // misses, tracking several at once
     PREFETCHER_INVALID
 } prefetcher_t;
 
+/* Some limitations of the stride and stream prefetchers */
+#define PREFETCHER_STRIDE_ENTRIES   256 // PCs tracked (direct mapped)
+#define PREFETCHER_STREAM_ENTRIES    16 // streams tracked (LRU)
+#define PREFETCHER_STREAM_WINDOW     16 // max distance (lines) to a stream
+#define PREFETCHER_INFLIGHT_ENTRIES 256 // prefetches timed (direct mapped)
+
+/* Type declaration: stride prefetcher table entry */
+typedef struct {
+    uint64_t pc;         // UINT64_MAX for an empty entry
+    uint64_t last;       // address of the last access of this PC
+    int64_t stride;      // last stride seen (bytes)
+    int confidence;      // 0..3, prefetch from 2 on
+} stride_entry_t;
+
+/* Type declaration: stream prefetcher table entry */
+typedef struct {
+    uint64_t last;       // last line of the stream, UINT64_MAX if empty
+    uint64_t age;        // time of the last access to the stream
+    int direction;       // +1 (ascending), -1 (descending) or 0 (unknown)
+    int confidence;      // 0..3, prefetch from 2 on
+} stream_entry_t;
+
+/* Type declaration: a prefetch that may still be in flight */
+typedef struct {
+    uint64_t line_id;    // UINT64_MAX for an empty entry
+    uint64_t time;       // time when the prefetch was issued
+} inflight_entry_t;
+
+/* Type declaration: stride and stream prefetchers data
+ *
+ * Both prefetchers issue 'degree' prefetches at a time, starting 'distance'
+ * strides (or lines) ahead of the access that triggered them. Timeliness is
+ * measured in accesses: a prefetched line hit less than 'latency' accesses
+ * after its prefetch was issued would not have arrived yet, so the prefetch
+ * was late (still useful, but it only hid part of the miss).
+ */
+typedef struct {
+    int stride;          // is the stride prefetcher ON?
+    int stream;          // is the stream prefetcher ON?
+    int degree;
+    int distance;
+    uint64_t latency;    // 0 to not measure timeliness
+    stride_entry_t stride_table[PREFETCHER_STRIDE_ENTRIES];
+    stream_entry_t stream_table[PREFETCHER_STREAM_ENTRIES];
+    inflight_entry_t inflight[PREFETCHER_INFLIGHT_ENTRIES];
+} prefetch_data_t;
+
 /* Type declaration: the reason why a line have been loaded into the cache */
 typedef enum {
     LOAD_ACCESS,
     LOAD_PREFETCH
 } load_t;
 
+/* Type declaration: what a cache keeps of the lines of the caches above it */
+typedef enum {
+    INCLUSION_NON_INCLUSIVE, // lines may or may not be present
+    INCLUSION_INCLUSIVE,     // lines are always present (evictions
+                             // invalidate the lines above)
+    INCLUSION_EXCLUSIVE,     // lines are never present (lines move up on a
+                             // hit and victims from above are stored here)
+    INCLUSION_INVALID
+} inclusion_t;
+
+/* Type declaration: state of a line found by the replacement policy */
+typedef enum {
+    LINE_ABSENT,
+    LINE_CLEAN,
+    LINE_DIRTY
+} line_state_t;
+
 /* Function type declarations */
-typedef int (*reuse_fn_t)(cache_handle_t *, const uint64_t);
+typedef uint64_t (*reuse_fn_t)(cache_handle_t *, const uint64_t);
 typedef int (*policy_init_fn_t)(cache_handle_t *);
 typedef int (*policy_access_fn_t)(cache_handle_t *, const uint64_t,
     const load_t);
+typedef line_state_t (*policy_line_fn_t)(cache_handle_t *, const uint64_t);
 
-/* Type declaration: cache structure */
+/* Type declaration: cache structure (holds all the state of a cache, see the
+ * thread safety notes in cache_sim.h)
+ */
 struct cache_handle {
     /* make the cache 'listable' */
     volatile list_item_t *next;
@@ -113,30 +223,47 @@ struct cache_handle {
     int total_sets;
     int offset_length;
     int set_length;
+    int way_length;
     /* replacement policy (or algorithm) */
     policy_access_fn_t access_fn;
+    policy_line_fn_t invalidate_fn;
+    policy_line_fn_t dirty_fn;
+    /* line evicted by the last miss (UINT64_MAX if a free way was used) */
+    uint64_t victim_line;
+    int victim_dirty;
     /* data section (replacement algorithm dependent) */
     void *data;
     /* reuse distance data */
-    void *reuse_data;
+    reuse_data_t *reuse_data;
     uint64_t reuse_limit;
     reuse_fn_t reuse_fn;
     /* symbols tracking data */
-    void *symbol_data;
+    symbol_data_t *symbol_data;
     /* prefetchers */
     int next_line;
-    /* cache hierarchy */
+    prefetch_data_t *prefetch_data;
+    /* cache hierarchy: the caches above this one are linked in 'upper'
+     * through their list items, 'inclusion' is what this cache keeps of
+     * their lines, and 'lower' is the next level (NULL for memory)
+     */
     int level;
+    inclusion_t inclusion;
     list_t upper;
-    list_t lower;
+    cache_handle_t *lower;
     /* performance counters */
     uint64_t access;               // # of cache hits (inclusive)
     uint64_t hit;                  // # of cache misses (inclusive)
     uint64_t miss;                 // # of cache accesses (inclusive)
     uint64_t conflict;             // # of set associative conflicts
     uint64_t prefetcher_next_line; // # of lines loaded by this prefetcher
+    uint64_t prefetcher_stride;    // # of lines loaded by this prefetcher
+    uint64_t prefetcher_stream;    // # of lines loaded by this prefetcher
+    uint64_t prefetcher_fill;      // # of lines brought in by prefetchers
     uint64_t prefetcher_hit;       // # of prefetched lines hit
+    uint64_t prefetcher_late;      // # of prefetched lines hit too early
     uint64_t prefetcher_evict;     // # of evicted lines loaded by prefetcher
+    uint64_t writeback;            // # of dirty lines written to lower level
+    uint64_t invalidation;         // # of lines invalidated in upper levels
 };
 
 /* Type declaration: policy structure */
@@ -144,6 +271,8 @@ typedef struct {
     const char *name;
     policy_init_fn_t init_fn;
     policy_access_fn_t access_fn;
+    policy_line_fn_t invalidate_fn; // drop a line, returns its state
+    policy_line_fn_t dirty_fn;      // mark a line dirty, returns its state
 } policy_t;
 
 #ifdef __cplusplus
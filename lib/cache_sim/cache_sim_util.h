@@ -38,6 +38,11 @@ extern "C" {
 #include "cache_sim.h"
 #endif
 
+/* Vector instructions for the tag lookup, if the compiler targets them */
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 /* Macro to extract the ID (tag - offset), offset, set, and tag of an address */
 #ifndef CACHE_SIM_ADDRESS_TO_LINE_ID
 #define CACHE_SIM_ADDRESS_TO_LINE_ID(a) \
@@ -90,6 +95,64 @@ static inline void list_movetop_item(list_t *list, list_item_t *item) {
     list->head.next = item;
 }
 
+/* Functions declaration: tag lookup
+ *
+ * The replacement policies keep the tags (line IDs) of each set in an array
+ * of their own, so all the ways of a set can be compared against a line at
+ * once: 4 tags at a time with AVX2 (when built with -mavx2 or -march=...),
+ * 2 at a time with SSE2 (any x86-64), and one at a time otherwise. Matches
+ * are gathered in a mask of up to 64 ways before testing it, so there is a
+ * single hard to predict branch per lookup. Returns the way that holds
+ * 'line_id', or -1.
+ */
+static inline int cache_sim_tag_find(const uint64_t *tags, const int ways,
+    const uint64_t line_id) {
+    uint64_t found = 0;
+    int way = 0, base = 0, limit = 0;
+#if defined(__AVX2__)
+    const __m256i line4 = _mm256_set1_epi64x((long long)line_id);
+#endif
+#if defined(__SSE2__)
+    const __m128i line2 = _mm_set1_epi64x((long long)line_id);
+    __m128i equal;
+#endif
+
+    for (base = 0; base < ways; base = limit) {
+        limit = ((ways - base) > 64) ? (base + 64) : ways;
+        found = 0;
+
+#if defined(__AVX2__)
+        for (; (way + 4) <= limit; way += 4) {
+            found |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(
+                _mm256_cmpeq_epi64(_mm256_loadu_si256(
+                    (const __m256i *)(tags + way)), line4))) << (way - base);
+        }
+#endif
+
+#if defined(__SSE2__)
+        /* SSE2 has no 64-bit compare: both 32-bit halves have to be equal */
+        for (; (way + 2) <= limit; way += 2) {
+            equal = _mm_cmpeq_epi32(
+                _mm_loadu_si128((const __m128i *)(tags + way)), line2);
+            equal = _mm_and_si128(equal,
+                _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+            found |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(equal)) <<
+                (way - base);
+        }
+#endif
+
+        for (; way < limit; way++) {
+            found |= (uint64_t)(line_id == tags[way]) << (way - base);
+        }
+
+        if (found) {
+            return base + __builtin_ctzll(found);
+        }
+    }
+
+    return -1;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+/* Simulates one cache per thread and checks that every cache reports the
+ * same counters as when the caches are simulated one after the other. Build
+ * it with -fsanitize=thread, from this directory, to also check for data
+ * races:
+ *
+ *   cc -fsanitize=thread -g -I.. cache_threads.c ../cache_*.c -lpthread -lm
+ */
+
+/* headers */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache_sim.h"
+#include "cache_sim_prefetcher.h"
+#include "cache_sim_reuse.h"
+#include "cache_sim_symbol.h"
+#include "cache_sim_types.h"
+
+#define NUM_THREADS  8
+#define NUM_ACCESSES (1 << 18)
+
+/* counters of one simulated cache */
+typedef struct {
+    int id;
+    int rc;
+    uint64_t access;
+    uint64_t hit;
+    uint64_t miss;
+    uint64_t conflict;
+    uint64_t prefetch_hit;
+} run_t;
+
+/* run_cache: simulate the cache of thread 'run->id' */
+static void *run_cache(void *arg) {
+    run_t *run = (run_t *)arg;
+    cache_handle_t *cache;
+    uint64_t seed = run->id + 1;
+    uint64_t address = 0;
+    int i = 0, rc = 0;
+
+    /* every thread uses a different configuration */
+    if (NULL == (cache = cache_sim_init(32768 << (run->id % 3), 64, 8,
+        (run->id % 2) ? "plru" : "lru"))) {
+        run->rc = CACHE_SIM_ERROR;
+        return NULL;
+    }
+    if ((CACHE_SIM_SUCCESS != cache_sim_reuse_enable(cache, 1024)) ||
+        (CACHE_SIM_SUCCESS != cache_sim_prefetcher_enable(cache,
+            PREFETCHER_STRIDE)) ||
+        (CACHE_SIM_SUCCESS != cache_sim_symbol_enable(cache)) ||
+        (0 > cache_sim_symbol_register(cache, "a", 0, 1 << 20)) ||
+        (0 > cache_sim_symbol_register(cache, "b", 1 << 20, 1 << 20))) {
+        cache_sim_fini(cache);
+        run->rc = CACHE_SIM_ERROR;
+        return NULL;
+    }
+
+    /* strided accesses to 'a' mixed with random accesses to 'b' */
+    for (i = 0; i < NUM_ACCESSES; i++) {
+        if (i % 4) {
+            address = (i * 8 * (run->id + 1)) % (1 << 20);
+            rc = cache_sim_symbol_access(cache, address, "a");
+        } else {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            address = (1 << 20) + ((seed >> 33) % (1 << 20));
+            rc = cache_sim_access_pc(cache, address, CACHE_SIM_WRITE, 1);
+        }
+        if (rc & CACHE_SIM_L1_MISS_CONFLICT) {
+            run->conflict++;
+        }
+    }
+
+    run->access = cache->access;
+    run->hit = cache->hit;
+    run->miss = cache->miss;
+    run->prefetch_hit = cache->prefetcher_hit;
+    run->rc = CACHE_SIM_SUCCESS;
+
+    cache_sim_fini(cache);
+
+    return NULL;
+}
+
+/* main */
+int main(int argc, char *argv[]) {
+    pthread_t threads[NUM_THREADS];
+    run_t serial[NUM_THREADS], parallel[NUM_THREADS];
+    int i = 0, failed = 0;
+
+    memset(serial, 0, sizeof(serial));
+    memset(parallel, 0, sizeof(parallel));
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        serial[i].id = i;
+        run_cache(&serial[i]);
+    }
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        parallel[i].id = i;
+        if (0 != pthread_create(&threads[i], NULL, run_cache, &parallel[i])) {
+            printf("Error\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        if ((CACHE_SIM_SUCCESS != serial[i].rc) ||
+            (CACHE_SIM_SUCCESS != parallel[i].rc) ||
+            (serial[i].access != parallel[i].access) ||
+            (serial[i].hit != parallel[i].hit) ||
+            (serial[i].miss != parallel[i].miss) ||
+            (serial[i].conflict != parallel[i].conflict) ||
+            (serial[i].prefetch_hit != parallel[i].prefetch_hit)) {
+            printf("Error: cache %d differs from the serial run\n", i);
+            failed = 1;
+        }
+    }
+
+    if (failed) {
+        exit(1);
+    }
+    printf("Ok!\n");
+
+    exit(0);
+}
+
+// EOF
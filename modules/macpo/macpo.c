@@ -28,12 +28,14 @@ extern "C" {
 #include <string.h>
 #include <time.h>
 #include <dirent.h>
+#include <fnmatch.h>
 
 /* Utility headers */
 #include <sqlite3.h>
 
 /* Modules headers */
 #include "macpo.h"
+#include "macpo_database.h"
 
 #include "macpo_module.h"
 
@@ -541,12 +543,12 @@ int macpo_run() {
 }
 
 int macpo_analyze() {
-    char * argv[3];
+    char * argv[4];
     int rc;
     test_t test;
     struct dirent* hFile;
     int error = PERFEXPERT_FALSE;
-    char *macpo_out;
+    char *macpo_out, *results, *trace_index;
 
     OUTPUT_VERBOSE((6, "%s", _YELLOW("analyzing the results of running the instrumented code")));
     argv[0] = "macpo-analyze";
@@ -559,15 +561,22 @@ int macpo_analyze() {
     }
     
     /* MACPO will generate several different macpo.XXX files for MPI codes. Here,
-     * we iterate over all those files and run macpo-analize. Then we store the
-     * files somewhere else
+     * we iterate over all those files and run macpo-analize, which stores the
+     * results in an SQLite file that we load into the database. Then we store
+     * the files somewhere else
      */
 
     while ((hFile = readdir(dirfile)) != NULL) {
         if (hFile->d_type != DT_REG) continue; // Do not process symbolic link (macpo.out)
-        if (!strstr(hFile->d_name, "macpo.")) continue;
-        argv[1] = hFile->d_name;
-        argv[2] = NULL;
+        if (0 != fnmatch("macpo.*.out", hFile->d_name, 0)) continue; // Nor trace indices
+
+        PERFEXPERT_ALLOC(char, results, strlen(globals.moduledir) + strlen(hFile->d_name) + 5);
+        snprintf(results, strlen(globals.moduledir) + strlen(hFile->d_name) + 5,
+                "%s/%s.db", globals.moduledir, hFile->d_name);
+        PERFEXPERT_ALLOC(char, argv[1], strlen(results) + 10);
+        snprintf(argv[1], strlen(results) + 10, "--output=%s", results);
+        argv[2] = hFile->d_name;
+        argv[3] = NULL;
         
         PERFEXPERT_ALLOC(char, test.output, (strlen(globals.moduledir) + strlen(hFile->d_name) + 10));
         snprintf(test.output, strlen(globals.moduledir) + strlen(hFile->d_name) + 10,
@@ -575,26 +584,40 @@ int macpo_analyze() {
         test.input = NULL;
         test.info = globals.program;
 
-        OUTPUT_VERBOSE((6, "   COMMAND=[%s %s]", argv[0], argv[1]));
+        OUTPUT_VERBOSE((6, "   COMMAND=[%s %s %s]", argv[0], argv[1], argv[2]));
 
         rc = perfexpert_fork_and_wait(&test, (char **)argv);
 
         switch (rc) {
-            case PERFEXPERT_FAILURE:
-            case PERFEXPERT_ERROR:
+            case PERFEXPERT_SUCCESS:
+                if (PERFEXPERT_SUCCESS != macpo_database_load(results, hFile->d_name)) {
+                    error = PERFEXPERT_TRUE;
+                }
+                break;
+            default:
                 error = PERFEXPERT_TRUE;
                 break;
-        default:
-            break;
         }
         PERFEXPERT_DEALLOC(test.output);
+        PERFEXPERT_DEALLOC(argv[1]);
+        PERFEXPERT_DEALLOC(results);
         
-        PERFEXPERT_ALLOC(char, macpo_out, strlen(globals.moduledir) + strlen(hFile->d_name) + 2);
+        PERFEXPERT_ALLOC(char, macpo_out, strlen(globals.moduledir) + strlen(hFile->d_name) + 6);
         snprintf(macpo_out, strlen(globals.moduledir) + strlen(hFile->d_name) + 2,
                  "%s/%s", globals.moduledir, hFile->d_name);
         if (PERFEXPERT_SUCCESS != perfexpert_util_file_rename(hFile->d_name, macpo_out)) {
             OUTPUT(("%s", _ERROR(" moving file %s to %s"), hFile->d_name, macpo_out));
         }
+
+        /* Keep the index next to its trace */
+        PERFEXPERT_ALLOC(char, trace_index, strlen(hFile->d_name) + 5);
+        snprintf(trace_index, strlen(hFile->d_name) + 5, "%s.idx", hFile->d_name);
+        strcat(macpo_out, ".idx");
+        if (PERFEXPERT_SUCCESS == perfexpert_util_file_exists(trace_index) &&
+            PERFEXPERT_SUCCESS != perfexpert_util_file_rename(trace_index, macpo_out)) {
+            OUTPUT(("%s", _ERROR(" moving file %s to %s"), trace_index, macpo_out));
+        }
+        PERFEXPERT_DEALLOC(trace_index);
         PERFEXPERT_DEALLOC(macpo_out);
 
     }
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2011-2016  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Antonio Gomez-Iglesias, Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System standard headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* Utility headers */
+#include <sqlite3.h>
+
+/* Modules headers */
+#include "macpo.h"
+#include "macpo_database.h"
+
+/* PerfExpert common headers */
+#include "common/perfexpert_constants.h"
+#include "common/perfexpert_output.h"
+
+/* Tables written by macpo-analyze --output. Each one is copied into a macpo_
+ * table that has the same columns preceded by the PerfExpert experiment ID
+ * and the name of the trace the results came from.
+ */
+static const char *macpo_tables[] = { "trace", "reuse_distance",
+    "cache_conflict", "stride", "vector_stride", "cache_level", "set_conflict",
+    "rank_stats", "failed_trace", NULL };
+
+/* macpo_database_init */
+int macpo_database_init(void) {
+    char *error = NULL;
+    char sql[] = "CREATE TABLE IF NOT EXISTS macpo_trace (   \
+        perfexpert_id   INTEGER NOT NULL,                     \
+        trace           VARCHAR NOT NULL,                     \
+        id              INTEGER,                              \
+        filename        VARCHAR,                              \
+        binary          VARCHAR,                              \
+        timestamp       INTEGER);                             \
+        CREATE TABLE IF NOT EXISTS macpo_reuse_distance (     \
+        perfexpert_id   INTEGER NOT NULL,                     \
+        trace           VARCHAR NOT NULL,                     \
+        stream          VARCHAR,                              \
+        distance        INTEGER,                              \
+        count           REAL);                                \
+        CREATE TABLE IF NOT EXISTS macpo_cache_conflict (     \
+        perfexpert_id   INTEGER NOT NULL,                     \
+        trace           VARCHAR NOT NULL,                     \
+        stream          VARCHAR,                              \
+        ratio           REAL);                                \
+        CREATE TABLE IF NOT EXISTS macpo_stride (             \
+        perfexpert_id   INTEGER NOT NULL,                     \
+        trace           VARCHAR NOT NULL,                     \
+        stream          VARCHAR,                              \
+        stride          INTEGER,                              \
+        count           REAL);                                \
+        CREATE TABLE IF NOT EXISTS macpo_vector_stride (      \
+        perfexpert_id   INTEGER NOT NULL,                     \
+        trace           VARCHAR NOT NULL,                     \
+        stream          VARCHAR,                              \
+        stride          INTEGER,                              \
+        count           REAL);                                \
+        CREATE TABLE IF NOT EXISTS macpo_cache_level (        \
+        perfexpert_id   INTEGER NOT NULL,                     \
+        trace           VARCHAR NOT NULL,                     \
+        level           INTEGER,                              \
+        size            INTEGER,                              \
+        line_size       INTEGER,                              \
+        ways            INTEGER,                              \
+        sets            INTEGER,                              \
+        accesses        REAL,                                 \
+        hits            REAL,                                 \
+        cold_misses     REAL,                                 \
+        conflict_misses REAL,                                 \
+        capacity_misses REAL);                                \
+        CREATE TABLE IF NOT EXISTS macpo_set_conflict (       \
+        perfexpert_id   INTEGER NOT NULL,                     \
+        trace           VARCHAR NOT NULL,                     \
+        level           INTEGER,                              \
+        core            INTEGER,                              \
+        set_number      INTEGER,                              \
+        count           REAL,                                 \
+        streams         VARCHAR);                             \
+        CREATE TABLE IF NOT EXISTS macpo_rank_stats (         \
+        perfexpert_id   INTEGER NOT NULL,                     \
+        trace           VARCHAR NOT NULL,                     \
+        rank_trace      INTEGER,                              \
+        stream          VARCHAR,                              \
+        accesses        REAL,                                 \
+        writes          REAL,                                 \
+        lines           REAL,                                 \
+        conflict_ratio  REAL,                                 \
+        outlier         VARCHAR);                             \
+        CREATE TABLE IF NOT EXISTS macpo_failed_trace (       \
+        perfexpert_id   INTEGER NOT NULL,                     \
+        trace           VARCHAR NOT NULL,                     \
+        filename        VARCHAR,                              \
+        error           INTEGER);";
+
+    if (SQLITE_OK != sqlite3_exec(globals.db, sql, NULL, NULL, &error)) {
+        OUTPUT(("%s %s", _ERROR("SQL error"), error));
+        sqlite3_free(error);
+        return PERFEXPERT_ERROR;
+    }
+
+    return PERFEXPERT_SUCCESS;
+}
+
+/* import_version */
+static int import_version(void *version, int c, char **val, char **names) {
+    *(int *)version = (NULL != val[0]) ? atoi(val[0]) : 0;
+    return SQLITE_OK;
+}
+
+/* macpo_database_load */
+int macpo_database_load(const char *results, const char *trace) {
+    char *error = NULL, *sql = NULL;
+    int i, version = 0, rc = PERFEXPERT_SUCCESS;
+
+    OUTPUT_VERBOSE((8, "   loading results from [%s]", results));
+
+    /* The results are in an SQLite file of their own, so attach it and copy
+     * its tables over instead of parsing the analyzer output. Paths and
+     * trace names are quoted by SQLite (%Q) since they may contain quotes
+     */
+    if (NULL == (sql = sqlite3_mprintf("ATTACH DATABASE %Q AS macpo_result;",
+        results))) {
+        OUTPUT(("%s", _ERROR("unable to allocate memory")));
+        return PERFEXPERT_ERROR;
+    }
+    if (SQLITE_OK != sqlite3_exec(globals.db, sql, NULL, NULL, &error)) {
+        OUTPUT(("%s %s", _ERROR("SQL error"), error));
+        sqlite3_free(error);
+        sqlite3_free(sql);
+        return PERFEXPERT_ERROR;
+    }
+    sqlite3_free(sql);
+
+    if (SQLITE_OK != sqlite3_exec(globals.db,
+        "PRAGMA macpo_result.user_version;", import_version, &version,
+        &error)) {
+        OUTPUT(("%s %s", _ERROR("SQL error"), error));
+        sqlite3_free(error);
+        rc = PERFEXPERT_ERROR;
+        goto DETACH;
+    }
+    if (MACPO_RESULT_VERSION != version) {
+        OUTPUT(("%s (%s has version %d, expected %d)",
+            _ERROR("unknown MACPO result version"), results, version,
+            MACPO_RESULT_VERSION));
+        rc = PERFEXPERT_ERROR;
+        goto DETACH;
+    }
+
+    for (i = 0; NULL != macpo_tables[i]; i++) {
+        if (NULL == (sql = sqlite3_mprintf("INSERT INTO macpo_%s SELECT "
+            "%llu, %Q, * FROM macpo_result.%s;", macpo_tables[i],
+            globals.unique_id, trace, macpo_tables[i]))) {
+            OUTPUT(("%s", _ERROR("unable to allocate memory")));
+            rc = PERFEXPERT_ERROR;
+            break;
+        }
+        OUTPUT_VERBOSE((10, "      SQL: %s", sql));
+
+        if (SQLITE_OK != sqlite3_exec(globals.db, sql, NULL, NULL, &error)) {
+            OUTPUT(("%s %s", _ERROR("SQL error"), error));
+            sqlite3_free(error);
+            rc = PERFEXPERT_ERROR;
+        }
+        sqlite3_free(sql);
+        if (PERFEXPERT_SUCCESS != rc) {
+            break;
+        }
+    }
+
+    DETACH:
+    if (SQLITE_OK != sqlite3_exec(globals.db, "DETACH DATABASE macpo_result;",
+        NULL, NULL, &error)) {
+        OUTPUT(("%s %s", _ERROR("SQL error"), error));
+        sqlite3_free(error);
+        rc = PERFEXPERT_ERROR;
+    }
+
+    return rc;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+// EOF
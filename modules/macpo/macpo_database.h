@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2011-2016  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifndef PERFEXPERT_MODULE_MACPO_DATABASE_H_
+#define PERFEXPERT_MODULE_MACPO_DATABASE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Version of the result files of macpo-analyze that we know how to load */
+#define MACPO_RESULT_VERSION 2
+
+/* Function declarations */
+int macpo_database_init(void);
+int macpo_database_load(const char *results, const char *trace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERFEXPERT_MODULE_MACPO_DATABASE_H_ */
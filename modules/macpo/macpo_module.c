@@ -28,6 +28,7 @@ extern "C" {
 /* Module headers */
 #include "macpo_module.h"
 #include "macpo.h"
+#include "macpo_database.h"
 
 /* PerfExpert common headers */
 #include "common/perfexpert_alloc.h"
@@ -87,13 +88,10 @@ int module_init(void) {
         return PERFEXPERT_ERROR;
     }
 
-    // TODO: I'm going to need this here
-    /*
-    if (PERFEXPERT_SUCCESS != init_database()) {
+    if (PERFEXPERT_SUCCESS != macpo_database_init()) {
         OUTPUT(("%s", _ERROR("initialing tables")));
         return PERFEXPERT_ERROR;
     }
-    */
 
     OUTPUT_VERBOSE((5, "%s", _MAGENTA("initialized")));
 
@@ -20,17 +20,170 @@
  */
 
 #include <argp.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include "argp_custom.h"
+#include "record_analysis.h"
+#include "trace_reader.h"
 
-struct argp_option options[4] =
+// Options without a short form.
+enum { OPT_WINDOWS = 256, OPT_RECORDS, OPT_LINES, OPT_STREAMS, OPT_THREADS };
+
+struct argp_option options[16] =
 {
     { "debug", 'd', NULL, 0, "Output debug information", 0 },
     { "iamabot", 'b', NULL, 0, "Print output in an easy-to-parse format", 0 },
+    { "output", 'o', "FILE", 0, "Also store the results in the SQLite "
+        "database FILE, which is replaced if it exists", 0 },
     { "stream-names", 's', NULL, 0, "Print all streams in the output, even if "
         "there are more than 5 streams", 0 },
+    { "sample-rate", 'r', "RATE", 0, "Approximate reuse distances by "
+        "analyzing only this fraction (0 < RATE <= 1) of cache lines", 0 },
+    { "sample-error", 'e', "ERROR", 0, "Approximate reuse distances, "
+        "sampling as few cache lines as an expected error of ERROR "
+        "(e.g. 0.01) allows", 0 },
+    { "filter-fraction", 'f', "FRACTION", 0, "Only analyze source lines "
+        "that have at least FRACTION of the records of a sampling window", 0 },
+    { "filter-count", 'n', "COUNT", 0, "Only analyze source lines that have "
+        "at least COUNT records in a sampling window", 0 },
+    { "filter-top", 'k', "K", 0, "Only analyze the K source lines with the "
+        "most records in a sampling window", 0 },
+    { "analyses", 'a', "LIST", 0, "Only run the analyses in the comma-separated "
+        "LIST: reuse, conflicts, sets, strides, vector-strides or all "
+        "[default]", 0 },
+    { "windows", OPT_WINDOWS, "FIRST[-[LAST]]", 0, "Only analyze records "
+        "from these sampling windows, counting from 0", 0 },
+    { "records", OPT_RECORDS, "FIRST[-[LAST]]", 0, "Only analyze these "
+        "memory accesses, counting from 0", 0 },
+    { "lines", OPT_LINES, "FIRST[-[LAST]]", 0, "Only analyze records from "
+        "these source lines", 0 },
+    { "streams", OPT_STREAMS, "LIST", 0, "Only analyze records of the "
+        "variables in the comma-separated LIST", 0 },
+    { "threads", OPT_THREADS, "LIST", 0, "Only analyze records of the threads "
+        "in the comma-separated LIST, numbered from 0 in the order in which "
+        "they first recorded an access (needs a trace index)", 0 },
     { 0, 0, 0, 0, 0, 0 }
 };
 
+static const struct {
+    const char* name;
+    int flag;
+} analysis_names[] = {
+    { "reuse",          ANALYSIS_REUSE_DISTANCE },
+    { "conflicts",      ANALYSIS_CACHE_CONFLICTS },
+    { "sets",           ANALYSIS_SET_CONFLICTS },
+    { "strides",        ANALYSIS_STRIDES },
+    { "vector-strides", ANALYSIS_VECTOR_STRIDES },
+    { "all",            ANALYSIS_ALL }
+};
+
+// Returns the analysis flags for a comma-separated list of names, or 0 if
+// the list contains an unknown name.
+static int parse_analyses(const char* list) {
+    const int num_names = sizeof(analysis_names) / sizeof(analysis_names[0]);
+    int flags = 0;
+
+    char* copy = strdup(list);
+    char* saveptr = NULL;
+    for (char* name = strtok_r(copy, ",", &saveptr); name != NULL;
+            name = strtok_r(NULL, ",", &saveptr)) {
+        int i;
+        for (i = 0; i < num_names; i++) {
+            if (strcmp(name, analysis_names[i].name) == 0) {
+                flags |= analysis_names[i].flag;
+                break;
+            }
+        }
+
+        if (i == num_names) {
+            flags = 0;
+            break;
+        }
+    }
+
+    free(copy);
+    return flags;
+}
+
+static bool parse_list(const char* list, name_list_t& items) {
+    items.clear();
+    split(list, ',', items);
+
+    for (size_t i = 0; i < items.size(); i++) {
+        if (items[i].size() == 0)
+            return false;
+    }
+
+    return items.size() > 0;
+}
+
+static bool parse_filter_option(int key, const char* arg,
+        trace_filter_t& filter) {
+    name_list_t items;
+
+    switch (key) {
+        case OPT_WINDOWS:
+            return trace_filter_t::parse_range(arg, filter.first_window,
+                    filter.last_window);
+
+        case OPT_RECORDS:
+            return trace_filter_t::parse_range(arg, filter.first_record,
+                    filter.last_record);
+
+        case OPT_LINES:
+            return trace_filter_t::parse_range(arg, filter.first_line,
+                    filter.last_line);
+
+        case OPT_STREAMS:
+            if (parse_list(arg, items) == false)
+                return false;
+
+            filter.streams.insert(items.begin(), items.end());
+            return true;
+
+        case OPT_THREADS:
+            if (parse_list(arg, items) == false)
+                return false;
+
+            for (size_t i = 0; i < items.size(); i++) {
+                char* end = NULL;
+                unsigned long thread = strtoul(items[i].c_str(), &end, 10);
+                if (*end != '\0')
+                    return false;
+
+                filter.threads.insert(thread);
+            }
+
+            return true;
+    }
+
+    return false;
+}
+
+bool get_trace_filter(const struct arg_info& info, trace_filter_t& filter) {
+    const struct {
+        int key;
+        const char* arg;
+    } options[] = {
+        { OPT_WINDOWS, info.windows },
+        { OPT_RECORDS, info.records },
+        { OPT_LINES, info.lines },
+        { OPT_STREAMS, info.streams },
+        { OPT_THREADS, info.threads }
+    };
+
+    filter = trace_filter_t();
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        if (options[i].arg != NULL &&
+                parse_filter_option(options[i].key, options[i].arg,
+                    filter) == false)
+            return false;
+    }
+
+    return true;
+}
+
 static error_t parse_opt(int key, char* arg, struct argp_state *state)
 {
 	struct arg_info* info = (struct arg_info*) state->input;
@@ -38,14 +191,73 @@ static error_t parse_opt(int key, char* arg, struct argp_state *state)
 	switch(key)
 	{
 		case 'b':	info->bot = true;		break;
+		case 'o':	info->output = arg;		break;
 		case 'd':	info->showDebug = true;		break;
 		case 's':	info->stream_names = true;		break;
 
+		case 'r':
+			info->sample_rate = atof(arg);
+			if (info->sample_rate <= 0 || info->sample_rate > 1)
+				argp_error(state, "sample rate must be in (0, 1]");
+
+			break;
+
+		case 'e':
+			info->sample_error = atof(arg);
+			if (info->sample_error <= 0 || info->sample_error >= 1)
+				argp_error(state, "sample error must be in (0, 1)");
+
+			break;
+
+		case 'f':
+			info->filter_mode = FILTER_FRACTION;
+			info->filter_value = atof(arg);
+			if (info->filter_value < 0 || info->filter_value > 1)
+				argp_error(state, "filter fraction must be in [0, 1]");
+
+			break;
+
+		case 'n':
+		case 'k':
+			info->filter_mode = key == 'n' ? FILTER_COUNT : FILTER_TOP_K;
+			info->filter_value = atof(arg);
+			if (info->filter_value < 0)
+				argp_error(state, "filter values must not be negative");
+
+			break;
+
+		case 'a':
+			info->analysis_flags = parse_analyses(arg);
+			if (info->analysis_flags == 0)
+				argp_error(state, "unknown analysis in \"%s\"", arg);
+
+			break;
+
+		case OPT_WINDOWS:
+		case OPT_RECORDS:
+		case OPT_LINES:
+		case OPT_STREAMS:
+		case OPT_THREADS: {
+			trace_filter_t filter;
+			if (parse_filter_option(key, arg, filter) == false)
+				argp_error(state, "invalid filter \"%s\"", arg);
+
+			if (key == OPT_WINDOWS)		info->windows = arg;
+			else if (key == OPT_RECORDS)	info->records = arg;
+			else if (key == OPT_LINES)	info->lines = arg;
+			else if (key == OPT_STREAMS)	info->streams = arg;
+			else				info->threads = arg;
+
+			break;
+		}
+
 		case ARGP_KEY_ARG:
-			if (state->arg_num >= 2)
-				argp_usage(state);
+			info->args = (char**) realloc(info->args,
+					(info->num_args + 1) * sizeof(char*));
+			if (info->args == NULL)
+				argp_failure(state, 1, ENOMEM, "positional arguments");
 
-			state->arg_num == 0 ? info->arg1 = arg : info->arg2 = arg;
+			info->args[info->num_args++] = arg;
 			break;
 
 		case ARGP_KEY_END:
@@ -61,5 +273,7 @@ static error_t parse_opt(int key, char* arg, struct argp_state *state)
 	return 0;
 }
 
-struct argp argp = { options, parse_opt, "[threshold] macpo.out", "Program to "
-    "process reuse distances", 0, 0, 0 };
+struct argp argp = { options, parse_opt, "[threshold] macpo.out...",
+    "Program to process reuse distances. If several traces or a directory "
+    "with traces (macpo.<pid>.out) are given, the traces are analyzed one "
+    "by one and their results are merged.", 0, 0, 0 };
@@ -54,6 +54,16 @@ int insert_cache_type(global_data_t& global_data, size_t cache_level,
     return -1;
 }
 
+// hwloc 2.0 replaced HWLOC_OBJ_CACHE with one object type per level.
+static bool is_data_cache(hwloc_obj_t obj) {
+#if HWLOC_API_VERSION >= 0x00020000
+    return hwloc_obj_type_is_dcache(obj->type);
+#else
+    return obj->type == HWLOC_OBJ_CACHE &&
+        obj->attr->cache.type != HWLOC_OBJ_CACHE_INSTRUCTION;
+#endif
+}
+
 int load_cache_info(global_data_t& global_data) {
     int code = 0;
     hwloc_topology_t topology;
@@ -67,7 +77,7 @@ int load_cache_info(global_data_t& global_data) {
     for (int i=0; i<max_depth; i++) {
         for (int j=0; j<hwloc_get_nbobjs_by_depth(topology, i); j++) {
             hwloc_obj_t obj = hwloc_get_obj_by_depth(topology, i, j);
-            if (obj->type == HWLOC_OBJ_CACHE) {
+            if (is_data_cache(obj)) {
                 hwloc_obj_attr_u::hwloc_cache_attr_s& cache = obj->attr->cache;
                 if ((code = insert_cache_type(global_data, cache.depth, cache.size,
                         cache.linesize, cache.associativity)) < 0)
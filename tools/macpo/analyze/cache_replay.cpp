@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include "cache_info.h"
+#include "cache_replay.h"
+#include "cache_sim_hierarchy.h"
+#include "cache_sim_types.h"
+#include "err_codes.h"
+#include "trace_reader.h"
+
+// Accesses that are replayed with a single call to cache_sim.
+#define REPLAY_CHUNK    4096
+
+// Accesses of a chunk, in the form that cache_sim takes them.
+typedef struct {
+    std::vector<uint64_t> addresses;
+    std::vector<int> types;
+    std::vector<size_t> streams;
+    std::vector<size_t> lines;
+    std::vector<int> results;
+} replay_chunk_t;
+
+static bool is_power_of_two(size_t value) {
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+static bool parse_size(const std::string& string, unsigned& size) {
+    char* end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(string.c_str(), &end, 10);
+    if (errno != 0 || end == string.c_str())
+        return false;
+
+    switch (*end) {
+        case 'G':   value <<= 10;   // Fall through.
+        case 'M':   value <<= 10;   // Fall through.
+        case 'K':   value <<= 10;   end++;  break;
+    }
+
+    if (*end != '\0' || value == 0 || value > 0xffffffffULL)
+        return false;
+
+    size = value;
+    return true;
+}
+
+static bool is_valid_level(const replay_level_t& level) {
+    if (!is_power_of_two(level.line_size) || level.associativity == 0 ||
+            level.size % (level.line_size * level.associativity) != 0)
+        return false;
+
+    return is_power_of_two(level.size / level.line_size /
+            level.associativity);
+}
+
+bool parse_replay_config(const char* string, replay_config_t& config) {
+    name_list_t levels;
+    split(string, ',', levels);
+
+    config.name = string;
+    config.levels.clear();
+    for (size_t i = 0; i < levels.size(); i++) {
+        name_list_t fields;
+        split(levels[i], ':', fields);
+        if (fields.size() < 3 || fields.size() > 5)
+            return false;
+
+        replay_level_t level;
+        if (!parse_size(fields[0], level.size) ||
+                !parse_size(fields[1], level.line_size) ||
+                !parse_size(fields[2], level.associativity))
+            return false;
+
+        level.policy = fields.size() > 3 ? fields[3] : "lru";
+        level.inclusion = fields.size() > 4 ? fields[4] : "non-inclusive";
+        if (!is_valid_level(level))
+            return false;
+
+        config.levels.push_back(level);
+    }
+
+    return config.levels.size() > 0;
+}
+
+static void add_machine_level(const cache_data_t& cache,
+        replay_config_t& config) {
+    if (cache.size == 0 || cache.line_size == 0)
+        return;
+
+    replay_level_t level;
+    level.line_size = cache.line_size;
+    level.associativity = cache.associativity;
+    level.policy = "lru";
+    level.inclusion = "non-inclusive";
+
+    // hwloc reports 0 for unknown and -1 for full associativity.
+    size_t lines = cache.size / cache.line_size;
+    if (level.associativity == 0 || level.associativity > lines)
+        level.associativity = lines;
+
+    size_t sets = 1;
+    while (2 * sets <= lines / level.associativity)
+        sets *= 2;
+
+    level.size = sets * level.associativity * level.line_size;
+
+    std::ostringstream name;
+    name << (config.name.size() ? "," : "") << level.size / 1024 << "K:" <<
+        level.line_size << ":" << level.associativity;
+    config.name += name.str();
+    config.levels.push_back(level);
+}
+
+int machine_replay_config(replay_config_t& config) {
+    global_data_t global_data;
+    memset(&global_data.l1_data, 0, sizeof(cache_data_t));
+    memset(&global_data.l2_data, 0, sizeof(cache_data_t));
+    memset(&global_data.l3_data, 0, sizeof(cache_data_t));
+
+    int code = load_cache_info(global_data);
+    if (code < 0)
+        return code;
+
+    config.name.clear();
+    config.levels.clear();
+    add_machine_level(global_data.l1_data, config);
+    add_machine_level(global_data.l2_data, config);
+    add_machine_level(global_data.l3_data, config);
+
+    return config.levels.size() > 0 ? 0 : -ERR_INV_CACHE;
+}
+
+int create_replay_caches(replay_config_t& config) {
+    std::vector<cache_sim_level_t> levels(config.levels.size());
+    for (size_t i = 0; i < config.levels.size(); i++) {
+        levels[i].total_size = config.levels[i].size;
+        levels[i].line_size = config.levels[i].line_size;
+        levels[i].associativity = config.levels[i].associativity;
+        levels[i].policy = config.levels[i].policy.c_str();
+        levels[i].inclusion = config.levels[i].inclusion.c_str();
+    }
+
+    config.cache = cache_sim_hierarchy_init(&levels[0], levels.size());
+    return config.cache != NULL ? 0 : -ERR_INV_CACHE;
+}
+
+void destroy_replay_caches(replay_config_t& config) {
+    if (config.cache != NULL) {
+        cache_sim_hierarchy_fini(config.cache);
+        config.cache = NULL;
+    }
+}
+
+static void replay_chunk(replay_chunk_t& chunk, replay_config_t& config) {
+    size_t count = chunk.addresses.size();
+    chunk.results.resize(count);
+    if (count == 0)
+        return;
+
+    cache_sim_access_batch(config.cache, &chunk.addresses[0],
+            &chunk.types[0], count, &chunk.results[0]);
+
+    // Consecutive accesses mostly come from the same source line.
+    access_count_map_t::iterator line = config.lines.end();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t hit = (chunk.results[i] & CACHE_SIM_L1_HIT) ? 1 : 0;
+
+        size_t stream = chunk.streams[i];
+        if (stream >= config.streams.size()) {
+            access_count_t zero = { 0, 0 };
+            config.streams.resize(stream + 1, zero);
+        }
+
+        if (line == config.lines.end() || line->first != chunk.lines[i]) {
+            access_count_t zero = { 0, 0 };
+            line = config.lines.insert(std::make_pair(chunk.lines[i],
+                        zero)).first;
+        }
+
+        config.streams[stream].accesses++;
+        config.streams[stream].hits += hit;
+        line->second.accesses++;
+        line->second.hits += hit;
+        config.total.accesses++;
+        config.total.hits += hit;
+    }
+}
+
+static void clear_chunk(replay_chunk_t& chunk) {
+    chunk.addresses.clear();
+    chunk.types.clear();
+    chunk.streams.clear();
+    chunk.lines.clear();
+}
+
+static void add_access(replay_chunk_t& chunk, uint64_t address,
+        int read_write, size_t stream, size_t line) {
+    chunk.addresses.push_back(address);
+    chunk.types.push_back(read_write == TYPE_WRITE ||
+            read_write == TYPE_READ_AND_WRITE ? CACHE_SIM_WRITE :
+            CACHE_SIM_READ);
+    chunk.streams.push_back(stream);
+    chunk.lines.push_back(line);
+}
+
+static int replay_macpo_trace(const char* filename, replay_config_t& config) {
+    trace_reader_t reader;
+    int code = reader.open(filename);
+    if (code < 0)
+        return code;
+
+    // Sampling windows are replayed back to back, with the caches as the
+    // previous window left them.
+    mem_info_list_t records;
+    replay_chunk_t chunk;
+    bool end_of_window = false;
+    while (true) {
+        code = reader.next_chunk(records, REPLAY_CHUNK, end_of_window);
+        if (code < 0 || (code == 0 && !end_of_window))
+            break;
+
+        clear_chunk(chunk);
+        for (size_t i = 0; i < records.size(); i++) {
+            const mem_info_t& mem_info = records[i];
+            add_access(chunk, mem_info.address, mem_info.read_write,
+                    mem_info.var_idx, mem_info.line_number);
+        }
+
+        replay_chunk(chunk, config);
+    }
+
+    if (code == 0 && reader.truncated_at() != (size_t) -1) {
+        std::cerr << "Warning: " << filename << " ends with a partial " <<
+            "record at byte " << reader.truncated_at() << ", ignoring it." <<
+            std::endl;
+    }
+
+    config.stream_list = reader.streams();
+    reader.close();
+    return code;
+}
+
+static int replay_raw_trace(const char* filename, replay_config_t& config) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL)
+        return -ERR_FILE;
+
+    std::vector<replay_record_t> records(REPLAY_CHUNK);
+    replay_chunk_t chunk;
+    size_t count = 0;
+    while ((count = fread(&records[0], sizeof(replay_record_t),
+                    REPLAY_CHUNK, file)) > 0) {
+        clear_chunk(chunk);
+        for (size_t i = 0; i < count; i++) {
+            add_access(chunk, records[i].address, records[i].read_write,
+                    records[i].stream, records[i].line_number);
+        }
+
+        replay_chunk(chunk, config);
+    }
+
+    int code = ferror(file) ? -ERR_FILE : 0;
+    fclose(file);
+
+    // Streams are only known by their numbers.
+    config.stream_list.clear();
+    return code;
+}
+
+int replay_trace(const char* filename, int format, replay_config_t& config) {
+    if (config.cache == NULL)
+        return -ERR_INV_CACHE;
+
+    if (format == FORMAT_RAW)
+        return replay_raw_trace(filename, config);
+
+    return replay_macpo_trace(filename, config);
+}
+
+static std::string stream_name(const replay_config_t& config, size_t stream) {
+    if (stream < config.stream_list.size())
+        return config.stream_list[stream];
+
+    std::ostringstream name;
+    name << "stream" << stream;
+    return name.str();
+}
+
+static double hit_ratio(const access_count_t& count) {
+    return count.accesses ? (double) count.hits / count.accesses : 0;
+}
+
+static bool more_accesses(const access_count_map_t::value_type* a,
+        const access_count_map_t::value_type* b) {
+    if (a->second.accesses != b->second.accesses)
+        return a->second.accesses > b->second.accesses;
+
+    return a->first < b->first;
+}
+
+void print_replay_results(const replay_config_t& config, int number,
+        size_t top_lines, bool bot) {
+    std::vector<const access_count_map_t::value_type*> lines;
+    for (access_count_map_t::const_iterator it = config.lines.begin();
+            it != config.lines.end(); it++) {
+        lines.push_back(&*it);
+    }
+
+    std::sort(lines.begin(), lines.end(), more_accesses);
+    if (top_lines > 0 && lines.size() > top_lines)
+        lines.resize(top_lines);
+
+    if (bot) {
+        std::cout << "replay." << number << ".config=" << config.name <<
+            std::endl;
+        std::cout << "replay." << number << ".accesses=" <<
+            config.total.accesses << std::endl;
+        std::cout << "replay." << number << ".hit_ratio=" <<
+            hit_ratio(config.total) << std::endl;
+
+        for (size_t i = 0; i < config.streams.size(); i++) {
+            if (config.streams[i].accesses == 0)
+                continue;
+
+            std::string name = stream_name(config, i);
+            std::cout << "replay." << number << ".stream." << name <<
+                ".accesses=" << config.streams[i].accesses << std::endl;
+            std::cout << "replay." << number << ".stream." << name <<
+                ".hit_ratio=" << hit_ratio(config.streams[i]) << std::endl;
+        }
+
+        for (size_t i = 0; i < lines.size(); i++) {
+            std::cout << "replay." << number << ".line." << lines[i]->first <<
+                ".accesses=" << lines[i]->second.accesses << std::endl;
+            std::cout << "replay." << number << ".line." << lines[i]->first <<
+                ".hit_ratio=" << hit_ratio(lines[i]->second) << std::endl;
+        }
+
+        for (const cache_handle_t* cache = config.cache; cache != NULL;
+                cache = cache->lower) {
+            access_count_t count = { cache->access, cache->hit };
+            std::cout << "replay." << number << ".level." << cache->level <<
+                ".accesses=" << cache->access << std::endl;
+            std::cout << "replay." << number << ".level." << cache->level <<
+                ".hit_ratio=" << hit_ratio(count) << std::endl;
+            std::cout << "replay." << number << ".level." << cache->level <<
+                ".writebacks=" << cache->writeback << std::endl;
+            std::cout << "replay." << number << ".level." << cache->level <<
+                ".invalidations=" << cache->invalidation << std::endl;
+        }
+
+        return;
+    }
+
+    std::cout << macpoprefix << "Configuration " << number << " (" <<
+        config.name << "): " << config.total.accesses << " accesses, " <<
+        100.0 * hit_ratio(config.total) << "% hits in the first level." <<
+        std::endl;
+
+    std::cout << macpoprefix << "Hit ratio of each stream:" << std::endl;
+    for (size_t i = 0; i < config.streams.size(); i++) {
+        if (config.streams[i].accesses == 0)
+            continue;
+
+        std::cout << "var: " << stream_name(config, i) << ": " <<
+            config.streams[i].accesses << " accesses, " <<
+            100.0 * hit_ratio(config.streams[i]) << "% hits." << std::endl;
+    }
+
+    std::cout << macpoprefix << "Hit ratio of the source lines with the most "
+        "accesses:" << std::endl;
+    for (size_t i = 0; i < lines.size(); i++) {
+        std::cout << "line " << lines[i]->first << ": " <<
+            lines[i]->second.accesses << " accesses, " <<
+            100.0 * hit_ratio(lines[i]->second) << "% hits." << std::endl;
+    }
+
+    std::cout << std::endl;
+}
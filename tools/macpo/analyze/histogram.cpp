@@ -20,7 +20,7 @@
  */
 
 #include <algorithm>
-#include <gsl/gsl_histogram.h>
+#include <new>
 
 #include "analysis_defs.h"
 #include "histogram.h"
@@ -32,30 +32,29 @@ bool pair_sort(const pair_t& p1, const pair_t& p2) {
     return val_1 > val_2;
 }
 
-int flatten_and_sort_histogram(gsl_histogram*& hist, pair_list_t& pair_list) {
+int flatten_and_sort_histogram(sparse_histogram_t*& hist,
+        pair_list_t& pair_list) {
     // Initialize.
     pair_list.clear();
 
-    size_t bin_count = gsl_histogram_bins(hist);
-    pair_list.resize(bin_count);
+    // Only bins that were counted in are returned, sorted by their values.
+    sparse_histogram_t::pair_list_t sorted = hist->sort();
+    pair_list.resize(sorted.size());
 
-    for (int i=0; i<bin_count; i++) {
-        size_t count = gsl_histogram_get(hist, i);
-        pair_list[i] = pair_t(i, count);
+    for (size_t i=0; i<sorted.size(); i++) {
+        pair_list[i] = pair_t(sorted[i].first, sorted[i].second);
     }
 
-    // Sort based on values.
-    std::sort(pair_list.begin(), pair_list.end(), pair_sort);
+    return 0;
 }
 
-int create_histogram_if_null(gsl_histogram*& hist, size_t bins) {
+int create_histogram_if_null(sparse_histogram_t*& hist, size_t bins,
+        size_t exact_bins) {
     if (hist == NULL) {
-        hist = gsl_histogram_alloc (bins);
+        hist = new (std::nothrow) sparse_histogram_t(exact_bins, bins);
 
         if (hist == NULL)
             return -1;
-
-        gsl_histogram_set_ranges_uniform (hist, 0, bins);
     }
 
     return 0;
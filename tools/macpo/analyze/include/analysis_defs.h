@@ -23,20 +23,20 @@
 #define ANALYSIS_DEFS_H_
 
 #include <vector>
-#include <gsl/gsl_histogram.h>
 
 #include "tools/macpo/common/avl_tree.h"
 #include "tools/macpo/common/generic_defs.h"
+#include "tools/macpo/common/histogram.h"
 #include "tools/macpo/common/macpo_record.h"
 #include "tools/macpo/common/macpo_record_cxx.h"
 
-typedef gsl_histogram histogram_t;
+typedef log_histogram_t<double> sparse_histogram_t;
 
 typedef std::vector<mem_info_list_t> mem_info_bucket_t;
 typedef std::vector<trace_info_list_t> trace_info_bucket_t;
 typedef std::vector<vector_stride_info_list_t> vector_stride_info_bucket_t;
 
-typedef std::vector<histogram_t*> histogram_list_t;
+typedef std::vector<sparse_histogram_t*> histogram_list_t;
 typedef std::vector<histogram_list_t> histogram_matrix_t;
 
 typedef std::vector<avl_tree*> avl_tree_list_t;
@@ -53,6 +53,7 @@ typedef struct {
 
 typedef struct {
     cache_data_t l1_data, l2_data, l3_data;
+    metadata_info_t metadata_info;
     name_list_t stream_list;
     mem_info_bucket_t mem_info_bucket;
     trace_info_bucket_t trace_info_bucket;
@@ -69,6 +70,7 @@ typedef struct {
 #define ANALYSIS_PREFETCH_STREAMS   (1 << 2)
 #define ANALYSIS_STRIDES            (1 << 3)
 #define ANALYSIS_VECTOR_STRIDES     (1 << 4)
+#define ANALYSIS_SET_CONFLICTS      (1 << 5)
 
 #define ANALYSIS_ALL                (~0)
 
@@ -26,10 +26,23 @@
 
 struct arg_info {
     float threshold;
-    char *arg1, *arg2, *location;
+    float sample_rate, sample_error;
+    int filter_mode;
+    float filter_value;
+    int analysis_flags;
+    char *windows, *records, *lines, *streams, *threads;
+    char *output;
+    char **args;
+    int num_args;
     bool bot, showDebug, stream_names;
 };
 
 extern struct argp argp;
 
+struct trace_filter_t;
+
+// Fills in `filter' from the filtering options. Returns false if an
+// option is malformed.
+bool get_trace_filter(const struct arg_info& info, trace_filter_t& filter);
+
 #endif /* ARGP_H_ */
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifndef CACHE_REPLAY_H_
+#define CACHE_REPLAY_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "analysis_defs.h"
+#include "cache_sim.h"
+
+/***
+
+Trace replay through simulated caches.
+
+macpo-replay streams the memory accesses of a trace through one or more cache
+hierarchies simulated by cache_sim (lib/cache_sim). It reports the hit ratio
+of every stream (variable) and source line in the first level of each
+hierarchy, along with the statistics that cache_sim keeps for every level.
+Hierarchies do not share any state, so they are replayed in parallel, each one
+reading the trace on its own.
+
+Besides MACPO traces, a generic binary format can be replayed, so that
+address traces produced by other tools can be used too. It is a plain sequence
+of replay_record_t records, in the byte order of the machine and without any
+header.
+
+*/
+
+typedef struct __attribute__((packed)) {
+    uint64_t address;
+    uint32_t line_number;   // Source line, 0 if not known.
+    uint16_t stream;        // Any number that identifies the variable.
+    uint16_t read_write;    // TYPE_READ or TYPE_WRITE (see macpo_record.h).
+} replay_record_t;
+
+enum { FORMAT_MACPO = 0, FORMAT_RAW };
+
+typedef struct {
+    uint64_t accesses, hits;
+} access_count_t;
+
+typedef std::vector<access_count_t> access_count_list_t;
+typedef std::map<size_t, access_count_t> access_count_map_t;
+
+// A cache level: the cache_sim_level_t fields, owning their strings.
+typedef struct {
+    unsigned size, line_size, associativity;
+    std::string policy, inclusion;
+} replay_level_t;
+
+typedef std::vector<replay_level_t> replay_level_list_t;
+
+struct replay_config_t {
+    std::string name;
+    replay_level_list_t levels;
+    cache_handle_t* cache;              // First level of the hierarchy.
+
+    access_count_t total;
+    access_count_list_t streams;        // Indexed by var_idx (or stream).
+    access_count_map_t lines;           // Indexed by source line.
+    name_list_t stream_list;
+
+    replay_config_t() : cache(NULL) {
+        total.accesses = total.hits = 0;
+    }
+};
+
+typedef std::vector<replay_config_t> replay_config_list_t;
+
+// Parses a hierarchy given as comma-separated levels, from the first one,
+// each one as SIZE:LINE:WAYS[:POLICY[:INCLUSION]] with an optional K, M or
+// G suffix on SIZE. Returns false if it is malformed.
+bool parse_replay_config(const char* string, replay_config_t& config);
+
+// Builds the hierarchy of data caches of this machine. The number of sets
+// of levels that do not have a power of two sets is rounded down.
+int machine_replay_config(replay_config_t& config);
+
+// Creates and destroys the simulated caches of a configuration.
+int create_replay_caches(replay_config_t& config);
+void destroy_replay_caches(replay_config_t& config);
+
+// Streams all memory accesses in `filename' through the caches of `config'.
+// Returns 0 on success or a negative error code.
+int replay_trace(const char* filename, int format, replay_config_t& config);
+
+// Prints the hit ratios of streams and of the `top_lines' source lines with
+// the most accesses (all of them if 0). With `bot', the counters of every
+// cache level are printed too, so the caches must not be destroyed yet.
+void print_replay_results(const replay_config_t& config, int number,
+        size_t top_lines, bool bot);
+
+#endif  /* CACHE_REPLAY_H_ */
@@ -23,6 +23,6 @@
 #define ERR_CODES_H_
 
 enum { SUCCESS=0, ERR_FILE, ERR_UNKNOWN_MSG, ERR_NO_MEM, ERR_INV_DATA,
-        ERR_INV_CACHE };
+        ERR_INV_CACHE, ERR_FILE_VERSION, ERR_DATABASE };
 
 #endif  /* ERR_CODES_H_ */
@@ -23,14 +23,17 @@
 #define HISTOGRAM_H_
 
 #include <algorithm>
-#include <gsl/gsl_histogram.h>
 
 #include "analysis_defs.h"
 
 bool pair_sort(const pair_t& p1, const pair_t& p2);
 
-int flatten_and_sort_histogram(gsl_histogram*& hist, pair_list_t& pair_list);
+int flatten_and_sort_histogram(sparse_histogram_t*& hist,
+        pair_list_t& pair_list);
 
-int create_histogram_if_null(gsl_histogram*& hist, size_t bins);
+// Values at or above bins-1 are counted in the last bin. Values below
+// `exact_bins' are counted exactly, larger ones in logarithmic bins.
+int create_histogram_if_null(sparse_histogram_t*& hist, size_t bins,
+        size_t exact_bins = LOG_HISTOGRAM_EXACT);
 
 #endif  /* HISTOGRAM_H_ */
@@ -22,9 +22,13 @@
 #ifndef LATENCY_ANALYSIS_H_
 #define LATENCY_ANALYSIS_H_
 
+#include <map>
+
 #include "analysis_defs.h"
 #include "avl_tree.h"
 #include "histogram.h"
+#include "record_visitor.h"
+#include "shards.h"
 
 static const char* MSG_CACHE_CONFLICTS = "cache_conflicts";
 static const char* MSG_REUSE_DISTANCE = "reuse_distance";
@@ -41,11 +45,13 @@ static bool init_counters(histogram_matrix_t& hist_matrix,
 
 static bool conflict(histogram_matrix_t& hist_matrix,
         avl_tree_list_t& tree_list, int num_cores, int var_idx, int core_id,
-        size_t address, short read_or_write, const int DIST_INFINITY);
+        size_t address, short read_or_write, const int DIST_INFINITY,
+        const shards_sampler_t& sampler);
 
 static size_t calculate_distance(histogram_matrix_t& hist_matrix,
         avl_tree_list_t& tree_list, int num_cores, int core_id, size_t var_idx,
-        size_t address, short read_or_write, const int DIST_INFINITY);
+        size_t address, short read_or_write, const int DIST_INFINITY,
+        const shards_sampler_t& sampler);
 
 int print_cache_conflicts(const global_data_t& global_data,
         double_list_t& conflict_list, bool bot);
@@ -53,8 +59,29 @@ int print_cache_conflicts(const global_data_t& global_data,
 int print_reuse_distances(const global_data_t& global_data,
         histogram_list_t& rd_list, const int DIST_INFINITY, bool bot);
 
-int latency_analysis(const global_data_t& global_data,
-        histogram_list_t& rd_list, double_list_t& conflict_list,
-        const int DIST_INFINITY);
+// Accumulates reuse distance histograms and cache line ownership conflicts
+// per stream as part of a fused scan. finish() fills in `conflict_list' once
+// the scan is complete.
+class latency_visitor_t : public record_visitor_t {
+ public:
+    latency_visitor_t(const global_data_t& global_data,
+            histogram_list_t& rd_list, double_list_t& conflict_list,
+            const int DIST_INFINITY, const shards_config_t& sampling);
+
+    bucket_visitor_t* begin_bucket(size_t index, const mem_info_list_t& list);
+    void end_bucket(size_t index, bucket_visitor_t* visitor);
+    void finish();
+
+ private:
+    int num_cores;
+    int num_streams;
+    int_list_t hit_list;
+    int_list_t miss_list;
+
+    histogram_list_t& rd_list;
+    double_list_t& conflict_list;
+    const int DIST_INFINITY;
+    const shards_config_t sampling;
+};
 
 #endif  /* LATENCY_ANALYSIS_H_ */
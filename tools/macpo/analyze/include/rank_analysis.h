@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifndef RANK_ANALYSIS_H_
+#define RANK_ANALYSIS_H_
+
+#include "analysis_defs.h"
+#include "argp_custom.h"
+#include "record_analysis.h"
+#include "trace_reader.h"
+
+/***
+
+Analysis of the traces of several processes, such as the ranks of an MPI job.
+
+Every trace is read, filtered and analyzed on its own, several traces at a
+time, and only its per-stream results are kept. Traces that cannot be analyzed
+are listed with the results of the others. Set conflicts are only analyzed for
+a single trace, since their results are not attributed to traces. Streams are matched across
+traces by name. Their histograms are added up for the merged report and their
+per-rank statistics are compared with each other: a rank is flagged as an
+outlier for a metric if the modified z-score of its value,
+0.6745 * (value - median) / MAD, exceeds OUTLIER_Z_SCORE. If most ranks have
+exactly the same value, so that the MAD is zero, ranks that deviate from the
+median by more than OUTLIER_DEVIATION of it are flagged instead.
+
+*/
+
+#define OUTLIER_Z_SCORE     3.5
+#define OUTLIER_DEVIATION   0.5
+#define OUTLIER_MIN_RANKS   3
+
+static const char* MSG_RANK_STATS = "rank_stats";
+
+static const char* MSG_ACCESSES = "accesses";
+static const char* MSG_LINES = "lines";
+static const char* MSG_WRITE_RATIO = "write_ratio";
+static const char* MSG_CONFLICT_RATIO = "conflict_ratio";
+static const char* MSG_OUTLIER = "outlier";
+static const char* MSG_FAILED_TRACE = "failed_trace";
+
+// Statistics of one stream in one trace.
+typedef struct {
+    double accesses;
+    double writes;
+    double lines;           // Distinct cache lines that were accessed.
+    double conflict_ratio;
+} stream_stats_t;
+
+typedef std::vector<stream_stats_t> stream_stats_list_t;
+
+class result_db_t;
+
+// Analyzes the records of the traces in `filenames' that match
+// `trace_filter' and prints merged and per-rank results, which are also
+// stored in `db' if it is not NULL. `global_data' only provides the cache
+// information. Returns the error code of a trace that failed if the others
+// were analyzed, since their results are still printed and stored.
+int analyze_ranks(const name_list_t& filenames,
+        const global_data_t& global_data, int analysis_flags,
+        const filter_config_t& filter, const trace_filter_t& trace_filter,
+        const struct arg_info& info, result_db_t* db = NULL);
+
+#endif  /* RANK_ANALYSIS_H_ */
@@ -22,15 +22,103 @@
 #ifndef RECORD_ANALYSIS_H_
 #define RECORD_ANALYSIS_H_
 
+#ifdef __GNUC__
+#include <tr1/unordered_map>
+#else
+#include <unordered_map>
+#endif
+
+#include "analysis_defs.h"
 #include "argp_custom.h"
 #include "generic_defs.h"
 #include "macpo_record.h"
+#include "shards.h"
+#include "trace_reader.h"
 
 #define CUT             0.8f
-#define LINE_NUM_LIMIT  10000
 
-int analyze_records(const global_data_t& global_data, int analysis_flags,
-        const struct arg_info& info);
-int filter_low_freq_records(global_data_t& global_data);
+/* Ways of selecting the source lines whose records are kept. */
+#define FILTER_DEFAULT  0   /* The CUT * (bucket size) most frequent lines. */
+#define FILTER_FRACTION 1   /* Lines with at least `value' of the records. */
+#define FILTER_COUNT    2   /* Lines with at least `value' records. */
+#define FILTER_TOP_K    3   /* The `value' most frequent lines. */
+
+typedef struct {
+    int mode;
+    double value;
+} filter_config_t;
+
+#ifdef __GNUC__
+typedef std::tr1::unordered_map<size_t, size_t> line_count_map_t;
+#else
+typedef std::unordered_map<size_t, size_t> line_count_map_t;
+#endif
+
+// Selects the source lines of a bucket whose records are kept by a filter:
+// count() every record of the bucket, select() and then ask keep().
+class line_filter_t {
+ public:
+    explicit line_filter_t(const filter_config_t& filter) : filter(filter),
+            records(0) {
+    }
+
+    void count(const mem_info_t& mem_info) {
+        line_counts[mem_info.line_number]++;
+        records++;
+    }
+
+    void select();
+
+    bool keep(const mem_info_t& mem_info) const {
+        line_count_map_t::const_iterator it =
+            line_counts.find(mem_info.line_number);
+        return it != line_counts.end() && it->second != 0;
+    }
+
+ private:
+    const filter_config_t filter;
+    size_t records;
+
+    // Lines that are dropped have their count reset.
+    line_count_map_t line_counts;
+};
+
+// Predicate for records that `line_filter' drops.
+class low_freq_record_t {
+ public:
+    explicit low_freq_record_t(const line_filter_t& line_filter) :
+            _line_filter(line_filter) {
+    }
+
+    bool operator()(const mem_info_t& mem_info) const {
+        return _line_filter.keep(mem_info) == false;
+    }
+
+ private:
+    const line_filter_t& _line_filter;
+};
+
+class result_db_t;
+
+// Runs the selected analyses over the records of `filename' that match
+// `trace_filter' and are kept by `filter', and prints their results.
+// `global_data' holds everything read_file() read but the memory accesses,
+// which are streamed. If `db' is not NULL, the results are also stored there.
+int analyze_records(const char* filename, const global_data_t& global_data,
+        const trace_filter_t& trace_filter, const filter_config_t& filter,
+        int analysis_flags, const struct arg_info& info,
+        result_db_t* db = NULL);
+
+// Returns the number of lines in the last-level cache, beyond which reuse
+// distances are treated as infinite, or -ERR_INV_CACHE.
+int get_distance_limit(const global_data_t& global_data);
+
+void get_sampling_config(const struct arg_info& info,
+        shards_config_t& sampling);
+
+// Drops, in every bucket, the records of lines that are not selected by
+// the filter. The order of the remaining records is preserved.
+int filter_low_freq_records(mem_info_bucket_t& bucket,
+        const filter_config_t& filter);
 
 #endif  /* RECORD_ANALYSIS_H_ */
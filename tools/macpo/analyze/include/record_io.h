@@ -31,6 +31,7 @@
 #include "analysis_defs.h"
 #include "generic_defs.h"
 #include "macpo_record.h"
+#include "trace_reader.h"
 
 static const char* MSG_METADATA_INFO = "metadata_info";
 
@@ -38,6 +39,15 @@ static const char* MSG_BINARY_NAME = "binary_name";
 static const char* MSG_TIMESTAMP = "timestamp";
 
 int print_trace_records(const global_data_t& global_data);
-int read_file(const char* filename, global_data_t& global_data, bool bot);
+// Reads the records of a trace that match `filter'. Without
+// `load_accesses', memory accesses are left for scan_trace() to stream: their
+// buckets are created but stay empty.
+int read_file(const char* filename, global_data_t& global_data, bool bot,
+        const trace_filter_t& filter, bool show_metadata = true,
+        bool load_accesses = true);
+
+// Appends `location' to `filenames' if it is a file, or the per-process
+// traces (macpo.<pid>.out) in it if it is a directory.
+int find_trace_files(const char* location, name_list_t& filenames);
 
 #endif  /* RECORD_IO_H_ */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifndef RECORD_VISITOR_H_
+#define RECORD_VISITOR_H_
+
+#include <vector>
+
+#include "analysis_defs.h"
+#include "record_analysis.h"
+#include "trace_reader.h"
+
+// Number of records that scan_trace() keeps in memory. Buckets are read until
+// they hold this many records, and larger buckets are streamed in chunks of
+// this many records.
+#define SCAN_BATCH_RECORDS  (1 << 22)
+
+/***
+
+Fused scanning of memory access records.
+
+Instead of every analysis walking all buckets by itself, analyses implement
+record_visitor_t and scan_buckets() walks each bucket once, handing every record
+to all analyses that were selected. Buckets are scanned in parallel, so
+analyses keep their state per bucket: begin_bucket() creates it and
+end_bucket() folds it into the results of the analysis. begin_bucket() and
+end_bucket() run concurrently for different buckets and must synchronize
+accordingly.
+
+scan_trace() streams the buckets (sampling windows) of a trace instead of
+loading all of them, so traces do not have to fit in memory. It reads buckets
+until they hold SCAN_BATCH_RECORDS records, drops their low-frequency records
+and scans them in parallel as one batch, freeing them before reading on. A
+bucket that grows beyond SCAN_BATCH_RECORDS records is scanned on its own,
+one chunk of records at a time, after a second reader has counted the records
+of its lines for the low-frequency filter. Buckets are numbered in trace
+order, as read_file() would number them.
+
+end_batch() is called after every batch and every chunk, when no record is
+being visited, so analyses that need to see records in trace order can
+process what their buckets collected.
+
+*/
+
+class bucket_visitor_t {
+ public:
+    virtual ~bucket_visitor_t() {}
+
+    virtual void visit(const mem_info_t& mem_info) = 0;
+};
+
+class record_visitor_t {
+ public:
+    virtual ~record_visitor_t() {}
+
+    // Returns the state for scanning bucket `index', or NULL
+    // if the bucket should not be visited by this analysis.
+    virtual bucket_visitor_t* begin_bucket(size_t index,
+            const mem_info_list_t& list) = 0;
+
+    // Takes ownership of `visitor' once all records of bucket
+    // `index' have been visited.
+    virtual void end_bucket(size_t index, bucket_visitor_t* visitor) = 0;
+
+    // Called, never concurrently, once the records read so far have been
+    // visited. The last bucket may still be open.
+    virtual void end_batch() {}
+};
+
+typedef std::vector<record_visitor_t*> record_visitor_list_t;
+
+// Visit every memory access record of `bucket' once with all analyses in
+// `visitors' and end the batch. The first bucket is numbered `first_index'.
+int scan_buckets(const mem_info_bucket_t& bucket, size_t first_index,
+        const record_visitor_list_t& visitors);
+
+// Visit every memory access record of `filename' that matches
+// `trace_filter' and is kept by `filter' once with all analyses in
+// `visitors'.
+int scan_trace(const char* filename, const trace_filter_t& trace_filter,
+        const filter_config_t& filter, const record_visitor_list_t& visitors);
+
+#endif  /* RECORD_VISITOR_H_ */
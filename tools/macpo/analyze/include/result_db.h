@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+
+#ifndef RESULT_DB_H_
+#define RESULT_DB_H_
+
+#include <sqlite3.h>
+
+#include <string>
+
+#include "analysis_defs.h"
+
+/***
+
+Structured output of analysis results.
+
+Besides printing them, macpo-analyze can store its results in an SQLite
+database (--output=FILE), so that tools such as the PerfExpert MACPO module
+can load them with plain SQL instead of parsing the text or bot output. The
+file is replaced if it exists and holds the following tables, where streams
+are identified by name and counts are doubles since they are scaled up when
+cache lines are sampled:
+
+    trace           (id, filename, binary, timestamp)
+    reuse_distance  (stream, distance, count)
+    cache_conflict  (stream, ratio)
+    stride          (stream, stride, count)
+    vector_stride   (stream, stride, count)
+    cache_level     (level, size, line_size, ways, sets, accesses, hits,
+                     cold_misses, conflict_misses, capacity_misses)
+    set_conflict    (level, core, set_number, count, streams)
+    rank_stats      (trace, stream, accesses, writes, lines, conflict_ratio,
+                     outlier)
+    failed_trace    (filename, error)
+
+Histograms are stored in full, one row per non-empty bin. Bins are identified
+by their lower bound and distances beyond the last-level cache have a NULL
+distance. The version of the layout is kept in the user_version pragma.
+
+All rows are written in a single transaction, which close() commits.
+
+*/
+
+#define RESULT_DB_VERSION   2
+
+class result_db_t {
+ public:
+    result_db_t();
+    ~result_db_t();
+
+    // Returns 0 on success or -ERR_DATABASE.
+    int open(const char* filename);
+    int close();
+
+    // Adds a trace and sets `id' to the identifier of its rank_stats rows.
+    int add_trace(const std::string& filename, const metadata_info_t& metadata,
+            int& id);
+
+    int add_reuse_distances(const name_list_t& stream_list,
+            const histogram_list_t& rd_list, const int DIST_INFINITY);
+    int add_cache_conflicts(const name_list_t& stream_list,
+            const double_list_t& conflict_list);
+    int add_strides(const name_list_t& stream_list,
+            const histogram_list_t& stride_list);
+    int add_vector_strides(const name_list_t& stream_list,
+            const histogram_list_t& stride_list);
+
+    int add_cache_level(int level, size_t size, size_t line_size, size_t ways,
+            size_t sets, double accesses, double hits, double cold_misses,
+            double conflict_misses, double capacity_misses);
+    int add_set_conflict(int level, int core, size_t set_number, double count,
+            const std::string& streams);
+
+    int add_rank_stats(int trace, const std::string& stream, double accesses,
+            double writes, double lines, double conflict_ratio,
+            const std::string& outlier);
+
+    // Records a trace that could not be analyzed and the (negative) error
+    // code it failed with.
+    int add_failed_trace(const std::string& filename, int error);
+
+ private:
+    enum { STMT_TRACE = 0, STMT_REUSE_DISTANCE, STMT_CACHE_CONFLICT,
+        STMT_STRIDE, STMT_VECTOR_STRIDE, STMT_CACHE_LEVEL, STMT_SET_CONFLICT,
+        STMT_RANK_STATS, STMT_FAILED_TRACE, NUM_STATEMENTS };
+
+    sqlite3* db;
+    sqlite3_stmt* statements[NUM_STATEMENTS];
+
+    int exec(const char* sql);
+    int step(sqlite3_stmt* statement);
+    int add_histograms(sqlite3_stmt* statement,
+            const name_list_t& stream_list, const histogram_list_t& list,
+            size_t infinity);
+
+    result_db_t(const result_db_t&);
+    result_db_t& operator=(const result_db_t&);
+};
+
+#endif  /* RESULT_DB_H_ */
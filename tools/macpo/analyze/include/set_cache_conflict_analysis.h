@@ -22,25 +22,106 @@
 #ifndef SET_CACHE_CONFLICT_ANALYSIS_H_ 
 #define SET_CACHE_CONFLICT_ANALYSIS_H_ 
 
+#include <map>
+#include <set>
+#include <vector>
+
 #include "analysis_defs.h"
 #include "histogram.h"
+#include "record_visitor.h"
+#include "shards.h"
+
+// Associativity assumed when hwloc does not report one.
+#define DEFAULT_ASSOCIATIVITY   8
+
+// A (sampled) access of one core, in trace order. Records are copied since
+// the buckets that hold them are freed as the trace is streamed.
+typedef struct {
+    size_t address;
+    size_t var_idx;
+    size_t position;
+    double weight;
+    unsigned short core_id;
+} access_ref_t;
+
+typedef std::vector<access_ref_t> access_list_t;
+
+// A cache line that the sampler stopped tracking at some point in the trace.
+typedef struct {
+    size_t position;
+    size_t cache_line;
+} eviction_t;
+
+// Geometry of one cache level, derived from its cache_data_t entry.
+struct cache_geometry_t {
+    int level;
+    size_t line_size;
+    size_t ways;
+    size_t sets;
+    size_t lines;
+    size_t set_mask;    // sets - 1 if sets is a power of two, 0 otherwise.
+};
+
+class result_db_t;
+struct core_replay_t;
+
+// A bucket whose accesses have not all been replayed yet.
+typedef struct {
+    access_list_t accesses;
+    bool ended;
+} pending_bucket_t;
+
+// Splits the trace by core as part of a fused scan and replays the accesses
+// of every core through every cache level after each batch. finish() prints
+// the conflicts that were found, also storing them in `db' if it is not NULL.
+// If sampling is enabled, only a hashed subset of cache lines is tracked and
+// the counts are scaled accordingly.
+class set_conflict_visitor_t : public record_visitor_t {
+ public:
+    set_conflict_visitor_t(const global_data_t& global_data,
+            const shards_config_t& sampling);
+    ~set_conflict_visitor_t();
 
-// This method iterates through the trace and based on reuse distance
-// (maintained using AVL tree), calculates the conflicts.
-int set_cache_conflict_analysis(const global_data_t& global_data);
+    bucket_visitor_t* begin_bucket(size_t index, const mem_info_list_t& list);
+    void end_bucket(size_t index, bucket_visitor_t* visitor);
+    void end_batch();
+    int finish(result_db_t* db = NULL);
+
+ private:
+    int num_cores;
+    size_t skipped;
+    std::vector<cache_geometry_t> geometry_list;
+    std::map<size_t, pending_bucket_t> pending_buckets;
+
+    // Sampling decisions depend on all accesses seen so far.
+    shards_sampler_t sampler;
+    size_t position;
+
+    // Replay state of every (level, core) pair, allocated on first use.
+    std::vector<core_replay_t*> replays;
+
+    const global_data_t& global_data;
+    const shards_config_t sampling;
+
+    void collect_accesses(std::vector<access_list_t>& core_accesses,
+            std::vector<eviction_t>& evictions);
+};
+
+// Fills in the geometry of a cache level. Returns -ERR_INV_CACHE if
+// the level was not detected.
+int get_cache_geometry(const cache_data_t& cache_data, int level,
+        cache_geometry_t& geometry);
 
 // this method returns the set number to which an address
 // maps to in a cache
-unsigned address_to_set(size_t address);
+size_t address_to_set(size_t address, const cache_geometry_t& geometry);
 
-// this struct is used to store a coflict when we are
-// 'almost' certain. There are no probabilities involved.
-struct conflict_t {
-    size_t set_number;
-    size_t var_idx;
+// this struct accumulates the conflicts of a single set
+struct set_conflict_t {
+    double count;
+    std::set<size_t> var_idx_set;
 
-    conflict_t(size_t _s, size_t _v) :
-        set_number(_s), var_idx(_v) {}
+    set_conflict_t() : count(0) {}
 };
 
 // this struct is used to store a conflict probability
@@ -53,12 +134,13 @@ struct conflict_prob_t {
         set_number(_s), var_idx(_v), miss_probability(_mp) {}
 };
 
+// Counts are weighted when sampling, hence doubles.
 struct cache_stats_t {
-    uint64_t addr_accesses;
-    uint64_t addr_hits;
-    uint64_t addr_conflict_misses;
-    uint64_t addr_cold_misses;
-    uint64_t addr_capacity_misses;
+    double addr_accesses;
+    double addr_hits;
+    double addr_conflict_misses;
+    double addr_cold_misses;
+    double addr_capacity_misses;
 
     cache_stats_t() {
         addr_accesses = 0;
@@ -67,9 +149,17 @@ struct cache_stats_t {
         addr_cold_misses = 0;
         addr_capacity_misses = 0;
     }
+
+    void add(const cache_stats_t& other) {
+        addr_accesses += other.addr_accesses;
+        addr_hits += other.addr_hits;
+        addr_conflict_misses += other.addr_conflict_misses;
+        addr_cold_misses += other.addr_cold_misses;
+        addr_capacity_misses += other.addr_capacity_misses;
+    }
 };
 
-typedef std::vector<conflict_t> conflict_list_t;
+typedef std::map<size_t, set_conflict_t> set_conflict_map_t;
 typedef std::vector<conflict_prob_t> conflict_prob_list_t;
 
 #endif /* SET_CACHE_CONFLICT_ANALYSIS_H_ */
@@ -23,6 +23,7 @@
 #define STRIDE_ANALYSIS_H_
 
 #include "histogram.h"
+#include "record_visitor.h"
 
 #define MAX_STRIDE      128
 #define STRIDE_COUNT    3
@@ -32,8 +33,21 @@ static const char* MSG_STRIDE_ANALYSIS = "stride_analysis";
 static const char* MSG_STRIDE_VALUE = "stride_value";
 static const char* MSG_STRIDE_COUNT = "stride_count";
 
-int stride_analysis(const global_data_t& global_data,
-        histogram_list_t& stride_list);
+// Accumulates stride histograms per stream into `stride_list'
+// as part of a fused scan.
+class stride_visitor_t : public record_visitor_t {
+ public:
+    stride_visitor_t(const global_data_t& global_data,
+            histogram_list_t& stride_list);
+
+    bucket_visitor_t* begin_bucket(size_t index, const mem_info_list_t& list);
+    void end_bucket(size_t index, bucket_visitor_t* visitor);
+
+ private:
+    int num_cores;
+    int num_streams;
+    histogram_list_t& stride_list;
+};
 
 int print_strides(const global_data_t& global_data,
         histogram_list_t& stride_list, bool bot);
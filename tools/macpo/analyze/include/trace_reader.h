@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifndef TRACE_READER_H_
+#define TRACE_READER_H_
+
+#include <stdint.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "analysis_defs.h"
+#include "macpo_record.h"
+#include "trace_codec.h"
+
+/***
+
+Streaming access to MACPO traces.
+
+trace_reader_t maps the trace file into memory and walks over it with a
+cursor, so that traces do not have to fit in memory and no record is copied
+unless the caller asks for it. next() returns a view of the next record, which
+points into the mapping (or into the buffer holding the current compressed
+block) and stays valid until the following call to next().
+
+next_chunk() is a convenience for analyses that only look at memory accesses:
+it unpacks up to a given number of accesses, stopping early at the end of a
+sampling window. Stream names and the metadata record are collected on the way
+and are available from streams() and metadata().
+
+All three trace formats are supported: legacy node_t traces, version 2 traces
+and compressed version 2 traces.
+
+If a filter is set, next() only returns the memory accesses, trace records and
+vector strides that match it (records of other types are always returned). If
+the trace has an index (see macpo_record.h), blocks whose index entries do not
+match are skipped without being read, otherwise every record is checked. Only
+traces with an index know which thread wrote a record, so filtering by thread
+drops all records of traces without one.
+
+*/
+
+// Records to select when reading a trace. Ranges are inclusive.
+struct trace_filter_t {
+    size_t first_window, last_window;   // Sampling windows, from 0.
+    size_t first_record, last_record;   // Memory accesses, from 0.
+    size_t first_line, last_line;
+    std::set<std::string> streams;
+    std::set<unsigned> threads;
+
+    trace_filter_t() : first_window(0), last_window((size_t) -1),
+            first_record(0), last_record((size_t) -1), first_line(0),
+            last_line((size_t) -1) {
+    }
+
+    bool active() const {
+        return first_window != 0 || last_window != (size_t) -1 ||
+            first_record != 0 || last_record != (size_t) -1 ||
+            first_line != 0 || last_line != (size_t) -1 ||
+            streams.size() > 0 || threads.size() > 0;
+    }
+
+    // Parses "FIRST", "FIRST-" or "FIRST-LAST". Returns false on error.
+    static bool parse_range(const char* string, size_t& first, size_t& last);
+};
+
+typedef struct {
+    uint16_t type_message;
+    uint16_t length;
+    const char* payload;
+} record_view_t;
+
+class trace_reader_t {
+ public:
+    trace_reader_t();
+    ~trace_reader_t();
+
+    // Returns 0 on success or a negative error code.
+    int open(const char* filename);
+    void close();
+
+    // Moves the cursor back to the first record.
+    void rewind();
+
+    // Only return records that match `filter' from now on.
+    void set_filter(const trace_filter_t& filter);
+
+    bool has_index() const;
+
+    // Number of indexed blocks skipped since the last rewind().
+    size_t skipped_blocks() const;
+
+    // Returns 1 if a record was read, 0 at the end of the trace
+    // or a negative error code. A partial record at the end of the
+    // trace ends it, see truncated_at().
+    int next(record_view_t& record);
+
+    // Copies a record into a node_t. Returns 0 on success, -ERR_UNKNOWN_MSG
+    // for record types that are not known or -ERR_INV_DATA.
+    int unpack(const record_view_t& record, node_t& node) const;
+
+    // Reads up to `max_records' memory accesses into `chunk', which is
+    // cleared first. Sets `end_of_window' if the chunk ends because a
+    // sampling window ended. Returns the number of accesses read or a
+    // negative error code. The end of the trace is reached when 0 is
+    // returned and `end_of_window' is not set.
+    int next_chunk(mem_info_list_t& chunk, size_t max_records,
+            bool& end_of_window);
+
+    const name_list_t& streams() const;
+    const metadata_info_t& metadata() const;
+
+    // Offset of the partial record that ended the trace,
+    // or (size_t) -1 if the trace has not ended or is complete.
+    size_t truncated_at() const;
+
+    bool is_legacy() const;
+    bool is_compressed() const;
+
+ private:
+    int fd;
+    const char* data;
+    size_t size;
+    size_t offset;
+    size_t partial_offset;
+    size_t records_offset;
+    uint16_t flags;
+    bool legacy;
+
+    // Records of the compressed block that is currently being read.
+    std::vector<char> block;
+    size_t block_size;
+    size_t block_offset;
+    codec_scratch_t* scratch;
+
+    name_list_t stream_list;
+    metadata_info_t metadata_info;
+
+    // Index entries sorted by offset and the state of filtering.
+    std::vector<index_entry_t> index;
+    size_t next_entry;
+    size_t entry_end;
+    uint32_t entry_thread;
+    size_t skipped;
+
+    trace_filter_t filter;
+    bool filtering;
+    size_t window;
+    size_t record_number;
+    uint64_t stream_mask;
+    std::vector<bool> selected_streams;
+
+    void load_index(const char* filename);
+    bool skip_block(const index_entry_t& entry) const;
+    void skip_blocks();
+    bool select(const record_view_t& record);
+
+    int next_record(record_view_t& record);
+    int end_of_trace();
+    int next_from_block(record_view_t& record);
+    void observe(const record_view_t& record);
+
+    trace_reader_t(const trace_reader_t&);
+    trace_reader_t& operator=(const trace_reader_t&);
+};
+
+#endif  /* TRACE_READER_H_ */
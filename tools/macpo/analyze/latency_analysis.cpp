@@ -27,6 +27,8 @@
 #include "avl_tree.h"
 #include "histogram.h"
 #include "latency_analysis.h"
+#include "record_visitor.h"
+#include "shards.h"
 
 static void free_counters(histogram_matrix_t& hist_matrix,
         avl_tree_list_t& tree_list, int num_cores, int num_streams) {
@@ -34,9 +36,7 @@ static void free_counters(histogram_matrix_t& hist_matrix,
         delete tree_list[i];
 
         for (int j=0; j<num_streams; j++) {
-            if (hist_matrix[i][j] != NULL) {
-                gsl_histogram_free(hist_matrix[i][j]);
-            }
+            delete hist_matrix[i][j];
         }
     }
 }
@@ -72,12 +72,14 @@ static bool init_counters(histogram_matrix_t& hist_matrix,
 
 static bool conflict(histogram_matrix_t& hist_matrix,
         avl_tree_list_t& tree_list, int num_cores, int var_idx, int core_id,
-        size_t cache_line, short read_or_write, const int DIST_INFINITY) {
+        size_t cache_line, short read_or_write, const int DIST_INFINITY,
+        const shards_sampler_t& sampler) {
     int i;
     bool conflict = false;
 
     for (i=0; i<num_cores; i++) {
-        size_t dist = tree_list[i]->get_distance(cache_line);
+        size_t dist = sampler.scale_distance(
+                tree_list[i]->get_distance(cache_line));
         if ((read_or_write == TYPE_WRITE ||
                 read_or_write == TYPE_READ_AND_WRITE) && i != core_id &&
                 dist >= 0 && dist < DIST_INFINITY) {
@@ -90,12 +92,10 @@ static bool conflict(histogram_matrix_t& hist_matrix,
                 break;
             }
 
-            double existing_count = gsl_histogram_get(hist_matrix[i][var_idx],
-                    dist);
-
-            gsl_histogram_accumulate(hist_matrix[i][var_idx], dist,
-                    -1.0 * existing_count);
-            gsl_histogram_increment(hist_matrix[i][var_idx], DIST_INFINITY-1);
+            // Bins hold a range of distances, so only move the weight of
+            // this line's access (1/rate when sampling) to the last bin.
+            sparse_histogram_t* hist = hist_matrix[i][var_idx];
+            hist->move(dist, DIST_INFINITY-1, sampler.weight());
         }
     }
 
@@ -104,15 +104,32 @@ static bool conflict(histogram_matrix_t& hist_matrix,
 
 static size_t calculate_distance(histogram_matrix_t& hist_matrix,
         avl_tree_list_t& tree_list, int num_cores, int core_id, size_t var_idx,
-        size_t cache_line, short read_or_write, const int DIST_INFINITY) {
+        size_t cache_line, short read_or_write, const int DIST_INFINITY,
+        const shards_sampler_t& sampler) {
     if (conflict(hist_matrix, tree_list, num_cores, var_idx, core_id,
-                cache_line, read_or_write, DIST_INFINITY)) {
+                cache_line, read_or_write, DIST_INFINITY, sampler)) {
         return DIST_INFINITY;
     } else {
-        return tree_list[core_id]->get_distance(cache_line);
+        return sampler.scale_distance(
+                tree_list[core_id]->get_distance(cache_line));
     }
 }
 
+static void drop_evicted_lines(shards_sampler_t& sampler,
+        avl_tree_list_t& tree_list, int num_cores,
+        std::map<size_t, short>& cache_line_owner) {
+    const std::vector<size_t>& evicted = sampler.evicted();
+    for (size_t i=0; i<evicted.size(); i++) {
+        for (int j=0; j<num_cores; j++) {
+            tree_list[j]->make_infinite_distance(evicted[i]);
+        }
+
+        cache_line_owner.erase(evicted[i]);
+    }
+
+    sampler.clear_evicted();
+}
+
 int print_cache_conflicts(const global_data_t& global_data,
         double_list_t& conflict_list, bool bot) {
     std::cout << std::endl;
@@ -238,142 +255,165 @@ int print_reuse_distances(const global_data_t& global_data,
     return 0;
 }
 
-int latency_analysis(const global_data_t& global_data,
-        histogram_list_t& rd_list, double_list_t& conflict_list,
-        const int DIST_INFINITY) {
-    const mem_info_bucket_t& bucket = global_data.mem_info_bucket;
-    const int num_cores = sysconf(_SC_NPROCESSORS_CONF);
-    const int num_streams = global_data.stream_list.size();
+// Reuse distances and ownership of cache lines within a single bucket.
+class latency_bucket_t : public bucket_visitor_t {
+ public:
+    latency_bucket_t(int num_cores, int num_streams, const int DIST_INFINITY,
+            const shards_config_t& sampling) : num_cores(num_cores),
+            num_streams(num_streams), DIST_INFINITY(DIST_INFINITY),
+            sampler(sampling),
+            sample_lines(shards_sampler_t::enabled(sampling)) {
+        local_hit_list.resize(num_streams, 0);
+        local_miss_list.resize(num_streams, 0);
 
-    int_list_t hit_list;
-    int_list_t miss_list;
+        histogram_matrix.resize(num_cores);
+        tree_list.resize(num_cores);
 
-    hit_list.resize(num_streams);
-    miss_list.resize(num_streams);
+        // init_counters() frees whatever it could allocate if it fails.
+        valid_allocation = init_counters(histogram_matrix, tree_list,
+                num_cores, num_streams);
+    }
 
-    for (int j=0; j<num_streams; j++) {
-        hit_list[j] = 0;
-        miss_list[j] = 0;
+    ~latency_bucket_t() {
+        if (valid_allocation) {
+            free_counters(histogram_matrix, tree_list, num_cores,
+                    num_streams);
+        }
     }
 
-    #pragma omp parallel for
-    for (int i=0; i<bucket.size(); i++) {
-        const mem_info_list_t& list = bucket.at(i);
+    void visit(const mem_info_t& mem_info) {
+        const unsigned short core_id = mem_info.coreID;
+        const size_t var_idx = mem_info.var_idx;
+        const size_t cache_line = ADDR_TO_CACHE_LINE(mem_info.address);
+        const short read_write = mem_info.read_write;
 
-        int_list_t local_hit_list;
-        int_list_t local_miss_list;
+        if (sample_lines) {
+            bool sampled = sampler.sample(cache_line);
+            drop_evicted_lines(sampler, tree_list, num_cores,
+                    cache_line_owner);
 
-        local_hit_list.resize(num_streams);
-        local_miss_list.resize(num_streams);
+            if (sampled == false)
+                return;
+        }
 
-        for (int j=0; j<num_streams; j++) {
-            local_hit_list[j] = 0;
-            local_miss_list[j] = 0;
+        // Quick validation check.
+        if (core_id >= num_cores || var_idx >= num_streams)
+            return;
+
+        avl_tree* tree = tree_list[core_id];
+        if (create_histogram_if_null(histogram_matrix[core_id][var_idx],
+                    DIST_INFINITY) < 0) {
+            return;
         }
 
-        avl_tree_list_t tree_list;
-        std::map<size_t, short> cache_line_owner;
+        sparse_histogram_t* hist = histogram_matrix[core_id][var_idx];
+        size_t distance = calculate_distance(histogram_matrix, tree_list,
+                num_cores, core_id, var_idx, cache_line, read_write,
+                DIST_INFINITY, sampler);
 
-        histogram_matrix_t histogram_matrix;
-        histogram_matrix.resize(num_cores);
-        tree_list.resize(num_cores);
+        // Occupy the last bin in case of overflow.
+        if (distance >= DIST_INFINITY)
+            distance = DIST_INFINITY - 1;
 
-        bool valid_allocation = init_counters(histogram_matrix, tree_list,
-                num_cores, num_streams);
+        hist->accumulate(distance, sampler.weight());
+        tree->insert(&mem_info);
 
-        if (valid_allocation) {
-            for (int j=0; j<list.size(); j++) {
-                bool valid_data = true;
-                const mem_info_t& mem_info = list.at(j);
-
-                const unsigned short core_id = mem_info.coreID;
-                const size_t var_idx = mem_info.var_idx;
-                const size_t cache_line = ADDR_TO_CACHE_LINE(mem_info.address);
-                const short read_write = mem_info.read_write;
-
-                // Quick validation check.
-                if (core_id >= 0 && core_id < num_cores &&
-                        var_idx >= 0 && var_idx < num_streams) {
-
-                    avl_tree* tree = tree_list[core_id];
-                    if (create_histogram_if_null(
-                                histogram_matrix[core_id][var_idx],
-                                DIST_INFINITY) < 0) {
-                        goto end_iteration;
-                    }
+        // Check if this cache line has been access earlier,
+        // and thus, if it has an owner.
+        if (cache_line_owner.find(cache_line) == cache_line_owner.end()) {
+            if (read_write == TYPE_WRITE ||
+                    read_write == TYPE_READ_AND_WRITE) {
+                cache_line_owner[cache_line] = core_id;
+            }
+        } else {
+            // This cache line already has an owner.
+            if (read_write == TYPE_WRITE ||
+                    read_write == TYPE_READ_AND_WRITE) {
+                // Chances of a conflict between owner and core_id.
+                short owner = cache_line_owner[cache_line];
+                if (owner == core_id) {
+                    local_hit_list[var_idx] += 1;
+                } else {
+                    local_miss_list[var_idx] += 1;
+                }
+            } else {
+                // This cache line is only being read, no conflicts here.
+                local_hit_list[var_idx] += 1;
+            }
+        }
+    }
 
-                    size_t distance = 0;
-                    histogram_t* hist = histogram_matrix[core_id][var_idx];
+    const int num_cores;
+    const int num_streams;
+    const int DIST_INFINITY;
+    bool valid_allocation;
 
-                    distance = calculate_distance(histogram_matrix, tree_list,
-                            num_cores, core_id, var_idx, cache_line, read_write,
-                            DIST_INFINITY);
+    int_list_t local_hit_list;
+    int_list_t local_miss_list;
+    avl_tree_list_t tree_list;
+    histogram_matrix_t histogram_matrix;
+    std::map<size_t, short> cache_line_owner;
 
-                    // Occupy the last bin in case of overflow.
-                    if (distance >= DIST_INFINITY)
-                        distance = DIST_INFINITY - 1;
+    // Lines are sampled per bucket, just like distances are tracked.
+    shards_sampler_t sampler;
+    const bool sample_lines;
+};
 
-                    gsl_histogram_increment(hist, distance);
-                    tree->insert(&mem_info);
+latency_visitor_t::latency_visitor_t(const global_data_t& global_data,
+        histogram_list_t& rd_list, double_list_t& conflict_list,
+        const int DIST_INFINITY, const shards_config_t& sampling) :
+        rd_list(rd_list), conflict_list(conflict_list),
+        DIST_INFINITY(DIST_INFINITY), sampling(sampling) {
+    num_cores = sysconf(_SC_NPROCESSORS_CONF);
+    num_streams = global_data.stream_list.size();
+
+    hit_list.resize(num_streams, 0);
+    miss_list.resize(num_streams, 0);
+}
 
-                    // Check if this cache line has been access earlier,
-                    // and thus, if it has an owner.
-                    if (cache_line_owner.find(cache_line) ==
-                            cache_line_owner.end()) {
-                        if (read_write == TYPE_WRITE ||
-                                read_write == TYPE_READ_AND_WRITE) {
-                            cache_line_owner[cache_line] = core_id;
-                        }
-                    } else {
-                        // This cache line already has an owner.
-                        if (read_write == TYPE_WRITE ||
-                                read_write == TYPE_READ_AND_WRITE) {
-                            // Chances of a conflict between owner and core_id.
-                            short owner = cache_line_owner[cache_line];
-                            if (owner == core_id) {
-                                local_hit_list[var_idx] += 1;
-                            } else {
-                                local_miss_list[var_idx] += 1;
-                            }
-                        } else {
-                            // This cache line is only being read,
-                            // no conflicts here.
-                            local_hit_list[var_idx] += 1;
-                        }
-                    }
-                }
-            }
+bucket_visitor_t* latency_visitor_t::begin_bucket(size_t index,
+        const mem_info_list_t& list) {
+    latency_bucket_t* bucket = new latency_bucket_t(num_cores, num_streams,
+            DIST_INFINITY, sampling);
 
-            // Sum up the histogram values from all cores.
-            #pragma omp critical
-            for (int j=0; j<num_cores; j++) {
-                for (int k=0; k<num_streams; k++) {
-                    histogram_t* h2 = histogram_matrix[j][k];
+    if (bucket->valid_allocation == false) {
+        delete bucket;
+        return NULL;
+    }
 
-                    if (h2 != NULL) {
-                        if (create_histogram_if_null(rd_list[k],
-                                    DIST_INFINITY) == 0) {
-                            gsl_histogram_add(rd_list[k], h2);
-                        }
+    return bucket;
+}
+
+void latency_visitor_t::end_bucket(size_t index, bucket_visitor_t* visitor) {
+    latency_bucket_t* bucket = static_cast<latency_bucket_t*>(visitor);
+    histogram_matrix_t& histogram_matrix = bucket->histogram_matrix;
+
+    // Sum up the histogram values from all cores.
+    #pragma omp critical (latency_analysis)
+    {
+        for (int j=0; j<num_cores; j++) {
+            for (int k=0; k<num_streams; k++) {
+                sparse_histogram_t* h2 = histogram_matrix[j][k];
+
+                if (h2 != NULL) {
+                    if (create_histogram_if_null(rd_list[k],
+                                DIST_INFINITY) == 0) {
+                        rd_list[k]->add(*h2);
                     }
                 }
             }
+        }
 
-            // Sum up the histogram values into result histogram.
-            #pragma omp critical
-            for (int j=0; j<num_streams; j++) {
-                hit_list[j] += local_hit_list[j];
-                miss_list[j] += local_miss_list[j];
-            }
-
-end_iteration:
-            free_counters(histogram_matrix, tree_list, num_cores, num_streams);
-        } else {    /* valid_allocation */
-            // Do nothing because init_counters takes care of freeing memory
-            // if all required memory could not be allocated.
+        for (int j=0; j<num_streams; j++) {
+            hit_list[j] += bucket->local_hit_list[j];
+            miss_list[j] += bucket->local_miss_list[j];
         }
     }
 
+    delete bucket;
+}
+
+void latency_visitor_t::finish() {
     for (int j=0; j<num_streams; j++) {
         double hits = hit_list[j];
         double misses = miss_list[j];
@@ -383,6 +423,4 @@ end_iteration:
             conflict_list[j] = misses / (hits + misses);
         }
     }
-
-    return 0;
 }
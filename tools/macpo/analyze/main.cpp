@@ -19,14 +19,35 @@
  * $HEADER$
  */
 
+#include <unistd.h>
+
 #include <cassert>
+#include <cstdlib>
 
 #include "argp_custom.h"
 #include "cache_info.h"
 #include "err_codes.h"
 #include "macpo_record.h"
+#include "rank_analysis.h"
 #include "record_io.h"
 #include "record_analysis.h"
+#include "result_db.h"
+
+static bool is_number(const char* string) {
+    char* end = NULL;
+    strtod(string, &end);
+    return end != string && *end == '\0';
+}
+
+static int close_output(result_db_t& result_db, const struct arg_info& info) {
+    int code = result_db.close();
+    if (code < 0) {
+        std::cerr << "Failed to write " << info.output << ", terminating." <<
+            std::endl;
+    }
+
+    return code;
+}
 
 int main(int argc, char *argv[]) {
     int code = 0;
@@ -37,14 +58,41 @@ int main(int argc, char *argv[]) {
     memset (&info, 0, sizeof(struct arg_info));
     argp_parse (&argp, argc, argv, 0, 0, &info);
 
-    if (info.arg2 == NULL) {
-        info.threshold = 0.1;   // Default threshold of 10%
-        info.location = info.arg1;
-    } else {
-        sscanf(info.arg1, "%f", &info.threshold);
-        info.location = info.arg2;
+    filter_config_t filter;
+    filter.mode = info.filter_mode;
+    filter.value = info.filter_value;
+
+    // A leading number that does not name a file is the filter threshold.
+    int first_location = 0;
+    info.threshold = 0.1;   // Default threshold of 10%
+    if (info.num_args > 1 && is_number(info.args[0]) &&
+            access(info.args[0], F_OK) != 0) {
+        sscanf(info.args[0], "%f", &info.threshold);
+        first_location = 1;
+
+        // Kept for compatibility, the threshold never selected any records.
+        std::cerr << "Warning: the threshold argument has no effect, use "
+            "--filter-fraction to select source lines by their share of "
+            "records." << std::endl;
     }
 
+    trace_filter_t trace_filter;
+    get_trace_filter(info, trace_filter);
+
+    name_list_t filenames;
+    for (int i=first_location; i<info.num_args; i++) {
+        if ((code = find_trace_files(info.args[i], filenames)) < 0) {
+            std::cerr << "Failed to find traces in " << info.args[i] <<
+                ", terminating." << std::endl;
+
+            return code;
+        }
+    }
+
+    int analysis_flags = ANALYSIS_ALL;
+    if (info.analysis_flags != 0)
+        analysis_flags = info.analysis_flags;
+
     if ((code = load_cache_info(global_data)) < 0) {
         std::cerr << "Failed to load cache information, terminating." <<
             std::endl;
@@ -52,27 +100,50 @@ int main(int argc, char *argv[]) {
         return code;
     }
 
-    if ((code = read_file(info.location, global_data, info.bot)) < 0) {
+    result_db_t result_db;
+    result_db_t* db = NULL;
+    if (info.output != NULL) {
+        if ((code = result_db.open(info.output)) < 0) {
+            std::cerr << "Failed to create " << info.output <<
+                ", terminating." << std::endl;
+
+            return code;
+        }
+
+        db = &result_db;
+    }
+
+    if (filenames.size() > 1) {
+        // The results of the traces that were analyzed are kept even if
+        // some traces failed, but the failure is still reported.
+        if ((code = analyze_ranks(filenames, global_data, analysis_flags,
+                        filter, trace_filter, info, db)) < 0) {
+            std::cerr << "Failed to analyze traces." << std::endl;
+        }
+
+        int close_code = close_output(result_db, info);
+        return code < 0 ? code : close_code;
+    }
+
+    // Memory accesses are streamed by analyze_records().
+    if ((code = read_file(filenames[0].c_str(), global_data, info.bot,
+                    trace_filter, true, false)) < 0) {
         std::cerr << "Failed to read records from file, terminating." <<
             std::endl;
 
         return code;
     }
 
+    int trace_id = 0;
+    if (db != NULL && (code = db->add_trace(filenames[0],
+                    global_data.metadata_info, trace_id)) < 0) {
+        return code;
+    }
+
     if (global_data.mem_info_bucket.size() ||
             global_data.vector_stride_info_bucket.size()) {
-        if ((code = filter_low_freq_records(global_data)) < 0) {
-            std::cerr << "Failed to filter low-frequency records, terminating."
-                << std::endl;
-
-            return code;
-        }
-
-        int analysis_flags = ANALYSIS_ALL;
-
-        // TODO: Set analysis_flags based on analyses selected via arguments.
-
-        if ((code = analyze_records(global_data, analysis_flags, info)) < 0) {
+        if ((code = analyze_records(filenames[0].c_str(), global_data,
+                        trace_filter, filter, analysis_flags, info, db)) < 0) {
             std::cerr << "Failed to analyze records, terminating." << std::endl;
             return code;
         }
@@ -84,5 +155,5 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    return 0;
+    return close_output(result_db, info);
 }
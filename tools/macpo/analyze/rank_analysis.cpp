@@ -0,0 +1,578 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef __GNUC__
+#include <tr1/unordered_set>
+#else
+#include <unordered_set>
+#endif
+
+#include "err_codes.h"
+#include "histogram.h"
+#include "latency_analysis.h"
+#include "rank_analysis.h"
+#include "record_io.h"
+#include "record_visitor.h"
+#include "result_db.h"
+#include "stride_analysis.h"
+#include "vector_stride_analysis.h"
+
+typedef std::tr1::unordered_set<size_t> line_set_t;
+typedef std::vector<line_set_t> line_set_list_t;
+
+// Everything that is kept of a trace once it has been analyzed.
+typedef struct {
+    std::string label;
+    int code;
+    metadata_info_t metadata;
+    name_list_t stream_list;
+    stream_stats_list_t stats;
+    histogram_list_t rd_list;
+    histogram_list_t stride_list;
+    histogram_list_t vector_stride_list;
+} rank_result_t;
+
+// Access counts and footprint of every stream within a single bucket.
+class stream_stats_bucket_t : public bucket_visitor_t {
+ public:
+    explicit stream_stats_bucket_t(size_t num_streams) :
+            num_streams(num_streams) {
+        stream_stats_t empty = { 0, 0, 0, 0 };
+        stats.resize(num_streams, empty);
+        lines.resize(num_streams);
+    }
+
+    void visit(const mem_info_t& mem_info) {
+        const size_t var_idx = mem_info.var_idx;
+        if (var_idx >= num_streams)
+            return;
+
+        stats[var_idx].accesses += 1;
+        if (mem_info.read_write == TYPE_WRITE ||
+                mem_info.read_write == TYPE_READ_AND_WRITE) {
+            stats[var_idx].writes += 1;
+        }
+
+        lines[var_idx].insert(ADDR_TO_CACHE_LINE(mem_info.address));
+    }
+
+    const size_t num_streams;
+    stream_stats_list_t stats;
+    line_set_list_t lines;
+};
+
+class stream_stats_visitor_t : public record_visitor_t {
+ public:
+    stream_stats_visitor_t(size_t num_streams, stream_stats_list_t& stats) :
+            num_streams(num_streams), stats(stats) {
+        stream_stats_t empty = { 0, 0, 0, 0 };
+        stats.resize(num_streams, empty);
+        lines.resize(num_streams);
+    }
+
+    bucket_visitor_t* begin_bucket(size_t index, const mem_info_list_t& list) {
+        return new stream_stats_bucket_t(num_streams);
+    }
+
+    void end_bucket(size_t index, bucket_visitor_t* visitor) {
+        stream_stats_bucket_t* bucket =
+            static_cast<stream_stats_bucket_t*>(visitor);
+
+        #pragma omp critical (stream_stats)
+        for (size_t j=0; j<num_streams; j++) {
+            stats[j].accesses += bucket->stats[j].accesses;
+            stats[j].writes += bucket->stats[j].writes;
+            lines[j].insert(bucket->lines[j].begin(), bucket->lines[j].end());
+        }
+
+        delete bucket;
+    }
+
+    void finish() {
+        for (size_t j=0; j<num_streams; j++) {
+            stats[j].lines = lines[j].size();
+        }
+    }
+
+ private:
+    const size_t num_streams;
+    stream_stats_list_t& stats;
+    line_set_list_t lines;
+};
+
+static std::string rank_label(const std::string& filename) {
+    size_t slash = filename.rfind('/');
+    return slash == std::string::npos ? filename : filename.substr(slash + 1);
+}
+
+static void analyze_rank(const std::string& filename,
+        const global_data_t& cache_info, int analysis_flags,
+        const filter_config_t& filter, const trace_filter_t& trace_filter,
+        const struct arg_info& info, const int DIST_INFINITY,
+        rank_result_t& result) {
+    global_data_t global_data = global_data_t();
+    global_data.l1_data = cache_info.l1_data;
+    global_data.l2_data = cache_info.l2_data;
+    global_data.l3_data = cache_info.l3_data;
+
+    result.label = rank_label(filename);
+    // Memory accesses are streamed by scan_trace() below.
+    if ((result.code = read_file(filename.c_str(), global_data, info.bot,
+                    trace_filter, false, false)) < 0)
+        return;
+
+    const int num_streams = global_data.stream_list.size();
+    result.rd_list.resize(num_streams);
+    result.stride_list.resize(num_streams);
+    result.vector_stride_list.resize(num_streams);
+
+    double_list_t conflict_list(num_streams, 0);
+
+    shards_config_t sampling;
+    get_sampling_config(info, sampling);
+
+    latency_visitor_t latency_visitor(global_data, result.rd_list,
+            conflict_list, DIST_INFINITY, sampling);
+    stride_visitor_t stride_visitor(global_data, result.stride_list);
+    stream_stats_visitor_t stats_visitor(num_streams, result.stats);
+
+    const bool latency = analysis_flags & (ANALYSIS_CACHE_CONFLICTS |
+            ANALYSIS_REUSE_DISTANCE);
+
+    record_visitor_list_t visitors(1, &stats_visitor);
+    if (latency)
+        visitors.push_back(&latency_visitor);
+
+    if (analysis_flags & ANALYSIS_STRIDES)
+        visitors.push_back(&stride_visitor);
+
+    if ((result.code = scan_trace(filename.c_str(), trace_filter, filter,
+                    visitors)) < 0)
+        return;
+
+    stats_visitor.finish();
+    if (latency) {
+        latency_visitor.finish();
+
+        for (int j=0; j<num_streams; j++) {
+            result.stats[j].conflict_ratio = conflict_list[j];
+        }
+    }
+
+    if (analysis_flags & ANALYSIS_VECTOR_STRIDES) {
+        if ((result.code = vector_stride_analysis(global_data,
+                        result.vector_stride_list)) < 0)
+            return;
+    }
+
+    result.metadata = global_data.metadata_info;
+    result.stream_list = global_data.stream_list;
+}
+
+static void free_histograms(histogram_list_t& list) {
+    for (size_t i=0; i<list.size(); i++) {
+        delete list[i];
+    }
+
+    list.clear();
+}
+
+// Adds `hist' into the merged histogram of stream `index'.
+static void merge_histogram(histogram_list_t& merged, size_t index,
+        sparse_histogram_t* hist, size_t bins, size_t exact_bins) {
+    if (hist == NULL)
+        return;
+
+    if (merged.size() <= index)
+        merged.resize(index + 1, NULL);
+
+    if (create_histogram_if_null(merged[index], bins, exact_bins) == 0)
+        merged[index]->add(*hist);
+}
+
+static double median(double_list_t values) {
+    const size_t middle = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + middle, values.end());
+    double upper = values[middle];
+
+    if (values.size() % 2 == 1)
+        return upper;
+
+    double lower = *std::max_element(values.begin(), values.begin() + middle);
+    return (lower + upper) / 2;
+}
+
+// Flags the values that are outliers according to their modified z-score.
+static void find_outliers(const double_list_t& values,
+        std::vector<bool>& outliers) {
+    outliers.assign(values.size(), false);
+    if (values.size() < OUTLIER_MIN_RANKS)
+        return;
+
+    const double center = median(values);
+
+    double_list_t deviations(values.size());
+    for (size_t i=0; i<values.size(); i++) {
+        deviations[i] = fabs(values[i] - center);
+    }
+
+    const double mad = median(deviations);
+    for (size_t i=0; i<values.size(); i++) {
+        if (mad > 0) {
+            outliers[i] = 0.6745 * deviations[i] / mad > OUTLIER_Z_SCORE;
+        } else {
+            outliers[i] = deviations[i] > OUTLIER_DEVIATION * fabs(center);
+        }
+    }
+}
+
+// Statistics of one stream in all ranks that accessed it.
+typedef struct {
+    std::vector<size_t> ranks;
+    std::vector<const stream_stats_t*> stats;
+} stream_ranks_t;
+
+// Prints the statistics of every stream in every rank and, if `db' is not
+// NULL, stores them there. `trace_ids' holds the identifiers of the ranks in
+// the database.
+static int print_rank_stats(const name_list_t& stream_list,
+        const std::vector<stream_ranks_t>& stream_ranks,
+        const std::vector<rank_result_t>& results, bool conflicts, bool bot,
+        result_db_t* db, const int_list_t& trace_ids) {
+    const char* metrics[] = { MSG_ACCESSES, MSG_LINES, MSG_CONFLICT_RATIO };
+    const int num_metrics = conflicts ? 3 : 2;
+
+    if (bot == false) {
+        std::cout << macpoprefix << "Per-rank stream statistics:" <<
+            std::endl;
+    }
+
+    for (size_t i=0; i<stream_list.size(); i++) {
+        const stream_ranks_t& ranks = stream_ranks[i];
+        const size_t count = ranks.ranks.size();
+
+        // outliers[m][r] is set if rank r is an outlier for metric m.
+        std::vector<std::vector<bool> > outliers(num_metrics);
+        for (int m=0; m<num_metrics; m++) {
+            double_list_t values(count);
+            for (size_t r=0; r<count; r++) {
+                const stream_stats_t& stats = *ranks.stats[r];
+                values[r] = m == 0 ? stats.accesses : m == 1 ? stats.lines :
+                    stats.conflict_ratio;
+            }
+
+            find_outliers(values, outliers[m]);
+        }
+
+        if (bot == false)
+            std::cout << "var: " << stream_list[i] << std::endl;
+
+        for (size_t r=0; r<count; r++) {
+            const std::string& label = results[ranks.ranks[r]].label;
+            const stream_stats_t& stats = *ranks.stats[r];
+            const double write_ratio = stats.accesses > 0 ?
+                stats.writes / stats.accesses : 0;
+
+            std::string flagged;
+            for (int m=0; m<num_metrics; m++) {
+                if (outliers[m][r]) {
+                    flagged += flagged.size() > 0 ? "," : "";
+                    flagged += metrics[m];
+                }
+            }
+
+            if (bot == false) {
+                std::cout << "  " << label << ": " << stats.accesses <<
+                    " accesses, " << stats.lines << " lines, " <<
+                    100.0 * write_ratio << "% writes";
+
+                if (conflicts) {
+                    std::cout << ", " << 100.0 * stats.conflict_ratio <<
+                        "% conflicts";
+                }
+
+                std::cout << ".";
+                if (flagged.size() > 0)
+                    std::cout << " [outlier: " << flagged << "]";
+
+                std::cout << std::endl;
+            } else {
+                std::string prefix = std::string(MSG_RANK_STATS) + "." +
+                    label + "." + stream_list[i] + ".";
+
+                std::cout << prefix << MSG_ACCESSES << "=" << stats.accesses <<
+                    std::endl;
+                std::cout << prefix << MSG_LINES << "=" << stats.lines <<
+                    std::endl;
+                std::cout << prefix << MSG_WRITE_RATIO << "=" << write_ratio <<
+                    std::endl;
+
+                if (conflicts) {
+                    std::cout << prefix << MSG_CONFLICT_RATIO << "=" <<
+                        stats.conflict_ratio << std::endl;
+                }
+
+                if (flagged.size() > 0) {
+                    std::cout << prefix << MSG_OUTLIER << "=" << flagged <<
+                        std::endl;
+                }
+            }
+
+            if (db != NULL) {
+                int code = db->add_rank_stats(trace_ids[ranks.ranks[r]],
+                        stream_list[i], stats.accesses, stats.writes,
+                        stats.lines, stats.conflict_ratio, flagged);
+                if (code < 0)
+                    return code;
+            }
+        }
+    }
+
+    std::cout << std::endl;
+    return 0;
+}
+
+static int store_merged_results(result_db_t& db,
+        const name_list_t& stream_list, int analysis_flags,
+        const histogram_list_t& rd_list, const double_list_t& conflicts,
+        const histogram_list_t& stride_list,
+        const histogram_list_t& vector_stride_list, const int DIST_INFINITY) {
+    int code = 0;
+    if ((analysis_flags & ANALYSIS_REUSE_DISTANCE) &&
+            (code = db.add_reuse_distances(stream_list, rd_list,
+                DIST_INFINITY)) < 0)
+        return code;
+
+    if ((analysis_flags & ANALYSIS_CACHE_CONFLICTS) &&
+            (code = db.add_cache_conflicts(stream_list, conflicts)) < 0)
+        return code;
+
+    if ((analysis_flags & ANALYSIS_STRIDES) &&
+            (code = db.add_strides(stream_list, stride_list)) < 0)
+        return code;
+
+    if ((analysis_flags & ANALYSIS_VECTOR_STRIDES) &&
+            (code = db.add_vector_strides(stream_list,
+                vector_stride_list)) < 0)
+        return code;
+
+    return 0;
+}
+
+static void print_failed_traces(const name_list_t& failed,
+        const int_list_t& codes, int num_ranks, bool bot) {
+    if (failed.size() == 0)
+        return;
+
+    if (bot == false) {
+        std::cout << macpoprefix << "Failed to analyze " << failed.size() <<
+            " of " << num_ranks << " traces:";
+
+        for (size_t i=0; i<failed.size(); i++) {
+            std::cout << (i > 0 ? ", " : " ") << rank_label(failed[i]);
+        }
+
+        std::cout << "." << std::endl;
+    } else {
+        for (size_t i=0; i<failed.size(); i++) {
+            std::cout << MSG_FAILED_TRACE << "." << rank_label(failed[i]) <<
+                "=" << codes[i] << std::endl;
+        }
+    }
+}
+
+int analyze_ranks(const name_list_t& filenames,
+        const global_data_t& global_data, int analysis_flags,
+        const filter_config_t& filter, const trace_filter_t& trace_filter,
+        const struct arg_info& info, result_db_t* db) {
+    const int num_ranks = filenames.size();
+    if (info.analysis_flags & ANALYSIS_SET_CONFLICTS) {
+        std::cerr << "Warning: set conflicts are only analyzed for a single "
+            "trace, skipping them." << std::endl;
+    }
+
+    analysis_flags &= ~ANALYSIS_SET_CONFLICTS;
+
+    const bool latency = analysis_flags & (ANALYSIS_CACHE_CONFLICTS |
+            ANALYSIS_REUSE_DISTANCE);
+
+    int DIST_INFINITY = get_distance_limit(global_data);
+    if (DIST_INFINITY < 0 && latency)
+        return DIST_INFINITY;
+
+    if (info.bot == false) {
+        std::cout << macpoprefix << "Analyzing " << num_ranks << " traces." <<
+            std::endl;
+    }
+
+    // Each trace is analyzed by a single thread, so that only as many
+    // traces as there are threads are in memory at any time.
+    std::vector<rank_result_t> results(num_ranks);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i=0; i<num_ranks; i++) {
+        analyze_rank(filenames[i], global_data, analysis_flags, filter,
+                trace_filter, info, DIST_INFINITY, results[i]);
+    }
+
+    // Match streams by name and merge their results.
+    global_data_t merged = global_data_t();
+    std::map<std::string, size_t> stream_index;
+    std::vector<stream_ranks_t> stream_ranks;
+
+    histogram_list_t rd_list, stride_list, vector_stride_list;
+    double_list_t conflicts, accesses;
+
+    int_list_t trace_ids(num_ranks, 0);
+    bool db_failed = false;
+
+    name_list_t failed;
+    int_list_t failed_codes;
+
+    int code = 0, analyzed = 0;
+    for (int i=0; i<num_ranks; i++) {
+        rank_result_t& result = results[i];
+        if (result.code < 0) {
+            std::cerr << "Failed to analyze " << filenames[i] <<
+                ", skipping." << std::endl;
+
+            failed.push_back(filenames[i]);
+            failed_codes.push_back(result.code);
+            if (db != NULL && db->add_failed_trace(filenames[i],
+                        result.code) < 0) {
+                db = NULL;
+                db_failed = true;
+            }
+
+            continue;
+        }
+
+        // Keep printing the results even if they cannot be stored.
+        if (db != NULL && db->add_trace(filenames[i], result.metadata,
+                    trace_ids[i]) < 0) {
+            db = NULL;
+            db_failed = true;
+        }
+
+        analyzed++;
+        for (size_t j=0; j<result.stream_list.size(); j++) {
+            const std::string& name = result.stream_list[j];
+            if (stream_index.find(name) == stream_index.end()) {
+                stream_index[name] = merged.stream_list.size();
+                merged.stream_list.push_back(name);
+                stream_ranks.push_back(stream_ranks_t());
+                conflicts.push_back(0);
+                accesses.push_back(0);
+            }
+
+            const size_t index = stream_index[name];
+            const stream_stats_t& stats = result.stats[j];
+            if (stats.accesses == 0)
+                continue;
+
+            stream_ranks[index].ranks.push_back(i);
+            stream_ranks[index].stats.push_back(&stats);
+
+            // Conflict ratios are weighted by the accesses of each rank.
+            conflicts[index] += stats.conflict_ratio * stats.accesses;
+            accesses[index] += stats.accesses;
+
+            merge_histogram(rd_list, index, result.rd_list[j], DIST_INFINITY,
+                    LOG_HISTOGRAM_EXACT);
+            merge_histogram(stride_list, index, result.stride_list[j],
+                    MAX_STRIDE, MAX_STRIDE);
+            merge_histogram(vector_stride_list, index,
+                    result.vector_stride_list[j], MAX_STRIDE, MAX_STRIDE);
+        }
+
+        free_histograms(result.rd_list);
+        free_histograms(result.stride_list);
+        free_histograms(result.vector_stride_list);
+    }
+
+    print_failed_traces(failed, failed_codes, num_ranks, info.bot);
+    if (analyzed == 0)
+        return failed_codes.size() > 0 ? failed_codes.back() : 0;
+
+    const size_t num_streams = merged.stream_list.size();
+    rd_list.resize(num_streams, NULL);
+    stride_list.resize(num_streams, NULL);
+    vector_stride_list.resize(num_streams, NULL);
+
+    for (size_t j=0; j<num_streams; j++) {
+        if (accesses[j] > 0)
+            conflicts[j] /= accesses[j];
+    }
+
+    if (info.bot == false) {
+        std::cout << macpoprefix << "Merged results of " << analyzed <<
+            " traces." << std::endl;
+    }
+
+    if (analysis_flags & ANALYSIS_REUSE_DISTANCE)
+        print_reuse_distances(merged, rd_list, DIST_INFINITY, info.bot);
+
+    if (analysis_flags & ANALYSIS_CACHE_CONFLICTS)
+        print_cache_conflicts(merged, conflicts, info.bot);
+
+    if (analysis_flags & ANALYSIS_STRIDES) {
+        if (info.bot == false)
+            std::cout << macpoprefix << "Stride values:" << std::endl;
+
+        print_strides(merged, stride_list, info.bot);
+    }
+
+    if (analysis_flags & ANALYSIS_VECTOR_STRIDES) {
+        if (info.bot == false)
+            std::cout << macpoprefix << "Vector stride values:" << std::endl;
+
+        print_vector_strides(merged, vector_stride_list);
+    }
+
+    // print_rank_stats() fails only if the results cannot be stored.
+    code = print_rank_stats(merged.stream_list, stream_ranks, results,
+            analysis_flags & ANALYSIS_CACHE_CONFLICTS, info.bot, db,
+            trace_ids);
+
+    if (db != NULL && code == 0) {
+        code = store_merged_results(*db, merged.stream_list, analysis_flags,
+                rd_list, conflicts, stride_list, vector_stride_list,
+                DIST_INFINITY);
+    }
+
+    free_histograms(rd_list);
+    free_histograms(stride_list);
+    free_histograms(vector_stride_list);
+    if (db_failed)
+        return -ERR_DATABASE;
+
+    if (code == 0 && failed_codes.size() > 0)
+        return failed_codes.back();
+
+    return code;
+}
@@ -19,132 +19,223 @@
  * $HEADER$
  */
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <new>
 #include <set>
+#include <vector>
 
 #include "argp_custom.h"
 #include "analysis_defs.h"
 #include "err_codes.h"
 #include "record_analysis.h"
+#include "record_visitor.h"
+#include "result_db.h"
 
 #include "latency_analysis.h"
 #include "stride_analysis.h"
 #include "vector_stride_analysis.h"
 #include "set_cache_conflict_analysis.h"
 
-int filter_low_freq_records(global_data_t& global_data) {
-    mem_info_bucket_t& bucket = global_data.mem_info_bucket;
+typedef std::pair<size_t, size_t> line_count_t;
 
-    for (int i=0; i<bucket.size(); i++) {
-        mem_info_list_t& list = bucket.at(i);
+// Most frequent lines first, ties broken by line number.
+static bool more_frequent(const line_count_t& a, const line_count_t& b) {
+    if (a.second != b.second)
+        return a.second > b.second;
+
+    return a.first < b.first;
+}
+
+// Number of records that a line needs to be kept,
+// or 0 if it depends on the rank of the line (top-K filters).
+static size_t min_line_count(const filter_config_t& filter,
+        size_t record_count) {
+    switch (filter.mode) {
+        case FILTER_FRACTION:
+            return (size_t) ceil(filter.value * record_count);
 
-        // Create a new histogram.
-        gsl_histogram *hist = gsl_histogram_alloc (LINE_NUM_LIMIT);
-        if (hist == NULL) {
-            return -ERR_NO_MEM;
+        case FILTER_COUNT:
+            return (size_t) filter.value;
+    }
+
+    return 0;
+}
+
+void line_filter_t::select() {
+    // Mark lines that should be dropped by resetting their count.
+    if (filter.mode == FILTER_FRACTION || filter.mode == FILTER_COUNT) {
+        const size_t min_count = min_line_count(filter, records);
+        for (line_count_map_t::iterator it = line_counts.begin();
+                it != line_counts.end(); it++) {
+            if (it->second < min_count)
+                it->second = 0;
         }
+    } else {
+        size_t k = filter.mode == FILTER_TOP_K ? (size_t) filter.value :
+            (size_t) (records * CUT);
+
+        if (k >= line_counts.size())
+            return;
 
-        gsl_histogram_set_ranges_uniform (hist, 0, LINE_NUM_LIMIT);
+        std::vector<line_count_t> ranking(line_counts.begin(),
+                line_counts.end());
+        std::nth_element(ranking.begin(), ranking.begin() + k, ranking.end(),
+                more_frequent);
 
-        // Shove it into the histogram.
-        for (int j=0; j<list.size(); j++) {
-            mem_info_t& mem_info = list.at(j);
-            gsl_histogram_increment(hist, mem_info.line_number);
+        for (size_t j=k; j<ranking.size(); j++) {
+            line_counts[ranking[j].first] = 0;
         }
+    }
+}
+
+static void filter_list(mem_info_list_t& list, const filter_config_t& filter) {
+    // Count the records of each line.
+    line_filter_t line_filter(filter);
+    for (mem_info_list_t::const_iterator it = list.begin(); it != list.end();
+            it++) {
+        line_filter.count(*it);
+    }
 
-        pair_list_t pair_list;
-        std::set<size_t> good_line_numbers;
+    line_filter.select();
 
-        flatten_and_sort_histogram(hist, pair_list);
+    // Discard all other samples, keeping the order of the remaining ones.
+    list.erase(std::remove_if(list.begin(), list.end(),
+                low_freq_record_t(line_filter)), list.end());
+}
 
-        size_t k = list.size() * CUT;
-        size_t limit = std::min(k, gsl_histogram_bins(hist));
+int filter_low_freq_records(mem_info_bucket_t& bucket,
+        const filter_config_t& filter) {
 
-        for (int j=0; j<limit; j++) {
-            size_t max_bin = pair_list[j].first;
-            size_t max_val = pair_list[j].second;
+    #pragma omp parallel for schedule(dynamic)
+    for (int i=0; i<bucket.size(); i++) {
+        filter_list(bucket.at(i), filter);
+    }
 
-            if (max_val > 0)
-                good_line_numbers.insert(max_bin);
-        }
+    return 0;
+}
 
-        // We don't need the histogram any more.
-        gsl_histogram_free(hist);
-
-        // Discard all other samples.
-        mem_info_list_t::iterator it = list.begin();
-        while (it != list.end()) {
-            const mem_info_t& mem_info = *it;
-            if (good_line_numbers.find(mem_info.line_number) ==
-                    good_line_numbers.end()) {
-                it = list.erase(it);
-            } else {
-                it++;
-            }
+int get_distance_limit(const global_data_t& global_data) {
+    const cache_data_t* cache_data[] = { &global_data.l3_data,
+        &global_data.l2_data, &global_data.l1_data };
+
+    // Distances beyond the last-level cache are all the same to us.
+    for (int i=0; i<3; i++) {
+        if (cache_data[i]->size != 0) {
+            return ceil(((double) cache_data[i]->size) /
+                    cache_data[i]->line_size);
         }
     }
 
-    return 0;
+    return -ERR_INV_CACHE;
+}
+
+void get_sampling_config(const struct arg_info& info,
+        shards_config_t& sampling) {
+    sampling.rate = info.sample_rate;
+    sampling.max_lines = shards_sampler_t::lines_for_error(info.sample_error);
 }
 
-int analyze_records(const global_data_t& global_data, int analysis_flags,
-        const struct arg_info& info) {
+int analyze_records(const char* filename, const global_data_t& global_data,
+        const trace_filter_t& trace_filter, const filter_config_t& filter,
+        int analysis_flags, const struct arg_info& info, result_db_t* db) {
     int code = 0;
     const int num_streams = global_data.stream_list.size();
 
-    if (analysis_flags & (ANALYSIS_CACHE_CONFLICTS | ANALYSIS_REUSE_DISTANCE)) {
-        if (info.bot == false) {
-            std::cout << macpoprefix << "Analyzing records for latency." <<
-                std::endl;
-        }
+    const bool latency = analysis_flags & (ANALYSIS_CACHE_CONFLICTS |
+            ANALYSIS_REUSE_DISTANCE);
+    const bool set_conflicts = analysis_flags & ANALYSIS_SET_CONFLICTS;
+    const bool strides = analysis_flags & ANALYSIS_STRIDES;
+
+    histogram_list_t rd_list;
+    double_list_t conflict_list;
+    histogram_list_t stride_list;
+
+    rd_list.resize(num_streams);
+    conflict_list.resize(num_streams);
+    stride_list.resize(num_streams);
+
+    int DIST_INFINITY = get_distance_limit(global_data);
+    if (DIST_INFINITY < 0 && (latency || set_conflicts))
+        return DIST_INFINITY;
+
+    shards_config_t sampling;
+    get_sampling_config(info, sampling);
+
+    // All analyses of memory accesses share a single scan of the trace.
+    latency_visitor_t latency_visitor(global_data, rd_list, conflict_list,
+            DIST_INFINITY, sampling);
+    set_conflict_visitor_t set_conflict_visitor(global_data, sampling);
+    stride_visitor_t stride_visitor(global_data, stride_list);
+
+    record_visitor_list_t visitors;
+    if (latency)
+        visitors.push_back(&latency_visitor);
 
-        histogram_list_t rd_list;
-        rd_list.resize(num_streams);
-
-        double_list_t conflict_list;
-        conflict_list.resize(num_streams);
-
-        int DIST_INFINITY;
-        if (global_data.l3_data.size != 0) {
-            const cache_data_t& l3_data = global_data.l3_data;
-            DIST_INFINITY = ceil(((double) l3_data.size) / l3_data.line_size);
-        } else if (global_data.l2_data.size != 0) {
-            const cache_data_t& l2_data = global_data.l2_data;
-            DIST_INFINITY = ceil(((double) l2_data.size) / l2_data.line_size);
-        } else if (global_data.l1_data.size != 0) {
-            const cache_data_t& l1_data = global_data.l1_data;
-            DIST_INFINITY = ceil(((double) l1_data.size) / l1_data.line_size);
-        } else {
-            return -ERR_INV_CACHE;
+    if (set_conflicts)
+        visitors.push_back(&set_conflict_visitor);
+
+    if (strides)
+        visitors.push_back(&stride_visitor);
+
+    if (latency && info.bot == false) {
+        std::cout << macpoprefix << "Analyzing records for latency." <<
+            std::endl;
+
+        if (shards_sampler_t::enabled(sampling)) {
+            std::cout << macpoprefix << "Approximating reuse distances by "
+                "sampling cache lines." << std::endl;
         }
+    }
 
-        if ((code = latency_analysis(global_data, rd_list, conflict_list,
-                        DIST_INFINITY)) < 0)
+    if (visitors.size() > 0) {
+        if ((code = scan_trace(filename, trace_filter, filter,
+                        visitors)) < 0)
             return code;
+    }
 
-        if ((code = set_cache_conflict_analysis(global_data)) < 0) 
+    if (set_conflicts) {
+        if ((code = set_conflict_visitor.finish(db)) < 0)
             return code;
+    }
 
-        print_reuse_distances(global_data, rd_list, DIST_INFINITY, info.bot);
-        print_cache_conflicts(global_data, conflict_list, info.bot);
+    if (latency) {
+        latency_visitor.finish();
+
+        if (analysis_flags & ANALYSIS_REUSE_DISTANCE) {
+            print_reuse_distances(global_data, rd_list, DIST_INFINITY,
+                    info.bot);
+
+            if (db != NULL && (code = db->add_reuse_distances(
+                            global_data.stream_list, rd_list,
+                            DIST_INFINITY)) < 0)
+                return code;
+        }
+
+        if (analysis_flags & ANALYSIS_CACHE_CONFLICTS) {
+            print_cache_conflicts(global_data, conflict_list, info.bot);
+
+            if (db != NULL && (code = db->add_cache_conflicts(
+                            global_data.stream_list, conflict_list)) < 0)
+                return code;
+        }
     }
 
-    if (analysis_flags & ANALYSIS_STRIDES) {
+    if (strides) {
         if (info.bot == false) {
             std::cout << macpoprefix << "Analyzing records for stride values." <<
                 std::endl;
         }
 
-        histogram_list_t stride_list;
-        stride_list.resize(num_streams);
+        print_strides(global_data, stride_list, info.bot);
 
-        if ((code = stride_analysis(global_data, stride_list)) < 0)
+        if (db != NULL && (code = db->add_strides(global_data.stream_list,
+                        stride_list)) < 0)
             return code;
-
-        print_strides(global_data, stride_list, info.bot);
     }
 
+    // Vector strides are recorded in a bucket of their own.
     if (analysis_flags & ANALYSIS_VECTOR_STRIDES) {
         if (info.bot == false) {
             std::cout << macpoprefix << "Analyzing records for vector stride "
@@ -159,6 +250,10 @@ int analyze_records(const global_data_t& global_data, int analysis_flags,
 
         // TODO: Change output format based on info.bot flag.
         print_vector_strides(global_data, stride_list /*, info.bot */);
+
+        if (db != NULL && (code = db->add_vector_strides(
+                        global_data.stream_list, stride_list)) < 0)
+            return code;
     }
 
     return 0;
@@ -19,11 +19,17 @@
  * $HEADER$
  */
 
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include <algorithm>
 #include <cassert>
 
 #include "err_codes.h"
 #include "generic_defs.h"
 #include "record_io.h"
+#include "trace_reader.h"
 
 static int handle_stream_msg(const stream_info_t& stream_info,
         global_data_t& global_data) {
@@ -67,8 +73,6 @@ static int handle_mem_msg(const mem_info_t& mem_info, global_data_t& global_data
 }
 
 static int handle_metadata_msg(const metadata_info_t& metadata_info, bool bot) {
-    // We don't need this metadata after we've read it,
-    // so use it and discard it instead of saving it for later.
     if (bot == false) {
         std::cout << macpoprefix << "Analyzing logs created from the binary " <<
             metadata_info.binary_name << " at " <<
@@ -136,56 +140,117 @@ int print_trace_records(const global_data_t& global_data) {
     return 0;
 }
 
-int read_file(const char* filename, global_data_t& global_data, bool bot) {
-    int code = 0;
+static int handle_node(const node_t& data_node, global_data_t& global_data,
+        bool bot, bool show_metadata) {
+    switch(data_node.type_message) {
+        case MSG_STREAM_INFO:
+            return handle_stream_msg(data_node.stream_info, global_data);
 
-    int fd;
-    if ((fd = open(filename, O_RDONLY)) < 0)
-        return -ERR_FILE;
+        case MSG_MEM_INFO:
+            return handle_mem_msg(data_node.mem_info, global_data);
+
+        case MSG_TRACE_INFO:
+            return handle_trace_msg(data_node.trace_info, global_data);
+
+        case MSG_METADATA:
+            global_data.metadata_info = data_node.metadata_info;
+            if (show_metadata == false)
+                return 0;
+
+            return handle_metadata_msg(data_node.metadata_info, bot);
+
+        case MSG_TERMINAL:
+            return handle_terminal_msg(global_data);
+
+        case MSG_VECTOR_STRIDE_INFO:
+            return handle_vector_stride_msg(data_node.vector_stride_info,
+                    global_data);
+    }
+
+    return -ERR_UNKNOWN_MSG;
+}
+
+int read_file(const char* filename, global_data_t& global_data, bool bot,
+        const trace_filter_t& filter, bool show_metadata,
+        bool load_accesses) {
+    trace_reader_t reader;
+
+    int code = reader.open(filename);
+    if (code < 0)
+        return code;
+
+    if (filter.threads.size() > 0 && reader.has_index() == false) {
+        std::cerr << "Warning: " << filename << " has no index, so records " <<
+            "cannot be selected by thread." << std::endl;
+    }
+
+    reader.set_filter(filter);
+
+    record_view_t record;
+    while ((code = reader.next(record)) > 0) {
+        if (record.type_message == MSG_MEM_INFO && load_accesses == false) {
+            // Only create the bucket that the access would have gone to.
+            if (global_data.mem_info_bucket.size() == 0)
+                global_data.mem_info_bucket.push_back(mem_info_list_t());
+
+            continue;
+        }
 
-    node_t data_node;
-    while (read(fd, &data_node, sizeof(data_node)) == sizeof(data_node)) {
-        switch(data_node.type_message) {
-            case MSG_STREAM_INFO:
-                if ((code = handle_stream_msg(data_node.stream_info,
-                        global_data)) < 0)
-                    return code;
-                break;
-
-            case MSG_MEM_INFO:
-                if ((code = handle_mem_msg(data_node.mem_info,
-                        global_data)) < 0)
-                    return code;
-                break;
-
-            case MSG_TRACE_INFO:
-                if ((code = handle_trace_msg(data_node.trace_info,
-                        global_data)) < 0)
-                    return code;
-                break;
-
-            case MSG_METADATA:
-                if ((code = handle_metadata_msg(data_node.metadata_info,
-                        bot)) < 0)
-                    return code;
-                break;
-
-            case MSG_TERMINAL:
-                if ((code = handle_terminal_msg(global_data)) < 0)
-                    return code;
-                break;
-
-            case MSG_VECTOR_STRIDE_INFO:
-                if ((code = handle_vector_stride_msg(data_node.vector_stride_info,
-                        global_data)) < 0)
-                    return code;
-                break;
-
-            default:
-                return -ERR_UNKNOWN_MSG;
+        node_t data_node;
+        code = reader.unpack(record, data_node);
+        if (code == -ERR_UNKNOWN_MSG) {
+            // Records carry their length,
+            // so skip over types that we don't understand.
+            continue;
         }
+
+        if (code < 0 || (code = handle_node(data_node, global_data, bot,
+                        show_metadata)) < 0)
+            break;
+    }
+
+    if (code == 0 && reader.truncated_at() != (size_t) -1) {
+        std::cerr << "Warning: " << filename << " ends with a partial " <<
+            "record at byte " << reader.truncated_at() << ", ignoring it." <<
+            std::endl;
+    }
+
+    return code;
+}
+
+int find_trace_files(const char* location, name_list_t& filenames) {
+    struct stat st;
+    if (stat(location, &st) < 0)
+        return -ERR_FILE;
+
+    if (S_ISDIR(st.st_mode) == 0) {
+        filenames.push_back(location);
+        return 0;
     }
 
-    close(fd);
+    DIR* dir = opendir(location);
+    if (dir == NULL)
+        return -ERR_FILE;
+
+    // Every process writes macpo.<pid>.out, macpo.out only links to one of
+    // them.
+    name_list_t found;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (fnmatch("macpo.*.out", entry->d_name, 0) != 0)
+            continue;
+
+        std::string filename = std::string(location) + "/" + entry->d_name;
+        if (stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            found.push_back(filename);
+    }
+
+    closedir(dir);
+
+    if (found.size() == 0)
+        return -ERR_FILE;
+
+    std::sort(found.begin(), found.end());
+    filenames.insert(filenames.end(), found.begin(), found.end());
     return 0;
-}                        
+}
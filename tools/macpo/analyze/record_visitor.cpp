@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#include <algorithm>
+
+#include "err_codes.h"
+#include "record_visitor.h"
+
+// Opens bucket `index' for the analyses that are interested in it.
+static void begin_bucket(const record_visitor_list_t& visitors, size_t index,
+        const mem_info_list_t& list, record_visitor_list_t& owners,
+        std::vector<bucket_visitor_t*>& bucket_visitors) {
+    for (size_t k=0; k<visitors.size(); k++) {
+        bucket_visitor_t* visitor = visitors[k]->begin_bucket(index, list);
+        if (visitor != NULL) {
+            owners.push_back(visitors[k]);
+            bucket_visitors.push_back(visitor);
+        }
+    }
+}
+
+static void visit_list(const mem_info_list_t& list,
+        const std::vector<bucket_visitor_t*>& bucket_visitors) {
+    const size_t count = bucket_visitors.size();
+    if (count == 0)
+        return;
+
+    for (mem_info_list_t::const_iterator it = list.begin(); it != list.end();
+            it++) {
+        for (size_t k=0; k<count; k++) {
+            bucket_visitors[k]->visit(*it);
+        }
+    }
+}
+
+static void end_bucket(size_t index, const record_visitor_list_t& owners,
+        const std::vector<bucket_visitor_t*>& bucket_visitors) {
+    for (size_t k=0; k<owners.size(); k++) {
+        owners[k]->end_bucket(index, bucket_visitors[k]);
+    }
+}
+
+static void end_batch(const record_visitor_list_t& visitors) {
+    for (size_t k=0; k<visitors.size(); k++) {
+        visitors[k]->end_batch();
+    }
+}
+
+int scan_buckets(const mem_info_bucket_t& bucket, size_t first_index,
+        const record_visitor_list_t& visitors) {
+    #pragma omp parallel for schedule(dynamic)
+    for (int i=0; i<bucket.size(); i++) {
+        const mem_info_list_t& list = bucket.at(i);
+
+        // Only keep analyses that are interested in this bucket.
+        record_visitor_list_t owners;
+        std::vector<bucket_visitor_t*> bucket_visitors;
+        begin_bucket(visitors, first_index + i, list, owners,
+                bucket_visitors);
+
+        visit_list(list, bucket_visitors);
+        end_bucket(first_index + i, owners, bucket_visitors);
+    }
+
+    end_batch(visitors);
+    return 0;
+}
+
+// Reads the buckets of a trace in batches, see record_visitor.h.
+class trace_scanner_t {
+ public:
+    trace_scanner_t(const char* filename, const trace_filter_t& trace_filter,
+            const filter_config_t& filter,
+            const record_visitor_list_t& visitors) : filename(filename),
+            trace_filter(trace_filter), filter(filter), visitors(visitors),
+            first_index(0), records(0), views(0), bucket_start(0),
+            lookahead_open(false), lookahead_views(0) {
+    }
+
+    int scan();
+
+ private:
+    const char* filename;
+    const trace_filter_t& trace_filter;
+    const filter_config_t& filter;
+    const record_visitor_list_t& visitors;
+
+    trace_reader_t reader;
+    mem_info_bucket_t batch;
+    size_t first_index;     // Index of the first bucket of the batch.
+    size_t records;         // Records in the batch.
+    size_t views;           // Records read from the trace.
+    size_t bucket_start;    // Records read before the last bucket.
+
+    // Counts the records of buckets that are streamed.
+    trace_reader_t lookahead;
+    bool lookahead_open;
+    size_t lookahead_views;
+
+    void start_bucket();
+    int scan_batch();
+    int stream_bucket();
+    int count_lines(line_filter_t& line_filter);
+    int read_chunk(const line_filter_t& line_filter, mem_info_list_t& chunk,
+            bool& ended);
+};
+
+void trace_scanner_t::start_bucket() {
+    batch.push_back(mem_info_list_t());
+    bucket_start = views;
+}
+
+// Filters and scans the buckets read so far, then frees them.
+int trace_scanner_t::scan_batch() {
+    int code;
+    if ((code = filter_low_freq_records(batch, filter)) < 0 ||
+            (code = scan_buckets(batch, first_index, visitors)) < 0)
+        return code;
+
+    first_index += batch.size();
+    records = 0;
+    mem_info_bucket_t().swap(batch);
+    return 0;
+}
+
+int trace_scanner_t::count_lines(line_filter_t& line_filter) {
+    int code;
+    if (lookahead_open == false) {
+        if ((code = lookahead.open(filename)) < 0)
+            return code;
+
+        lookahead.set_filter(trace_filter);
+        lookahead_open = true;
+    }
+
+    // Both readers see the same records, so skip to the start of the bucket.
+    record_view_t record;
+    while (lookahead_views < bucket_start) {
+        if ((code = lookahead.next(record)) <= 0)
+            return code < 0 ? code : -ERR_INV_DATA;
+
+        lookahead_views++;
+    }
+
+    while ((code = lookahead.next(record)) > 0) {
+        lookahead_views++;
+        if (record.type_message == MSG_TERMINAL)
+            break;
+
+        if (record.type_message != MSG_MEM_INFO)
+            continue;
+
+        node_t data_node;
+        if ((code = lookahead.unpack(record, data_node)) < 0)
+            return code;
+
+        line_filter.count(data_node.mem_info);
+    }
+
+    return code < 0 ? code : 0;
+}
+
+// Reads up to SCAN_BATCH_RECORDS records of the last bucket into `chunk',
+// keeping those of the lines that `line_filter' selects. Sets `ended' at the
+// end of the bucket. Returns 1 if there are more records to read, 0 at the
+// end of the trace or a negative error code.
+int trace_scanner_t::read_chunk(const line_filter_t& line_filter,
+        mem_info_list_t& chunk, bool& ended) {
+    record_view_t record;
+    for (size_t count = 0; count < SCAN_BATCH_RECORDS; ) {
+        int code = reader.next(record);
+        if (code <= 0) {
+            ended = true;
+            return code;
+        }
+
+        views++;
+        if (record.type_message == MSG_TERMINAL) {
+            ended = true;
+            return 1;
+        }
+
+        if (record.type_message != MSG_MEM_INFO)
+            continue;
+
+        node_t data_node;
+        if ((code = reader.unpack(record, data_node)) < 0)
+            return code;
+
+        if (line_filter.keep(data_node.mem_info))
+            chunk.push_back(data_node.mem_info);
+
+        count++;
+    }
+
+    return 1;
+}
+
+// Scans the last bucket of the batch, which is too large to be loaded, on its
+// own. Returns 1 if it ended with a terminal record, 0 at the end of the
+// trace or a negative error code.
+int trace_scanner_t::stream_bucket() {
+    mem_info_list_t chunk;
+    chunk.swap(batch.back());
+    batch.pop_back();
+
+    // Buckets before this one are scanned first.
+    int code;
+    if ((code = scan_batch()) < 0)
+        return code;
+
+    line_filter_t line_filter(filter);
+    if ((code = count_lines(line_filter)) < 0)
+        return code;
+
+    line_filter.select();
+    chunk.erase(std::remove_if(chunk.begin(), chunk.end(),
+                low_freq_record_t(line_filter)), chunk.end());
+
+    const size_t index = first_index++;
+    record_visitor_list_t owners;
+    std::vector<bucket_visitor_t*> bucket_visitors;
+    begin_bucket(visitors, index, chunk, owners, bucket_visitors);
+
+    code = 1;
+    bool ended = false;
+    while (true) {
+        visit_list(chunk, bucket_visitors);
+        if (ended)
+            break;
+
+        end_batch(visitors);
+        chunk.clear();
+        if ((code = read_chunk(line_filter, chunk, ended)) < 0)
+            return code;
+    }
+
+    end_bucket(index, owners, bucket_visitors);
+    end_batch(visitors);
+    return code;
+}
+
+int trace_scanner_t::scan() {
+    int code = reader.open(filename);
+    if (code < 0)
+        return code;
+
+    reader.set_filter(trace_filter);
+
+    // Buckets are split as read_file() splits them: every terminal record
+    // starts a new bucket, and accesses before the first one start the
+    // first bucket.
+    record_view_t record;
+    while ((code = reader.next(record)) > 0) {
+        views++;
+        if (record.type_message == MSG_TERMINAL) {
+            // All buckets read so far are complete.
+            if (records >= SCAN_BATCH_RECORDS && (code = scan_batch()) < 0)
+                return code;
+
+            start_bucket();
+            continue;
+        }
+
+        if (record.type_message != MSG_MEM_INFO)
+            continue;
+
+        node_t data_node;
+        if ((code = reader.unpack(record, data_node)) < 0)
+            return code;
+
+        if (batch.size() == 0)
+            batch.push_back(mem_info_list_t());
+
+        batch.back().push_back(data_node.mem_info);
+        records++;
+
+        if (batch.back().size() >= SCAN_BATCH_RECORDS) {
+            if ((code = stream_bucket()) <= 0)
+                return code;
+
+            start_bucket();
+        }
+    }
+
+    if (code < 0)
+        return code;
+
+    return scan_batch();
+}
+
+int scan_trace(const char* filename, const trace_filter_t& trace_filter,
+        const filter_config_t& filter, const record_visitor_list_t& visitors) {
+    trace_scanner_t scanner(filename, trace_filter, filter, visitors);
+    return scanner.scan();
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#include <argp.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include "cache_replay.h"
+#include "err_codes.h"
+
+typedef struct {
+    replay_config_list_t configs;
+    const char* filename;
+    int format;
+    size_t top_lines;
+    bool bot;
+} replay_args_t;
+
+static struct argp_option options[] = {
+    { "cache", 'c', "LEVELS", 0, "Replay the trace through the cache "
+        "hierarchy given by the comma-separated LEVELS, from the first one, "
+        "each one as SIZE:LINE:WAYS[:POLICY[:INCLUSION]], e.g. "
+        "32K:64:8,1M:64:16:plru:inclusive. POLICY is lru [default] or plru "
+        "and INCLUSION is what a level keeps of the lines of the level above "
+        "it: non-inclusive [default], inclusive or exclusive. Repeat to "
+        "replay independent hierarchies in parallel. Defaults to the data "
+        "caches of this machine", 0 },
+    { "format", 'f', "FORMAT", 0, "Format of the trace: macpo [default] or "
+        "raw (a plain sequence of replay_record_t records, see "
+        "cache_replay.h)", 0 },
+    { "top-lines", 'k', "K", 0, "Report the hit ratio of the K source lines "
+        "with the most accesses, 0 for all of them [default: 10]", 0 },
+    { "iamabot", 'b', NULL, 0, "Print output in an easy-to-parse format", 0 },
+    { 0, 0, 0, 0, 0, 0 }
+};
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state) {
+    replay_args_t* args = (replay_args_t*) state->input;
+
+    switch (key) {
+        case 'c': {
+            replay_config_t config;
+            if (parse_replay_config(arg, config) == false)
+                argp_error(state, "invalid cache hierarchy \"%s\"", arg);
+
+            args->configs.push_back(config);
+            break;
+        }
+
+        case 'f':
+            if (strcmp(arg, "macpo") == 0)
+                args->format = FORMAT_MACPO;
+            else if (strcmp(arg, "raw") == 0)
+                args->format = FORMAT_RAW;
+            else
+                argp_error(state, "unknown trace format \"%s\"", arg);
+
+            break;
+
+        case 'k': {
+            char* end = NULL;
+            errno = 0;
+            args->top_lines = strtoul(arg, &end, 10);
+            if (errno != 0 || end == arg || *end != '\0')
+                argp_error(state, "invalid number of lines \"%s\"", arg);
+
+            break;
+        }
+
+        case 'b':
+            args->bot = true;
+            break;
+
+        case ARGP_KEY_ARG:
+            if (args->filename != NULL)
+                argp_error(state, "only one trace can be replayed at a time");
+
+            args->filename = arg;
+            break;
+
+        case ARGP_KEY_END:
+            if (args->filename == NULL)
+                argp_usage(state);
+
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+// cache_sim prints its banners and statistics to stdout. To keep the output
+// parseable with --iamabot, they are sent to stderr instead while caches are
+// created and destroyed. Returns the descriptor to restore, or -1.
+static int divert_stdout(bool bot) {
+    if (bot == false)
+        return -1;
+
+    std::cout.flush();
+    fflush(stdout);
+
+    int saved = dup(STDOUT_FILENO);
+    if (saved >= 0)
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    return saved;
+}
+
+static void restore_stdout(int saved) {
+    if (saved < 0)
+        return;
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+static struct argp argp = { options, parse_opt, "TRACE",
+    "Replays the memory accesses of a trace through simulated caches.", NULL,
+    NULL, NULL };
+
+int main(int argc, char *argv[]) {
+    int code = 0;
+    replay_args_t args;
+    args.filename = NULL;
+    args.format = FORMAT_MACPO;
+    args.top_lines = 10;
+    args.bot = false;
+
+    argp_parse(&argp, argc, argv, 0, 0, &args);
+
+    replay_config_list_t& configs = args.configs;
+    if (configs.size() == 0) {
+        replay_config_t config;
+        if ((code = machine_replay_config(config)) < 0) {
+            std::cerr << "Failed to load cache information, terminating." <<
+                std::endl;
+
+            return code;
+        }
+
+        configs.push_back(config);
+    }
+
+    // cache_sim prints as it creates and destroys caches, so that is done
+    // outside of the parallel region.
+    int saved_stdout = divert_stdout(args.bot);
+    for (size_t i = 0; i < configs.size(); i++) {
+        if ((code = create_replay_caches(configs[i])) < 0) {
+            std::cerr << "Failed to create the caches of " <<
+                configs[i].name << ", terminating." << std::endl;
+
+            for (size_t j = 0; j < i; j++)
+                destroy_replay_caches(configs[j]);
+
+            restore_stdout(saved_stdout);
+            return code;
+        }
+    }
+
+    restore_stdout(saved_stdout);
+
+    if (args.bot == false) {
+        std::cout << macpoprefix << "Replaying " << args.filename <<
+            " through " << configs.size() << " cache configuration(s)." <<
+            std::endl;
+    }
+
+    // Configurations share nothing but the (read-only) trace.
+    std::vector<int> codes(configs.size(), 0);
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < (int) configs.size(); i++) {
+        codes[i] = replay_trace(args.filename, args.format, configs[i]);
+    }
+
+    for (size_t i = 0; i < configs.size(); i++) {
+        if (codes[i] < 0) {
+            std::cerr << "Failed to replay " << args.filename << " through " <<
+                configs[i].name << "." << std::endl;
+
+            code = codes[i];
+        } else {
+            print_replay_results(configs[i], i + 1, args.top_lines, args.bot);
+        }
+
+        saved_stdout = divert_stdout(args.bot);
+        destroy_replay_caches(configs[i]);
+        restore_stdout(saved_stdout);
+    }
+
+    return code;
+}
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+
+#include <unistd.h>
+
+#include <iostream>
+
+#include "err_codes.h"
+#include "result_db.h"
+
+static const char* schema =
+    "CREATE TABLE trace (id INTEGER PRIMARY KEY, filename VARCHAR, "
+        "binary VARCHAR, timestamp INTEGER);"
+    "CREATE TABLE reuse_distance (stream VARCHAR, distance INTEGER, "
+        "count REAL);"
+    "CREATE TABLE cache_conflict (stream VARCHAR, ratio REAL);"
+    "CREATE TABLE stride (stream VARCHAR, stride INTEGER, count REAL);"
+    "CREATE TABLE vector_stride (stream VARCHAR, stride INTEGER, count REAL);"
+    "CREATE TABLE cache_level (level INTEGER, size INTEGER, "
+        "line_size INTEGER, ways INTEGER, sets INTEGER, accesses REAL, "
+        "hits REAL, cold_misses REAL, conflict_misses REAL, "
+        "capacity_misses REAL);"
+    "CREATE TABLE set_conflict (level INTEGER, core INTEGER, "
+        "set_number INTEGER, count REAL, streams VARCHAR);"
+    "CREATE TABLE rank_stats (trace INTEGER, stream VARCHAR, accesses REAL, "
+        "writes REAL, lines REAL, conflict_ratio REAL, outlier VARCHAR);"
+    "CREATE TABLE failed_trace (filename VARCHAR, error INTEGER);";
+
+// Indexed by the STMT_* constants.
+static const char* inserts[] = {
+    "INSERT INTO trace (filename, binary, timestamp) VALUES (?, ?, ?);",
+    "INSERT INTO reuse_distance VALUES (?, ?, ?);",
+    "INSERT INTO cache_conflict VALUES (?, ?);",
+    "INSERT INTO stride VALUES (?, ?, ?);",
+    "INSERT INTO vector_stride VALUES (?, ?, ?);",
+    "INSERT INTO cache_level VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);",
+    "INSERT INTO set_conflict VALUES (?, ?, ?, ?, ?);",
+    "INSERT INTO rank_stats VALUES (?, ?, ?, ?, ?, ?, ?);",
+    "INSERT INTO failed_trace VALUES (?, ?);"
+};
+
+result_db_t::result_db_t() : db(NULL) {
+    for (int i=0; i<NUM_STATEMENTS; i++) {
+        statements[i] = NULL;
+    }
+}
+
+result_db_t::~result_db_t() {
+    close();
+}
+
+int result_db_t::exec(const char* sql) {
+    char* error = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &error) != SQLITE_OK) {
+        std::cerr << "SQL error: " << error << std::endl;
+        sqlite3_free(error);
+        return -ERR_DATABASE;
+    }
+
+    return 0;
+}
+
+int result_db_t::step(sqlite3_stmt* statement) {
+    int code = sqlite3_step(statement);
+    sqlite3_reset(statement);
+
+    if (code != SQLITE_DONE) {
+        std::cerr << "SQL error: " << sqlite3_errmsg(db) << std::endl;
+        return -ERR_DATABASE;
+    }
+
+    return 0;
+}
+
+int result_db_t::open(const char* filename) {
+    int code = 0;
+    char pragma[64];
+
+    close();
+
+    // Results of an earlier run would otherwise be mixed with ours.
+    unlink(filename);
+
+    if (sqlite3_open(filename, &db) != SQLITE_OK) {
+        std::cerr << "Failed to open " << filename << ": " <<
+            sqlite3_errmsg(db) << std::endl;
+
+        sqlite3_close(db);
+        db = NULL;
+        return -ERR_DATABASE;
+    }
+
+    snprintf(pragma, sizeof(pragma), "PRAGMA user_version = %d;",
+            RESULT_DB_VERSION);
+    if ((code = exec(pragma)) < 0 || (code = exec(schema)) < 0 ||
+            (code = exec("BEGIN TRANSACTION;")) < 0) {
+        close();
+        return code;
+    }
+
+    for (int i=0; i<NUM_STATEMENTS; i++) {
+        if (sqlite3_prepare_v2(db, inserts[i], -1, &statements[i],
+                    NULL) != SQLITE_OK) {
+            std::cerr << "SQL error: " << sqlite3_errmsg(db) << std::endl;
+            close();
+            return -ERR_DATABASE;
+        }
+    }
+
+    return 0;
+}
+
+int result_db_t::close() {
+    int code = 0;
+    if (db == NULL)
+        return 0;
+
+    for (int i=0; i<NUM_STATEMENTS; i++) {
+        sqlite3_finalize(statements[i]);
+        statements[i] = NULL;
+    }
+
+    if (sqlite3_get_autocommit(db) == 0)
+        code = exec("COMMIT;");
+
+    sqlite3_close(db);
+    db = NULL;
+    return code;
+}
+
+int result_db_t::add_trace(const std::string& filename,
+        const metadata_info_t& metadata, int& id) {
+    sqlite3_stmt* statement = statements[STMT_TRACE];
+    sqlite3_bind_text(statement, 1, filename.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(statement, 2, metadata.binary_name, -1,
+            SQLITE_TRANSIENT);
+    sqlite3_bind_int64(statement, 3, metadata.execution_timestamp);
+
+    int code = step(statement);
+    if (code < 0)
+        return code;
+
+    id = sqlite3_last_insert_rowid(db);
+    return 0;
+}
+
+int result_db_t::add_histograms(sqlite3_stmt* statement,
+        const name_list_t& stream_list, const histogram_list_t& list,
+        size_t infinity) {
+    int code = 0;
+    for (size_t i=0; i<list.size() && i<stream_list.size(); i++) {
+        if (list[i] == NULL)
+            continue;
+
+        const sparse_histogram_t::pair_list_t bins = list[i]->sort();
+        for (size_t j=0; j<bins.size(); j++) {
+            sqlite3_bind_text(statement, 1, stream_list[i].c_str(), -1,
+                    SQLITE_STATIC);
+
+            if (bins[j].first == infinity) {
+                sqlite3_bind_null(statement, 2);
+            } else {
+                sqlite3_bind_int64(statement, 2, bins[j].first);
+            }
+
+            sqlite3_bind_double(statement, 3, bins[j].second);
+
+            if ((code = step(statement)) < 0)
+                return code;
+        }
+    }
+
+    return 0;
+}
+
+int result_db_t::add_reuse_distances(const name_list_t& stream_list,
+        const histogram_list_t& rd_list, const int DIST_INFINITY) {
+    return add_histograms(statements[STMT_REUSE_DISTANCE], stream_list,
+            rd_list, DIST_INFINITY - 1);
+}
+
+int result_db_t::add_cache_conflicts(const name_list_t& stream_list,
+        const double_list_t& conflict_list) {
+    sqlite3_stmt* statement = statements[STMT_CACHE_CONFLICT];
+
+    int code = 0;
+    for (size_t i=0; i<conflict_list.size() && i<stream_list.size(); i++) {
+        double ratio = conflict_list[i];
+        if (ratio < 0)
+            ratio = 0;
+
+        if (ratio > 1)
+            ratio = 1;
+
+        sqlite3_bind_text(statement, 1, stream_list[i].c_str(), -1,
+                SQLITE_STATIC);
+        sqlite3_bind_double(statement, 2, ratio);
+
+        if ((code = step(statement)) < 0)
+            return code;
+    }
+
+    return 0;
+}
+
+int result_db_t::add_strides(const name_list_t& stream_list,
+        const histogram_list_t& stride_list) {
+    // Strides have no infinity.
+    return add_histograms(statements[STMT_STRIDE], stream_list, stride_list,
+            (size_t) -1);
+}
+
+int result_db_t::add_vector_strides(const name_list_t& stream_list,
+        const histogram_list_t& stride_list) {
+    return add_histograms(statements[STMT_VECTOR_STRIDE], stream_list,
+            stride_list, (size_t) -1);
+}
+
+int result_db_t::add_cache_level(int level, size_t size, size_t line_size,
+        size_t ways, size_t sets, double accesses, double hits,
+        double cold_misses, double conflict_misses, double capacity_misses) {
+    sqlite3_stmt* statement = statements[STMT_CACHE_LEVEL];
+    sqlite3_bind_int(statement, 1, level);
+    sqlite3_bind_int64(statement, 2, size);
+    sqlite3_bind_int64(statement, 3, line_size);
+    sqlite3_bind_int64(statement, 4, ways);
+    sqlite3_bind_int64(statement, 5, sets);
+    sqlite3_bind_double(statement, 6, accesses);
+    sqlite3_bind_double(statement, 7, hits);
+    sqlite3_bind_double(statement, 8, cold_misses);
+    sqlite3_bind_double(statement, 9, conflict_misses);
+    sqlite3_bind_double(statement, 10, capacity_misses);
+
+    return step(statement);
+}
+
+int result_db_t::add_set_conflict(int level, int core, size_t set_number,
+        double count, const std::string& streams) {
+    sqlite3_stmt* statement = statements[STMT_SET_CONFLICT];
+    sqlite3_bind_int(statement, 1, level);
+    sqlite3_bind_int(statement, 2, core);
+    sqlite3_bind_int64(statement, 3, set_number);
+    sqlite3_bind_double(statement, 4, count);
+    sqlite3_bind_text(statement, 5, streams.c_str(), -1, SQLITE_STATIC);
+
+    return step(statement);
+}
+
+int result_db_t::add_rank_stats(int trace, const std::string& stream,
+        double accesses, double writes, double lines, double conflict_ratio,
+        const std::string& outlier) {
+    sqlite3_stmt* statement = statements[STMT_RANK_STATS];
+    sqlite3_bind_int(statement, 1, trace);
+    sqlite3_bind_text(statement, 2, stream.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_double(statement, 3, accesses);
+    sqlite3_bind_double(statement, 4, writes);
+    sqlite3_bind_double(statement, 5, lines);
+    sqlite3_bind_double(statement, 6, conflict_ratio);
+
+    if (outlier.size() > 0) {
+        sqlite3_bind_text(statement, 7, outlier.c_str(), -1, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_null(statement, 7);
+    }
+
+    return step(statement);
+}
+
+int result_db_t::add_failed_trace(const std::string& filename, int error) {
+    sqlite3_stmt* statement = statements[STMT_FAILED_TRACE];
+    sqlite3_bind_text(statement, 1, filename.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(statement, 2, error);
+
+    return step(statement);
+}
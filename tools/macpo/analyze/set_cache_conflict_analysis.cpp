@@ -19,168 +19,450 @@
  * $HEADER$
  */
 
-#include <cassert>
-#include <map>
-#include <vector>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
 #include <string>
+#include <vector>
 
 #include "analysis_defs.h"
+#include "err_codes.h"
 #include "reuse_distance.h"
 #include "histogram.h"
-#include <iostream>
+#include "record_visitor.h"
+#include "result_db.h"
 
 #include "set_cache_conflict_analysis.h"
-#include "associative_cache.h"
 
-// TODO(goyalankit): remove hardcoded associativity
-#define ASSOCIATIVITY 8
+// Weighted counts are printed as whole numbers.
+#define ROUND_COUNT(x)  ((uint64_t) ((x) + 0.5))
 
 typedef std::vector<reuse_distance_manager *> reuse_distance_list_t;
 
-// creates a bit mask with bits between a and b from the right as 1.
-// example: b = 4, a = 2 => 0000001100
-#define BIT_MASK(a, b) (size_t)(((size_t) -1 >> ((sizeof(size_t)*8) \
-                - (b))) & ~((1U << (a)) - 1))
+typedef std::vector<eviction_t> eviction_list_t;
 
-unsigned address_to_set(size_t address) {
-    return ((address & BIT_MASK(6, 12)) >> 6);
-}
+// Results for one core at one cache level.
+typedef struct {
+    cache_stats_t cache_stats;
+    set_conflict_map_t set_conflicts;
+} core_result_t;
 
-template < class T, class U>
-inline std::ostream& operator << (std::ostream& os, const std::map<T, U>& v) {
-    os << "[";
-    for (typename std::map<T, U>::const_iterator ii = v.begin();
-            ii != v.end(); ++ii) {
-        os << " " << ii->first;
+// Replay state of one core at one cache level, kept across batches.
+struct core_replay_t {
+    avl_tree tree;
+    reuse_distance_list_t set_rd_list;
+    core_result_t result;
+
+    explicit core_replay_t(const cache_geometry_t& geometry) :
+            set_rd_list(geometry.sets, NULL) {
+    }
+
+    ~core_replay_t() {
+        for (size_t i = 0; i < set_rd_list.size(); i++) {
+            delete set_rd_list[i];
+        }
     }
-    os << " ]";
-    return os;
+};
+
+int get_cache_geometry(const cache_data_t& cache_data, int level,
+        cache_geometry_t& geometry) {
+    if (cache_data.size == 0 || cache_data.line_size == 0)
+        return -ERR_INV_CACHE;
+
+    geometry.level = level;
+    geometry.line_size = cache_data.line_size;
+    geometry.lines = std::max(cache_data.size / cache_data.line_size,
+            (size_t) 1);
+
+    // hwloc reports 0 if the associativity is unknown
+    // and -1 for fully-associative caches.
+    size_t ways = cache_data.associativity;
+    if (ways == 0)
+        ways = DEFAULT_ASSOCIATIVITY;
+
+    geometry.ways = std::min(ways, geometry.lines);
+    geometry.sets = std::max(geometry.lines / geometry.ways, (size_t) 1);
+
+    // Caches with a power-of-two number of sets are indexed with a mask.
+    bool power_of_two = (geometry.sets & (geometry.sets - 1)) == 0;
+    geometry.set_mask = power_of_two ? geometry.sets - 1 : 0;
+    return 0;
 }
 
-void print_set_conflicts(std::vector<conflict_list_t> &conflicts,
-        int num_sets, const name_list_t &stream_info) {
-    int total_conflicts = 0;
-    std::map< int, std::map<int, int>* > core_set_var_conf;
-    std::map<int, std::map<int, std::map<std::string, int> > > core_set_var_name;
-    for (int core_id = 0; core_id < conflicts.size(); core_id++) {
-        core_set_var_conf[core_id] = new std::map<int, int>();
-        for (int n = 0; n < conflicts[core_id].size(); n++) {
-            conflict_t ct = conflicts[core_id][n];
-            total_conflicts++;
-            (*core_set_var_conf[core_id])[ct.set_number]++;
-            core_set_var_name[core_id][ct.set_number][stream_info[ct.var_idx]] = 1;
+size_t address_to_set(size_t address, const cache_geometry_t& geometry) {
+    size_t cache_line = address / geometry.line_size;
+    if (geometry.set_mask != 0)
+        return cache_line & geometry.set_mask;
 
+    return cache_line % geometry.sets;
+}
+
+void print_set_conflicts(const core_result_t* results, int num_cores,
+        const name_list_t &stream_info) {
+    double total_conflicts = 0;
+    for (int core_id = 0; core_id < num_cores; core_id++) {
+        const set_conflict_map_t& set_conflicts = results[core_id].set_conflicts;
+        for (set_conflict_map_t::const_iterator it = set_conflicts.begin();
+                it != set_conflicts.end(); ++it) {
+            total_conflicts += it->second.count;
         }
     }
 
-    std::cout << "Total Conflicts: " << total_conflicts << std::endl;
+    std::cout << "Total Conflicts: " << ROUND_COUNT(total_conflicts) <<
+        std::endl;
 
-    for (int i = 0; i < core_set_var_conf.size(); ++i) {
-        if (core_set_var_conf[i]->size() != 0) {
+    for (int i = 0; i < num_cores; ++i) {
+        const set_conflict_map_t& set_conflicts = results[i].set_conflicts;
+        if (set_conflicts.size() != 0) {
             std::cout << "Conflicts for core number: " << i << std::endl;
             std::cout << "set_num" << " " << "num_conflicts" << std::endl;
         }
 
-        for (std::map<int, int>::iterator it = core_set_var_conf[i]->begin();
-                it != core_set_var_conf[i]->end(); ++it) {
-            std::cout << it->first << " " << it->second <<  " "
-                << core_set_var_name[i][it->first] << std::endl;
+        for (set_conflict_map_t::const_iterator it = set_conflicts.begin();
+                it != set_conflicts.end(); ++it) {
+            std::cout << it->first << " " << ROUND_COUNT(it->second.count) <<
+                " [";
+
+            const std::set<size_t>& var_idx_set = it->second.var_idx_set;
+            for (std::set<size_t>::const_iterator var = var_idx_set.begin();
+                    var != var_idx_set.end(); ++var) {
+                std::cout << " " << stream_info[*var];
+            }
+
+            std::cout << " ]" << std::endl;
         }
     }
 }
 
-void printCacheInformation(cache_data_t cache_data, int number_of_sets) {
-    std::cout << "----- Cache Information ----------" << std::endl;
-    std::cout << "Cache size:            " << cache_data.size << std::endl;
-    std::cout << "Cache line size:       " << cache_data.line_size << std::endl;
-    std::cout << "Number of cache lines: " << (cache_data.size / cache_data.line_size) << std::endl;
-    std::cout << "Cache associativity:   " << ASSOCIATIVITY << std::endl;
-    std::cout << "Number of sets:        " << number_of_sets <<  std::endl;
-}
+static int store_set_conflicts(result_db_t* db,
+        const cache_geometry_t& geometry, const cache_stats_t& cache_stats,
+        const core_result_t* results, int num_cores,
+        const name_list_t& stream_info) {
+    int code = db->add_cache_level(geometry.level,
+            geometry.lines * geometry.line_size, geometry.line_size,
+            geometry.ways, geometry.sets, cache_stats.addr_accesses,
+            cache_stats.addr_hits, cache_stats.addr_cold_misses,
+            cache_stats.addr_conflict_misses,
+            cache_stats.addr_capacity_misses);
+    if (code < 0)
+        return code;
 
+    for (int core_id = 0; core_id < num_cores; core_id++) {
+        const set_conflict_map_t& set_conflicts = results[core_id].set_conflicts;
+        for (set_conflict_map_t::const_iterator it = set_conflicts.begin();
+                it != set_conflicts.end(); ++it) {
+            std::string streams;
+            const std::set<size_t>& var_idx_set = it->second.var_idx_set;
+            for (std::set<size_t>::const_iterator var = var_idx_set.begin();
+                    var != var_idx_set.end(); ++var) {
+                streams += streams.size() > 0 ? "," : "";
+                streams += stream_info[*var];
+            }
 
-int set_cache_conflict_analysis(const global_data_t& global_data) {
-    const mem_info_bucket_t& bucket = global_data.mem_info_bucket;
-    const int num_cores = sysconf(_SC_NPROCESSORS_CONF);
-    const int num_streams = global_data.stream_list.size();
-    cache_data_t l1_data = global_data.l1_data;
-    size_t l1_cache_lines = l1_data.size / l1_data.line_size;
-    l1_data.associativity = ASSOCIATIVITY;
-    cache_stats_t cache_stats;
+            if ((code = db->add_set_conflict(geometry.level, core_id,
+                            it->first, it->second.count, streams)) < 0)
+                return code;
+        }
+    }
 
-    const int num_sets = l1_data.size/
-        (l1_data.line_size  * l1_data.associativity);
-    std::vector< conflict_list_t > set_conflicts_per_core_for_l1_cache(num_cores);
-    // list of per set reuse distance manager for each core
-    std::vector<reuse_distance_list_t *> rd_trees_per_core(num_cores);
+    return 0;
+}
+
+void printCacheInformation(const cache_geometry_t& geometry) {
+    std::cout << "----- L" << geometry.level << " Cache Information ------" <<
+        std::endl;
+    std::cout << "Cache size:            " <<
+        geometry.lines * geometry.line_size << std::endl;
+    std::cout << "Cache line size:       " << geometry.line_size << std::endl;
+    std::cout << "Number of cache lines: " << geometry.lines << std::endl;
+    std::cout << "Cache associativity:   " << geometry.ways << std::endl;
+    std::cout << "Number of sets:        " << geometry.sets <<  std::endl;
+}
 
-    for (int k = 0; k < num_cores; k++) {
-        rd_trees_per_core[k] = new reuse_distance_list_t(num_sets);
-        for (int l = 0; l < num_sets; l++) {
-            (*rd_trees_per_core[k])[l] = new reuse_distance_manager();
+// Collects the records of a single bucket in trace order, dropping invalid
+// records.
+class set_conflict_bucket_t : public bucket_visitor_t {
+ public:
+    set_conflict_bucket_t(int num_cores, size_t num_streams,
+            access_list_t& accesses) : num_cores(num_cores),
+            num_streams(num_streams), skipped(0), accesses(accesses) {
+    }
+
+    void visit(const mem_info_t& mem_info) {
+        // Quick validation check.
+        if (mem_info.coreID >= num_cores || mem_info.var_idx >= num_streams) {
+            skipped++;
+        } else {
+            access_ref_t access = { mem_info.address, mem_info.var_idx, 0, 1,
+                mem_info.coreID };
+            accesses.push_back(access);
         }
     }
 
-    // cache level 1 stats
-    // std::cout << "Size: " << l1_data.size << " line_size: " << l1_data.line_size
-    //    << " count: " << l1_data.count << " Number of lines: " << l1_cache_lines << std::endl;
-    std::cout << "Getting set cache conflicts" << std::endl;
+    const int num_cores;
+    const size_t num_streams;
+    size_t skipped;
+    access_list_t& accesses;
+};
+
+set_conflict_visitor_t::set_conflict_visitor_t(
+        const global_data_t& global_data, const shards_config_t& sampling) :
+        skipped(0), sampler(sampling), position(0),
+        global_data(global_data), sampling(sampling) {
+    num_cores = sysconf(_SC_NPROCESSORS_CONF);
+
+    const cache_data_t* cache_data[] = { &global_data.l1_data,
+        &global_data.l2_data, &global_data.l3_data };
+    const int num_levels = sizeof(cache_data) / sizeof(cache_data[0]);
+
+    for (int i = 0; i < num_levels; i++) {
+        cache_geometry_t geometry;
+        if (get_cache_geometry(*cache_data[i], i + 1, geometry) == 0)
+            geometry_list.push_back(geometry);
+    }
+
+    replays.resize(geometry_list.size() * num_cores, NULL);
+}
+
+set_conflict_visitor_t::~set_conflict_visitor_t() {
+    for (size_t i = 0; i < replays.size(); i++) {
+        delete replays[i];
+    }
+}
+
+bucket_visitor_t* set_conflict_visitor_t::begin_bucket(size_t index,
+        const mem_info_list_t& list) {
+    // Map nodes do not move, so every bucket then fills its own list without
+    // locking. A bucket that is streamed is begun only once.
+    pending_bucket_t* bucket;
+    #pragma omp critical (set_conflict_analysis)
+    bucket = &pending_buckets[index];
+
+    bucket->ended = false;
+    bucket->accesses.reserve(list.size());
+    return new set_conflict_bucket_t(num_cores,
+            global_data.stream_list.size(), bucket->accesses);
+}
+
+void set_conflict_visitor_t::end_bucket(size_t index,
+        bucket_visitor_t* visitor) {
+    set_conflict_bucket_t* bucket = static_cast<set_conflict_bucket_t*>(
+            visitor);
+
+    #pragma omp atomic
+    skipped += bucket->skipped;
+
+    #pragma omp critical (set_conflict_analysis)
+    pending_buckets[index].ended = true;
+
+    delete bucket;
+}
+
+// Split the accesses of the pending buckets by core, keeping them in trace
+// order and, if sampling is enabled, dropping the accesses to lines that are
+// not sampled. This is serial since the sampler's decisions depend on the
+// order of accesses.
+void set_conflict_visitor_t::collect_accesses(
+        std::vector<access_list_t>& core_accesses,
+        eviction_list_t& evictions) {
+    const bool sample_lines = shards_sampler_t::enabled(sampling);
+
+    std::map<size_t, pending_bucket_t>::iterator it = pending_buckets.begin();
+    while (it != pending_buckets.end()) {
+        access_list_t& accesses = it->second.accesses;
+        for (size_t j = 0; j < accesses.size(); j++) {
+            access_ref_t access = accesses[j];
 
-    assert(l1_data.size != 0 && l1_data.line_size != 0
-            && l1_data.associativity !=0);
-
-    for (int i = 0; i < bucket.size(); i++) {
-        const mem_info_list_t& list = bucket.at(i);
-        unsigned set_id = 0;
-        long reuse_distance;
-        size_t core_id;
-        size_t var_idx, cache_line;
-
-        for (int j = 0; j < list.size(); j++) {
-            const mem_info_t& mem_info = list.at(j);
-            var_idx = mem_info.var_idx;
-            cache_line = ADDR_TO_CACHE_LINE(mem_info.address);
-            set_id = address_to_set(mem_info.address);
-            core_id = mem_info.coreID;
-            reuse_distance_list_t &set_rd_list = (*rd_trees_per_core[core_id]);
-            conflict_list_t &set_conflicts_for_l1_cache =
-                set_conflicts_per_core_for_l1_cache[core_id];
-
-            cache_stats.addr_accesses++;
-            // Quick validation check
-            if (core_id >= 0 && core_id < num_cores ||
-                    var_idx >= 0 && var_idx < num_streams) {
-                // if address is already seen => not a cold miss
-                reuse_distance = set_rd_list[set_id]->get_distance(cache_line);
-                if (reuse_distance != -1) {
-                    // L1 conflicts
-                    if (reuse_distance > l1_data.associativity && reuse_distance < l1_cache_lines) {
-                        conflict_t conflict(set_id, var_idx);
-                        set_conflicts_for_l1_cache.push_back(conflict);
-                        cache_stats.addr_conflict_misses++;
-                    } else if (reuse_distance >= l1_cache_lines){
-                        cache_stats.addr_capacity_misses++;
-                    } else{
-                        cache_stats.addr_hits++;
-                    }
-                } else {
-                    cache_stats.addr_cold_misses++;
+            // Positions of accesses in the trace, used to order sampler
+            // evictions.
+            access.position = position++;
+
+            if (sample_lines) {
+                bool sampled = sampler.sample(
+                        ADDR_TO_CACHE_LINE(access.address));
+
+                const std::vector<size_t>& evicted = sampler.evicted();
+                for (size_t k = 0; k < evicted.size(); k++) {
+                    eviction_t eviction = { access.position, evicted[k] };
+                    evictions.push_back(eviction);
                 }
-                set_rd_list[set_id]->insert(cache_line);
+
+                sampler.clear_evicted();
+                if (sampled == false)
+                    continue;
+
+                access.weight = sampler.weight();
+            }
+
+            core_accesses[access.core_id].push_back(access);
+        }
+
+        // Release the memory of this bucket as soon as possible. A bucket
+        // that is still being streamed receives more accesses later.
+        if (it->second.ended) {
+            pending_buckets.erase(it++);
+        } else {
+            accesses.clear();
+            it++;
+        }
+    }
+}
+
+static void insert_line(avl_tree& tree, size_t cache_line) {
+    // avl_tree works on 64-byte lines, so feed it line numbers directly.
+    mem_info_t mem_info;
+    mem_info.address = cache_line << 6;
+    tree.insert(&mem_info);
+}
+
+// Forget lines that are no longer sampled, up to `position' in the trace.
+static void apply_evictions(const cache_geometry_t& geometry,
+        const eviction_list_t& evictions, size_t& next_eviction,
+        size_t position, core_replay_t& replay) {
+    while (next_eviction < evictions.size() &&
+            evictions[next_eviction].position <= position) {
+        size_t address = evictions[next_eviction].cache_line << 6;
+        size_t cache_line = address / geometry.line_size;
+        size_t set_id = address_to_set(address, geometry);
+
+        replay.tree.make_infinite_distance(cache_line);
+        if (replay.set_rd_list[set_id] != NULL)
+            replay.set_rd_list[set_id]->remove(cache_line);
+
+        next_eviction++;
+    }
+}
+
+// Replay the accesses of one core through one cache level. A per-set
+// distance of at least the number of ways is a miss, which is a conflict
+// miss if the line would still have been in a fully-associative cache of
+// the same size and a capacity miss otherwise.
+static void analyze_core(const cache_geometry_t& geometry,
+        const access_list_t& accesses, const eviction_list_t& evictions,
+        core_replay_t& replay) {
+    avl_tree& tree = replay.tree;
+    reuse_distance_list_t& set_rd_list = replay.set_rd_list;
+    core_result_t& result = replay.result;
+    cache_stats_t& cache_stats = result.cache_stats;
+
+    size_t next_eviction = 0;
+    for (size_t i = 0; i < accesses.size(); i++) {
+        const access_ref_t& access = accesses[i];
+        apply_evictions(geometry, evictions, next_eviction, access.position,
+                replay);
+
+        const size_t cache_line = access.address / geometry.line_size;
+        const size_t set_id = address_to_set(access.address, geometry);
+        const double weight = access.weight;
+
+        if (set_rd_list[set_id] == NULL)
+            set_rd_list[set_id] = new reuse_distance_manager();
+
+        reuse_distance_manager* set_rd = set_rd_list[set_id];
+        size_t set_distance = set_rd->get_distance(cache_line);
+
+        cache_stats.addr_accesses += weight;
+        if (set_distance == (size_t) -1) {
+            cache_stats.addr_cold_misses += weight;
+        } else if (set_distance * weight < geometry.ways) {
+            cache_stats.addr_hits += weight;
+        } else {
+            size_t distance = tree.get_distance(cache_line);
+            if (distance != (size_t) -1 &&
+                    distance * weight < geometry.lines) {
+                set_conflict_t& set_conflict = result.set_conflicts[set_id];
+                set_conflict.count += weight;
+                set_conflict.var_idx_set.insert(access.var_idx);
+                cache_stats.addr_conflict_misses += weight;
             } else {
-                std::cout << "Fatal Mistake" << std::endl;
+                cache_stats.addr_capacity_misses += weight;
             }
         }
+
+        set_rd->insert(cache_line);
+        insert_line(tree, cache_line);
+    }
+
+    // Later accesses must not see lines evicted during this batch.
+    apply_evictions(geometry, evictions, next_eviction, (size_t) -1, replay);
+}
+
+void set_conflict_visitor_t::end_batch() {
+    eviction_list_t evictions;
+    std::vector<access_list_t> core_accesses(num_cores);
+    collect_accesses(core_accesses, evictions);
+
+    // Every (level, core) pair is replayed independently and writes only
+    // its own state, so no locking is needed.
+    const int num_tasks = replays.size();
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int task = 0; task < num_tasks; task++) {
+        const int level = task / num_cores;
+        const int core_id = task % num_cores;
+
+        if (replays[task] == NULL) {
+            if (core_accesses[core_id].size() == 0)
+                continue;
+
+            replays[task] = new core_replay_t(geometry_list[level]);
+        }
+
+        analyze_core(geometry_list[level], core_accesses[core_id],
+                evictions, *replays[task]);
+    }
+}
+
+int set_conflict_visitor_t::finish(result_db_t* db) {
+    if (geometry_list.size() == 0)
+        return -ERR_INV_CACHE;
+
+    std::cout << "Getting set cache conflicts" << std::endl;
+
+    // Cores without accesses have no replay state.
+    std::vector<core_result_t> results(replays.size());
+    for (size_t task = 0; task < replays.size(); task++) {
+        if (replays[task] != NULL)
+            results[task] = replays[task]->result;
+    }
+
+    if (skipped > 0) {
+        std::cout << "Skipped " << skipped << " records with invalid core " <<
+            "or stream ids." << std::endl;
     }
-    std::cout << "-----------------------------" << std::endl;
-    std::cout << "Total Address Accesses " <<  cache_stats.addr_accesses << std::endl;
-    std::cout << "Total Address Cold Misses " <<  cache_stats.addr_cold_misses << std::endl;
-    std::cout << "Total Address Conflict Misses   " <<  cache_stats.addr_conflict_misses << std::endl;
-    std::cout << "Total Address Capacity Misses   " <<  cache_stats.addr_capacity_misses << std::endl;
-    std::cout << "Total Address Hits     " <<  cache_stats.addr_hits << std::endl;
-    std::cout << "-----------------------------" << std::endl;
 
-    print_set_conflicts(set_conflicts_per_core_for_l1_cache, num_sets, global_data.stream_list);
+    if (shards_sampler_t::enabled(sampling)) {
+        std::cout << "Sampling rate " << sampler.rate() << std::endl;
+    }
+
+    for (int level = 0; level < geometry_list.size(); level++) {
+        const core_result_t* level_results = &results[level * num_cores];
+
+        cache_stats_t cache_stats;
+        for (int core_id = 0; core_id < num_cores; core_id++) {
+            cache_stats.add(level_results[core_id].cache_stats);
+        }
+
+        printCacheInformation(geometry_list[level]);
+        std::cout << "-----------------------------" << std::endl;
+        std::cout << "Total Address Accesses " <<  ROUND_COUNT(cache_stats.addr_accesses) << std::endl;
+        std::cout << "Total Address Cold Misses " <<  ROUND_COUNT(cache_stats.addr_cold_misses) << std::endl;
+        std::cout << "Total Address Conflict Misses   " <<  ROUND_COUNT(cache_stats.addr_conflict_misses) << std::endl;
+        std::cout << "Total Address Capacity Misses   " <<  ROUND_COUNT(cache_stats.addr_capacity_misses) << std::endl;
+        std::cout << "Total Address Hits     " <<  ROUND_COUNT(cache_stats.addr_hits) << std::endl;
+        std::cout << "-----------------------------" << std::endl;
+
+        print_set_conflicts(level_results, num_cores, global_data.stream_list);
+
+        if (db != NULL) {
+            int code = store_set_conflicts(db, geometry_list[level],
+                    cache_stats, level_results, num_cores,
+                    global_data.stream_list);
+            if (code < 0)
+                return code;
+        }
+    }
 
     return 0;
 }
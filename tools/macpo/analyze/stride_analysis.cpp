@@ -23,69 +23,84 @@
 #include <map>
 
 #include "histogram.h"
+#include "record_visitor.h"
 #include "stride_analysis.h"
 
-int stride_analysis(const global_data_t& global_data,
-        histogram_list_t& stride_list) {
-    const mem_info_bucket_t& bucket = global_data.mem_info_bucket;
-    const int num_cores = sysconf(_SC_NPROCESSORS_CONF);
-    const int num_streams = global_data.stream_list.size();
-
-    #pragma omp parallel for
-    for (int i=0; i<bucket.size(); i++) {
-        const mem_info_list_t& list = bucket.at(i);
-
-        std::map<size_t, size_t> last_addr;
-        histogram_list_t local_stride_list;
+// Stride histograms of a single bucket.
+class stride_bucket_t : public bucket_visitor_t {
+ public:
+    stride_bucket_t(int num_cores, int num_streams) : num_cores(num_cores),
+            num_streams(num_streams) {
         local_stride_list.resize(num_streams);
+    }
 
-        for (int j=0; j<list.size(); j++) {
-            const mem_info_t& mem_info = list.at(j);
-
-            const unsigned short core_id = mem_info.coreID;
-            const size_t var_idx = mem_info.var_idx;
-            const size_t address = mem_info.address;
-            const short read_write = mem_info.read_write;
-            const int type_size = mem_info.type_size == 0 ? 1 :
-                    mem_info.type_size;
-
-            // Quick validation check.
-            if ((core_id >= 0 && core_id < num_cores ||
-                    var_idx >= 0) && var_idx < num_streams) {
-                // Check if this address was accessed in the past.
-                if (last_addr.find(var_idx) != last_addr.end()) {
-                    size_t last_address = last_addr[var_idx];
-                    size_t stride = (address - last_address) / type_size;
-
-                    if (create_histogram_if_null(local_stride_list[var_idx],
-                                MAX_STRIDE) == 0) {
-
-                        // Occupy the last bin in case of overflow.
-                        if (stride >= MAX_STRIDE)
-                            stride = MAX_STRIDE - 1;
-
-                        gsl_histogram_increment(local_stride_list[var_idx],
-                                stride);
-                    }
+    void visit(const mem_info_t& mem_info) {
+        const unsigned short core_id = mem_info.coreID;
+        const size_t var_idx = mem_info.var_idx;
+        const size_t address = mem_info.address;
+        const short read_write = mem_info.read_write;
+        const int type_size = mem_info.type_size == 0 ? 1 :
+                mem_info.type_size;
+
+        // Quick validation check.
+        if ((core_id >= 0 && core_id < num_cores ||
+                var_idx >= 0) && var_idx < num_streams) {
+            // Check if this address was accessed in the past.
+            if (last_addr.find(var_idx) != last_addr.end()) {
+                size_t last_address = last_addr[var_idx];
+                size_t stride = (address - last_address) / type_size;
+
+                if (create_histogram_if_null(local_stride_list[var_idx],
+                            MAX_STRIDE, MAX_STRIDE) == 0) {
+
+                    // Occupy the last bin in case of overflow.
+                    if (stride >= MAX_STRIDE)
+                        stride = MAX_STRIDE - 1;
+
+                    local_stride_list[var_idx]->increment(stride);
                 }
-
-                // Add this address as the last-seen address.
-                last_addr[var_idx] = address;
             }
+
+            // Add this address as the last-seen address.
+            last_addr[var_idx] = address;
         }
+    }
 
-        // Sum up the histogram values into result histogram.
-        #pragma omp critical
-        for (int j=0; j<num_streams; j++) {
-            if (local_stride_list[j] != NULL) {
-                if (create_histogram_if_null(stride_list[j], MAX_STRIDE) == 0) {
-                    gsl_histogram_add(stride_list[j], local_stride_list[j]);
-                }
+    const int num_cores;
+    const int num_streams;
+    std::map<size_t, size_t> last_addr;
+    histogram_list_t local_stride_list;
+};
+
+stride_visitor_t::stride_visitor_t(const global_data_t& global_data,
+        histogram_list_t& stride_list) : stride_list(stride_list) {
+    num_cores = sysconf(_SC_NPROCESSORS_CONF);
+    num_streams = global_data.stream_list.size();
+}
+
+bucket_visitor_t* stride_visitor_t::begin_bucket(size_t index,
+        const mem_info_list_t& list) {
+    return new stride_bucket_t(num_cores, num_streams);
+}
+
+void stride_visitor_t::end_bucket(size_t index, bucket_visitor_t* visitor) {
+    stride_bucket_t* bucket = static_cast<stride_bucket_t*>(visitor);
+    histogram_list_t& local_stride_list = bucket->local_stride_list;
+
+    // Sum up the histogram values into result histogram.
+    #pragma omp critical (stride_analysis)
+    for (int j=0; j<num_streams; j++) {
+        if (local_stride_list[j] != NULL) {
+            if (create_histogram_if_null(stride_list[j], MAX_STRIDE,
+                        MAX_STRIDE) == 0) {
+                stride_list[j]->add(*local_stride_list[j]);
             }
+
+            delete local_stride_list[j];
         }
     }
 
-    return 0;
+    delete bucket;
 }
 
 int print_strides(const global_data_t& global_data,
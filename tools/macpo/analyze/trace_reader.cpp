@@ -0,0 +1,572 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "err_codes.h"
+#include "trace_reader.h"
+
+// Thread of records that are not part of any indexed block.
+#define NO_THREAD   ((uint32_t) -1)
+
+bool trace_filter_t::parse_range(const char* string, size_t& first,
+        size_t& last) {
+    char* end = NULL;
+    first = strtoul(string, &end, 10);
+    if (end == string)
+        return false;
+
+    if (*end == '\0') {
+        last = first;
+        return true;
+    }
+
+    if (*end++ != '-')
+        return false;
+
+    if (*end == '\0') {
+        last = (size_t) -1;
+        return true;
+    }
+
+    const char* start = end;
+    last = strtoul(start, &end, 10);
+    return end != start && *end == '\0' && first <= last;
+}
+
+static bool offset_comparator(const index_entry_t& a, const index_entry_t& b) {
+    return a.offset < b.offset;
+}
+
+trace_reader_t::trace_reader_t() : fd(-1), data(NULL), size(0), offset(0),
+        partial_offset((size_t) -1), records_offset(0), flags(0),
+        legacy(false), block_size(0), block_offset(0), scratch(NULL),
+        next_entry(0), entry_end(0), entry_thread(NO_THREAD), skipped(0),
+        filtering(false), window(0), record_number(0), stream_mask(0) {
+}
+
+trace_reader_t::~trace_reader_t() {
+    close();
+}
+
+int trace_reader_t::open(const char* filename) {
+    close();
+
+    if ((fd = ::open(filename, O_RDONLY)) < 0)
+        return -ERR_FILE;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close();
+        return -ERR_FILE;
+    }
+
+    size = st.st_size;
+    if (size > 0) {
+        void* ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            close();
+            return -ERR_FILE;
+        }
+
+        // Records are read front to back exactly once.
+        madvise(ptr, size, MADV_SEQUENTIAL);
+        data = reinterpret_cast<const char*>(ptr);
+    }
+
+    // Traces without a header are a plain sequence of node_t structs.
+    trace_header_t header;
+    if (size >= sizeof(header)) {
+        memcpy(&header, data, sizeof(header));
+    }
+
+    if (size >= sizeof(header) && header.magic == MACPO_TRACE_MAGIC) {
+        if (header.version != MACPO_TRACE_VERSION) {
+            close();
+            return -ERR_FILE_VERSION;
+        }
+
+        legacy = false;
+        flags = header.flags;
+        records_offset = sizeof(header);
+        load_index(filename);
+    } else {
+        legacy = true;
+        flags = 0;
+        records_offset = 0;
+    }
+
+    rewind();
+    return 0;
+}
+
+void trace_reader_t::close() {
+    if (data != NULL)
+        munmap(const_cast<char*>(data), size);
+
+    if (fd >= 0)
+        ::close(fd);
+
+    delete scratch;
+
+    fd = -1;
+    data = NULL;
+    size = offset = records_offset = 0;
+    scratch = NULL;
+    block_size = block_offset = 0;
+    stream_list.clear();
+    index.clear();
+}
+
+void trace_reader_t::rewind() {
+    offset = records_offset;
+    partial_offset = (size_t) -1;
+    block_size = block_offset = 0;
+    stream_list.clear();
+    memset(&metadata_info, 0, sizeof(metadata_info));
+
+    next_entry = entry_end = skipped = 0;
+    entry_thread = NO_THREAD;
+    window = record_number = 0;
+    stream_mask = 0;
+    selected_streams.clear();
+}
+
+void trace_reader_t::load_index(const char* filename) {
+    index.clear();
+
+    char* path = realpath(filename, NULL);
+    if (path == NULL)
+        return;
+
+    std::string index_name = std::string(path) + MACPO_INDEX_SUFFIX;
+    free(path);
+
+    // Traces are perfectly usable without their index.
+    int index_fd = ::open(index_name.c_str(), O_RDONLY);
+    if (index_fd < 0)
+        return;
+
+    std::vector<char> contents;
+    char buffer[1 << 16];
+    ssize_t length;
+    while ((length = read(index_fd, buffer, sizeof(buffer))) > 0) {
+        contents.insert(contents.end(), buffer, buffer + length);
+    }
+
+    ::close(index_fd);
+
+    index_header_t header;
+    if (contents.size() < sizeof(header))
+        return;
+
+    memcpy(&header, &contents[0], sizeof(header));
+    if (header.magic != MACPO_INDEX_MAGIC ||
+            header.version != MACPO_INDEX_VERSION ||
+            header.entry_size != sizeof(index_entry_t))
+        return;
+
+    for (size_t pos = sizeof(header); pos + sizeof(index_entry_t) <=
+            contents.size(); pos += sizeof(index_entry_t)) {
+        index_entry_t entry;
+        memcpy(&entry, &contents[pos], sizeof(entry));
+
+        // Drop blocks that did not make it into the trace.
+        if (entry.offset >= records_offset && entry.size <= size &&
+                entry.offset <= size - entry.size)
+            index.push_back(entry);
+    }
+
+    std::sort(index.begin(), index.end(), offset_comparator);
+}
+
+void trace_reader_t::set_filter(const trace_filter_t& trace_filter) {
+    filter = trace_filter;
+    filtering = filter.active();
+
+    // Selected blocks are no longer read strictly front to back.
+    if (filtering && index.size() > 0 && data != NULL)
+        madvise(const_cast<char*>(data), size, MADV_NORMAL);
+}
+
+bool trace_reader_t::has_index() const {
+    return index.size() > 0;
+}
+
+size_t trace_reader_t::skipped_blocks() const {
+    return skipped;
+}
+
+bool trace_reader_t::skip_block(const index_entry_t& entry) const {
+    if (window < filter.first_window)
+        return true;
+
+    if (filter.threads.size() > 0 &&
+            filter.threads.find(entry.thread) == filter.threads.end())
+        return true;
+
+    if (filter.streams.size() > 0 && (entry.stream_mask & stream_mask) == 0)
+        return true;
+
+    if (entry.last_line < filter.first_line ||
+            entry.first_line > filter.last_line)
+        return true;
+
+    if (entry.mem_records > 0 && (record_number > filter.last_record ||
+                record_number + entry.mem_records <= filter.first_record))
+        return true;
+
+    return false;
+}
+
+// Called whenever the cursor is at a record boundary of the trace file.
+void trace_reader_t::skip_blocks() {
+    if (offset >= entry_end)
+        entry_thread = NO_THREAD;
+
+    while (next_entry < index.size() && index[next_entry].offset <= offset) {
+        const index_entry_t& entry = index[next_entry++];
+        if (entry.offset < offset)
+            continue;
+
+        if (skip_block(entry)) {
+            offset += entry.size;
+            record_number += entry.mem_records;
+            skipped++;
+        } else {
+            entry_end = entry.offset + entry.size;
+            entry_thread = entry.thread;
+        }
+    }
+}
+
+bool trace_reader_t::select(const record_view_t& record) {
+    switch (record.type_message) {
+        case MSG_TERMINAL:
+            window++;
+            return true;
+
+        case MSG_STREAM_INFO: {
+            node_t data_node;
+            if (unpack(record, data_node) == 0) {
+                const std::string name = data_node.stream_info.stream_name;
+                bool selected = filter.streams.size() == 0 ||
+                    filter.streams.find(name) != filter.streams.end();
+
+                if (selected)
+                    stream_mask |= 1ULL << (selected_streams.size() % 64);
+
+                selected_streams.push_back(selected);
+            }
+
+            return true;
+        }
+
+        case MSG_MEM_INFO:
+        case MSG_TRACE_INFO:
+        case MSG_VECTOR_STRIDE_INFO:
+            break;
+
+        default:
+            return true;
+    }
+
+    const size_t number = record_number;
+    if (record.type_message == MSG_MEM_INFO) {
+        record_number++;
+
+        if (number < filter.first_record || number > filter.last_record)
+            return false;
+    }
+
+    if (window < filter.first_window || window > filter.last_window)
+        return false;
+
+    if (filter.threads.size() > 0 &&
+            filter.threads.find(entry_thread) == filter.threads.end())
+        return false;
+
+    node_t data_node;
+    if (unpack(record, data_node) < 0)
+        return true;
+
+    size_t var_idx, line_number;
+    if (record.type_message == MSG_MEM_INFO) {
+        var_idx = data_node.mem_info.var_idx;
+        line_number = data_node.mem_info.line_number;
+    } else if (record.type_message == MSG_TRACE_INFO) {
+        var_idx = data_node.trace_info.var_idx;
+        line_number = data_node.trace_info.line_number;
+    } else {
+        var_idx = data_node.vector_stride_info.var_idx;
+        line_number = data_node.vector_stride_info.loop_line_number;
+    }
+
+    if (filter.streams.size() > 0 && (var_idx >= selected_streams.size() ||
+                selected_streams[var_idx] == false))
+        return false;
+
+    return line_number >= filter.first_line &&
+        line_number <= filter.last_line;
+}
+
+int trace_reader_t::next_from_block(record_view_t& record) {
+    record_header_t header;
+    memcpy(&header, &block[block_offset], sizeof(header));
+    block_offset += sizeof(header);
+
+    if (block_offset + header.length > block_size ||
+            header.type_message == MSG_COMPRESSED_BLOCK)
+        return -ERR_INV_DATA;
+
+    record.type_message = header.type_message;
+    record.length = header.length;
+    record.payload = &block[block_offset];
+
+    block_offset += header.length;
+    return 1;
+}
+
+int trace_reader_t::next(record_view_t& record) {
+    while (true) {
+        // Nothing of interest remains after the last window or record.
+        if (filtering && (window > filter.last_window ||
+                    record_number > filter.last_record))
+            return 0;
+
+        int code = next_record(record);
+        if (code <= 0 || filtering == false || select(record))
+            return code;
+    }
+}
+
+// Runs that are killed while writing leave a partial record (or compressed
+// block) at the end of the trace. Everything before it is still usable.
+int trace_reader_t::end_of_trace() {
+    if (offset < size) {
+        partial_offset = offset;
+        offset = size;
+    }
+
+    return 0;
+}
+
+int trace_reader_t::next_record(record_view_t& record) {
+    if (legacy) {
+        if (offset + sizeof(node_t) > size)
+            return end_of_trace();
+
+        // The payload of a legacy record is the whole node_t.
+        node_t data_node;
+        memcpy(&data_node, data + offset, sizeof(data_node));
+        record.type_message = data_node.type_message;
+        record.length = sizeof(node_t);
+        record.payload = data + offset;
+
+        offset += sizeof(node_t);
+        return 1;
+    }
+
+    while (true) {
+        if (block_offset + sizeof(record_header_t) <= block_size)
+            return next_from_block(record);
+
+        if (block_offset != block_size)
+            return -ERR_INV_DATA;
+
+        if (filtering)
+            skip_blocks();
+
+        if (offset + sizeof(record_header_t) > size)
+            return end_of_trace();
+
+        record_header_t header;
+        memcpy(&header, data + offset, sizeof(header));
+        if (offset + sizeof(header) + header.length > size)
+            return end_of_trace();
+
+        offset += sizeof(header);
+
+        const char* payload = data + offset;
+        offset += header.length;
+
+        if (header.type_message != MSG_COMPRESSED_BLOCK) {
+            if (header.length > MAX_RECORD_LENGTH)
+                return -ERR_INV_DATA;
+
+            record.type_message = header.type_message;
+            record.length = header.length;
+            record.payload = payload;
+            return 1;
+        }
+
+        if (scratch == NULL) {
+            scratch = new codec_scratch_t;
+            block.resize(TRACE_CODEC_CHUNK_SIZE);
+        }
+
+        ssize_t decoded = trace_codec_decompress(scratch, payload,
+                header.length, &block[0]);
+        if (decoded < 0)
+            return -ERR_INV_DATA;
+
+        block_size = decoded;
+        block_offset = 0;
+    }
+}
+
+int trace_reader_t::unpack(const record_view_t& record, node_t& data_node)
+        const {
+    if (legacy) {
+        memcpy(&data_node, record.payload, sizeof(data_node));
+        return 0;
+    }
+
+    size_t length = record.length;
+    const char* payload = record.payload;
+    data_node.type_message = record.type_message;
+
+    switch(record.type_message) {
+        case MSG_STREAM_INFO:
+            length = std::min(length, (size_t) STREAM_LENGTH-1);
+            memcpy(data_node.stream_info.stream_name, payload, length);
+            data_node.stream_info.stream_name[length] = '\0';
+            return 0;
+
+        case MSG_MEM_INFO:
+            if (length < sizeof(mem_record_t))
+                return -ERR_INV_DATA;
+
+            unpack_mem_info(reinterpret_cast<const mem_record_t*>(payload),
+                    &data_node.mem_info);
+            return 0;
+
+        case MSG_TRACE_INFO:
+            if (length < sizeof(trace_record_t))
+                return -ERR_INV_DATA;
+
+            unpack_trace_info(reinterpret_cast<const trace_record_t*>(payload),
+                    &data_node.trace_info);
+            return 0;
+
+        case MSG_METADATA:
+            if (length < sizeof(metadata_record_t))
+                return -ERR_INV_DATA;
+
+            data_node.metadata_info.execution_timestamp =
+                reinterpret_cast<const metadata_record_t*>(
+                        payload)->execution_timestamp;
+
+            length = std::min(length - sizeof(metadata_record_t),
+                    (size_t) STRING_LENGTH-1);
+            memcpy(data_node.metadata_info.binary_name,
+                    payload + sizeof(metadata_record_t), length);
+            data_node.metadata_info.binary_name[length] = '\0';
+            return 0;
+
+        case MSG_TERMINAL:
+            return 0;
+
+        case MSG_VECTOR_STRIDE_INFO:
+            if (length < sizeof(vector_stride_record_t))
+                return -ERR_INV_DATA;
+
+            unpack_vector_stride_info(
+                    reinterpret_cast<const vector_stride_record_t*>(payload),
+                    &data_node.vector_stride_info);
+            return 0;
+    }
+
+    return -ERR_UNKNOWN_MSG;
+}
+
+void trace_reader_t::observe(const record_view_t& record) {
+    if (record.type_message != MSG_STREAM_INFO &&
+            record.type_message != MSG_METADATA)
+        return;
+
+    node_t data_node;
+    if (unpack(record, data_node) < 0)
+        return;
+
+    if (data_node.type_message == MSG_STREAM_INFO)
+        stream_list.push_back(data_node.stream_info.stream_name);
+    else
+        metadata_info = data_node.metadata_info;
+}
+
+int trace_reader_t::next_chunk(mem_info_list_t& chunk, size_t max_records,
+        bool& end_of_window) {
+    chunk.clear();
+    end_of_window = false;
+
+    record_view_t record;
+    while (chunk.size() < max_records) {
+        int code = next(record);
+        if (code <= 0)
+            return code < 0 ? code : chunk.size();
+
+        if (record.type_message == MSG_TERMINAL) {
+            end_of_window = true;
+            break;
+        }
+
+        if (record.type_message != MSG_MEM_INFO) {
+            observe(record);
+            continue;
+        }
+
+        node_t data_node;
+        if ((code = unpack(record, data_node)) < 0)
+            return code;
+
+        chunk.push_back(data_node.mem_info);
+    }
+
+    return chunk.size();
+}
+
+const name_list_t& trace_reader_t::streams() const {
+    return stream_list;
+}
+
+const metadata_info_t& trace_reader_t::metadata() const {
+    return metadata_info;
+}
+
+size_t trace_reader_t::truncated_at() const {
+    return partial_offset;
+}
+
+bool trace_reader_t::is_legacy() const {
+    return legacy;
+}
+
+bool trace_reader_t::is_compressed() const {
+    return (flags & MACPO_TRACE_COMPRESSED) != 0;
+}
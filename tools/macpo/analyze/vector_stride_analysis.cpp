@@ -58,14 +58,13 @@ int vector_stride_analysis(const global_data_t& global_data,
                     size_t stride = (address - last_address) / type_size;
 
                     if (create_histogram_if_null(local_stride_list[var_idx],
-                                MAX_STRIDE) == 0) {
+                                MAX_STRIDE, MAX_STRIDE) == 0) {
 
                         // Occupy the last bin in case of overflow.
                         if (stride >= MAX_STRIDE)
                             stride = MAX_STRIDE - 1;
 
-                        gsl_histogram_increment(local_stride_list[var_idx],
-                                stride);
+                        local_stride_list[var_idx]->increment(stride);
                     }
                 }
 
@@ -78,9 +77,12 @@ int vector_stride_analysis(const global_data_t& global_data,
         #pragma omp critical
         for (int j=0; j<num_streams; j++) {
             if (local_stride_list[j] != NULL) {
-                if (create_histogram_if_null(stride_list[j], MAX_STRIDE) == 0) {
-                    gsl_histogram_add(stride_list[j], local_stride_list[j]);
+                if (create_histogram_if_null(stride_list[j], MAX_STRIDE,
+                            MAX_STRIDE) == 0) {
+                    stride_list[j]->add(*local_stride_list[j]);
                 }
+
+                delete local_stride_list[j];
             }
         }
     }
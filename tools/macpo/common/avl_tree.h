@@ -19,60 +19,224 @@
  * $HEADER$
  */
 
-#if 0
-    Adapted from: www.zentut.com/c-tutorial/c-avl-tree/
-#endif
-
 #ifndef TOOLS_MACPO_COMMON_AVL_TREE_H_
 #define TOOLS_MACPO_COMMON_AVL_TREE_H_
 
 #include <stdint.h>
 
 #include <algorithm>
+#include <utility>
 #include <vector>
 
 #include "macpo_record.h"
 
 #define ADDR_TO_CACHE_LINE(x)   (x >> 6)
 
+/***
+
+Reuse distance engine.
+
+Every access is stamped with the value of a logical clock. A hash table from
+cache line to the timestamp of its last access finds the previous access of a
+line, and a Fenwick (binary indexed) tree over timestamps marks which
+timestamps are still the last access of some line. The reuse distance of a
+line, i.e. the number of distinct lines accessed since its last access, is then
+the number of marked timestamps after its own, so both insert() and
+get_distance() cost O(log n) in the number of distinct lines instead of O(n).
+
+Timestamps only grow, so once the clock reaches the capacity of the Fenwick
+tree, live timestamps are renumbered densely (preserving their order) and the
+tree is rebuilt, growing it so that at least three quarters of it are free
+afterwards. The cost of this is amortized over the accesses since the previous
+rebuild.
+
+The class keeps its historical name and interface.
+
+*/
+
 class avl_tree {
  public:
+    avl_tree() : clock(0), live_count(0), hash_shift(0) {
+    }
+
     void insert(const mem_info_t* mem_info) {
         size_t cache_line = ADDR_TO_CACHE_LINE(mem_info->address);
-        addr_vector_t::iterator it = std::find(addr_vector.begin(),
-                addr_vector.end(), cache_line);
-        if (it != addr_vector.end()) {
-            addr_vector.erase(it);
+
+        // Keep the hash table at most half full.
+        if (2 * (live_count + 1) > table.size())
+            grow_table();
+
+        size_t slot = find_slot(cache_line);
+        if (table[slot].cache_line == cache_line) {
+            update(table[slot].timestamp, -1);
+        } else {
+            table[slot].cache_line = cache_line;
+            live_count++;
         }
 
-        addr_vector.push_back(cache_line);
+        if (clock >= fenwick.size()) {
+            compact(slot);
+        }
+
+        table[slot].timestamp = clock;
+        update(clock, 1);
+        clock++;
     }
 
     size_t get_distance(size_t cache_line) {
-        addr_vector_t::iterator it = std::find(addr_vector.begin(),
-                addr_vector.end(), cache_line);
-        if (it == addr_vector.end()) {
+        if (live_count == 0) {
+            return -1;
+        }
+
+        size_t slot = find_slot(cache_line);
+        if (table[slot].cache_line != cache_line) {
             return -1;
         }
 
-        return addr_vector.end() - it - 1;
+        // Lines whose last access came after that of this line.
+        return live_count - prefix_sum(table[slot].timestamp);
     }
 
     void make_infinite_distance(size_t cache_line) {
-        addr_vector_t::iterator it = std::find(addr_vector.begin(),
-                addr_vector.end(), cache_line);
-        if (it != addr_vector.end()) {
-            addr_vector.erase(it);
+        if (live_count == 0) {
+            return;
+        }
+
+        size_t slot = find_slot(cache_line);
+        if (table[slot].cache_line == cache_line) {
+            update(table[slot].timestamp, -1);
+            erase_slot(slot);
+            live_count--;
         }
     }
 
     void destroy() {
-        addr_vector.clear();
+        table.clear();
+        fenwick.clear();
+        clock = 0;
+        live_count = 0;
+        hash_shift = 0;
     }
 
  private:
-    typedef std::vector<size_t> addr_vector_t;
-    addr_vector_t addr_vector;
+    typedef struct {
+        size_t cache_line;
+        size_t timestamp;
+    } entry_t;
+
+    // Cache line numbers are addresses shifted right, so they are never this.
+    static const size_t EMPTY_LINE = (size_t) -1;
+
+    std::vector<entry_t> table;
+    std::vector<size_t> fenwick;
+    size_t clock;
+    size_t live_count;
+    int hash_shift;
+
+    size_t hash(size_t cache_line) const {
+        return (size_t) ((cache_line * 0x9e3779b97f4a7c15ULL) >> hash_shift);
+    }
+
+    // Slot holding `cache_line' or the empty slot where it would go.
+    size_t find_slot(size_t cache_line) const {
+        const size_t mask = table.size() - 1;
+        size_t slot = hash(cache_line);
+        while (table[slot].cache_line != EMPTY_LINE &&
+                table[slot].cache_line != cache_line) {
+            slot = (slot + 1) & mask;
+        }
+
+        return slot;
+    }
+
+    // Remove the entry at `slot' by moving back entries of the same probe
+    // sequence, so that lookups never need tombstones.
+    void erase_slot(size_t slot) {
+        const size_t mask = table.size() - 1;
+        size_t next = (slot + 1) & mask;
+        while (table[next].cache_line != EMPTY_LINE) {
+            size_t home = hash(table[next].cache_line);
+            if (((next - home) & mask) >= ((next - slot) & mask)) {
+                table[slot] = table[next];
+                slot = next;
+            }
+
+            next = (next + 1) & mask;
+        }
+
+        table[slot].cache_line = EMPTY_LINE;
+    }
+
+    void grow_table() {
+        std::vector<entry_t> old_table;
+        old_table.swap(table);
+
+        size_t size = std::max(old_table.size() * 2, (size_t) 1024);
+        entry_t empty = { EMPTY_LINE, 0 };
+        table.assign(size, empty);
+
+        hash_shift = 64;
+        for (size_t i = size; i > 1; i >>= 1) {
+            hash_shift--;
+        }
+
+        for (size_t i = 0; i < old_table.size(); i++) {
+            if (old_table[i].cache_line != EMPTY_LINE) {
+                table[find_slot(old_table[i].cache_line)] = old_table[i];
+            }
+        }
+    }
+
+    // Add `delta' to the count at `timestamp'.
+    void update(size_t timestamp, int delta) {
+        for (size_t i = timestamp + 1; i <= fenwick.size(); i += i & -i) {
+            fenwick[i-1] += delta;
+        }
+    }
+
+    // Number of marked timestamps in [0, timestamp].
+    size_t prefix_sum(size_t timestamp) const {
+        size_t sum = 0;
+        for (size_t i = timestamp + 1; i > 0; i -= i & -i) {
+            sum += fenwick[i-1];
+        }
+
+        return sum;
+    }
+
+    // Renumber live timestamps to 0..n-1 and rebuild the tree. `skip' is
+    // the slot being inserted, which the caller stamps after this call.
+    void compact(size_t skip) {
+        std::vector<std::pair<size_t, size_t> > order;
+        order.reserve(live_count);
+        for (size_t i = 0; i < table.size(); i++) {
+            if (i != skip && table[i].cache_line != EMPTY_LINE) {
+                order.push_back(std::make_pair(table[i].timestamp, i));
+            }
+        }
+
+        std::sort(order.begin(), order.end());
+
+        for (size_t i = 0; i < order.size(); i++) {
+            table[order[i].second].timestamp = i;
+        }
+
+        size_t capacity = std::max(fenwick.size(), (size_t) 1024);
+        while (4 * live_count > capacity) {
+            capacity *= 2;
+        }
+
+        clock = order.size();
+        fenwick.assign(capacity, 0);
+        for (size_t i = 1; i <= capacity; i++) {
+            if (i <= clock)
+                fenwick[i-1] += 1;
+
+            size_t parent = i + (i & -i);
+            if (parent <= capacity)
+                fenwick[parent-1] += fenwick[i-1];
+        }
+    }
 };
 
 #endif  // TOOLS_MACPO_COMMON_AVL_TREE_H_
@@ -22,6 +22,12 @@
 #ifndef TOOLS_MACPO_COMMON_HISTOGRAM_H_
 #define TOOLS_MACPO_COMMON_HISTOGRAM_H_
 
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <algorithm>
 #include <iterator>
 #include <map>
@@ -71,7 +77,7 @@ class histogram_t {
                 std::back_inserter<pair_list_t>(pair_list));
         std::sort(pair_list.begin(), pair_list.end(), _compare);
 
-        if (k > 0 && pair_list.size() > k) {
+        if (k > 0 && pair_list.size() > (size_t) k) {
             pair_list.resize(k);
         }
 
@@ -86,6 +92,169 @@ class histogram_t {
     }
 };
 
+/***
+
+Log-binned histograms.
+
+log_histogram_t counts values below `exact_limit' in bins of their own and
+values above it in geometric bins, 2^LOG_HISTOGRAM_STEP_BITS of them per
+power of two, so that the width of a bin is at most 1/8 of its lower bound
+with the default of 3 bits. A histogram covering 64-bit values therefore needs only a few hundred
+bins, which are allocated as values get counted.
+
+If `limit' is non-zero, values at or above `limit - 1' are clamped to it and
+counted in an overflow bin of their own, just like callers used to occupy the
+last bin of a fixed-size histogram on overflow.
+
+Bins are identified by their lower bound, which is what sort() reports.
+
+*/
+
+#ifndef LOG_HISTOGRAM_EXACT
+#define LOG_HISTOGRAM_EXACT 64
+#endif
+
+#ifndef LOG_HISTOGRAM_STEP_BITS
+#define LOG_HISTOGRAM_STEP_BITS 3
+#endif
+
+#define LOG_HISTOGRAM_STEPS (1 << LOG_HISTOGRAM_STEP_BITS)
+
+template <class val_t>
+class log_histogram_t {
+ public:
+    typedef std::pair<uint64_t, val_t> pair_t;
+    typedef std::vector<pair_t> pair_list_t;
+
+    explicit log_histogram_t(uint64_t exact_limit = LOG_HISTOGRAM_EXACT,
+            uint64_t limit = 0) : _exact_log(0), _limit(limit), _overflow(0) {
+        // The exact range is a power of two with room for at least one
+        // step below it.
+        while ((1ULL << _exact_log) < exact_limit ||
+                (1ULL << _exact_log) < LOG_HISTOGRAM_STEPS) {
+            _exact_log++;
+        }
+    }
+
+    void accumulate(uint64_t value, const val_t& weight) {
+        if (_limit > 0 && value >= _limit - 1) {
+            _overflow += weight;
+            return;
+        }
+
+        size_t index = bin_index(value);
+        if (index >= _bins.size()) {
+            _bins.resize(index + 1, 0);
+        }
+
+        _bins[index] += weight;
+    }
+
+    void increment(uint64_t value) {
+        accumulate(value, 1);
+    }
+
+    // Count of the bin that `value' falls into.
+    const val_t get(uint64_t value) const {
+        if (_limit > 0 && value >= _limit - 1) {
+            return _overflow;
+        }
+
+        size_t index = bin_index(value);
+        return index < _bins.size() ? _bins[index] : 0;
+    }
+
+    // Move up to `weight' from the bin of `from' to the bin of `to', leaving
+    // the other values that share the bin of `from' untouched.
+    const val_t move(uint64_t from, uint64_t to, const val_t& weight) {
+        const val_t moved = std::min(get(from), weight);
+        accumulate(from, -moved);
+        accumulate(to, moved);
+        return moved;
+    }
+
+    void add(const log_histogram_t& other) {
+        assert(_exact_log == other._exact_log && _limit == other._limit);
+
+        if (other._bins.size() > _bins.size()) {
+            _bins.resize(other._bins.size(), 0);
+        }
+
+        for (size_t i = 0; i < other._bins.size(); i++) {
+            _bins[i] += other._bins[i];
+        }
+
+        _overflow += other._overflow;
+    }
+
+    void clear() {
+        _bins.clear();
+        _overflow = 0;
+    }
+
+    // Lower bound of the values counted in the bin at `index'.
+    uint64_t lower_bound(size_t index) const {
+        const uint64_t exact = 1ULL << _exact_log;
+        if (index < exact) {
+            return index;
+        }
+
+        const uint64_t steps = LOG_HISTOGRAM_STEPS;
+        const size_t octave = (index - exact) / steps;
+        const uint64_t step = (index - exact) % steps;
+        return (steps + step) <<
+            (_exact_log + octave - LOG_HISTOGRAM_STEP_BITS);
+    }
+
+    const pair_list_t sort() const {
+        return sort(-1);
+    }
+
+    const pair_list_t sort(const int& k) const {
+        // Sort non-empty bins and return the top k pairs.
+        pair_list_t pair_list;
+        for (size_t i = 0; i < _bins.size(); i++) {
+            if (_bins[i] != 0) {
+                pair_list.push_back(pair_t(lower_bound(i), _bins[i]));
+            }
+        }
+
+        if (_overflow != 0) {
+            pair_list.push_back(pair_t(_limit - 1, _overflow));
+        }
+
+        std::stable_sort(pair_list.begin(), pair_list.end(), _compare);
+
+        if (k > 0 && pair_list.size() > (size_t) k) {
+            pair_list.resize(k);
+        }
+
+        return pair_list;
+    }
+
+ private:
+    std::vector<val_t> _bins;
+    int _exact_log;
+    uint64_t _limit;
+    val_t _overflow;
+
+    size_t bin_index(uint64_t value) const {
+        const uint64_t exact = 1ULL << _exact_log;
+        if (value < exact) {
+            return value;
+        }
+
+        const int msb = 63 - __builtin_clzll(value);
+        const uint64_t step = (value >> (msb - LOG_HISTOGRAM_STEP_BITS)) &
+            (LOG_HISTOGRAM_STEPS - 1);
+        return exact + (msb - _exact_log) * LOG_HISTOGRAM_STEPS + step;
+    }
+
+    static bool _compare(const pair_t& a, const pair_t& b) {
+        return a.second > b.second;
+    }
+};
+
 template <class bin_t, class val_t>
 class multigram_t {
  private:
@@ -96,6 +265,30 @@ class multigram_t {
 
     l1_map_t map_indexes;
 
+    void free_indexes() {
+        typedef typename l1_map_t::iterator l1_iterator;
+        typedef typename l2_map_t::iterator l2_iterator;
+        typedef typename l3_map_t::iterator l3_iterator;
+
+        for (l1_iterator it = map_indexes.begin(); it != map_indexes.end();
+                it++) {
+            l2_map_t* l2_map = it->second;
+            for (l2_iterator it = l2_map->begin(); it != l2_map->end(); it++) {
+                l3_map_t* l3_map = it->second;
+                for (l3_iterator it = l3_map->begin(); it != l3_map->end();
+                        it++) {
+                    delete it->second;
+                }
+
+                delete l3_map;
+            }
+
+            delete l2_map;
+        }
+
+        map_indexes.clear();
+    }
+
     hist_t* map_into_histogram(int64_t thread_id, void* function_address,
             int64_t line_number) {
         typedef typename l1_map_t::iterator l1_iterator;
@@ -154,6 +347,14 @@ class multigram_t {
     }
 
  public:
+    ~multigram_t() {
+        free_indexes();
+    }
+
+    void clear() {
+        free_indexes();
+    }
+
     typedef struct {
         int64_t thread_id;
         int64_t line_number;
@@ -233,4 +434,338 @@ class multigram_t {
     }
 };
 
+/***
+
+Thread-sharded multigrams.
+
+sharded_multigram_t holds the same (function address, line number, bin) ->
+value data as multigram_t, but every thread updates a private shard, so that
+updates need neither locks nor tree lookups. A shard is an open-addressing hash
+table that is keyed by all three components and is grown by doubling. Entries
+that are looked up for the first time start out with the initial value given
+to the constructor.
+
+merge() folds the shards of all threads into a regular multigram_t (under
+thread id 0), combining values of the same key with merge_t, and
+get_all_histograms() returns the merged data. merge() may be called more than
+once, but it must not run concurrently with updates.
+
+Threads that exit hand their shard over to threads that start later, so only
+threads beyond the first MAX_SHARDS that are alive at the same time share an
+overflow shard, which is protected by a lock.
+
+*/
+
+#ifndef MAX_SHARDS
+#define MAX_SHARDS  256
+#endif
+
+// Small, dense id of the calling thread, used to pick a shard. Ids below
+// MAX_SHARDS are released when their thread exits and are reused afterwards.
+static inline int shard_thread_id() {
+    static volatile int id_in_use[MAX_SHARDS];
+    static pthread_key_t id_key;
+    static pthread_once_t id_key_once = PTHREAD_ONCE_INIT;
+    static __thread int thread_id = -1;
+
+    struct id_key_t {
+        static void create() {
+            pthread_key_create(&id_key, release);
+        }
+
+        static void release(void* value) {
+            thread_id = -1;
+            __sync_lock_release(&id_in_use[(intptr_t) value - 1]);
+        }
+    };
+
+    if (thread_id == -1) {
+        thread_id = MAX_SHARDS;
+        for (int i = 0; i < MAX_SHARDS; i++) {
+            if (__sync_lock_test_and_set(&id_in_use[i], 1) == 0) {
+                thread_id = i;
+                break;
+            }
+        }
+
+        if (thread_id < MAX_SHARDS) {
+            pthread_once(&id_key_once, id_key_t::create);
+            pthread_setspecific(id_key, (void*) (intptr_t) (thread_id + 1));
+        }
+    }
+
+    return thread_id;
+}
+
+template <class val_t>
+struct merge_min_t {
+    val_t operator()(const val_t& a, const val_t& b) const {
+        return std::min(a, b);
+    }
+};
+
+template <class val_t>
+struct merge_sum_t {
+    val_t operator()(const val_t& a, const val_t& b) const {
+        return a + b;
+    }
+};
+
+template <class val_t>
+struct merge_or_t {
+    val_t operator()(const val_t& a, const val_t& b) const {
+        return a || b;
+    }
+};
+
+template <class bin_t, class val_t, class merge_t>
+class sharded_multigram_t {
+ private:
+    typedef multigram_t<bin_t, val_t> merged_t;
+
+    typedef struct {
+        void* function_address;
+        int64_t line_number;
+        bin_t bin;
+        val_t val;
+        bool used;
+    } entry_t;
+
+    typedef struct {
+        entry_t* entries;
+        size_t capacity;
+        size_t count;
+    } shard_t;
+
+    static const size_t kInitialCapacity = 64;
+
+    const val_t initial_val;
+    shard_t* shards[MAX_SHARDS + 1];
+    volatile int16_t overflow_lock;
+    merged_t merged;
+
+    static size_t hash(void* function_address, int64_t line_number,
+            const bin_t& bin) {
+        uint64_t key = reinterpret_cast<uintptr_t>(function_address);
+        key ^= (uint64_t) line_number * 0x9e3779b97f4a7c15ULL;
+        key ^= (uint64_t) bin * 0xc2b2ae3d27d4eb4fULL;
+        key ^= key >> 29;
+        key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 32;
+        return key;
+    }
+
+    static entry_t* find_slot(entry_t* entries, size_t capacity,
+            void* function_address, int64_t line_number, const bin_t& bin) {
+        size_t mask = capacity - 1;
+        size_t idx = hash(function_address, line_number, bin) & mask;
+        while (entries[idx].used && (entries[idx].function_address !=
+                    function_address || entries[idx].line_number !=
+                    line_number || entries[idx].bin != bin)) {
+            idx = (idx + 1) & mask;
+        }
+
+        return &entries[idx];
+    }
+
+    static entry_t* new_entries(size_t capacity) {
+        return reinterpret_cast<entry_t*>(calloc(capacity, sizeof(entry_t)));
+    }
+
+    bool grow(shard_t* shard) {
+        size_t capacity = shard->capacity * 2;
+        entry_t* entries = new_entries(capacity);
+        if (entries == NULL) {
+            return false;
+        }
+
+        for (size_t i = 0; i < shard->capacity; i++) {
+            const entry_t& entry = shard->entries[i];
+            if (entry.used) {
+                *find_slot(entries, capacity, entry.function_address,
+                        entry.line_number, entry.bin) = entry;
+            }
+        }
+
+        free(shard->entries);
+        shard->entries = entries;
+        shard->capacity = capacity;
+        return true;
+    }
+
+    shard_t* get_shard(int thread_id) {
+        int idx = thread_id < MAX_SHARDS ? thread_id : MAX_SHARDS;
+        if (shards[idx] == NULL) {
+            shard_t* shard = new shard_t;
+            shard->entries = new_entries(kInitialCapacity);
+            shard->capacity = kInitialCapacity;
+            shard->count = 0;
+
+            // Only the overflow shard may be created by several threads.
+            if (__sync_bool_compare_and_swap(&shards[idx], NULL, shard) ==
+                    false) {
+                free(shard->entries);
+                delete shard;
+            }
+        }
+
+        return shards[idx];
+    }
+
+    // Returns the entry for the key, creating it if necessary.
+    // Returns NULL if we ran out of memory.
+    entry_t* lookup(shard_t* shard, void* function_address,
+            int64_t line_number, const bin_t& bin) {
+        if (shard->entries == NULL) {
+            return NULL;
+        }
+
+        entry_t* entry = find_slot(shard->entries, shard->capacity,
+                function_address, line_number, bin);
+        if (entry->used) {
+            return entry;
+        }
+
+        // Keep the load factor below 1/2.
+        if (2 * (shard->count + 1) > shard->capacity) {
+            if (grow(shard) == false) {
+                return NULL;
+            }
+
+            entry = find_slot(shard->entries, shard->capacity,
+                    function_address, line_number, bin);
+        }
+
+        entry->function_address = function_address;
+        entry->line_number = line_number;
+        entry->bin = bin;
+        entry->val = initial_val;
+        entry->used = true;
+        shard->count += 1;
+        return entry;
+    }
+
+    // Wraps accesses to the overflow shard in a lock.
+    class shard_guard_t {
+     public:
+        shard_guard_t(volatile int16_t* lock_var, bool needed) :
+                _lock_var(needed ? lock_var : NULL) {
+            if (_lock_var != NULL) {
+                while (__sync_bool_compare_and_swap(_lock_var, 0, 1) ==
+                        false) {
+                    // do nothing.
+                }
+            }
+        }
+
+        ~shard_guard_t() {
+            if (_lock_var != NULL) {
+                __sync_lock_release(_lock_var);
+            }
+        }
+
+     private:
+        volatile int16_t* _lock_var;
+    };
+
+ public:
+    typedef typename merged_t::hist_id_t hist_id_t;
+    typedef typename merged_t::pair_t pair_t;
+    typedef typename merged_t::pair_list_t pair_list_t;
+
+    explicit sharded_multigram_t(const val_t& initial) : initial_val(initial),
+            overflow_lock(0) {
+        memset(shards, 0, sizeof(shards));
+    }
+
+    ~sharded_multigram_t() {
+        for (int i = 0; i <= MAX_SHARDS; i++) {
+            if (shards[i] != NULL) {
+                free(shards[i]->entries);
+                delete shards[i];
+            }
+        }
+    }
+
+    const val_t get(void* function_address, int64_t line_number,
+            const bin_t& bin) {
+        int thread_id = shard_thread_id();
+        shard_guard_t guard(&overflow_lock, thread_id >= MAX_SHARDS);
+
+        entry_t* entry = lookup(get_shard(thread_id), function_address,
+                line_number, bin);
+        return entry != NULL ? entry->val : initial_val;
+    }
+
+    void set(void* function_address, int64_t line_number, const bin_t& bin,
+            const val_t& val) {
+        int thread_id = shard_thread_id();
+        shard_guard_t guard(&overflow_lock, thread_id >= MAX_SHARDS);
+
+        entry_t* entry = lookup(get_shard(thread_id), function_address,
+                line_number, bin);
+        if (entry != NULL) {
+            entry->val = val;
+        }
+    }
+
+    const val_t increment(void* function_address, int64_t line_number,
+            const bin_t& bin, const val_t& val) {
+        int thread_id = shard_thread_id();
+        shard_guard_t guard(&overflow_lock, thread_id >= MAX_SHARDS);
+
+        entry_t* entry = lookup(get_shard(thread_id), function_address,
+                line_number, bin);
+        if (entry == NULL) {
+            return initial_val;
+        }
+
+        entry->val += val;
+        return entry->val;
+    }
+
+    void merge() {
+        typedef std::pair<void*, int64_t> location_t;
+        typedef std::pair<location_t, bin_t> key_t;
+        typedef std::map<key_t, val_t> key_map_t;
+
+        merge_t merge_values;
+        key_map_t values;
+        for (int i = 0; i <= MAX_SHARDS; i++) {
+            shard_t* shard = shards[i];
+            if (shard == NULL || shard->entries == NULL) {
+                continue;
+            }
+
+            for (size_t j = 0; j < shard->capacity; j++) {
+                const entry_t& entry = shard->entries[j];
+                if (entry.used == false) {
+                    continue;
+                }
+
+                key_t key(location_t(entry.function_address,
+                            entry.line_number), entry.bin);
+                typename key_map_t::iterator it = values.find(key);
+                if (it == values.end()) {
+                    values[key] = entry.val;
+                } else {
+                    it->second = merge_values(it->second, entry.val);
+                }
+            }
+        }
+
+        merged.clear();
+        for (typename key_map_t::iterator it = values.begin();
+                it != values.end(); it++) {
+            const key_t& key = it->first;
+            merged.set(0, key.first.first, key.first.second, key.second,
+                    it->second);
+        }
+    }
+
+    pair_list_t get_all_histograms() {
+        return merged.get_all_histograms();
+    }
+};
+
 #endif  // TOOLS_MACPO_COMMON_HISTOGRAM_H_
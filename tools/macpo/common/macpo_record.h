@@ -30,7 +30,7 @@
 
 enum { TYPE_UNKNOWN = 0, TYPE_READ, TYPE_WRITE, TYPE_READ_AND_WRITE };
 enum { MSG_TERMINAL = 0, MSG_STREAM_INFO, MSG_MEM_INFO, MSG_METADATA,
-        MSG_TRACE_INFO, MSG_VECTOR_STRIDE_INFO };
+        MSG_TRACE_INFO, MSG_VECTOR_STRIDE_INFO, MSG_COMPRESSED_BLOCK };
 
 typedef struct {
     uint16_t coreID;
@@ -78,4 +78,141 @@ typedef struct node {
     };
 } node_t;
 
+/***
+
+On-disk trace format.
+
+Traces written before version 2 are a plain sequence of node_t structures, so
+that every record occupies sizeof(node_t) bytes irrespective of its type.
+
+Starting with version 2, the trace begins with a trace_header_t followed by a
+sequence of records. Each record is a record_header_t, which holds the message
+type and the length of the payload, followed by the packed payload itself.
+Streams and metadata carry their strings without the trailing NUL bytes.
+Readers skip payloads of unknown message types using the length field.
+If MACPO_TRACE_COMPRESSED is set in the header, runs of records are packed into
+MSG_COMPRESSED_BLOCK records (see trace_codec.h).
+
+*/
+
+#define MACPO_TRACE_MAGIC       0x4f50434d  /* "MCPO" in little endian. */
+#define MACPO_TRACE_VERSION     2
+
+/* Set in trace_header_t.flags if records are packed into compressed blocks. */
+#define MACPO_TRACE_COMPRESSED  0x1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+} trace_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t type_message;
+    uint16_t length;
+} record_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t coreID;
+    uint8_t read_write;
+    uint8_t reserved;
+    uint32_t line_number;
+    uint64_t address;
+    uint32_t var_idx;
+    int32_t type_size;
+} mem_record_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t coreID;
+    uint8_t read_write;
+    uint8_t reserved;
+    uint32_t line_number;
+    uint64_t base;
+    uint64_t address;
+    uint32_t var_idx;
+} trace_record_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t coreID;
+    uint16_t reserved;
+    uint32_t loop_line_number;
+    uint64_t address;
+    uint32_t var_idx;
+    int32_t type_size;
+} vector_stride_record_t;
+
+typedef struct __attribute__((packed)) {
+    int64_t execution_timestamp;
+    /* Followed by the binary name, without the trailing NUL. */
+} metadata_record_t;
+
+/* Largest payload that a record may carry. */
+#define MAX_RECORD_LENGTH   (sizeof(metadata_record_t) + STRING_LENGTH)
+
+/***
+
+Trace index.
+
+Along with a version 2 trace, the runtime writes an index file, whose name is
+that of the trace with MACPO_INDEX_SUFFIX appended. It holds an index_header_t
+followed by one index_entry_t for every block of records that a thread wrote
+to the trace at once. Entries are in the order in which blocks were written,
+which is not necessarily the order of their offsets.
+
+Blocks only contain records of a single thread and always start and end at
+record boundaries (of MSG_COMPRESSED_BLOCK records in compressed traces). The
+remaining records, such as streams, metadata and end-of-window markers, lie
+between blocks. Readers can therefore skip every block whose entry shows that
+none of its records are of interest.
+
+*/
+
+#define MACPO_INDEX_MAGIC       0x5844494d  /* "MIDX" in little endian. */
+#define MACPO_INDEX_VERSION     1
+#define MACPO_INDEX_SUFFIX      ".idx"
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+} index_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t offset;        /* Offset of the block in the trace. */
+    uint64_t size;          /* Length of the block in the trace. */
+    uint32_t mem_records;   /* Number of MSG_MEM_INFO records. */
+    uint32_t thread;        /* Threads are numbered as they first record. */
+    uint64_t stream_mask;   /* Bit (var_idx % 64) is set for every stream. */
+    uint32_t first_line;    /* Range of source lines of the records. */
+    uint32_t last_line;
+} index_entry_t;
+
+static inline void unpack_mem_info(const mem_record_t* rec, mem_info_t* info) {
+    info->coreID = rec->coreID;
+    info->read_write = rec->read_write;
+    info->line_number = rec->line_number;
+    info->address = rec->address;
+    info->var_idx = rec->var_idx;
+    info->type_size = rec->type_size;
+}
+
+static inline void unpack_trace_info(const trace_record_t* rec,
+        trace_info_t* info) {
+    info->coreID = rec->coreID;
+    info->read_write = rec->read_write;
+    info->line_number = rec->line_number;
+    info->base = rec->base;
+    info->address = rec->address;
+    info->var_idx = rec->var_idx;
+}
+
+static inline void unpack_vector_stride_info(const vector_stride_record_t* rec,
+        vector_stride_info_t* info) {
+    info->coreID = rec->coreID;
+    info->loop_line_number = rec->loop_line_number;
+    info->address = rec->address;
+    info->var_idx = rec->var_idx;
+    info->type_size = rec->type_size;
+}
+
 #endif  // TOOLS_MACPO_COMMON_MACPO_RECORD_H_
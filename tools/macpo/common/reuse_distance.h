@@ -103,6 +103,12 @@ class reuse_distance_manager {
             return -1;
     }
 
+    // Forget all accesses to this cache line.
+    void remove(size_t cache_line) {
+        cache_line_count_map.erase(cache_line);
+        already_accessed.erase(cache_line);
+    }
+
     void cache_set_insert(size_t cache_line) {
         cache_set_t::iterator it =  find_in_cache(cache_line);
         // if we found it then erase so that we can put it in front
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifndef TOOLS_MACPO_COMMON_SHARDS_H_
+#define TOOLS_MACPO_COMMON_SHARDS_H_
+
+#include <math.h>
+#include <stdint.h>
+
+#include <set>
+#include <utility>
+#include <vector>
+
+/***
+
+Spatially hashed sampling of cache lines for approximate reuse distances
+(as in SHARDS, Waldspurger et al., FAST '15).
+
+A cache line is sampled if the hash of its number falls below a threshold,
+which makes the sampling decision the same for every access to that line. Reuse
+distances computed over sampled lines only are scaled up by 1/rate, and every
+sampled access stands for 1/rate accesses of the full trace.
+
+With a fixed rate, the memory needed is proportional to the number of distinct
+lines times the rate. If a bound on the number of sampled lines is set, the
+threshold is lowered whenever the bound is exceeded and the lines whose hash is
+no longer below it are handed back to the caller through evicted(), so that
+they can be dropped from the reuse distance trees. Memory then stays constant
+regardless of the length of the trace. The expected error of the resulting miss
+ratio curves is roughly 1/sqrt(number of sampled lines), which is what
+lines_for_error() uses to turn an error bound into a line bound.
+
+*/
+
+#define SHARDS_HASH_BITS    24
+#define SHARDS_MODULUS      (1U << SHARDS_HASH_BITS)
+
+typedef struct {
+    double rate;        // Initial sampling rate in (0, 1].
+    size_t max_lines;   // Bound on sampled lines, 0 for no bound.
+} shards_config_t;
+
+class shards_sampler_t {
+ public:
+    explicit shards_sampler_t(const shards_config_t& config) :
+            max_lines(config.max_lines) {
+        double rate = config.rate;
+        if (rate <= 0 || rate > 1)
+            rate = 1;
+
+        threshold = (uint32_t) ceil(rate * SHARDS_MODULUS);
+    }
+
+    static bool enabled(const shards_config_t& config) {
+        return (config.rate > 0 && config.rate < 1) || config.max_lines > 0;
+    }
+
+    static size_t lines_for_error(double error) {
+        if (error <= 0 || error >= 1)
+            return 0;
+
+        return (size_t) ceil(1.0 / (error * error));
+    }
+
+    static uint32_t hash(size_t cache_line) {
+        return (uint32_t) ((cache_line * 0x9e3779b97f4a7c15ULL) >>
+                (64 - SHARDS_HASH_BITS));
+    }
+
+    // Returns true if accesses to `cache_line' should be analyzed.
+    bool sample(size_t cache_line) {
+        uint32_t value = hash(cache_line);
+        if (value >= threshold)
+            return false;
+
+        if (max_lines == 0)
+            return true;
+
+        if (sampled.insert(std::make_pair(value, cache_line)).second &&
+                sampled.size() > max_lines) {
+            lower_threshold();
+        }
+
+        return value < threshold;
+    }
+
+    double rate() const {
+        return (double) threshold / SHARDS_MODULUS;
+    }
+
+    // Scale a distance between sampled lines to the full trace. Infinite
+    // distances, (size_t) -1, stay infinite.
+    size_t scale_distance(size_t distance) const {
+        if (threshold >= SHARDS_MODULUS || distance == (size_t) -1)
+            return distance;
+
+        return (size_t) (distance / rate());
+    }
+
+    // Number of accesses that a sampled access stands for.
+    double weight() const {
+        return 1.0 / rate();
+    }
+
+    // Lines dropped since the last call to clear_evicted().
+    const std::vector<size_t>& evicted() const {
+        return evicted_lines;
+    }
+
+    void clear_evicted() {
+        evicted_lines.clear();
+    }
+
+ private:
+    typedef std::set<std::pair<uint32_t, size_t> > sample_set_t;
+
+    uint32_t threshold;
+    size_t max_lines;
+    sample_set_t sampled;
+    std::vector<size_t> evicted_lines;
+
+    // Drop all lines that share the largest hash value.
+    void lower_threshold() {
+        threshold = sampled.rbegin()->first;
+        while (sampled.size() > 0 && sampled.rbegin()->first >= threshold) {
+            sample_set_t::iterator it = sampled.end();
+            it--;
+
+            evicted_lines.push_back(it->second);
+            sampled.erase(it);
+        }
+    }
+};
+
+#endif  // TOOLS_MACPO_COMMON_SHARDS_H_
@@ -0,0 +1,603 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifndef TOOLS_MACPO_COMMON_TRACE_CODEC_H_
+#define TOOLS_MACPO_COMMON_TRACE_CODEC_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "macpo_record.h"
+
+/***
+
+Compressed trace blocks.
+
+When compression is enabled, libmrt packs runs of (version 2) records into
+MSG_COMPRESSED_BLOCK records. The payload of such a record is a
+compressed_block_t followed by the block data.
+
+Records in a block are first delta-encoded: accesses (memory, trace and vector
+stride records) store the variable index and the differences of the line
+number and address with respect to the previous access to the same variable
+within the block, as zigzag varints. The core id and the type size are only
+stored when they change. All other records are copied verbatim behind an escape
+tag. Since consecutive accesses to a variable mostly differ by a small stride,
+an access usually shrinks from 28 bytes to 4 or 5 bytes.
+
+The delta-encoded data is then optionally run through a small LZ77 compressor,
+which removes the repetition that remains in loops (same variables, same line
+numbers, same strides). If that does not make the block any smaller, the
+delta-encoded data is stored as is.
+
+Each block is self-contained: the delta state is reset at the beginning of
+every block, so that blocks from different threads can be interleaved in the
+trace file and decoded without knowing which thread wrote them.
+
+*/
+
+/* Maximum size of the records that go into a single block. */
+#define TRACE_CODEC_CHUNK_SIZE  (16 * 1024)
+
+/* Upper bound on the size of the delta-encoded data of a block. */
+#define TRACE_CODEC_DELTA_BOUND (2 * TRACE_CODEC_CHUNK_SIZE)
+
+/* Upper bound on the size of a MSG_COMPRESSED_BLOCK record. */
+#define TRACE_CODEC_BLOCK_BOUND (sizeof(record_header_t) +                  \
+        sizeof(compressed_block_t) + TRACE_CODEC_DELTA_BOUND)
+
+#define TRACE_CODEC_SLOTS       256
+#define TRACE_CODEC_HASH_BITS   12
+#define TRACE_CODEC_MIN_MATCH   4
+
+/* Escape tag for records that are not delta-encoded. */
+#define TRACE_CODEC_RAW         0xff
+
+enum { BLOCK_DELTA = 0, BLOCK_DELTA_LZ };
+
+typedef struct __attribute__((packed)) {
+    uint32_t length;    /* Size of the delta-encoded data. */
+    uint8_t method;     /* BLOCK_DELTA or BLOCK_DELTA_LZ. */
+} compressed_block_t;
+
+typedef struct {
+    uint32_t var_idx;
+    uint16_t coreID;
+    int32_t type_size;
+    uint32_t line_number;
+    uint64_t base;
+    uint64_t address;
+} codec_slot_t;
+
+/* Per-variable delta state, direct-mapped on the variable index. */
+typedef struct {
+    codec_slot_t slots[TRACE_CODEC_SLOTS];
+} codec_state_t;
+
+/* Scratch space needed to compress a block. */
+typedef struct {
+    codec_state_t state;
+    uint16_t hash_table[1 << TRACE_CODEC_HASH_BITS];
+    uint8_t delta[TRACE_CODEC_DELTA_BOUND];
+} codec_scratch_t;
+
+enum { FLAG_CORE = 0x4, FLAG_TYPE_SIZE = 0x8 };
+
+static inline uint8_t* put_varint(uint8_t* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    *out++ = value;
+    return out;
+}
+
+static inline const uint8_t* get_varint(const uint8_t* in, const uint8_t* end,
+        uint64_t* value) {
+    uint64_t result = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = *in++;
+        result |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return in;
+        }
+    }
+
+    return NULL;
+}
+
+static inline uint8_t* put_delta(uint8_t* out, uint64_t value, uint64_t last) {
+    int64_t delta = (int64_t) (value - last);
+    return put_varint(out, ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));
+}
+
+static inline const uint8_t* get_delta(const uint8_t* in, const uint8_t* end,
+        uint64_t last, uint64_t* value) {
+    uint64_t zigzag;
+    if ((in = get_varint(in, end, &zigzag)) == NULL)
+        return NULL;
+
+    *value = last + ((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+    return in;
+}
+
+static inline codec_slot_t* codec_slot(codec_state_t* state, uint32_t var_idx) {
+    codec_slot_t* slot = &state->slots[var_idx % TRACE_CODEC_SLOTS];
+    if (slot->var_idx != var_idx) {
+        memset(slot, 0, sizeof(*slot));
+        slot->var_idx = var_idx;
+    }
+
+    return slot;
+}
+
+static inline void codec_reset(codec_state_t* state) {
+    memset(state, 0, sizeof(*state));
+
+    // Make sure that the first lookup of every slot misses.
+    for (int i = 0; i < TRACE_CODEC_SLOTS; i++)
+        state->slots[i].var_idx = ~0u;
+}
+
+static inline uint8_t* put_access(uint8_t* out, codec_slot_t* slot,
+        uint8_t flags, uint16_t coreID, int32_t type_size) {
+    if (coreID != slot->coreID)
+        flags |= FLAG_CORE;
+    if (type_size != slot->type_size)
+        flags |= FLAG_TYPE_SIZE;
+
+    *out++ = flags;
+    if (flags & FLAG_CORE)
+        out = put_varint(out, coreID);
+    if (flags & FLAG_TYPE_SIZE)
+        out = put_delta(out, (uint32_t) type_size, 0);
+
+    slot->coreID = coreID;
+    slot->type_size = type_size;
+    return out;
+}
+
+static inline const uint8_t* get_access(const uint8_t* in, const uint8_t* end,
+        codec_slot_t* slot, uint8_t* flags) {
+    uint64_t value;
+
+    if (in >= end)
+        return NULL;
+
+    *flags = *in++;
+    if (*flags & FLAG_CORE) {
+        if ((in = get_varint(in, end, &value)) == NULL)
+            return NULL;
+        slot->coreID = value;
+    }
+
+    if (*flags & FLAG_TYPE_SIZE) {
+        if ((in = get_delta(in, end, 0, &value)) == NULL)
+            return NULL;
+        slot->type_size = (int32_t) value;
+    }
+
+    return in;
+}
+
+// Delta-encode the records in `records' into `out', which must have room for
+// TRACE_CODEC_DELTA_BOUND bytes. At most TRACE_CODEC_CHUNK_SIZE bytes of
+// complete records are consumed, the number of which is returned in
+// `consumed'. Returns the size of the encoded data.
+static inline size_t delta_encode(codec_state_t* state, const char* records,
+        size_t length, uint8_t* out, size_t* consumed) {
+    uint8_t* ptr = out;
+    size_t offset = 0;
+
+    codec_reset(state);
+    while (offset + sizeof(record_header_t) <= length) {
+        const record_header_t* header =
+            reinterpret_cast<const record_header_t*>(records + offset);
+        const size_t size = sizeof(record_header_t) + header->length;
+        if (offset + size > length || offset + size > TRACE_CODEC_CHUNK_SIZE)
+            break;
+
+        const char* payload = records + offset + sizeof(record_header_t);
+        if (header->type_message == MSG_MEM_INFO &&
+                header->length == sizeof(mem_record_t)) {
+            const mem_record_t* rec =
+                reinterpret_cast<const mem_record_t*>(payload);
+            codec_slot_t* slot = codec_slot(state, rec->var_idx);
+
+            *ptr++ = MSG_MEM_INFO;
+            ptr = put_varint(ptr, rec->var_idx);
+            ptr = put_access(ptr, slot, rec->read_write & 0x3, rec->coreID,
+                    rec->type_size);
+            ptr = put_delta(ptr, rec->line_number, slot->line_number);
+            ptr = put_delta(ptr, rec->address, slot->address);
+
+            slot->line_number = rec->line_number;
+            slot->address = rec->address;
+        } else if (header->type_message == MSG_TRACE_INFO &&
+                header->length == sizeof(trace_record_t)) {
+            const trace_record_t* rec =
+                reinterpret_cast<const trace_record_t*>(payload);
+            codec_slot_t* slot = codec_slot(state, rec->var_idx);
+
+            *ptr++ = MSG_TRACE_INFO;
+            ptr = put_varint(ptr, rec->var_idx);
+            ptr = put_access(ptr, slot, rec->read_write & 0x3, rec->coreID,
+                    slot->type_size);
+            ptr = put_delta(ptr, rec->line_number, slot->line_number);
+            ptr = put_delta(ptr, rec->base, slot->base);
+            ptr = put_delta(ptr, rec->address, slot->address);
+
+            slot->line_number = rec->line_number;
+            slot->base = rec->base;
+            slot->address = rec->address;
+        } else if (header->type_message == MSG_VECTOR_STRIDE_INFO &&
+                header->length == sizeof(vector_stride_record_t)) {
+            const vector_stride_record_t* rec =
+                reinterpret_cast<const vector_stride_record_t*>(payload);
+            codec_slot_t* slot = codec_slot(state, rec->var_idx);
+
+            *ptr++ = MSG_VECTOR_STRIDE_INFO;
+            ptr = put_varint(ptr, rec->var_idx);
+            ptr = put_access(ptr, slot, 0, rec->coreID, rec->type_size);
+            ptr = put_delta(ptr, rec->loop_line_number, slot->line_number);
+            ptr = put_delta(ptr, rec->address, slot->address);
+
+            slot->line_number = rec->loop_line_number;
+            slot->address = rec->address;
+        } else {
+            *ptr++ = TRACE_CODEC_RAW;
+            ptr = put_varint(ptr, header->type_message);
+            ptr = put_varint(ptr, header->length);
+            memcpy(ptr, payload, header->length);
+            ptr += header->length;
+        }
+
+        offset += size;
+    }
+
+    *consumed = offset;
+    return ptr - out;
+}
+
+// Decode delta-encoded data back into records. Returns the size of the
+// records written to `out', or -1 if the data is corrupt or does not fit.
+static inline ssize_t delta_decode(codec_state_t* state, const uint8_t* in,
+        size_t length, char* out, size_t capacity) {
+    const uint8_t* end = in + length;
+    size_t offset = 0;
+    uint64_t var_idx, line_number, base, address;
+    uint8_t flags;
+
+    codec_reset(state);
+    while (in < end) {
+        const uint8_t tag = *in++;
+        if (tag == TRACE_CODEC_RAW) {
+            uint64_t type_message, size;
+            if ((in = get_varint(in, end, &type_message)) == NULL ||
+                    (in = get_varint(in, end, &size)) == NULL ||
+                    size > (size_t) (end - in) || size > UINT16_MAX ||
+                    offset + sizeof(record_header_t) + size > capacity)
+                return -1;
+
+            record_header_t* header =
+                reinterpret_cast<record_header_t*>(out + offset);
+            header->type_message = type_message;
+            header->length = size;
+            memcpy(out + offset + sizeof(record_header_t), in, size);
+
+            in += size;
+            offset += sizeof(record_header_t) + size;
+            continue;
+        }
+
+        if ((in = get_varint(in, end, &var_idx)) == NULL)
+            return -1;
+
+        codec_slot_t* slot = codec_slot(state, var_idx);
+        if ((in = get_access(in, end, slot, &flags)) == NULL ||
+                (in = get_delta(in, end, slot->line_number,
+                        &line_number)) == NULL)
+            return -1;
+
+        record_header_t* header =
+            reinterpret_cast<record_header_t*>(out + offset);
+        char* payload = out + offset + sizeof(record_header_t);
+        header->type_message = tag;
+
+        if (tag == MSG_MEM_INFO) {
+            if ((in = get_delta(in, end, slot->address, &address)) == NULL ||
+                    offset + sizeof(record_header_t) + sizeof(mem_record_t) >
+                    capacity)
+                return -1;
+
+            mem_record_t* rec = reinterpret_cast<mem_record_t*>(payload);
+            rec->coreID = slot->coreID;
+            rec->read_write = flags & 0x3;
+            rec->reserved = 0;
+            rec->line_number = line_number;
+            rec->address = address;
+            rec->var_idx = var_idx;
+            rec->type_size = slot->type_size;
+            header->length = sizeof(mem_record_t);
+        } else if (tag == MSG_TRACE_INFO) {
+            if ((in = get_delta(in, end, slot->base, &base)) == NULL ||
+                    (in = get_delta(in, end, slot->address, &address)) ==
+                    NULL || offset + sizeof(record_header_t) +
+                    sizeof(trace_record_t) > capacity)
+                return -1;
+
+            trace_record_t* rec = reinterpret_cast<trace_record_t*>(payload);
+            rec->coreID = slot->coreID;
+            rec->read_write = flags & 0x3;
+            rec->reserved = 0;
+            rec->line_number = line_number;
+            rec->base = base;
+            rec->address = address;
+            rec->var_idx = var_idx;
+            header->length = sizeof(trace_record_t);
+            slot->base = base;
+        } else if (tag == MSG_VECTOR_STRIDE_INFO) {
+            if ((in = get_delta(in, end, slot->address, &address)) == NULL ||
+                    offset + sizeof(record_header_t) +
+                    sizeof(vector_stride_record_t) > capacity)
+                return -1;
+
+            vector_stride_record_t* rec =
+                reinterpret_cast<vector_stride_record_t*>(payload);
+            rec->coreID = slot->coreID;
+            rec->reserved = 0;
+            rec->loop_line_number = line_number;
+            rec->address = address;
+            rec->var_idx = var_idx;
+            rec->type_size = slot->type_size;
+            header->length = sizeof(vector_stride_record_t);
+        } else {
+            return -1;
+        }
+
+        slot->line_number = line_number;
+        slot->address = address;
+        offset += sizeof(record_header_t) + header->length;
+    }
+
+    return offset;
+}
+
+static inline uint32_t lz_hash(const uint8_t* ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return (value * 2654435761u) >> (32 - TRACE_CODEC_HASH_BITS);
+}
+
+static inline uint8_t* lz_put_length(uint8_t* out, size_t length) {
+    for (; length >= 0xff; length -= 0xff)
+        *out++ = 0xff;
+
+    *out++ = length;
+    return out;
+}
+
+// Compress `length' bytes from `in' into `out'. Gives up and returns 0 as soon
+// as the output would grow beyond `capacity'. The input must not be larger
+// than 64KB, so that positions fit in the 16-bit hash table.
+static inline size_t lz_compress(const uint8_t* in, size_t length,
+        uint8_t* out, size_t capacity, uint16_t* hash_table) {
+    const uint8_t* anchor = in;
+    const uint8_t* ptr = in;
+    const uint8_t* end = in + length;
+    uint8_t* op = out;
+
+    memset(hash_table, 0, sizeof(uint16_t) << TRACE_CODEC_HASH_BITS);
+
+    // Sequences are: a token holding the literal and match lengths
+    // (4 bits each), extra length bytes for the literals, the literals, a
+    // 16-bit offset and extra length bytes for the match. The last sequence
+    // carries no match.
+    while (ptr + TRACE_CODEC_MIN_MATCH <= end) {
+        uint32_t hash = lz_hash(ptr);
+        const uint8_t* match = in + hash_table[hash];
+        hash_table[hash] = ptr - in;
+
+        if (match >= ptr || ptr - match > UINT16_MAX ||
+                memcmp(match, ptr, TRACE_CODEC_MIN_MATCH) != 0) {
+            ptr++;
+            continue;
+        }
+
+        size_t match_length = TRACE_CODEC_MIN_MATCH;
+        while (ptr + match_length < end &&
+                match[match_length] == ptr[match_length])
+            match_length++;
+
+        const size_t literals = ptr - anchor;
+        if ((size_t) (op - out) + literals + literals / 0xff +
+                match_length / 0xff + 8 > capacity)
+            return 0;
+
+        uint8_t* token = op++;
+        const size_t extra = match_length - TRACE_CODEC_MIN_MATCH;
+        *token = ((literals < 0xf ? literals : 0xf) << 4) |
+            (extra < 0xf ? extra : 0xf);
+
+        if (literals >= 0xf)
+            op = lz_put_length(op, literals - 0xf);
+
+        memcpy(op, anchor, literals);
+        op += literals;
+
+        const uint16_t distance = ptr - match;
+        memcpy(op, &distance, sizeof(distance));
+        op += sizeof(distance);
+
+        if (extra >= 0xf)
+            op = lz_put_length(op, extra - 0xf);
+
+        ptr += match_length;
+        anchor = ptr;
+    }
+
+    const size_t literals = end - anchor;
+    if ((size_t) (op - out) + literals + literals / 0xff + 2 > capacity)
+        return 0;
+
+    *op++ = (literals < 0xf ? literals : 0xf) << 4;
+    if (literals >= 0xf)
+        op = lz_put_length(op, literals - 0xf);
+
+    memcpy(op, anchor, literals);
+    op += literals;
+    return op - out;
+}
+
+static inline const uint8_t* lz_get_length(const uint8_t* in,
+        const uint8_t* end, size_t* length) {
+    uint8_t byte;
+    do {
+        if (in >= end)
+            return NULL;
+
+        byte = *in++;
+        *length += byte;
+    } while (byte == 0xff);
+
+    return in;
+}
+
+// Decompress into `out', which is expected to receive exactly `length' bytes.
+// Returns false if the data is corrupt.
+static inline bool lz_decompress(const uint8_t* in, size_t in_length,
+        uint8_t* out, size_t length) {
+    const uint8_t* end = in + in_length;
+    uint8_t* op = out;
+    uint8_t* op_end = out + length;
+
+    while (in < end) {
+        const uint8_t token = *in++;
+
+        size_t literals = token >> 4;
+        if (literals == 0xf && (in = lz_get_length(in, end, &literals)) == NULL)
+            return false;
+
+        if (literals > (size_t) (end - in) || literals > (size_t) (op_end - op))
+            return false;
+
+        memcpy(op, in, literals);
+        op += literals;
+        in += literals;
+
+        // The last sequence has no match.
+        if (in == end)
+            break;
+
+        uint16_t distance;
+        if ((size_t) (end - in) < sizeof(distance))
+            return false;
+
+        memcpy(&distance, in, sizeof(distance));
+        in += sizeof(distance);
+
+        size_t match_length = token & 0xf;
+        if (match_length == 0xf &&
+                (in = lz_get_length(in, end, &match_length)) == NULL)
+            return false;
+
+        match_length += TRACE_CODEC_MIN_MATCH;
+        if (distance == 0 || distance > op - out ||
+                match_length > (size_t) (op_end - op))
+            return false;
+
+        // Matches may overlap with the bytes being produced.
+        const uint8_t* match = op - distance;
+        for (size_t i = 0; i < match_length; i++)
+            op[i] = match[i];
+
+        op += match_length;
+    }
+
+    return op == op_end;
+}
+
+// Pack as many of the records in `records' as fit into a single
+// MSG_COMPRESSED_BLOCK record, written to `out', which must have room for
+// TRACE_CODEC_BLOCK_BOUND bytes. Returns the size of the block record, and the
+// number of bytes of records that went into it in `consumed'.
+static inline size_t trace_codec_compress(codec_scratch_t* scratch,
+        const char* records, size_t length, char* out, size_t* consumed) {
+    record_header_t* header = reinterpret_cast<record_header_t*>(out);
+    compressed_block_t* block = reinterpret_cast<compressed_block_t*>(out +
+            sizeof(record_header_t));
+    uint8_t* data = reinterpret_cast<uint8_t*>(out + sizeof(record_header_t) +
+            sizeof(compressed_block_t));
+
+    size_t delta_length = delta_encode(&scratch->state, records, length,
+            scratch->delta, consumed);
+    size_t data_length = lz_compress(scratch->delta, delta_length, data,
+            delta_length, scratch->hash_table);
+
+    if (data_length == 0 || data_length >= delta_length) {
+        memcpy(data, scratch->delta, delta_length);
+        data_length = delta_length;
+        block->method = BLOCK_DELTA;
+    } else {
+        block->method = BLOCK_DELTA_LZ;
+    }
+
+    block->length = delta_length;
+    header->type_message = MSG_COMPRESSED_BLOCK;
+    header->length = sizeof(compressed_block_t) + data_length;
+    return sizeof(record_header_t) + header->length;
+}
+
+// Unpack the payload of a MSG_COMPRESSED_BLOCK record into `out', which must
+// have room for TRACE_CODEC_CHUNK_SIZE bytes. Returns the size of the records,
+// or -1 if the block is corrupt.
+static inline ssize_t trace_codec_decompress(codec_scratch_t* scratch,
+        const char* payload, size_t length, char* out) {
+    if (length < sizeof(compressed_block_t))
+        return -1;
+
+    const compressed_block_t* block =
+        reinterpret_cast<const compressed_block_t*>(payload);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(payload +
+            sizeof(compressed_block_t));
+    const size_t data_length = length - sizeof(compressed_block_t);
+
+    if (block->length > TRACE_CODEC_DELTA_BOUND)
+        return -1;
+
+    if (block->method == BLOCK_DELTA_LZ) {
+        if (lz_decompress(data, data_length, scratch->delta,
+                    block->length) == false)
+            return -1;
+
+        data = scratch->delta;
+    } else if (block->method != BLOCK_DELTA || data_length != block->length) {
+        return -1;
+    }
+
+    return delta_decode(&scratch->state, data, block->length, out,
+            TRACE_CODEC_CHUNK_SIZE);
+}
+
+#endif  // TOOLS_MACPO_COMMON_TRACE_CODEC_H_
@@ -20,11 +20,13 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
 
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
+#include <pthread.h>
 #include <sched.h>
 #include <unistd.h>
 
@@ -36,16 +38,16 @@
 #include <vector>
 #include <utility>
 
-#include "avl_tree.h"
 #include "elf_reader.h"
 #include "generic_defs.h"
 #include "histogram.h"
 #include "mrt.h"
 #include "macpo_record.h"
+#include "online_rd.h"
+#include "trace_buffer.h"
 
 typedef std::pair<int64_t, int16_t> val_idx_pair;
 typedef std::pair<int, int16_t> line_threadid_pair;
-typedef histogram_t<int64_t, int64_t> rdhist;
 
 typedef std::map<int16_t, bool> bool_map;
 typedef std::map<int16_t, int16_t> short_map;
@@ -58,6 +60,9 @@ typedef std::map<int64_t, long_histogram> long_histogram_coll;
 static const int DIST_INFINITY = 40 * 1024 * 1024 / 64;
 static const int RECORD_THRESHOLD = 512;
 
+// Cache lines that each thread tracks for online reuse distances.
+static const long ONLINE_RD_LINES = 8192;
+
 typedef struct _tag_source_location {
     int64_t line_number;
     void* function_address;
@@ -76,14 +81,30 @@ bool operator<(const src_location_t& left, const src_location_t& right) {
 
 typedef std::set<src_location_t> src_location_list_t;
 static src_location_list_t analyzed_loops;
-static std::map<void*, uint64_t> function_count;
 
-static multigram_t<int16_t, bool> overlap_hist;
-static multigram_t<int16_t, int16_t> branch_hist;
-static multigram_t<int16_t, int16_t> align_hist;
-static multigram_t<int16_t, int16_t> sstore_align_hist;
-static multigram_t<int16_t, int16_t> stride_hist;
-static multigram_t<int64_t, int64_t> tripcount_hist;
+// Conflicting observations of a branch make it unpredictable.
+struct merge_branch_t {
+    int16_t operator()(const int16_t& a, const int16_t& b) const {
+        if (a == BRANCH_NOINIT || a == b) {
+            return b;
+        }
+
+        return b == BRANCH_NOINIT ? a : BRANCH_UNKNOWN;
+    }
+};
+
+static sharded_multigram_t<int16_t, bool, merge_or_t<bool> >
+    overlap_hist(false);
+static sharded_multigram_t<int16_t, int16_t, merge_branch_t>
+    branch_hist(BRANCH_NOINIT);
+static sharded_multigram_t<int16_t, int16_t, merge_min_t<int16_t> >
+    align_hist(ALIGN_NOINIT);
+static sharded_multigram_t<int16_t, int16_t, merge_min_t<int16_t> >
+    sstore_align_hist(ALIGN_NOINIT);
+static sharded_multigram_t<int16_t, int16_t, merge_min_t<int16_t> >
+    stride_hist(STRIDE_NOINIT);
+static sharded_multigram_t<int64_t, int64_t, merge_sum_t<int64_t> >
+    tripcount_hist(0);
 
 static bool_map_coll overlap_bin;
 static short_map_coll branch_bin, align_bin, sstore_align_bin, stride_bin;
@@ -93,42 +114,309 @@ static std::map<src_location_t, src_location_t> branch_loop_line_pair;
 static std::map<src_location_t, src_location_list_t> loop_branch_line_pair;
 
 static volatile sig_atomic_t sleeping = 0;
-static volatile sig_atomic_t access_count = 0;
+
+// Record budget and adaptive sampling state, see mrt.h.
+static volatile long access_count = 0;
+static volatile long total_records = 0;
+static volatile sig_atomic_t window_id = 0;
+static volatile sig_atomic_t window_budget_hit = 0;
+static volatile sig_atomic_t budget_exhausted = 0;
+
+static long window_record_limit = WINDOW_RECORD_LIMIT;
+static long thread_window_record_limit = 0;
+static long max_records = 0;
+static long window_budget = WINDOW_RECORD_LIMIT;
+static long awake_usec = AWAKE_USEC;
+static int target_overhead = 0;
+static bool adaptive_sampling = false;
+
+static __thread int thread_window = -1;
+static __thread long thread_records = 0;
+static __thread long thread_allowance = 0;
 
 static int fd = -1;
+static int index_fd = -1;
 static int sleep_sec = 0;
 static int new_sleep_sec = 1;
 static int *intel_apic_mapping = NULL;
-static node_t terminal_node;
+static record_header_t terminal_record;
 static size_t numCores = 0;
 
 static std::vector<std::string> stream_list;
 
+// Compute reuse distances instead of writing a trace.
+static bool online_reuse = false;
+
+static int core_id_source = CORE_ID_CPUID;
+
 static __thread int coreID = -1;
-static __thread avl_tree* tree = NULL;
-static __thread rdhist* histogram_list[MAX_VARIABLES];
+static __thread int core_id_countdown = 0;
 
-static volatile int16_t global_lock = 0;
+/***
 
-static inline void lock(volatile int16_t* lock_var) {
-    if (lock_var == NULL) {
-        return;
+Counting calls to instrumented functions.
+
+Each checker stops looking at a function after RECORD_THRESHOLD calls. Calls
+are counted in a table private to each thread and published to the shared
+table, with an atomic add, every FUNCTION_COUNT_BATCH calls. Once the shared
+count of a function crosses the threshold, the thread marks its private entry
+as saturated, so that later calls return after a single thread-local lookup.
+The threshold may thus be overshot by up to FUNCTION_COUNT_BATCH calls per
+thread.
+
+Threads that cannot get a private table (because allocation failed or their
+table is full) count directly in the shared table. Both tables use open
+addressing; entries of the shared table are claimed with a compare-and-swap.
+Private tables are kept in a list, so that counts that were not published yet
+can be added up at exit, and are recycled once their thread exits. Threads may
+still be running while the counts are added up, so the owner of a private
+entry updates its count with atomic operations and the count is taken from it
+with a compare-and-swap, which leaves saturated entries alone.
+
+*/
+
+typedef struct {
+    void* volatile function_address;
+    volatile uint64_t count;
+} function_count_t;
+
+typedef struct _tag_function_count_table {
+    volatile sig_atomic_t in_use;
+    struct _tag_function_count_table* volatile next;
+    function_count_t entries[FUNCTION_COUNT_SLOTS];
+} function_count_table_t;
+
+static const uint64_t FUNCTION_SATURATED = ~0ULL;
+
+static function_count_t function_count[FUNCTION_COUNT_SLOTS];
+static function_count_table_t* volatile function_count_tables = NULL;
+
+static pthread_key_t function_count_key;
+static pthread_once_t function_count_key_once = PTHREAD_ONCE_INIT;
+static __thread function_count_table_t* local_function_count = NULL;
+
+static function_count_t* find_function_count(function_count_t* entries,
+        void* func_addr, bool shared) {
+    const size_t mask = FUNCTION_COUNT_SLOTS - 1;
+    size_t idx = (reinterpret_cast<uintptr_t>(func_addr) *
+            0x9e3779b97f4a7c15ULL) >> 32;
+
+    for (size_t probe = 0; probe < FUNCTION_COUNT_SLOTS; probe++) {
+        function_count_t* entry = &entries[(idx + probe) & mask];
+        void* key = entry->function_address;
+        if (key == func_addr) {
+            return entry;
+        }
+
+        if (key == NULL) {
+            if (shared == false) {
+                entry->function_address = func_addr;
+                return entry;
+            }
+
+            key = __sync_val_compare_and_swap(&entry->function_address,
+                    (void*) NULL, func_addr);
+            if (key == NULL || key == func_addr) {
+                return entry;
+            }
+        }
     }
 
-    while (__sync_bool_compare_and_swap(lock_var, 0, 1) == false) {
-        // do nothing.
+    return NULL;
+}
+
+static bool publish_function_count(void* func_addr, uint64_t calls) {
+    function_count_t* entry = find_function_count(function_count, func_addr,
+            true);
+    if (entry == NULL) {
+        // No room to keep track of this function, so leave it alone.
+        return false;
     }
 
-    asm volatile("lfence" ::: "memory");
+    return __sync_add_and_fetch(&entry->count, calls) <= RECORD_THRESHOLD;
+}
+
+static void publish_function_counts(function_count_table_t* table) {
+    for (int i = 0; i < FUNCTION_COUNT_SLOTS; i++) {
+        function_count_t& entry = table->entries[i];
+        void* func_addr = entry.function_address;
+        if (func_addr == NULL) {
+            continue;
+        }
+
+        // The owner of the table may be counting calls at the same time.
+        uint64_t calls = entry.count;
+        while (calls != 0 && calls != FUNCTION_SATURATED) {
+            uint64_t seen = __sync_val_compare_and_swap(&entry.count, calls,
+                    0);
+            if (seen == calls) {
+                publish_function_count(func_addr, calls);
+                break;
+            }
+
+            calls = seen;
+        }
+    }
 }
 
-static inline void unlock(volatile int16_t* lock_var) {
-    if (lock_var == NULL) {
+static void release_function_count_table(void* ptr) {
+    function_count_table_t* table =
+        reinterpret_cast<function_count_table_t*>(ptr);
+    if (table == NULL) {
         return;
     }
 
-    *lock_var = 0;
-    asm volatile("sfence" ::: "memory");
+    publish_function_counts(table);
+    memset(table->entries, 0, sizeof(table->entries));
+
+    // Let some other thread adopt this table.
+    local_function_count = NULL;
+    __sync_synchronize();
+    table->in_use = 0;
+}
+
+static void create_function_count_key() {
+    pthread_key_create(&function_count_key, release_function_count_table);
+}
+
+static function_count_table_t* get_function_count_table() {
+    pthread_once(&function_count_key_once, create_function_count_key);
+
+    // First try to recycle a table left behind by a thread that has exited.
+    function_count_table_t* table = function_count_tables;
+    while (table != NULL) {
+        if (__sync_bool_compare_and_swap(&table->in_use, 0, 1)) {
+            break;
+        }
+
+        table = table->next;
+    }
+
+    if (table == NULL) {
+        table = reinterpret_cast<function_count_table_t*>(calloc(1,
+                    sizeof(*table)));
+        if (table == NULL) {
+            return NULL;
+        }
+
+        table->in_use = 1;
+        do {
+            table->next = function_count_tables;
+        } while (__sync_bool_compare_and_swap(&function_count_tables,
+                    table->next, table) == false);
+    }
+
+    pthread_setspecific(function_count_key, table);
+    return table;
+}
+
+// Returns true if the checkers should look at this call to the function.
+static inline bool count_function_call(void* func_addr) {
+    if (local_function_count == NULL) {
+        local_function_count = get_function_count_table();
+    }
+
+    function_count_t* entry = NULL;
+    if (local_function_count != NULL) {
+        entry = find_function_count(local_function_count->entries, func_addr,
+                false);
+    }
+
+    if (entry == NULL) {
+        return publish_function_count(func_addr, 1);
+    }
+
+    // Only the owner marks an entry as saturated.
+    if (entry->count == FUNCTION_SATURATED) {
+        return false;
+    }
+
+    if (__sync_add_and_fetch(&entry->count, 1) < FUNCTION_COUNT_BATCH) {
+        return true;
+    }
+
+    uint64_t calls = __sync_lock_test_and_set(&entry->count, 0);
+    if (publish_function_count(func_addr, calls) == false) {
+        entry->count = FUNCTION_SATURATED;
+        return false;
+    }
+
+    return true;
+}
+
+static void aggregate_function_counts() {
+    for (function_count_table_t* table = function_count_tables; table != NULL;
+            table = table->next) {
+        publish_function_counts(table);
+    }
+
+#ifdef DEBUG_PRINT
+    for (int i = 0; i < FUNCTION_COUNT_SLOTS; i++) {
+        if (function_count[i].function_address != NULL) {
+            fprintf(stderr, "MACPO :: Function %p was checked %lu times\n",
+                    function_count[i].function_address,
+                    function_count[i].count);
+        }
+    }
+#endif
+}
+
+static bool reserve_records() {
+    // Records are charged to the shared counters in batches,
+    // so that threads don't contend on every access.
+    if (window_budget_hit == 1 ||
+            __sync_fetch_and_add(&access_count, RECORD_BATCH) >= window_budget) {
+        window_budget_hit = 1;
+        return false;
+    }
+
+    if (max_records > 0 && __sync_fetch_and_add(&total_records,
+                RECORD_BATCH) >= max_records) {
+        budget_exhausted = 1;
+        return false;
+    }
+
+    thread_allowance = RECORD_BATCH;
+    return true;
+}
+
+static inline bool record_allowed() {
+    if (sleeping == 1 || budget_exhausted == 1)
+        return false;
+
+    if (thread_window != window_id) {
+        // First record of this thread in a new window.
+        thread_window = window_id;
+        thread_records = 0;
+        thread_allowance = 0;
+    }
+
+    if (thread_window_record_limit > 0 &&
+            thread_records >= thread_window_record_limit)
+        return false;
+
+    if (thread_allowance == 0 && reserve_records() == false)
+        return false;
+
+    thread_allowance--;
+    thread_records++;
+    return true;
+}
+
+static inline void write_record(uint16_t type_message, const void* payload,
+        size_t length, bool buffered) {
+    char record[sizeof(record_header_t) + MAX_RECORD_LENGTH];
+    record_header_t* header = reinterpret_cast<record_header_t*>(record);
+
+    header->type_message = type_message;
+    header->length = length;
+    memcpy(record + sizeof(record_header_t), payload, length);
+
+    // Fall back to an unbuffered write if the record could not be buffered.
+    const size_t size = sizeof(record_header_t) + length;
+    if (buffered == false || trace_buffer_write(record, size) == false) {
+        trace_buffer_write_direct(record, size);
+    }
 }
 
 static bool index_comparator(const val_idx_pair& v1, const val_idx_pair& v2) {
@@ -157,21 +445,16 @@ static int get_proc_kind() {
     return proc;
 }
 
-static int getCoreID() {
-    if (coreID != -1)
-        return coreID;
-
+static int get_core_id_from_apic() {
     int info[4];
     if (!isCPUIDSupported()) {
-        coreID = 0;
-        return coreID;  // default
+        return 0;   // default
     }
 
     int proc = get_proc_kind();
     if (proc == PROC_AMD) {
         __cpuid(info, 1, 0);
-        coreID = (info[1] & 0xff000000) >> 24;
-        return coreID;
+        return (info[1] & 0xff000000) >> 24;
     } else if (proc == PROC_INTEL) {
         int apic_id = 0;
         __cpuid(info, 0xB, 0);
@@ -199,11 +482,78 @@ static int getCoreID() {
                 break;
         }
 
-        coreID = i == numCores ? 0 : i;
+        return i == numCores ? 0 : i;
+    }
+
+    return 0;
+}
+
+#if defined(__x86_64) || defined(__i386)
+static inline int read_tsc_aux() {
+    uint32_t eax, ecx, edx;
+    asm volatile("rdtscp" : "=a" (eax), "=c" (ecx), "=d" (edx));
+
+    // Linux stores the node number above bit 12 and the CPU number below it.
+    return ecx & 0xfff;
+}
+
+static bool is_rdtscp_supported() {
+    if (!isCPUIDSupported()) {
+        return false;
+    }
+
+    int info[4];
+    __cpuid(info, 0x80000000, 0);
+    if ((unsigned int) info[EAX] < 0x80000001) {
+        return false;
+    }
+
+    __cpuid(info, 0x80000001, 0);
+    return (info[EDX] & (1 << 27)) != 0;
+}
+#endif
+
+static int select_core_id_source() {
+    int cpu = sched_getcpu();
+
+#if defined(__x86_64) || defined(__i386)
+    // Only trust TSC_AUX if the OS stores the CPU number in it.
+    if (cpu >= 0 && is_rdtscp_supported() && read_tsc_aux() == cpu) {
+        return CORE_ID_RDTSCP;
+    }
+#endif
+
+    if (cpu >= 0) {
+        return CORE_ID_SCHED_GETCPU;
+    }
+
+    return CORE_ID_CPUID;
+}
+
+static inline int getCoreID() {
+    if (coreID != -1 && core_id_countdown-- > 0)
         return coreID;
+
+    // Threads may migrate, so re-read the core id every now and then.
+    core_id_countdown = CORE_ID_REFRESH;
+    switch (core_id_source) {
+#if defined(__x86_64) || defined(__i386)
+        case CORE_ID_RDTSCP:
+            coreID = read_tsc_aux();
+            break;
+#endif
+
+        case CORE_ID_SCHED_GETCPU:
+            coreID = std::max(sched_getcpu(), 0);
+            break;
+
+        default:
+            // CPUID is serializing and slow, keep the first value we got.
+            if (coreID == -1)
+                coreID = get_core_id_from_apic();
+            break;
     }
 
-    coreID = 0;
     return coreID;
 }
 
@@ -848,15 +1198,107 @@ void print_stride_check_results(const src_location_t& location) {
     }
 }
 
+static void merge_histograms() {
+    overlap_hist.merge();
+    branch_hist.merge();
+    align_hist.merge();
+    sstore_align_hist.merge();
+    stride_hist.merge();
+    tripcount_hist.merge();
+}
+
+void indigo__end() {
+    trace_buffer_flush_all(true);
+    aggregate_function_counts();
+    merge_histograms();
+}
+
+static void print_reuse_distances() {
+    const rd_histogram_list_t& histograms = online_rd_merge();
+
+    fprintf(stderr, "\n==== Reuse distance metrics ====");
+
+    for (size_t i = 0; i < histograms.size(); i++) {
+        const rd_histogram_t* hist = histograms[i];
+        if (hist == NULL) {
+            continue;
+        }
+
+        const rd_histogram_t::pair_list_t pair_list = hist->sort(3);
+        if (pair_list.size() == 0) {
+            continue;
+        }
+
+        std::string name = "unknown";
+        if (i < stream_list.size()) {
+            name = stream_list[i];
+        }
+
+        const rd_histogram_t::pair_t pair = pair_list[0];
+        if (pair.first >= DIST_INFINITY - 1) {
+            fprintf(stderr, "\nReuse distance for %s is greater than the size "
+                    "of the last-level cache. Consider adding the following "
+                    "pragma to let the compiler generate non-temporal store "
+                    "instructions:\n#pragma vector nontemporal(%s)\n",
+                    name.c_str(), name.c_str());
+        }
+
+        fprintf(stderr, "\n%s:", name.c_str());
+        for (rd_histogram_t::pair_list_t::const_iterator it =
+                pair_list.begin(); it != pair_list.end(); it++) {
+            const uint64_t bin = it->first;
+            const double count = it->second;
+            if (bin >= DIST_INFINITY - 1) {
+                fprintf(stderr, " inf. (%.0f times)", count);
+            } else {
+                fprintf(stderr, " %lu (%.0f times)", (unsigned long) bin,
+                        count);
+            }
+        }
+
+        fprintf(stderr, ".\n");
+    }
+
+    fprintf(stderr, "\n");
+}
+
+static void write_online_summary() {
+    char filename[32];
+    snprintf(filename, sizeof(filename), "macpo.%d.mrc", getpid());
+
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "MACPO :: Failed to open %s for writing: %s.\n",
+                filename, strerror(errno));
+        return;
+    }
+
+    online_rd_write_summary(file, stream_list);
+    if (fclose(file) != 0) {
+        fprintf(stderr, "MACPO :: Failed to write %s: %s.\n", filename,
+                strerror(errno));
+    }
+}
+
 void indigo__exit() {
     if (fd >= 0) {
+        trace_buffer_fini();
         close(fd);
+        fd = -1;
+    }
+
+    if (index_fd >= 0) {
+        close(index_fd);
+        index_fd = -1;
     }
 
     if (intel_apic_mapping) {
         free(intel_apic_mapping);
     }
 
+    aggregate_function_counts();
+    merge_histograms();
+
     // Get the name of the executable file.
     const int kLen = 1024;
     char link_buffer[kLen];
@@ -909,56 +1351,11 @@ void indigo__exit() {
         }
     }
 
-    fprintf(stderr, "\n==== Reuse distance metrics ====");
-
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        rdhist* hist = histogram_list[i];
-        if (hist == NULL) {
-            continue;
-        }
-
-        if (hist->size() == 0) {
-            continue;
-        }
+    print_reuse_distances();
 
-        if (i >= stream_list.size()) {
-            // We can't process any more histograms because
-            // stream_list will not contain names for any of them.
-            return;
-        }
-
-        const rdhist::pair_list_t pair_list = hist->sort(3);
-        assert(pair_list.size() > 0);
-
-        const rdhist::pair_t pair = pair_list[0];
-        if (pair.first == DIST_INFINITY) {
-            fprintf(stderr, "\nReuse distance for %s is greater than the size "
-                    "of the last-level cache. Consider adding the following "
-                    "pragma to let the compiler generate non-temporal store "
-                    "instructions:\n#pragma vector nontemporal(%s)\n",
-                    stream_list[i].c_str(), stream_list[i].c_str());
-        }
-
-        for (rdhist::pair_list_t::const_iterator it = pair_list.begin();
-                it != pair_list.end(); it++) {
-            const rdhist::pair_t pair = *it;
-            int64_t max_bin = pair.first;
-            int64_t max_val = pair.second;
-            if (max_bin == DIST_INFINITY) {
-                if (max_val > 0) {
-                    fprintf(stderr, " %d (%d times)", max_bin, max_val);
-                }
-            } else {
-                if (max_val > 0) {
-                    fprintf(stderr, " inf. (%d times)", max_val);
-                }
-            }
-        }
-
-        fprintf(stderr, ".\n");
+    if (online_reuse) {
+        write_online_summary();
     }
-
-    fprintf(stderr, "\n");
 }
 
 int64_t* new_histogram(size_t histogram_entries) {
@@ -978,23 +1375,14 @@ int64_t* new_histogram(size_t histogram_entries) {
 void indigo__record_branch_c(int line_number, void* func_addr,
         int loop_line_number, int true_branch_count, int false_branch_count) {
     src_location_t loop_location(func_addr, loop_line_number);
-    std::map<void*, uint64_t>::iterator it = function_count.find(func_addr);
-    if (it != function_count.end()) {
-        if (it->second >= RECORD_THRESHOLD) {
-            return;
-        }
-
-        it->second += 1;
-    } else {
-        lock(&global_lock);
-        function_count[func_addr] += 1;
-        unlock(&global_lock);
+    if (count_function_call(func_addr) == false) {
+        return;
     }
 
     analyzed_loops.insert(loop_location);
 
     // Short circuit to prevent runtime overhead.
-    if (branch_hist.get(0, func_addr, line_number, 0) == BRANCH_UNKNOWN) {
+    if (branch_hist.get(func_addr, line_number, 0) == BRANCH_UNKNOWN) {
         return;
     }
 
@@ -1019,11 +1407,11 @@ void indigo__record_branch_c(int line_number, void* func_addr,
         status = BRANCH_UNKNOWN;
     }
 
-    if (branch_hist.get(0, func_addr, line_number, 0) == BRANCH_NOINIT) {
-        branch_hist.set(0, func_addr, line_number, 0, status);
+    if (branch_hist.get(func_addr, line_number, 0) == BRANCH_NOINIT) {
+        branch_hist.set(func_addr, line_number, 0, status);
     } else {
-        if (branch_hist.get(0, func_addr, line_number, 0) != status) {
-            branch_hist.set(0, func_addr, line_number, 0, BRANCH_UNKNOWN);
+        if (branch_hist.get(func_addr, line_number, 0) != status) {
+            branch_hist.set(func_addr, line_number, 0, BRANCH_UNKNOWN);
         }
     }
 }
@@ -1035,19 +1423,18 @@ void indigo__vector_stride_c(int loop_line_number, int var_idx, void* addr,
     if (fd < 0)
         return;
 
-    if (sleeping == 1 || access_count >= 131072)    // 131072 is 128*1024.
+    if (record_allowed() == false)
         return;
 
-    node_t node;
-    node.type_message = MSG_VECTOR_STRIDE_INFO;
-
-    node.vector_stride_info.coreID = getCoreID();
-    node.vector_stride_info.address = (size_t) addr;
-    node.vector_stride_info.var_idx = var_idx;
-    node.vector_stride_info.loop_line_number = loop_line_number;
-    node.vector_stride_info.type_size = type_size;
+    vector_stride_record_t record;
+    record.coreID = getCoreID();
+    record.reserved = 0;
+    record.address = (size_t) addr;
+    record.var_idx = var_idx;
+    record.loop_line_number = loop_line_number;
+    record.type_size = type_size;
 
-    write(fd, &node, sizeof(node_t));
+    write_record(MSG_VECTOR_STRIDE_INFO, &record, sizeof(record), true);
 }
 
 /**
@@ -1058,17 +1445,8 @@ void indigo__vector_stride_c(int loop_line_number, int var_idx, void* addr,
 int indigo__aligncheck_c(int line_number, void* func_addr, int stream_count,
         int16_t dep_status, ...) {
     src_location_t location(func_addr, line_number);
-    std::map<void*, uint64_t>::iterator it = function_count.find(func_addr);
-    if (it != function_count.end()) {
-        if (it->second >= RECORD_THRESHOLD) {
-            return -1;
-        }
-
-        it->second += 1;
-    } else {
-        lock(&global_lock);
-        function_count[func_addr] += 1;
-        unlock(&global_lock);
+    if (count_function_call(func_addr) == false) {
+        return -1;
     }
 
     analyzed_loops.insert(location);
@@ -1076,7 +1454,7 @@ int indigo__aligncheck_c(int line_number, void* func_addr, int stream_count,
     va_list args;
     int i, j;
 
-    if (align_hist.get(0, func_addr, line_number, 0) == NOT_ALIGNED) {
+    if (align_hist.get(func_addr, line_number, 0) == NOT_ALIGNED) {
         return -1;
     }
 
@@ -1088,7 +1466,7 @@ int indigo__aligncheck_c(int line_number, void* func_addr, int stream_count,
         int64_t _remainder = ((int64_t) address) % 64;
         if (remainder != -1 && remainder != _remainder) {
             va_end(args);
-            align_hist.set(0, func_addr, line_number, 0, NOT_ALIGNED);
+            align_hist.set(func_addr, line_number, 0, NOT_ALIGNED);
             return -1;
         }
 
@@ -1099,9 +1477,9 @@ int indigo__aligncheck_c(int line_number, void* func_addr, int stream_count,
     va_end(args);
 
     if (remainder == 0) {
-        align_hist.set(0, func_addr, line_number, 0, FULL_ALIGNED);
+        align_hist.set(func_addr, line_number, 0, FULL_ALIGNED);
     } else {
-        align_hist.set(0, func_addr, line_number, 0, MUTUAL_ALIGNED);
+        align_hist.set(func_addr, line_number, 0, MUTUAL_ALIGNED);
     }
 
     return remainder;
@@ -1117,17 +1495,8 @@ int indigo__aligncheck_c(int line_number, void* func_addr, int stream_count,
 int indigo__sstore_aligncheck_c(int line_number, void* func_addr,
         int stream_count, int16_t dep_status, ...) {
     src_location_t location(func_addr, line_number);
-    std::map<void*, uint64_t>::iterator it = function_count.find(func_addr);
-    if (it != function_count.end()) {
-        if (it->second >= RECORD_THRESHOLD) {
-            return -1;
-        }
-
-        it->second += 1;
-    } else {
-        lock(&global_lock);
-        function_count[func_addr] += 1;
-        unlock(&global_lock);
+    if (count_function_call(func_addr) == false) {
+        return -1;
     }
 
     analyzed_loops.insert(location);
@@ -1135,7 +1504,7 @@ int indigo__sstore_aligncheck_c(int line_number, void* func_addr,
     va_list args;
     int i, j;
 
-    if (sstore_align_hist.get(0, func_addr, line_number, 0) == NOT_ALIGNED) {
+    if (sstore_align_hist.get(func_addr, line_number, 0) == NOT_ALIGNED) {
         return -1;
     }
 
@@ -1147,7 +1516,7 @@ int indigo__sstore_aligncheck_c(int line_number, void* func_addr,
         int64_t _remainder = ((int64_t) address) % 64;
         if (remainder != -1 && remainder != _remainder) {
             va_end(args);
-            sstore_align_hist.set(0, func_addr, line_number, 0, NOT_ALIGNED);
+            sstore_align_hist.set(func_addr, line_number, 0, NOT_ALIGNED);
             return -1;
         }
 
@@ -1158,9 +1527,9 @@ int indigo__sstore_aligncheck_c(int line_number, void* func_addr,
     va_end(args);
 
     if (remainder == 0) {
-        sstore_align_hist.set(0, func_addr, line_number, 0, FULL_ALIGNED);
+        sstore_align_hist.set(func_addr, line_number, 0, FULL_ALIGNED);
     } else {
-        sstore_align_hist.set(0, func_addr, line_number, 0, MUTUAL_ALIGNED);
+        sstore_align_hist.set(func_addr, line_number, 0, MUTUAL_ALIGNED);
     }
 
     return remainder;
@@ -1176,17 +1545,8 @@ int indigo__sstore_aligncheck_c(int line_number, void* func_addr,
 void indigo__overlap_check_c(int line_number, void* func_addr,
         int stream_count, ...) {
     src_location_t location(func_addr, line_number);
-    std::map<void*, uint64_t>::iterator it = function_count.find(func_addr);
-    if (it != function_count.end()) {
-        if (it->second >= RECORD_THRESHOLD) {
-            return;
-        }
-
-        it->second += 1;
-    } else {
-        lock(&global_lock);
-        function_count[func_addr] += 1;
-        unlock(&global_lock);
+    if (count_function_call(func_addr) == false) {
+        return;
     }
 
     analyzed_loops.insert(location);
@@ -1199,7 +1559,7 @@ void indigo__overlap_check_c(int line_number, void* func_addr,
     void* end_addresses[MAX_STREAMS];
 
     // If we've already found an overlap, terminate the search.
-    if (overlap_hist.get(0, func_addr, line_number, 0) == true)
+    if (overlap_hist.get(func_addr, line_number, 0) == true)
         return;
 
     va_start(args, stream_count);
@@ -1230,7 +1590,7 @@ void indigo__overlap_check_c(int line_number, void* func_addr,
             if ((ref_start <= start && ref_end >= start) ||
                     (ref_start <= end && ref_end >= end)) {
                 // We have an overlap!
-                overlap_hist.set(0, func_addr, line_number, 0, true);
+                overlap_hist.set(func_addr, line_number, 0, true);
                 return;
             }
         }
@@ -1240,17 +1600,8 @@ void indigo__overlap_check_c(int line_number, void* func_addr,
 void indigo__tripcount_check_c(int line_number, void* func_addr,
         int64_t trip_count) {
     src_location_t location(func_addr, line_number);
-    std::map<void*, uint64_t>::iterator it = function_count.find(func_addr);
-    if (it != function_count.end()) {
-        if (it->second >= RECORD_THRESHOLD) {
-            return;
-        }
-
-        it->second += 1;
-    } else {
-        lock(&global_lock);
-        function_count[func_addr] += 1;
-        unlock(&global_lock);
+    if (count_function_call(func_addr) == false) {
+        return;
     }
 
     analyzed_loops.insert(location);
@@ -1258,48 +1609,30 @@ void indigo__tripcount_check_c(int line_number, void* func_addr,
     if (trip_count < 0)
         trip_count = 0;
 
-    tripcount_hist.increment(0, func_addr, line_number, trip_count, 1);
+    tripcount_hist.increment(func_addr, line_number, trip_count, 1);
 }
 
 void indigo__unknown_stride_check_c(int line_number, void* func_addr) {
     src_location_t location(func_addr, line_number);
-    std::map<void*, uint64_t>::iterator it = function_count.find(func_addr);
-    if (it != function_count.end()) {
-        if (it->second >= RECORD_THRESHOLD) {
-            return;
-        }
-
-        it->second += 1;
-    } else {
-        lock(&global_lock);
-        function_count[func_addr] += 1;
-        unlock(&global_lock);
+    if (count_function_call(func_addr) == false) {
+        return;
     }
 
     analyzed_loops.insert(location);
 
-    stride_hist.set(0, func_addr, line_number, 0, STRIDE_UNKNOWN);
+    stride_hist.set(func_addr, line_number, 0, STRIDE_UNKNOWN);
 }
 
 void indigo__stride_check_c(int line_number, void* func_addr, int stride) {
     src_location_t location(func_addr, line_number);
-    std::map<void*, uint64_t>::iterator it = function_count.find(func_addr);
-    if (it != function_count.end()) {
-        if (it->second >= RECORD_THRESHOLD) {
-            return;
-        }
-
-        it->second += 1;
-    } else {
-        lock(&global_lock);
-        function_count[func_addr] += 1;
-        unlock(&global_lock);
+    if (count_function_call(func_addr) == false) {
+        return;
     }
 
     analyzed_loops.insert(location);
 
     // Short circuit to prevent runtime overhead.
-    if (stride_hist.get(0, func_addr, line_number, 0) == STRIDE_UNKNOWN)
+    if (stride_hist.get(func_addr, line_number, 0) == STRIDE_UNKNOWN)
         return;
 
     int16_t status = STRIDE_NOINIT;
@@ -1320,48 +1653,19 @@ void indigo__stride_check_c(int line_number, void* func_addr, int stride) {
             break;
     }
 
-    if (stride_hist.get(0, func_addr, line_number, 0) > status) {
-        stride_hist.set(0, func_addr, line_number, 0, status);
+    if (stride_hist.get(func_addr, line_number, 0) > status) {
+        stride_hist.set(func_addr, line_number, 0, status);
     }
 }
 
 void indigo__reuse_dist_c(int var_id, void* address) {
-    if (sleeping == 1) {
+    if (sleeping == 1 || var_id < 0) {
         return;
     }
 
     // FIXME: This measures reuse distance only for those accesses
     // that are generated from the current thread only.
-
-    if (var_id >= MAX_VARIABLES)
-        return;
-
-    // FIXME: Set DIST_INFINITY to twice the size of the largest cache.
-    if (histogram_list[var_id] == NULL) {
-        histogram_list[var_id] = new histogram_t<int64_t, int64_t>();
-    }
-
-    if (tree == NULL) {
-        tree = new avl_tree();
-    }
-
-    // Construct a dummy mem_info_t packet.
-    mem_info_t mem_info;
-    mem_info.coreID = getCoreID();
-    mem_info.var_idx = var_id;
-    mem_info.address = (size_t) address;
-    mem_info.read_write = TYPE_WRITE;
-
-    size_t distance = DIST_INFINITY - 1;
-    size_t cache_line = ADDR_TO_CACHE_LINE(mem_info.address);
-
-    distance = tree->get_distance(cache_line);
-    if (distance >= DIST_INFINITY) {
-        distance = DIST_INFINITY - 1;
-    }
-
-    histogram_list[var_id]->increment(distance, 1);
-    tree->insert(&mem_info);
+    online_rd_access(var_id, (size_t) address);
 }
 
 static inline void fill_trace_struct(int read_write, int line_number,
@@ -1371,23 +1675,22 @@ static inline void fill_trace_struct(int read_write, int line_number,
     if (fd < 0)
         return;
 
-    if (sleeping == 1 || access_count >= 131072)    // 131072 is 128*1024.
+    if (record_allowed() == false)
         return;
 
     size_t address_base = (size_t) base;
     size_t address = (size_t) p;
 
-    node_t node;
-    node.type_message = MSG_TRACE_INFO;
+    trace_record_t record;
+    record.coreID = getCoreID();
+    record.read_write = read_write;
+    record.reserved = 0;
+    record.base = address_base;
+    record.address = address;
+    record.var_idx = var_idx;
+    record.line_number = line_number;
 
-    node.trace_info.coreID = getCoreID();
-    node.trace_info.read_write = read_write;
-    node.trace_info.base = address_base;
-    node.trace_info.address = address;
-    node.trace_info.var_idx = var_idx;
-    node.trace_info.line_number = line_number;
-
-    write(fd, &node, sizeof(node_t));
+    write_record(MSG_TRACE_INFO, &record, sizeof(record), true);
 }
 
 static inline void fill_mem_struct(int read_write, int line_number, size_t p,
@@ -1397,20 +1700,19 @@ static inline void fill_mem_struct(int read_write, int line_number, size_t p,
     if (fd < 0)
         return;
 
-    if (sleeping == 1 || access_count >= 131072)    // 131072 is 128*1024.
+    if (record_allowed() == false)
         return;
 
-    node_t node;
-    node.type_message = MSG_MEM_INFO;
-
-    node.mem_info.coreID = getCoreID();
-    node.mem_info.read_write = read_write;
-    node.mem_info.address = p;
-    node.mem_info.var_idx = var_idx;
-    node.mem_info.line_number = line_number;
-    node.mem_info.type_size = type_size;
+    mem_record_t record;
+    record.coreID = getCoreID();
+    record.read_write = read_write;
+    record.reserved = 0;
+    record.address = p;
+    record.var_idx = var_idx;
+    record.line_number = line_number;
+    record.type_size = type_size;
 
-    write(fd, &node, sizeof(node_t));
+    write_record(MSG_MEM_INFO, &record, sizeof(record), true);
 }
 
 void indigo__gen_trace_c(int read_write, int line_number, void* base,
@@ -1427,11 +1729,19 @@ void indigo__gen_trace_f(int *read_write, int *line_number, void* base,
                 (size_t) addr, *var_idx);
 }
 
+static inline void record_reuse(size_t p, int var_idx) {
+    if (var_idx >= 0 && record_allowed()) {
+        online_rd_access(var_idx, p);
+    }
+}
+
 void indigo__record_c(int read_write, int line_number, void* addr,
         int var_idx, int type_size) {
     if (fd >= 0)
         fill_mem_struct(read_write, line_number, (size_t) addr, var_idx,
                 type_size);
+    else if (online_reuse)
+        record_reuse((size_t) addr, var_idx);
 }
 
 void indigo__record_f_(int *read_write, int *line_number, void* addr,
@@ -1439,23 +1749,25 @@ void indigo__record_f_(int *read_write, int *line_number, void* addr,
     if (fd >= 0)
         fill_mem_struct(*read_write, *line_number, (size_t) addr, *var_idx,
                 *type_size);
+    else if (online_reuse)
+        record_reuse((size_t) addr, *var_idx);
 }
 
 void indigo__write_idx_c(const char* var_name, const int length) {
-    node_t node;
-    node.type_message = MSG_STREAM_INFO;
+    stream_info_t stream_info;
 #define indigo__MIN(a, b)   (a) < (b) ? (a) : (b)
     int dst_len = indigo__MIN(STREAM_LENGTH-1, length);
 #undef indigo__MIN
 
-    strncpy(node.stream_info.stream_name, var_name, dst_len);
-    node.stream_info.stream_name[dst_len] = '\0';
+    strncpy(stream_info.stream_name, var_name, dst_len);
+    stream_info.stream_name[dst_len] = '\0';
 
-    std::string stream_name(node.stream_info.stream_name);
+    std::string stream_name(stream_info.stream_name);
     stream_list.push_back(stream_name);
 
     if (fd >= 0) {
-        write(fd, &node, sizeof(node_t));
+        write_record(MSG_STREAM_INFO, stream_name.c_str(), stream_name.size(),
+                false);
     }
 }
 
@@ -1469,13 +1781,33 @@ static void create_output_file() {
     char szFilename[32];
     snprintf(szFilename, sizeof(szFilename), "macpo.%d.out", getpid());
 
-    fd = open(szFilename, O_CREAT | O_APPEND | O_WRONLY | O_TRUNC, S_IRUSR |
-            S_IWUSR | S_IRGRP);
+    // Writers reserve their own ranges of the file, see trace_buffer.h.
+    fd = open(szFilename, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR |
+            S_IRGRP);
     if (fd < 0) {
         perror("MACPO :: Error opening log for writing");
         exit(1);
     }
 
+    // The trace is still usable without its index.
+    char szIndexFilename[sizeof(szFilename) + sizeof(MACPO_INDEX_SUFFIX)];
+    snprintf(szIndexFilename, sizeof(szIndexFilename), "%s%s", szFilename,
+            MACPO_INDEX_SUFFIX);
+
+    index_fd = open(szIndexFilename, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR |
+            S_IWUSR | S_IRGRP);
+    if (index_fd < 0)
+        perror("MACPO :: Error opening trace index for writing");
+
+    const bool compress = getenv("MACPO_COMPRESS_TRACE") != NULL;
+    trace_buffer_init(fd, index_fd, compress);
+
+    trace_header_t header;
+    header.magic = MACPO_TRACE_MAGIC;
+    header.version = MACPO_TRACE_VERSION;
+    header.flags = compress ? MACPO_TRACE_COMPRESSED : 0;
+    trace_buffer_write_direct(&header, sizeof(header));
+
     if (access("macpo.out", F_OK) == 0) {
         // file exists, remove it
         if (unlink("macpo.out") == -1)
@@ -1488,20 +1820,75 @@ static void create_output_file() {
 
     // Now that we are done handling the critical stuff,
     // write the metadata log to the macpo.out file.
-    node_t node;
-    node.type_message = MSG_METADATA;
-    size_t exe_path_len = readlink("/proc/self/exe",
-            node.metadata_info.binary_name, STRING_LENGTH-1);
+    char metadata[MAX_RECORD_LENGTH];
+    metadata_record_t* record = reinterpret_cast<metadata_record_t*>(metadata);
+    ssize_t exe_path_len = readlink("/proc/self/exe",
+            metadata + sizeof(metadata_record_t), STRING_LENGTH-1);
     if (exe_path_len == -1) {
         perror("MACPO :: Failed to read binary name from /proc/self/exe");
     } else {
-        // Write the terminating character
-        node.metadata_info.binary_name[exe_path_len] = '\0';
-        time(&node.metadata_info.execution_timestamp);
-        write(fd, &node, sizeof(node_t));
+        // The binary name is written without the terminating character.
+        record->execution_timestamp = time(NULL);
+        write_record(MSG_METADATA, metadata, sizeof(metadata_record_t) +
+                exe_path_len, false);
+    }
+
+    terminal_record.type_message = MSG_TERMINAL;
+    terminal_record.length = 0;
+}
+
+static void grow_sleep() {
+    int temp = sleep_sec + new_sleep_sec;
+    sleep_sec = new_sleep_sec;
+    new_sleep_sec = temp;
+}
+
+static long next_window_budget() {
+    if (max_records > 0 && adaptive_sampling) {
+        // Spread whatever is left of the trace budget over future windows.
+        long remaining = max_records - total_records;
+        return std::min(window_record_limit, std::max(remaining / 8, 0L));
+    }
+
+    return window_record_limit;
+}
+
+static void start_window() {
+    window_budget = next_window_budget();
+    access_count = 0;
+    window_budget_hit = 0;
+    window_id++;
+}
+
+static void adapt_sampling() {
+    if (window_budget_hit == 1) {
+        awake_usec = awake_usec * 3 / 4;
+    } else if (access_count < window_budget / 2) {
+        awake_usec = awake_usec * 5 / 4;
+    }
+
+    long max_awake_usec = MAX_AWAKE_USEC;
+    if (target_overhead > 0) {
+        if (sleep_sec == 0) {
+            grow_sleep();
+        }
+
+        // Awake period that makes up target_overhead percent of the
+        // awake and sleep periods together.
+        long target_usec = sleep_sec * 1000000L * target_overhead /
+            (100 - target_overhead);
+
+        if (target_usec < MIN_AWAKE_USEC) {
+            grow_sleep();
+        }
+
+        max_awake_usec = std::min(max_awake_usec, target_usec);
+    } else {
+        grow_sleep();
     }
 
-    terminal_node.type_message = MSG_TERMINAL;
+    awake_usec = std::max(std::min(awake_usec, max_awake_usec),
+            (long) MIN_AWAKE_USEC);
 }
 
 static void signalHandler(int sig) {
@@ -1515,29 +1902,34 @@ static void signalHandler(int sig) {
     if (sleeping == 1) {
         // Wake up for a brief period of time
         if (fd >= 0) {
+            // Records of the previous window must precede the terminal node.
+            trace_buffer_end_window(&terminal_record,
+                    sizeof(terminal_record));
             fdatasync(fd);
-            write(fd, &terminal_node, sizeof(node_t));
         }
 
+        start_window();
+
         // Don't reorder so that `sleeping = 0' remains after fwrite()
         asm volatile("" ::: "memory");
         sleeping = 0;
 
         itimer_new.it_value.tv_sec = AWAKE_SEC;
-        itimer_new.it_value.tv_usec = AWAKE_USEC;
+        itimer_new.it_value.tv_usec = awake_usec;
         setitimer(ITIMER_PROF, &itimer_new, &itimer_old);
     } else {
         // Go to sleep now...
         sleeping = 1;
 
-        int temp = sleep_sec + new_sleep_sec;
-        sleep_sec = new_sleep_sec;
-        new_sleep_sec = temp;
+        if (adaptive_sampling) {
+            adapt_sampling();
+        } else {
+            grow_sleep();
+        }
 
         itimer_new.it_value.tv_sec = sleep_sec;
         itimer_new.it_value.tv_usec = 0;
         setitimer(ITIMER_PROF, &itimer_new, &itimer_old);
-        access_count = 0;
     }
 }
 
@@ -1559,7 +1951,7 @@ static void set_timers() {
         sleeping = 0;
 
         itimer_new.it_value.tv_sec = AWAKE_SEC;
-        itimer_new.it_value.tv_usec = AWAKE_USEC;
+        itimer_new.it_value.tv_usec = awake_usec;
         setitimer(ITIMER_PROF, &itimer_new, &itimer_old);
     }
 }
@@ -1616,10 +2008,67 @@ static void set_thread_affinity() {
     }
 }
 
+static long get_env_long(const char* name, long default_value) {
+    const char* value = getenv(name);
+    if (value == NULL) {
+        return default_value;
+    }
+
+    char* end = NULL;
+    long result = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || result < 0) {
+        fprintf(stderr, "MACPO :: Ignoring invalid value \"%s\" of %s.\n",
+                value, name);
+        return default_value;
+    }
+
+    return result;
+}
+
+static void set_record_budget(int16_t enable_sampling) {
+    // Without sampling, everything is recorded unless asked otherwise.
+    window_record_limit = get_env_long("MACPO_WINDOW_RECORDS",
+            enable_sampling ? WINDOW_RECORD_LIMIT : LONG_MAX);
+    thread_window_record_limit = get_env_long("MACPO_THREAD_WINDOW_RECORDS",
+            0);
+    max_records = get_env_long("MACPO_MAX_RECORDS", 0);
+
+    target_overhead = get_env_long("MACPO_TARGET_OVERHEAD", 0);
+    if (target_overhead >= 100) {
+        fprintf(stderr, "MACPO :: MACPO_TARGET_OVERHEAD must be below 100, "
+                "ignoring it.\n");
+        target_overhead = 0;
+    }
+
+    long target_trace_mb = get_env_long("MACPO_TARGET_TRACE_MB", 0);
+    if (target_trace_mb > 0) {
+        long records = target_trace_mb * 1024 * 1024 /
+            (sizeof(record_header_t) + sizeof(mem_record_t));
+        if (max_records == 0 || records < max_records) {
+            max_records = records;
+        }
+    }
+
+    adaptive_sampling = enable_sampling &&
+        (target_overhead > 0 || target_trace_mb > 0);
+    window_budget = next_window_budget();
+}
+
 void indigo__init_(int16_t create_file, int16_t enable_sampling) {
-    set_thread_affinity();
+    // The APIC mapping is only needed if the OS can't tell the core id.
+    core_id_source = select_core_id_source();
+    if (core_id_source == CORE_ID_CPUID) {
+        set_thread_affinity();
+    }
+
+    set_record_budget(enable_sampling);
+
+    online_rd_init(DIST_INFINITY, get_env_long("MACPO_ONLINE_LINES",
+                ONLINE_RD_LINES));
 
-    if (create_file) {
+    // In online mode, accesses never reach a trace.
+    online_reuse = getenv("MACPO_ONLINE_REUSE") != NULL;
+    if (create_file && online_reuse == false) {
         create_output_file();
     }
 
@@ -78,13 +78,72 @@ to 711 micro-seconds. And thus, we set AWAKE_USEC to 711.
 #define AWAKE_USEC  711
 #endif
 
+/***
+
+Record budget.
+
+Within each sampling window, at most WINDOW_RECORD_LIMIT accesses are recorded
+across all threads (MACPO_WINDOW_RECORDS overrides the limit). The environment
+variable MACPO_THREAD_WINDOW_RECORDS additionally caps the records of each
+thread per window, and MACPO_MAX_RECORDS caps the records of the whole run. If
+sampling is disabled, there is no window limit unless MACPO_WINDOW_RECORDS is
+set. Threads charge the shared counters RECORD_BATCH records at a time, so the
+limits may be overshot by up to RECORD_BATCH records per thread.
+
+Adaptive sampling.
+
+Setting MACPO_TARGET_OVERHEAD to a percentage makes the sampler keep the time
+spent in sampling windows below that share of the CPU time of the process: the
+awake period is stretched towards the target and the Fibonacci growth of the
+sleep period is resumed only if even the shortest awake period would exceed
+it. Setting MACPO_TARGET_TRACE_MB bounds the trace size: the run as a whole
+gets a record budget for that many megabytes, and each window may use up an
+eighth of what is left. In either mode, the awake period shrinks when a window
+runs out of budget before it ends (the rest of the window would be pure
+overhead) and grows when the window uses less than half of its budget, within
+MIN_AWAKE_USEC and MAX_AWAKE_USEC.
+
+*/
+
+#ifndef WINDOW_RECORD_LIMIT
+#define WINDOW_RECORD_LIMIT     131072
+#endif
+
+#ifndef RECORD_BATCH
+#define RECORD_BATCH            64
+#endif
+
+#ifndef MIN_AWAKE_USEC
+#define MIN_AWAKE_USEC          100
+#endif
+
+#ifndef MAX_AWAKE_USEC
+#define MAX_AWAKE_USEC          500000
+#endif
+
+// Number of core id lookups that a thread serves from its cached value before
+// asking the OS (or the processor) again on which core it is running.
+#ifndef CORE_ID_REFRESH
+#define CORE_ID_REFRESH         256
+#endif
+
+// Size of the tables that count calls to instrumented functions (a power of
+// two) and how many calls a thread counts before publishing them.
+#ifndef FUNCTION_COUNT_SLOTS
+#define FUNCTION_COUNT_SLOTS    256
+#endif
+
+#ifndef FUNCTION_COUNT_BATCH
+#define FUNCTION_COUNT_BATCH    16
+#endif
+
 #define ALIGN_ENTRIES           3
-#define MAX_VARIABLES           32
 #define CACHE_LINE_SIZE         64
 #define MAX_HISTOGRAM_ENTRIES   1024
 
 enum { EAX = 0, EBX, ECX, EDX };
 enum { PROC_UNKNOWN = -1, PROC_INTEL = 0, PROC_AMD };
+enum { CORE_ID_CPUID = 0, CORE_ID_SCHED_GETCPU, CORE_ID_RDTSCP };
 
 #ifdef __GNUC__
 static void mycpuid(int *p, unsigned int param, unsigned int ecx) {
@@ -184,6 +243,8 @@ static void getProcessorName(char* string) {
 #if defined(__cplusplus)
 extern "C" {
 #endif
+void indigo__end();
+
 void indigo__exit();
 
 void indigo__record_branch_c(int line_number, void* func_addr,
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+
+#include "macpo_record.h"
+#include "online_rd.h"
+
+// Must agree with ADDR_TO_CACHE_LINE().
+#define CACHE_LINE_BYTES    64
+
+typedef struct _tag_online_rd_state {
+    volatile sig_atomic_t busy;
+    volatile sig_atomic_t in_use;
+    struct _tag_online_rd_state* volatile next;
+    shards_sampler_t sampler;
+    avl_tree tree;
+    rd_histogram_list_t histograms;
+
+    explicit _tag_online_rd_state(const shards_config_t& config) : busy(0),
+            in_use(1), next(NULL), sampler(config) {
+    }
+} online_rd_state_t;
+
+static size_t distance_limit = 1;
+static shards_config_t sampling = { 1, 0 };
+static online_rd_state_t* volatile state_list = NULL;
+
+// Histograms of threads that have exited and, after online_rd_merge(), of
+// all threads.
+static rd_histogram_list_t merged;
+static pthread_mutex_t merged_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t state_key;
+static pthread_once_t state_key_once = PTHREAD_ONCE_INIT;
+
+static __thread online_rd_state_t* thread_state = NULL;
+
+static inline bool claim(online_rd_state_t* state) {
+    return __sync_lock_test_and_set(&state->busy, 1) == 0;
+}
+
+static inline void release(online_rd_state_t* state) {
+    __sync_lock_release(&state->busy);
+}
+
+// Moves the counts of `state' into the merged histograms. The caller must
+// have claimed `state'.
+static void fold_state(online_rd_state_t* state) {
+    pthread_mutex_lock(&merged_lock);
+
+    rd_histogram_list_t& histograms = state->histograms;
+    if (merged.size() < histograms.size()) {
+        merged.resize(histograms.size(), NULL);
+    }
+
+    for (size_t i = 0; i < histograms.size(); i++) {
+        if (histograms[i] == NULL) {
+            continue;
+        }
+
+        if (merged[i] == NULL) {
+            merged[i] = new (std::nothrow) rd_histogram_t(LOG_HISTOGRAM_EXACT,
+                    distance_limit);
+        }
+
+        if (merged[i] != NULL) {
+            merged[i]->add(*histograms[i]);
+        }
+
+        histograms[i]->clear();
+    }
+
+    pthread_mutex_unlock(&merged_lock);
+}
+
+static void release_state(void* ptr) {
+    online_rd_state_t* state = reinterpret_cast<online_rd_state_t*>(ptr);
+    if (state == NULL) {
+        return;
+    }
+
+    while (claim(state) == false) {
+        sched_yield();
+    }
+
+    fold_state(state);
+
+    // Drop everything that the next owner does not need.
+    for (size_t i = 0; i < state->histograms.size(); i++) {
+        delete state->histograms[i];
+    }
+
+    state->histograms.clear();
+    state->tree.destroy();
+    state->sampler = shards_sampler_t(sampling);
+
+    thread_state = NULL;
+    release(state);
+
+    // Let some other thread adopt this state.
+    __sync_synchronize();
+    state->in_use = 0;
+}
+
+static void create_state_key() {
+    pthread_key_create(&state_key, release_state);
+}
+
+static online_rd_state_t* get_state() {
+    if (thread_state != NULL) {
+        return thread_state;
+    }
+
+    pthread_once(&state_key_once, create_state_key);
+
+    // Adopt the state of a thread that has exited, if there is one.
+    online_rd_state_t* state = NULL;
+    for (online_rd_state_t* it = state_list; it != NULL; it = it->next) {
+        if (it->in_use == 0 && __sync_bool_compare_and_swap(&it->in_use, 0,
+                    1)) {
+            state = it;
+            break;
+        }
+    }
+
+    if (state == NULL) {
+        state = new (std::nothrow) online_rd_state_t(sampling);
+        if (state == NULL) {
+            return NULL;
+        }
+
+        online_rd_state_t* head;
+        do {
+            head = state_list;
+            state->next = head;
+        } while (__sync_bool_compare_and_swap(&state_list, head, state) ==
+                false);
+    }
+
+    pthread_setspecific(state_key, state);
+    thread_state = state;
+    return state;
+}
+
+void online_rd_init(size_t limit, size_t max_lines) {
+    distance_limit = limit > 1 ? limit : 1;
+    sampling.rate = 1;
+    sampling.max_lines = max_lines;
+}
+
+void online_rd_access(size_t var_idx, size_t address) {
+    online_rd_state_t* state = get_state();
+    if (state == NULL || claim(state) == false) {
+        // A merge is in progress, this access is lost.
+        return;
+    }
+
+    const size_t cache_line = ADDR_TO_CACHE_LINE(address);
+    shards_sampler_t& sampler = state->sampler;
+    const bool sampled = sampler.sample(cache_line);
+
+    // Lines that are no longer sampled must not count as reused later.
+    const std::vector<size_t>& evicted = sampler.evicted();
+    for (size_t i = 0; i < evicted.size(); i++) {
+        state->tree.make_infinite_distance(evicted[i]);
+    }
+
+    sampler.clear_evicted();
+
+    if (sampled == false) {
+        release(state);
+        return;
+    }
+
+    rd_histogram_list_t& histograms = state->histograms;
+    if (var_idx >= histograms.size()) {
+        histograms.resize(var_idx + 1, NULL);
+    }
+
+    if (histograms[var_idx] == NULL) {
+        histograms[var_idx] = new (std::nothrow) rd_histogram_t(
+                LOG_HISTOGRAM_EXACT, distance_limit);
+    }
+
+    if (histograms[var_idx] != NULL) {
+        size_t distance = sampler.scale_distance(
+                state->tree.get_distance(cache_line));
+
+        if (distance >= distance_limit) {
+            distance = distance_limit - 1;
+        }
+
+        histograms[var_idx]->accumulate(distance, sampler.weight());
+    }
+
+    mem_info_t mem_info;
+    memset(&mem_info, 0, sizeof(mem_info));
+    mem_info.var_idx = var_idx;
+    mem_info.address = address;
+    state->tree.insert(&mem_info);
+
+    release(state);
+}
+
+const rd_histogram_list_t& online_rd_merge() {
+    for (online_rd_state_t* state = state_list; state != NULL;
+            state = state->next) {
+        while (claim(state) == false) {
+            sched_yield();
+        }
+
+        fold_state(state);
+        release(state);
+    }
+
+    return merged;
+}
+
+void online_rd_write_summary(FILE* file,
+        const std::vector<std::string>& stream_list) {
+    for (size_t i = 0; i < merged.size(); i++) {
+        if (merged[i] == NULL) {
+            continue;
+        }
+
+        const rd_histogram_t::pair_list_t pairs = merged[i]->sort();
+
+        double accesses = 0;
+        for (size_t j = 0; j < pairs.size(); j++) {
+            accesses += pairs[j].second;
+        }
+
+        if (accesses == 0) {
+            continue;
+        }
+
+        char fallback[32];
+        snprintf(fallback, sizeof(fallback), "stream_%lu", (unsigned long) i);
+        const char* name = i < stream_list.size() ? stream_list[i].c_str() :
+            fallback;
+
+        fprintf(file, "mrc.%s.accesses=%.0f\n", name, accesses);
+
+        // Powers of two are bin boundaries, so the accesses that miss in a
+        // cache of that many lines are exactly those of the bins above.
+        for (size_t lines = 1; lines < distance_limit; lines *= 2) {
+            double misses = 0;
+            for (size_t j = 0; j < pairs.size(); j++) {
+                if (pairs[j].first >= lines) {
+                    misses += pairs[j].second;
+                }
+            }
+
+            fprintf(file, "mrc.%s.miss_ratio[%lu]=%g\n", name,
+                    (unsigned long) (lines * CACHE_LINE_BYTES),
+                    misses / accesses);
+        }
+    }
+}
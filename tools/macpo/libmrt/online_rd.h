@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifndef TOOLS_MACPO_LIBMRT_ONLINE_RD_H_
+#define TOOLS_MACPO_LIBMRT_ONLINE_RD_H_
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "avl_tree.h"
+#include "histogram.h"
+#include "shards.h"
+
+/***
+
+Online reuse distances.
+
+Instead of writing accesses to a trace, the runtime can compute the reuse
+distances of sampled accesses as the program runs and only write a summary
+at exit. Every thread owns a reuse distance engine (see avl_tree.h) in front
+of which sits a SHARDS sampler (see shards.h) that keeps at most `max_lines'
+cache lines, and a log-binned histogram of distances for every stream that the
+thread accessed. Memory use per thread is therefore bounded by the number of
+sampled lines plus a few hundred bins per stream, no matter how long the
+program runs or how many streams it has.
+
+Like trace buffers, states are registered in a global, append-only list. The
+owner claims its state for the duration of an access and a merger claims it
+for the duration of a merge. When a thread exits, its histograms are folded
+into the shared ones and its state is recycled by threads created later.
+
+Distances are per thread, so that they describe the locality seen by a
+private cache.
+
+*/
+
+typedef log_histogram_t<double> rd_histogram_t;
+typedef std::vector<rd_histogram_t*> rd_histogram_list_t;
+
+// Distances at or beyond `distance_limit' (in cache lines) count as
+// infinite. Each thread samples at most `max_lines' cache lines, 0 for no
+// bound.
+void online_rd_init(size_t distance_limit, size_t max_lines);
+
+// Account for an access of stream `var_idx' to `address' by this thread.
+void online_rd_access(size_t var_idx, size_t address);
+
+// Fold the histograms of all threads into the shared ones and return them,
+// indexed by stream. Entries of streams that were never accessed are NULL.
+const rd_histogram_list_t& online_rd_merge();
+
+// Write the miss ratio curve of every stream, as computed by the last call
+// to online_rd_merge(), in the key=value format of the analyzer's bot output.
+void online_rd_write_summary(FILE* file,
+        const std::vector<std::string>& stream_list);
+
+#endif  // TOOLS_MACPO_LIBMRT_ONLINE_RD_H_
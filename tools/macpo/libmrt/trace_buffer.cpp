@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "macpo_record.h"
+#include "trace_buffer.h"
+
+static int trace_fd = -1;
+static int index_fd = -1;
+static bool compress_records = false;
+static trace_buffer_t* volatile buffer_list = NULL;
+
+// Ends of the data reserved so far in the trace and in the index.
+static volatile size_t trace_offset = 0;
+static volatile size_t index_offset = 0;
+
+static volatile uint32_t thread_count = 0;
+static __thread uint32_t thread_number = (uint32_t) -1;
+
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+
+static __thread trace_buffer_t* thread_buffer = NULL;
+
+// The buffer that the calling thread holds or is about to claim. A signal
+// handler that interrupts the thread must not wait for this buffer.
+static __thread trace_buffer_t* volatile claimed_buffer = NULL;
+
+// End-of-window marker and the number of copies of it that are written once
+// `deferred_buffer' is released, see trace_buffer_end_window().
+static const void* volatile window_marker = NULL;
+static volatile size_t window_marker_size = 0;
+static volatile uint32_t deferred_markers = 0;
+static trace_buffer_t* volatile deferred_buffer = NULL;
+
+static void write_buffer(trace_buffer_t* buffer);
+
+static inline bool claim(trace_buffer_t* buffer) {
+    claimed_buffer = buffer;
+    asm volatile("" ::: "memory");
+
+    if (__sync_lock_test_and_set(&buffer->busy, 1) == 0) {
+        return true;
+    }
+
+    claimed_buffer = NULL;
+    return false;
+}
+
+static inline void unlock(trace_buffer_t* buffer) {
+    __sync_lock_release(&buffer->busy);
+    asm volatile("" ::: "memory");
+    claimed_buffer = NULL;
+}
+
+// Flush `buffer', which held records of a window that has ended, and write
+// the markers that had to wait for it.
+static void write_deferred_markers(trace_buffer_t* buffer) {
+    while (claim(buffer) == false) {
+        // Someone else is writing out this buffer, wait for it.
+    }
+
+    if (deferred_buffer == buffer) {
+        deferred_buffer = NULL;
+        write_buffer(buffer);
+
+        uint32_t markers = __sync_lock_test_and_set(&deferred_markers, 0);
+        for (uint32_t i = 0; i < markers; i++) {
+            trace_buffer_write_direct(window_marker, window_marker_size);
+        }
+    }
+
+    unlock(buffer);
+}
+
+static inline void release(trace_buffer_t* buffer) {
+    unlock(buffer);
+
+    while (deferred_buffer == buffer) {
+        write_deferred_markers(buffer);
+    }
+}
+
+static void write_at(int fd, const char* ptr, size_t remaining,
+        size_t offset) {
+    while (remaining > 0 && fd >= 0) {
+        ssize_t written = pwrite(fd, ptr, remaining, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // Nothing sensible to do here, drop the remaining data.
+            break;
+        }
+
+        ptr += written;
+        offset += written;
+        remaining -= written;
+    }
+}
+
+// Summarize the (uncompressed) records in `raw' into an index entry.
+static void describe_records(const char* raw, size_t raw_size,
+        index_entry_t* entry) {
+    entry->mem_records = 0;
+    entry->stream_mask = 0;
+    entry->first_line = (uint32_t) -1;
+    entry->last_line = 0;
+
+    size_t offset = 0;
+    while (offset + sizeof(record_header_t) <= raw_size) {
+        record_header_t header;
+        memcpy(&header, raw + offset, sizeof(header));
+        offset += sizeof(header);
+
+        uint32_t var_idx = 0, line_number = 0;
+        const char* payload = raw + offset;
+        if (header.type_message == MSG_MEM_INFO &&
+                header.length >= sizeof(mem_record_t)) {
+            const mem_record_t* record =
+                reinterpret_cast<const mem_record_t*>(payload);
+            var_idx = record->var_idx;
+            line_number = record->line_number;
+            entry->mem_records++;
+        } else if (header.type_message == MSG_TRACE_INFO &&
+                header.length >= sizeof(trace_record_t)) {
+            const trace_record_t* record =
+                reinterpret_cast<const trace_record_t*>(payload);
+            var_idx = record->var_idx;
+            line_number = record->line_number;
+        } else if (header.type_message == MSG_VECTOR_STRIDE_INFO &&
+                header.length >= sizeof(vector_stride_record_t)) {
+            const vector_stride_record_t* record =
+                reinterpret_cast<const vector_stride_record_t*>(payload);
+            var_idx = record->var_idx;
+            line_number = record->loop_line_number;
+        } else {
+            offset += header.length;
+            continue;
+        }
+
+        entry->stream_mask |= 1ULL << (var_idx % 64);
+        if (line_number < entry->first_line)
+            entry->first_line = line_number;
+
+        if (line_number > entry->last_line)
+            entry->last_line = line_number;
+
+        offset += header.length;
+    }
+
+    if (entry->first_line > entry->last_line)
+        entry->first_line = entry->last_line = 0;
+}
+
+// Write a block of `size' bytes holding the records in `raw' on behalf of
+// `buffer' and add it to the index.
+static void write_block(trace_buffer_t* buffer, const char* ptr, size_t size,
+        const char* raw, size_t raw_size) {
+    if (size == 0 || trace_fd < 0) {
+        return;
+    }
+
+    size_t offset = __sync_fetch_and_add(&trace_offset, size);
+    write_at(trace_fd, ptr, size, offset);
+
+    if (index_fd >= 0) {
+        index_entry_t entry;
+        entry.offset = offset;
+        entry.size = size;
+        entry.thread = buffer->thread;
+        describe_records(raw, raw_size, &entry);
+
+        size_t entry_offset = __sync_fetch_and_add(&index_offset,
+                sizeof(entry));
+        write_at(index_fd, reinterpret_cast<const char*>(&entry),
+                sizeof(entry), entry_offset);
+    }
+}
+
+static void write_packed(trace_buffer_t* buffer) {
+    // Raw records [start, offset) are packed into buffer->packed.
+    size_t start = 0, offset = 0, packed = 0;
+    while (offset < buffer->used) {
+        if (packed + TRACE_CODEC_BLOCK_BOUND > TRACE_BUFFER_PACKED_SIZE) {
+            write_block(buffer, buffer->packed, packed, buffer->data + start,
+                    offset - start);
+            start = offset;
+            packed = 0;
+        }
+
+        size_t consumed = 0;
+        size_t size = trace_codec_compress(buffer->scratch,
+                buffer->data + offset, buffer->used - offset,
+                buffer->packed + packed, &consumed);
+        if (consumed == 0) {
+            // Should not happen, but don't lose the records if it does.
+            write_block(buffer, buffer->packed, packed, buffer->data + start,
+                    offset - start);
+            write_block(buffer, buffer->data + offset, buffer->used - offset,
+                    buffer->data + offset, buffer->used - offset);
+            return;
+        }
+
+        packed += size;
+        offset += consumed;
+    }
+
+    write_block(buffer, buffer->packed, packed, buffer->data + start,
+            offset - start);
+}
+
+static void write_buffer(trace_buffer_t* buffer) {
+    // This may run inside the SIGPROF handler, so preserve errno.
+    int saved_errno = errno;
+
+    if (buffer->scratch != NULL) {
+        write_packed(buffer);
+    } else {
+        write_block(buffer, buffer->data, buffer->used, buffer->data,
+                buffer->used);
+    }
+
+    buffer->used = 0;
+    errno = saved_errno;
+}
+
+static void release_thread_buffer(void* ptr) {
+    trace_buffer_t* buffer = reinterpret_cast<trace_buffer_t*>(ptr);
+    if (buffer == NULL) {
+        return;
+    }
+
+    while (claim(buffer) == false) {
+        // A flusher is writing out this buffer, wait for it.
+    }
+
+    write_buffer(buffer);
+    release(buffer);
+
+    // Let some other thread adopt this buffer.
+    thread_buffer = NULL;
+    __sync_synchronize();
+    buffer->in_use = 0;
+}
+
+static void create_buffer_key() {
+    pthread_key_create(&buffer_key, release_thread_buffer);
+}
+
+static trace_buffer_t* get_thread_buffer() {
+    if (thread_buffer != NULL) {
+        return thread_buffer;
+    }
+
+    // First try to recycle a buffer left behind by a thread that has exited.
+    trace_buffer_t* buffer = buffer_list;
+    while (buffer != NULL) {
+        if (__sync_bool_compare_and_swap(&buffer->in_use, 0, 1)) {
+            break;
+        }
+
+        buffer = buffer->next;
+    }
+
+    if (buffer == NULL) {
+        buffer = reinterpret_cast<trace_buffer_t*>(malloc(sizeof(*buffer)));
+        if (buffer == NULL) {
+            return NULL;
+        }
+
+        buffer->busy = 0;
+        buffer->in_use = 1;
+        buffer->used = 0;
+        buffer->scratch = NULL;
+        buffer->packed = NULL;
+
+        if (compress_records) {
+            buffer->scratch = reinterpret_cast<codec_scratch_t*>(
+                    malloc(sizeof(codec_scratch_t)));
+            buffer->packed = reinterpret_cast<char*>(
+                    malloc(TRACE_BUFFER_PACKED_SIZE));
+
+            // Fall back to writing uncompressed records.
+            if (buffer->scratch == NULL || buffer->packed == NULL) {
+                free(buffer->scratch);
+                free(buffer->packed);
+                buffer->scratch = NULL;
+                buffer->packed = NULL;
+            }
+        }
+
+        // Push the new buffer to the head of the global list.
+        do {
+            buffer->next = buffer_list;
+        } while (__sync_bool_compare_and_swap(&buffer_list, buffer->next,
+                    buffer) == false);
+    }
+
+    if (thread_number == (uint32_t) -1) {
+        thread_number = __sync_fetch_and_add(&thread_count, 1);
+    }
+
+    buffer->thread = thread_number;
+    thread_buffer = buffer;
+    pthread_setspecific(buffer_key, buffer);
+    return buffer;
+}
+
+void trace_buffer_init(int fd, int index, bool compress) {
+    pthread_once(&buffer_key_once, create_buffer_key);
+    trace_fd = fd;
+    index_fd = index;
+    trace_offset = 0;
+    compress_records = compress;
+
+    if (index_fd >= 0) {
+        index_header_t header;
+        header.magic = MACPO_INDEX_MAGIC;
+        header.version = MACPO_INDEX_VERSION;
+        header.entry_size = sizeof(index_entry_t);
+
+        write_at(index_fd, reinterpret_cast<const char*>(&header),
+                sizeof(header), 0);
+        index_offset = sizeof(header);
+    }
+}
+
+void trace_buffer_write_direct(const void* data, size_t size) {
+    if (trace_fd < 0) {
+        return;
+    }
+
+    // This may run inside the SIGPROF handler, so preserve errno.
+    int saved_errno = errno;
+
+    size_t offset = __sync_fetch_and_add(&trace_offset, size);
+    write_at(trace_fd, reinterpret_cast<const char*>(data), size, offset);
+
+    errno = saved_errno;
+}
+
+void trace_buffer_fini() {
+    trace_buffer_flush_all(true);
+    trace_fd = -1;
+    index_fd = -1;
+}
+
+bool trace_buffer_write(const void* record, size_t size) {
+    if (trace_fd < 0 || size > TRACE_BUFFER_SIZE) {
+        return false;
+    }
+
+    trace_buffer_t* buffer = get_thread_buffer();
+    if (buffer == NULL) {
+        return false;
+    }
+
+    while (claim(buffer) == false) {
+        // A flusher is writing out this buffer, wait for it.
+    }
+
+    if (buffer->used + size > TRACE_BUFFER_SIZE) {
+        write_buffer(buffer);
+    }
+
+    memcpy(buffer->data + buffer->used, record, size);
+    buffer->used += size;
+
+    release(buffer);
+    return true;
+}
+
+void trace_buffer_flush_all(bool wait) {
+    // Don't lose track of the buffer held by an interrupted thread.
+    trace_buffer_t* interrupted = claimed_buffer;
+
+    for (trace_buffer_t* buffer = buffer_list; buffer != NULL;
+            buffer = buffer->next) {
+        if (claim(buffer)) {
+            write_buffer(buffer);
+            release(buffer);
+        } else if (wait) {
+            while (claim(buffer) == false) {
+                // The owner is appending to this buffer, wait for it.
+            }
+
+            write_buffer(buffer);
+            release(buffer);
+        }
+    }
+
+    claimed_buffer = interrupted;
+}
+
+void trace_buffer_end_window(const void* marker, size_t size) {
+    if (trace_fd < 0) {
+        return;
+    }
+
+    // A window that ends while the marker of the previous one is deferred
+    // only adds another copy of the marker.
+    uint32_t markers;
+    while ((markers = deferred_markers) > 0) {
+        if (__sync_bool_compare_and_swap(&deferred_markers, markers,
+                    markers + 1)) {
+            return;
+        }
+    }
+
+    trace_buffer_t* interrupted = claimed_buffer;
+    bool deferred = false;
+
+    for (trace_buffer_t* buffer = buffer_list; buffer != NULL;
+            buffer = buffer->next) {
+        if (claim(buffer) == false) {
+            // The interrupted thread cannot finish its append before this
+            // handler returns, so its buffer is flushed when it releases it.
+            if (buffer == interrupted) {
+                deferred = true;
+                continue;
+            }
+
+            // Some other thread holds the buffer, wait for it.
+            while (claim(buffer) == false) {
+            }
+        }
+
+        write_buffer(buffer);
+        unlock(buffer);
+    }
+
+    claimed_buffer = interrupted;
+
+    if (deferred) {
+        window_marker = marker;
+        window_marker_size = size;
+        deferred_markers = 1;
+        __sync_synchronize();
+        deferred_buffer = interrupted;
+    } else {
+        trace_buffer_write_direct(marker, size);
+    }
+}
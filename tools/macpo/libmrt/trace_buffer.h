@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2011-2013  University of Texas at Austin. All rights reserved.
+ *
+ * $COPYRIGHT$
+ *
+ * Additional copyrights may follow
+ *
+ * This file is part of PerfExpert.
+ *
+ * PerfExpert is free software: you can redistribute it and/or modify it under
+ * the terms of the The University of Texas at Austin Research License
+ *
+ * PerfExpert is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.
+ *
+ * Authors: Leonardo Fialho and Ashay Rane
+ *
+ * $HEADER$
+ */
+
+#ifndef TOOLS_MACPO_LIBMRT_TRACE_BUFFER_H_
+#define TOOLS_MACPO_LIBMRT_TRACE_BUFFER_H_
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace_codec.h"
+
+/***
+
+Per-thread buffering of trace records.
+
+Each thread that records an access owns a fixed-size buffer into which records
+are copied. The buffer is written to the trace file with a single pwrite() once
+it fills up, so the common path of recording an access costs a memcpy() instead
+of a system call. Every flush first reserves a range of the file by atomically
+advancing the shared file offset and then writes the whole buffer into that
+range, so records from different threads never interleave partially.
+
+Buffers are registered in a global, append-only list so that they can be
+flushed from the SIGPROF handler, from indigo__end() and at exit. A thread and
+a flusher never touch the same buffer at the same time: the owner claims its
+buffer for the duration of an append, and a flusher claims it for the duration
+of the pwrite(). Buffers of threads that have exited are flushed by a
+thread-specific destructor and are recycled by threads created later.
+
+Every record that was appended before a sampling window ends is written ahead
+of the end-of-window marker. trace_buffer_end_window() flushes all buffers
+and waits for those that other threads are appending to. The one buffer it
+cannot wait for is the one held by the thread that the SIGPROF handler
+interrupted; the marker is then deferred until that thread releases its
+buffer, which flushes the buffer and writes the marker. Records that other
+threads flush in the meantime may precede the marker of the window they
+follow, as may records of a window that ends while its predecessor's marker
+is still deferred.
+
+If compression is enabled, the records of a buffer are packed into compressed
+blocks (see trace_codec.h) when the buffer is flushed. The scratch space for
+packing is allocated along with the buffer, so that flushing from the SIGPROF
+handler does not need to allocate memory.
+
+Since the offset of every flushed block is known when it is reserved, each
+block is described by an index_entry_t (see macpo_record.h) in the index file.
+All writes to the trace must go through this module so that offsets stay
+consistent.
+
+*/
+
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE   (1 << 20)
+#endif
+
+// Room for packed blocks, written out whenever the next block may not fit.
+#ifndef TRACE_BUFFER_PACKED_SIZE
+#define TRACE_BUFFER_PACKED_SIZE    (8 * TRACE_CODEC_BLOCK_BOUND)
+#endif
+
+typedef struct _tag_trace_buffer {
+    volatile sig_atomic_t busy;
+    volatile sig_atomic_t in_use;
+    uint32_t thread;
+    size_t used;
+    struct _tag_trace_buffer* volatile next;
+    codec_scratch_t* scratch;
+    char* packed;
+    char data[TRACE_BUFFER_SIZE];
+} trace_buffer_t;
+
+// Set the file descriptor that all buffers are flushed into, the file
+// descriptor of the index (or -1 for none) and whether records are
+// compressed. Must be called before anything is written to the trace.
+void trace_buffer_init(int fd, int index_fd, bool compress);
+
+// Write data that is not part of any block, such as the trace header or the
+// end-of-window marker, directly to the trace. Safe to call from a signal
+// handler.
+void trace_buffer_write_direct(const void* data, size_t size);
+
+// Flush all buffers and detach from the file descriptor.
+void trace_buffer_fini();
+
+// Append a record to the calling thread's buffer, flushing it first if the
+// record does not fit. Returns false if the record could not be buffered.
+bool trace_buffer_write(const void* record, size_t size);
+
+// Flush the buffers of all threads. If `wait' is false, buffers that are
+// currently being appended to are skipped, which makes this function safe to
+// call from a signal handler.
+void trace_buffer_flush_all(bool wait);
+
+// Flush the buffers of all threads and write the end-of-window marker after
+// them, deferring the marker if the calling thread was interrupted while
+// holding its buffer. `marker' must stay valid until the next call. Safe to
+// call from a signal handler.
+void trace_buffer_end_window(const void* marker, size_t size);
+
+#endif  // TOOLS_MACPO_LIBMRT_TRACE_BUFFER_H_
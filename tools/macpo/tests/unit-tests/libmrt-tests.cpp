@@ -1,6 +1,10 @@
 
+#include <pthread.h>
+
+#include "avl_tree.h"
 #include "generic_defs.h"
 #include "histogram.h"
+#include "trace_codec.h"
 
 #include "gtest/gtest.h"
 
@@ -23,3 +27,201 @@ TEST(libmrt, HistogramSort) {
     EXPECT_EQ(pair.first, 13);
     EXPECT_EQ(pair.second, 30);
 }
+
+TEST(libmrt, LogHistogramBins) {
+    log_histogram_t<double> hist(64, 100000);
+
+    hist.increment(5);
+    hist.increment(5);
+    hist.accumulate(1000, 2.5);
+    hist.increment(1010);
+    hist.increment(5000000);
+
+    // Values below the exact limit have bins of their own.
+    EXPECT_EQ(hist.get(5), 2);
+    EXPECT_EQ(hist.get(6), 0);
+
+    // 1000 and 1010 share the bin [960, 1024).
+    EXPECT_EQ(hist.get(960), 3.5);
+    EXPECT_EQ(hist.get(1023), 3.5);
+    EXPECT_EQ(hist.get(1024), 0);
+
+    // Values beyond the limit are clamped into the last bin.
+    EXPECT_EQ(hist.get(99999), 1);
+
+    log_histogram_t<double> other(64, 100000);
+    other.increment(5);
+    hist.add(other);
+
+    log_histogram_t<double>::pair_list_t pair_list = hist.sort();
+    EXPECT_EQ(pair_list.size(), 3);
+    EXPECT_EQ(pair_list[0].first, 960);
+    EXPECT_EQ(pair_list[0].second, 3.5);
+    EXPECT_EQ(pair_list[1].first, 5);
+    EXPECT_EQ(pair_list[1].second, 3);
+    EXPECT_EQ(pair_list[2].first, 99999);
+}
+
+TEST(libmrt, LogHistogramMove) {
+    log_histogram_t<double> hist(64, 100000);
+
+    // 1000 and 1010 share the bin [960, 1024).
+    hist.accumulate(1000, 2);
+    hist.accumulate(1010, 3);
+
+    // Invalidating one access at 1010 leaves the other counts in the bin.
+    EXPECT_EQ(hist.move(1010, 99999, 1), 1);
+    EXPECT_EQ(hist.get(1000), 4);
+    EXPECT_EQ(hist.get(99999), 1);
+
+    // No more than the bin holds is moved.
+    EXPECT_EQ(hist.move(1000, 99999, 10), 4);
+    EXPECT_EQ(hist.get(1000), 0);
+    EXPECT_EQ(hist.get(99999), 5);
+}
+
+typedef sharded_multigram_t<int64_t, int64_t, merge_sum_t<int64_t> >
+    sum_multigram_t;
+
+static void* increment_multigram(void* arg) {
+    sum_multigram_t* multigram = reinterpret_cast<sum_multigram_t*>(arg);
+    for (int i = 0; i < 1000; i++) {
+        multigram->increment(reinterpret_cast<void*>(0x400000), 10 + i % 2,
+                i % 4, 1);
+    }
+
+    return NULL;
+}
+
+TEST(libmrt, ShardedMultigramMerge) {
+    sum_multigram_t multigram(0);
+
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, increment_multigram, &multigram);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    multigram.merge();
+    sum_multigram_t::pair_list_t list = multigram.get_all_histograms();
+    ASSERT_EQ(list.size(), 2);
+
+    for (int i = 0; i < 2; i++) {
+        histogram_t<int64_t, int64_t>* hist = list[i].second;
+        EXPECT_EQ(list[i].first.line_number, 10 + i);
+        EXPECT_EQ(hist->size(), 2);
+        EXPECT_EQ(hist->get(i), 1000);
+        EXPECT_EQ(hist->get(i + 2), 1000);
+    }
+
+    // Merging again must not count anything twice.
+    multigram.merge();
+    list = multigram.get_all_histograms();
+    ASSERT_EQ(list.size(), 2);
+    EXPECT_EQ(list[0].second->get(0), 1000);
+}
+
+static void* increment_shard(void* arg) {
+    sum_multigram_t* multigram = reinterpret_cast<sum_multigram_t*>(arg);
+    multigram->increment(NULL, 10, 0, 1);
+    return reinterpret_cast<void*>(shard_thread_id());
+}
+
+TEST(libmrt, ShardedMultigramReuse) {
+    sum_multigram_t multigram(0);
+
+    // Threads that run one after another must not run out of private
+    // shards, however many of them there are.
+    for (int i = 0; i < 2 * MAX_SHARDS; i++) {
+        pthread_t thread;
+        void* thread_id = NULL;
+        pthread_create(&thread, NULL, increment_shard, &multigram);
+        pthread_join(thread, &thread_id);
+        ASSERT_LT(reinterpret_cast<intptr_t>(thread_id), MAX_SHARDS);
+    }
+
+    multigram.merge();
+    sum_multigram_t::pair_list_t list = multigram.get_all_histograms();
+    ASSERT_EQ(list.size(), 1);
+    EXPECT_EQ(list[0].second->get(0), 2 * MAX_SHARDS);
+}
+
+static void access_line(avl_tree& tree, size_t cache_line) {
+    mem_info_t mem_info;
+    mem_info.address = cache_line << 6;
+    tree.insert(&mem_info);
+}
+
+TEST(libmrt, ReuseDistance) {
+    avl_tree tree;
+
+    // Access lines 0..4999 twice in a row so that the tree is rebuilt.
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < 5000; i++) {
+            if (pass == 0) {
+                EXPECT_EQ(tree.get_distance(i), (size_t) -1);
+            } else {
+                EXPECT_EQ(tree.get_distance(i), 4999);
+            }
+
+            access_line(tree, i);
+        }
+    }
+
+    access_line(tree, 10);
+    EXPECT_EQ(tree.get_distance(10), 0);
+    EXPECT_EQ(tree.get_distance(11), 4989);
+    EXPECT_EQ(tree.get_distance(9), 4990);
+
+    tree.make_infinite_distance(4999);
+    EXPECT_EQ(tree.get_distance(4999), (size_t) -1);
+    EXPECT_EQ(tree.get_distance(11), 4988);
+
+    tree.destroy();
+    EXPECT_EQ(tree.get_distance(10), (size_t) -1);
+}
+
+TEST(libmrt, TraceCodecRoundTrip) {
+    std::vector<char> records;
+    for (int i = 0; i < 500; i++) {
+        record_header_t header;
+        mem_record_t record;
+
+        header.type_message = MSG_MEM_INFO;
+        header.length = sizeof(record);
+
+        record.coreID = i / 100;
+        record.read_write = TYPE_READ + i % 2;
+        record.reserved = 0;
+        record.line_number = 10 + i % 3;
+        record.address = 0x7fff0000 - i * 8;
+        record.var_idx = i % 3;
+        record.type_size = 8;
+
+        records.insert(records.end(), reinterpret_cast<char*>(&header),
+                reinterpret_cast<char*>(&header) + sizeof(header));
+        records.insert(records.end(), reinterpret_cast<char*>(&record),
+                reinterpret_cast<char*>(&record) + sizeof(record));
+    }
+
+    codec_scratch_t* scratch = new codec_scratch_t;
+    std::vector<char> block(TRACE_CODEC_BLOCK_BOUND);
+    std::vector<char> decoded(TRACE_CODEC_CHUNK_SIZE);
+
+    size_t consumed = 0;
+    size_t size = trace_codec_compress(scratch, &records[0], records.size(),
+            &block[0], &consumed);
+    EXPECT_EQ(consumed, records.size());
+    EXPECT_LT(size, records.size() / 10);
+
+    ssize_t length = trace_codec_decompress(scratch,
+            &block[sizeof(record_header_t)], size - sizeof(record_header_t),
+            &decoded[0]);
+    ASSERT_EQ(length, records.size());
+    EXPECT_TRUE(std::equal(records.begin(), records.end(), decoded.begin()));
+
+    delete scratch;
+}
@@ -0,0 +1,181 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "macpo_record.h"
+#include "mrt.h"
+#include "trace_reader.h"
+
+#include "gtest/gtest.h"
+
+#define WINDOW_RECORDS      256
+#define MAX_RECORDS         200
+#define NUM_ACCESSES        1000
+#define FEW_ACCESSES        10
+#define NUM_WINDOWS         3
+
+// Filled in by the traced process.
+typedef struct {
+    long awake_usec[NUM_WINDOWS];
+} budget_state_t;
+
+static budget_state_t* state = NULL;
+static double data[NUM_ACCESSES];
+
+static void record_accesses(int count) {
+    for (int i = 0; i < count; i++) {
+        indigo__record_c(TYPE_READ, 100, &data[i], 0, sizeof(data[i]));
+    }
+}
+
+// Stops the profiling timer, so that windows only change when the test
+// raises SIGPROF. Returns the awake period that was left, in microseconds.
+static long stop_timer() {
+    struct itimerval itimer_old, itimer_new;
+    memset(&itimer_new, 0, sizeof(itimer_new));
+    setitimer(ITIMER_PROF, &itimer_new, &itimer_old);
+    return itimer_old.it_value.tv_sec * 1000000L +
+        itimer_old.it_value.tv_usec;
+}
+
+// Ends the current window and starts the next one.
+static long next_window() {
+    raise(SIGPROF);     // Go to sleep.
+    stop_timer();
+    raise(SIGPROF);     // Wake up.
+    return stop_timer();
+}
+
+// Runs in a process of its own, libmrt keeps its state in globals.
+static void write_sampled_trace() {
+    setenv("MACPO_WINDOW_RECORDS", "256", 1);
+    setenv("MACPO_TARGET_OVERHEAD", "50", 1);
+
+    indigo__init_(1, 1);
+    state->awake_usec[0] = stop_timer();
+
+    // Exceeds the budget of the window.
+    record_accesses(NUM_ACCESSES);
+    state->awake_usec[1] = next_window();
+
+    // Uses less than half of the budget of the window.
+    record_accesses(FEW_ACCESSES);
+    state->awake_usec[2] = next_window();
+
+    indigo__end();
+}
+
+static void write_limited_trace() {
+    setenv("MACPO_MAX_RECORDS", "200", 1);
+
+    indigo__init_(1, 0);
+    record_accesses(NUM_ACCESSES);
+    indigo__end();
+}
+
+// libmrt keeps its state in globals, so every trace is written by a
+// process of its own, in a directory of its own. Returns the name of the
+// trace.
+static std::string run_traced(void (*function)(), std::string& directory) {
+    char name[] = "/tmp/macpo-test.XXXXXX";
+    EXPECT_TRUE(mkdtemp(name) != NULL);
+    directory = name;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (chdir(name) == 0) {
+            function();
+        }
+
+        _exit(0);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), "/macpo.%d.out", pid);
+    return directory + filename;
+}
+
+static void remove_traced(const std::string& filename,
+        const std::string& directory) {
+    unlink(filename.c_str());
+    unlink((filename + MACPO_INDEX_SUFFIX).c_str());
+    unlink((directory + "/macpo.out").c_str());
+    rmdir(directory.c_str());
+}
+
+// Counts the memory accesses of every window of a trace.
+static std::vector<size_t> count_accesses(void (*function)()) {
+    std::string directory;
+    std::string filename = run_traced(function, directory);
+
+    std::vector<size_t> counts(1, 0);
+    trace_reader_t reader;
+    EXPECT_EQ(reader.open(filename.c_str()), 0);
+
+    record_view_t record;
+    int code;
+    while ((code = reader.next(record)) > 0) {
+        if (record.type_message == MSG_MEM_INFO) {
+            counts.back()++;
+        } else if (record.type_message == MSG_TERMINAL) {
+            counts.push_back(0);
+        }
+    }
+
+    EXPECT_EQ(code, 0);
+    reader.close();
+
+    remove_traced(filename, directory);
+    return counts;
+}
+
+TEST(record_budget, WindowBudget) {
+    state = reinterpret_cast<budget_state_t*>(mmap(NULL,
+                sizeof(budget_state_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(state, MAP_FAILED);
+    memset(state, 0, sizeof(*state));
+
+    std::vector<size_t> counts = count_accesses(write_sampled_trace);
+
+    // Recording stops at the budget and resumes in the next window.
+    ASSERT_EQ(counts.size(), NUM_WINDOWS);
+    EXPECT_EQ(counts[0], WINDOW_RECORDS);
+    EXPECT_EQ(counts[1], FEW_ACCESSES);
+    EXPECT_EQ(counts[2], 0);
+
+    // The awake period shrinks to 3/4 after a window that hit the budget
+    // and grows by 5/4 after one that used less than half of it. The kernel
+    // may round the periods it reports up to a clock tick, so they are only
+    // compared with each other.
+    EXPECT_LT(state->awake_usec[1], state->awake_usec[0]);
+    EXPECT_GT(state->awake_usec[2], state->awake_usec[1]);
+    EXPECT_LT(state->awake_usec[2], state->awake_usec[0]);
+
+    munmap(state, sizeof(budget_state_t));
+    state = NULL;
+}
+
+TEST(record_budget, MaxRecords) {
+    std::vector<size_t> counts = count_accesses(write_limited_trace);
+
+    // Records are reserved in batches, so the last batch may go over.
+    size_t expected = (MAX_RECORDS + RECORD_BATCH - 1) / RECORD_BATCH *
+        RECORD_BATCH;
+
+    ASSERT_EQ(counts.size(), 1);
+    EXPECT_EQ(counts[0], expected);
+    EXPECT_LT(counts[0], NUM_ACCESSES);
+}
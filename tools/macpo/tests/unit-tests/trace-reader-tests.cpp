@@ -0,0 +1,491 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "macpo_record.h"
+#include "trace_buffer.h"
+#include "trace_reader.h"
+
+#include "gtest/gtest.h"
+
+#define NUM_STREAMS         4
+#define NUM_WINDOWS         3
+#define WINDOW_RECORDS      3000
+#define BLOCK_RECORDS       250
+
+#define ORDERED_WINDOWS     200
+
+static void write_record(uint16_t type_message, const void* payload,
+        size_t length, bool buffered) {
+    std::vector<char> record(sizeof(record_header_t) + length);
+    record_header_t header;
+    header.type_message = type_message;
+    header.length = length;
+
+    memcpy(&record[0], &header, sizeof(header));
+    memcpy(&record[sizeof(header)], payload, length);
+    if (buffered == false || trace_buffer_write(&record[0],
+                record.size()) == false)
+        trace_buffer_write_direct(&record[0], record.size());
+}
+
+// Writes a trace (and its index) the way libmrt does. Every block holds
+// accesses to a few lines of a single stream, so that index entries differ.
+static void write_trace_records(const std::string& filename, bool compress) {
+    int fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    std::string index_name = filename + MACPO_INDEX_SUFFIX;
+    int index_fd = open(index_name.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+            0600);
+
+    trace_buffer_init(fd, index_fd, compress);
+
+    trace_header_t header;
+    header.magic = MACPO_TRACE_MAGIC;
+    header.version = MACPO_TRACE_VERSION;
+    header.flags = compress ? MACPO_TRACE_COMPRESSED : 0;
+    trace_buffer_write_direct(&header, sizeof(header));
+
+    for (int i = 0; i < NUM_STREAMS; i++) {
+        std::string name = "s" + std::string(1, '0' + i);
+        write_record(MSG_STREAM_INFO, name.c_str(), name.size(), false);
+    }
+
+    for (int window = 0; window < NUM_WINDOWS; window++) {
+        for (int i = 0; i < WINDOW_RECORDS; i++) {
+            const int block = i / BLOCK_RECORDS;
+
+            mem_record_t record;
+            record.coreID = 0;
+            record.read_write = TYPE_READ + i % 2;
+            record.reserved = 0;
+            record.line_number = 100 + 10 * block + i % 3;
+            record.address = 0x10000 + (window * WINDOW_RECORDS + i) * 8;
+            record.var_idx = block % NUM_STREAMS;
+            record.type_size = 8;
+            write_record(MSG_MEM_INFO, &record, sizeof(record), true);
+
+            if ((i + 1) % BLOCK_RECORDS == 0)
+                trace_buffer_flush_all(true);
+        }
+
+        trace_buffer_flush_all(true);
+        write_record(MSG_TERMINAL, NULL, 0, false);
+    }
+
+    trace_buffer_fini();
+    close(fd);
+    close(index_fd);
+}
+
+// trace_buffer keeps its state in globals, so every trace is written by a
+// process of its own.
+static std::string write_trace(const char* name, bool compress) {
+    std::string filename = std::string("/tmp/macpo-test.") +
+        std::string(1, compress ? 'c' : 'u') + "." + name;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        write_trace_records(filename, compress);
+        _exit(0);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return filename;
+}
+
+static void remove_trace(const std::string& filename) {
+    unlink(filename.c_str());
+    unlink((filename + MACPO_INDEX_SUFFIX).c_str());
+}
+
+// Reads all records of `filename' that match `filter'. Returns the code of
+// the last call to next().
+static int read_trace(const std::string& filename,
+        const trace_filter_t& filter, std::vector<node_t>& nodes,
+        size_t* truncated_at = NULL, size_t* skipped_blocks = NULL) {
+    trace_reader_t reader;
+    int code = reader.open(filename.c_str());
+    if (code < 0)
+        return code;
+
+    reader.set_filter(filter);
+
+    record_view_t record;
+    while ((code = reader.next(record)) > 0) {
+        node_t node;
+        memset(&node, 0, sizeof(node));
+        if ((code = reader.unpack(record, node)) < 0)
+            return code;
+
+        nodes.push_back(node);
+    }
+
+    if (truncated_at != NULL)
+        *truncated_at = reader.truncated_at();
+
+    if (skipped_blocks != NULL)
+        *skipped_blocks = reader.skipped_blocks();
+
+    return code;
+}
+
+static size_t count_type(const std::vector<node_t>& nodes, int type_message) {
+    size_t count = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].type_message == type_message)
+            count++;
+    }
+
+    return count;
+}
+
+// Reads `filename' with `filter' once using its index and once without it.
+// Blocks must have been skipped with the index and both reads must return
+// the same records.
+static void read_filtered(const std::string& filename,
+        const trace_filter_t& filter, std::vector<node_t>& nodes) {
+    const std::string index_name = filename + MACPO_INDEX_SUFFIX;
+    const std::string moved_name = index_name + ".moved";
+
+    trace_reader_t reader;
+    ASSERT_EQ(reader.open(filename.c_str()), 0);
+    EXPECT_TRUE(reader.has_index());
+    reader.close();
+
+    size_t skipped_blocks = 0;
+    ASSERT_EQ(read_trace(filename, filter, nodes, NULL, &skipped_blocks), 0);
+    EXPECT_GT(skipped_blocks, 0);
+
+    ASSERT_EQ(rename(index_name.c_str(), moved_name.c_str()), 0);
+
+    ASSERT_EQ(reader.open(filename.c_str()), 0);
+    EXPECT_FALSE(reader.has_index());
+    reader.close();
+
+    std::vector<node_t> unindexed;
+    int code = read_trace(filename, filter, unindexed, NULL, &skipped_blocks);
+    ASSERT_EQ(rename(moved_name.c_str(), index_name.c_str()), 0);
+    ASSERT_EQ(code, 0);
+    EXPECT_EQ(skipped_blocks, 0);
+
+    ASSERT_EQ(nodes.size(), unindexed.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        EXPECT_EQ(memcmp(&nodes[i], &unindexed[i], sizeof(node_t)), 0);
+    }
+}
+
+// Position of a memory access within the trace, recovered from its address.
+static size_t access_number(const node_t& node) {
+    return (node.mem_info.address - 0x10000) / 8;
+}
+
+static void filter_streams(const std::string& filename) {
+    trace_filter_t filter;
+    filter.streams.insert("s1");
+    filter.streams.insert("s3");
+
+    std::vector<node_t> nodes;
+    read_filtered(filename, filter, nodes);
+
+    // Blocks 1, 3, 5, ... of every window.
+    ASSERT_EQ(count_type(nodes, MSG_MEM_INFO), NUM_WINDOWS * WINDOW_RECORDS /
+            2);
+    EXPECT_EQ(count_type(nodes, MSG_STREAM_INFO), NUM_STREAMS);
+    EXPECT_EQ(count_type(nodes, MSG_TERMINAL), NUM_WINDOWS);
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].type_message == MSG_MEM_INFO) {
+            EXPECT_TRUE(nodes[i].mem_info.var_idx == 1 ||
+                    nodes[i].mem_info.var_idx == 3);
+        }
+    }
+}
+
+static void filter_lines(const std::string& filename) {
+    trace_filter_t filter;
+    filter.first_line = 121;
+    filter.last_line = 131;
+
+    std::vector<node_t> nodes;
+    read_filtered(filename, filter, nodes);
+
+    // Only blocks 2 and 3 of every window hold any of these lines.
+    size_t expected = 0;
+    for (int i = 0; i < WINDOW_RECORDS; i++) {
+        const size_t line_number = 100 + 10 * (i / BLOCK_RECORDS) + i % 3;
+        if (line_number >= filter.first_line &&
+                line_number <= filter.last_line)
+            expected++;
+    }
+
+    ASSERT_EQ(count_type(nodes, MSG_MEM_INFO), NUM_WINDOWS * expected);
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].type_message == MSG_MEM_INFO) {
+            EXPECT_GE(nodes[i].mem_info.line_number, 121);
+            EXPECT_LE(nodes[i].mem_info.line_number, 131);
+        }
+    }
+}
+
+static void filter_windows(const std::string& filename) {
+    trace_filter_t filter;
+    filter.first_window = 1;
+    filter.last_window = 1;
+
+    std::vector<node_t> nodes;
+    read_filtered(filename, filter, nodes);
+
+    // Reading stops at the end of the last selected window.
+    ASSERT_EQ(count_type(nodes, MSG_MEM_INFO), WINDOW_RECORDS);
+    EXPECT_EQ(count_type(nodes, MSG_TERMINAL), 2);
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].type_message == MSG_MEM_INFO) {
+            EXPECT_EQ(access_number(nodes[i]) / WINDOW_RECORDS, 1);
+        }
+    }
+}
+
+static void filter_records(const std::string& filename) {
+    // Starts and ends in the middle of a block.
+    trace_filter_t filter;
+    filter.first_record = WINDOW_RECORDS + 1000;
+    filter.last_record = WINDOW_RECORDS + 1999;
+
+    std::vector<node_t> nodes;
+    read_filtered(filename, filter, nodes);
+
+    ASSERT_EQ(count_type(nodes, MSG_MEM_INFO), 1000);
+
+    size_t expected = filter.first_record;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].type_message == MSG_MEM_INFO) {
+            EXPECT_EQ(access_number(nodes[i]), expected++);
+        }
+    }
+}
+
+static void filter_all(const std::string& filename) {
+    filter_streams(filename);
+    filter_lines(filename);
+    filter_windows(filename);
+    filter_records(filename);
+}
+
+static void truncate_trace(const std::string& filename) {
+    struct stat st;
+    ASSERT_EQ(stat(filename.c_str(), &st), 0);
+
+    std::vector<node_t> complete;
+    size_t truncated_at = 0;
+    ASSERT_EQ(read_trace(filename, trace_filter_t(), complete, &truncated_at),
+            0);
+    EXPECT_EQ(truncated_at, (size_t) -1);
+    ASSERT_EQ(count_type(complete, MSG_MEM_INFO),
+            NUM_WINDOWS * WINDOW_RECORDS);
+
+    // Cut the trace in the middle of a record (or compressed block), as a
+    // run that is killed while writing would.
+    const size_t cut = st.st_size * 2 / 3 + 1;
+    ASSERT_EQ(truncate(filename.c_str(), cut), 0);
+
+    std::vector<node_t> partial;
+    ASSERT_EQ(read_trace(filename, trace_filter_t(), partial, &truncated_at),
+            0);
+    EXPECT_LT(truncated_at, cut);
+    EXPECT_GT(count_type(partial, MSG_MEM_INFO), 0);
+    EXPECT_LT(count_type(partial, MSG_MEM_INFO),
+            count_type(complete, MSG_MEM_INFO));
+
+    // Everything before the partial record is kept.
+    ASSERT_LE(partial.size(), complete.size());
+    for (size_t i = 0; i < partial.size(); i++) {
+        EXPECT_EQ(memcmp(&partial[i], &complete[i], sizeof(node_t)), 0);
+    }
+
+    // Blocks that the index describes beyond the end are ignored as well.
+    trace_filter_t filter;
+    filter.first_line = 110;
+    filter.last_line = 119;
+
+    std::vector<node_t> filtered;
+    EXPECT_EQ(read_trace(filename, filter, filtered), 0);
+}
+
+TEST(trace_reader, IndexedFilters) {
+    std::string filename = write_trace("indexed", false);
+    filter_all(filename);
+    remove_trace(filename);
+}
+
+TEST(trace_reader, IndexedCompressedFilters) {
+    std::string filename = write_trace("indexed", true);
+    filter_all(filename);
+    remove_trace(filename);
+}
+
+TEST(trace_reader, TruncatedTrace) {
+    std::string filename = write_trace("truncated", false);
+    truncate_trace(filename);
+    remove_trace(filename);
+}
+
+TEST(trace_reader, TruncatedCompressedTrace) {
+    std::string filename = write_trace("truncated", true);
+    truncate_trace(filename);
+    remove_trace(filename);
+}
+
+// State shared between the process that writes the trace and the test.
+typedef struct {
+    volatile size_t completed;      // Accesses written by the writer thread.
+    volatile size_t windows;        // Windows ended by the signal handler.
+    volatile bool done;             // No more windows are ended.
+    size_t boundaries[ORDERED_WINDOWS];
+} ordering_state_t;
+
+static ordering_state_t* ordering = NULL;
+static record_header_t terminal_record;
+
+static void end_window(int sig) {
+    // Every access completed so far belongs to the window that ends here.
+    ordering->boundaries[ordering->windows] = ordering->completed;
+    trace_buffer_end_window(&terminal_record, sizeof(terminal_record));
+    __sync_synchronize();
+    ordering->windows++;
+}
+
+// Writes accesses until no more windows are ended, since signals sent to a
+// thread that has exited are lost.
+static void* write_accesses(void* arg) {
+    for (size_t i = 0; ordering->done == false; i++) {
+        mem_record_t record;
+        record.coreID = 0;
+        record.read_write = TYPE_READ;
+        record.reserved = 0;
+        record.line_number = 100;
+        record.address = 0x10000 + i * 8;
+        record.var_idx = 0;
+        record.type_size = 8;
+        write_record(MSG_MEM_INFO, &record, sizeof(record), true);
+
+        __sync_synchronize();
+        ordering->completed = i + 1;
+    }
+
+    return NULL;
+}
+
+// Ends windows while a thread appends accesses, by interrupting the writer
+// itself (whose buffer is then sometimes held by the interrupted append) and
+// by interrupting this thread (which has to wait for the writer's buffer).
+static void write_ordered_trace(const std::string& filename, bool compress) {
+    int fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    trace_buffer_init(fd, -1, compress);
+
+    trace_header_t header;
+    header.magic = MACPO_TRACE_MAGIC;
+    header.version = MACPO_TRACE_VERSION;
+    header.flags = compress ? MACPO_TRACE_COMPRESSED : 0;
+    trace_buffer_write_direct(&header, sizeof(header));
+
+    terminal_record.type_message = MSG_TERMINAL;
+    terminal_record.length = 0;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = end_window;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+
+    pthread_t writer;
+    pthread_create(&writer, NULL, write_accesses, NULL);
+
+    for (size_t window = 0; window < ORDERED_WINDOWS; window++) {
+        usleep(50);
+        pthread_kill(window % 2 ? pthread_self() : writer, SIGUSR1);
+
+        while (ordering->windows == window) {
+            sched_yield();
+        }
+    }
+
+    ordering->done = true;
+    pthread_join(writer, NULL);
+    trace_buffer_fini();
+    close(fd);
+}
+
+static void check_window_order(bool compress) {
+    ordering = reinterpret_cast<ordering_state_t*>(mmap(NULL,
+                sizeof(ordering_state_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(ordering, MAP_FAILED);
+    memset(ordering, 0, sizeof(*ordering));
+
+    std::string filename = std::string("/tmp/macpo-test.") +
+        std::string(1, compress ? 'c' : 'u') + ".ordered";
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        write_ordered_trace(filename, compress);
+        _exit(0);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ASSERT_EQ(ordering->windows, ORDERED_WINDOWS);
+
+    trace_reader_t reader;
+    ASSERT_EQ(reader.open(filename.c_str()), 0);
+
+    // Accesses are written in order by a single thread, so the marker of
+    // every window must follow at least as many accesses as were completed
+    // when the window ended.
+    size_t accesses = 0, windows = 0;
+    record_view_t record;
+    int code;
+    while ((code = reader.next(record)) > 0) {
+        node_t node;
+        ASSERT_EQ(reader.unpack(record, node), 0);
+
+        if (node.type_message == MSG_MEM_INFO) {
+            ASSERT_EQ(access_number(node), accesses);
+            accesses++;
+        } else if (node.type_message == MSG_TERMINAL) {
+            ASSERT_LT(windows, ORDERED_WINDOWS);
+            ASSERT_GE(accesses, ordering->boundaries[windows]);
+            windows++;
+        }
+    }
+
+    EXPECT_EQ(code, 0);
+    EXPECT_EQ(accesses, ordering->completed);
+    EXPECT_EQ(windows, ORDERED_WINDOWS);
+
+    remove_trace(filename);
+    munmap(ordering, sizeof(ordering_state_t));
+    ordering = NULL;
+}
+
+TEST(trace_reader, WindowOrder) {
+    check_window_order(false);
+}
+
+TEST(trace_reader, CompressedWindowOrder) {
+    check_window_order(true);
+}